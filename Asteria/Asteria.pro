@@ -58,7 +58,29 @@ SOURCES += \
     infra/imaged.cpp \
     infra/imageui.cpp \
     math/geocalfitter.cpp \
-    optics/pinholecamerawithsipdistortion.cpp
+    optics/pinholecamerawithsipdistortion.cpp \
+    util/framediffutil.cpp \
+    infra/framedifference.cpp \
+    infra/imageucpool.cpp \
+    util/jpgdecoder.cpp \
+    util/jpgdecodepool.cpp \
+    util/pixelkernelutil.cpp \
+    util/threadutil.cpp \
+    infra/workerpool.cpp \
+    infra/v4l2framesource.cpp \
+    infra/replayframesource.cpp \
+    util/syntheticvideogenerator.cpp \
+    infra/calibrationaccumulator.cpp \
+    util/medianfilterutil.cpp \
+    util/crossmatchutil.cpp \
+    infra/referencestarcatalogue.cpp \
+    infra/visiblestarcache.cpp \
+    optics/inversedistortionpolynomial.cpp \
+    util/distortionutil.cpp \
+    infra/pixelraymap.cpp \
+    util/psffitutil.cpp \
+    math/multiepochgeocalfitter.cpp \
+    util/autodiffutil.cpp
 
 HEADERS += \
     gui/cameraselectionwindow.h \
@@ -126,7 +148,34 @@ HEADERS += \
     config/parametermultiplechoice.h \
     config/configparameterbase.h \
     config/parameterarray.h \
-    config/parametersingle.h
+    config/parametersingle.h \
+    util/framediffutil.h \
+    infra/framedifference.h \
+    infra/imageucpool.h \
+    util/jpgdecoder.h \
+    util/jpgdecodepool.h \
+    util/pixelkernelutil.h \
+    infra/spscringbuffer.h \
+    util/threadutil.h \
+    infra/workerpool.h \
+    infra/framesource.h \
+    infra/v4l2framesource.h \
+    infra/replayframesource.h \
+    util/syntheticvideogenerator.h \
+    infra/calibrationaccumulator.h \
+    util/medianfilterutil.h \
+    util/crossmatchutil.h \
+    infra/referencestarcatalogue.h \
+    infra/visiblestarcache.h \
+    optics/inversedistortionpolynomial.h \
+    util/distortionutil.h \
+    infra/pixelraymap.h \
+    math/fixedlevenbergmarquardtsolver.h \
+    util/psffitutil.h \
+    math/multiepochgeocalfitter.h \
+    math/dual.h \
+    util/autodiffutil.h \
+    util/pagealignedallocator.h
 
 # Add precompiled libraries (-L vs. -l: -L specifies where to look; -l specifies the library name)
 LIBS += -L/usr/local/lib -lboost_serialization -lboost_system -lboost_wserialization
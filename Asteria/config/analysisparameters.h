@@ -9,16 +9,20 @@ class AnalysisParameters : public ConfigParameterFamily {
 
 public:
 
-    AnalysisParameters(AsteriaState * state) : ConfigParameterFamily("Analysis", 1) {
+    AnalysisParameters(AsteriaState * state) : ConfigParameterFamily("Analysis", 3) {
 
         parameters = new ConfigParameterBase*[numPar];
         validators = new ParameterValidator*[numPar];
 
         // Create validators for each parameter
         validators[0] = new ValidateWithinLimits<double>(0.0, 100.0);
+        validators[1] = new ValidateWithinLimits<unsigned int>(0u, 64u);
+        validators[2] = new ValidateWithinLimits<unsigned int>(1u, 1000u);
 
         // Create parameters
         parameters[0] = new ParameterSingle<double>("linearity_threshold", "Linearity threshold", "pixels", validators[0], &(state->linearity_threshold));
+        parameters[1] = new ParameterSingle<unsigned int>("processing_threads", "Number of analysis threads (0 = automatic)", "threads", validators[1], &(state->processing_threads));
+        parameters[2] = new ParameterSingle<unsigned int>("processing_queue_length", "Maximum number of clips queued for analysis in memory", "jobs", validators[2], &(state->processing_queue_length));
     }
 };
 
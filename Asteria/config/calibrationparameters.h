@@ -13,7 +13,7 @@ class CalibrationParameters : public ConfigParameterFamily {
 
 public:
 
-    CalibrationParameters(AsteriaState * state) : ConfigParameterFamily("Calibration", 6) {
+    CalibrationParameters(AsteriaState * state) : ConfigParameterFamily("Calibration", 7) {
 
         parameters = new ConfigParameterBase*[numPar];
         validators = new ParameterValidator*[numPar];
@@ -25,6 +25,7 @@ public:
         validators[3] = new ValidateWithinLimits<unsigned int>(0u, 30u);
         validators[4] = new ValidateWithinLimits<double>(0.0, 50.0);
         validators[5] = new ValidateWithinLimits<double>(-1.0, 20.0);
+        validators[6] = new ValidateWithinLimits<double>(-1.0, 50.0);
 
         // Create parameters
 
@@ -42,6 +43,7 @@ public:
         parameters[3] = new ParameterSingle<unsigned int>("bkg_median_filter_half_width", "Half-width of median filter kernel for background estimation", "pixels", validators[3], &(state->bkg_median_filter_half_width));
         parameters[4] = new ParameterSingle<double>("source_detection_threshold_sigmas", "Source detection threshold, in sigmas above the background level", "-", validators[4], &(state->source_detection_threshold_sigmas));
         parameters[5] = new ParameterSingle<double>("ref_star_faint_mag_limit", "Reference star faint magnitude limit", "mag", validators[5], &(state->ref_star_faint_mag_limit));
+        parameters[6] = new ParameterSingle<double>("source_detection_floor_sigmas", "Source detection pixel floor, in sigmas above the background level (negative to disable)", "-", validators[6], &(state->source_detection_floor_sigmas));
     }
 };
 
@@ -236,6 +236,13 @@ public:
         unsigned int width  = value[0];
         unsigned int height = value[1];
 
+        if(!state->replayPath.empty()) {
+            // No camera: the image size is set by the replayed frames
+            state->width = width;
+            state->height = height;
+            return true;
+        }
+
         // Check that the chosen camera & pixel format etc can support the requested image size
         v4l2_format * format = new v4l2_format();
         memset(format, 0, sizeof(*format));
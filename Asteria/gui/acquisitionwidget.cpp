@@ -35,8 +35,10 @@ AcquisitionWidget::AcquisitionWidget(QWidget *parent, AsteriaState * state) : QW
     fpsField = new QLabel("");
     QLabel * totalFramesLabel = new QLabel("Total frames: ");
     totalFramesField = new QLabel("");
-    QLabel * droppedFramesLabel = new QLabel("Dropped frames: ");
+    QLabel * droppedFramesLabel = new QLabel("Dropped frames (camera): ");
     droppedFramesField = new QLabel("");
+    QLabel * pipelineDroppedFramesLabel = new QLabel("Dropped frames (pipeline): ");
+    pipelineDroppedFramesField = new QLabel("");
 
     QWidget * acqStateDisplay = new QWidget(this);
 
@@ -56,6 +58,8 @@ AcquisitionWidget::AcquisitionWidget(QWidget *parent, AsteriaState * state) : QW
     layout->addWidget(droppedFramesLabel, 4, 0);
     layout->addWidget(droppedFramesField, 4, 1);
     layout->addWidget(overlaycheckbox, 4, 2);
+    layout->addWidget(pipelineDroppedFramesLabel, 5, 0);
+    layout->addWidget(pipelineDroppedFramesField, 5, 1);
 
     acqStateDisplay->setLayout(layout);
 
@@ -103,4 +107,5 @@ void AcquisitionWidget::updateVideoStats(const AcquisitionVideoStats &stats) {
     fpsField->setText(QString::asprintf("%5.3f", stats.fps));
     totalFramesField->setText(QString::asprintf("%5d", stats.totalFrames));
     droppedFramesField->setText(QString::asprintf("%5d", stats.droppedFrames));
+    pipelineDroppedFramesField->setText(QString::asprintf("%5d", stats.pipelineDroppedFrames));
 }
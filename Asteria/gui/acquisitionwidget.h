@@ -35,6 +35,7 @@ public:
     QLabel *fpsField;
     QLabel *totalFramesField;
     QLabel *droppedFramesField;
+    QLabel *pipelineDroppedFramesField;
 
 signals:
     // Forward the signals from the AcquisitionThread
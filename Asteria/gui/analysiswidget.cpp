@@ -85,7 +85,7 @@ void AnalysisWidget::loadClip(QString path) {
         return;
     }
 
-    player->loadClip(inv->eventFrames, inv->peakHold);
+    player->loadClip(inv->eventFrames, inv->peakHold, inv->locs);
 }
 
 #ifdef REANALYSE
@@ -69,9 +69,9 @@ void GLMeteorDrawer::newFrame(std::shared_ptr<Imageuc> image, bool renderOverlay
     }
 
     // For displaying the RGBA annotated image with 32bit pixels:
-    if(!image->annotatedImage.empty() && renderOverlay) {
+    if(image->overlay && renderOverlay) {
         glBindTexture(GL_TEXTURE_2D, OverlayImageTexture);
-        unsigned int* annotated = &(image->annotatedImage[0]);
+        unsigned int* annotated = &(image->overlay->rawImage[0]);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, annotated);
         renderOverlayImageTexture = true;
     }
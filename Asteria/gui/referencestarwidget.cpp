@@ -297,6 +297,77 @@ void ReferenceStarWidget::slide(double position) {
     update();
 }
 
+/**
+ * @brief Draws one half of a grid line, walking outwards from its starting point at x=0 or y=0 in equal steps
+ * in the camera frame (x,y) coordinates. The points along the line are projected in batches, and the line stops
+ * when it leaves the image or the projection becomes unphysical (the points stop moving outwards).
+ * @param cam
+ *  The camera model.
+ * @param pixels
+ *  The image to draw into.
+ * @param width
+ *  Width of the image [pixels]
+ * @param height
+ *  Height of the image [pixels]
+ * @param vertical
+ *  True for a line of constant x, false for a line of constant y.
+ * @param fixed
+ *  The constant x or y coordinate of the line.
+ * @param step
+ *  The step in y or x coordinate between points along the line; negative values walk towards the top or left
+ * of the image.
+ * @param i_start
+ *  The i coordinate of the starting point of the line [pixels]
+ * @param j_start
+ *  The j coordinate of the starting point of the line [pixels]
+ */
+static void drawGridLine(const CameraModelBase &cam, std::vector<unsigned int> &pixels, unsigned int &width, unsigned int &height,
+                         const bool &vertical, const double &fixed, const double &step, const double &i_start, const double &j_start) {
+
+    const unsigned int batchSize = 64;
+    double x[batchSize], y[batchSize], z[batchSize], i[batchSize], j[batchSize];
+    unsigned char visible[batchSize];
+
+    double limit = vertical ? height : width;
+
+    double i0 = i_start;
+    double j0 = j_start;
+    double v = step;
+
+    for(unsigned int p = 0; p < batchSize; p++) {
+        z[p] = 1.0;
+    }
+
+    while(true) {
+
+        // Next batch of points along the line
+        for(unsigned int p = 0; p < batchSize; p++) {
+            x[p] = vertical ? fixed : v;
+            y[p] = vertical ? v : fixed;
+            v += step;
+        }
+        cam.projectVectors(x, y, z, batchSize, i, j, visible);
+
+        for(unsigned int p = 0; p < batchSize; p++) {
+
+            // Coordinate along the line, and at the previous point
+            double c1 = vertical ? j[p] : i[p];
+            double c0 = vertical ? j0 : i0;
+
+            // Stop drawing line if we've moved outside of the image area or the projection has become unphysical
+            if(step > 0 ? (c1 > limit || c1 < c0) : (c1 < 0 || c1 > c0)) {
+                return;
+            }
+
+            RenderUtil::drawLine(pixels, width, height, i0, i[p], j0, j[p], 0x00FFFFFF);
+
+            // Cache point for next iteration
+            i0 = i[p];
+            j0 = j[p];
+        }
+    }
+}
+
 void ReferenceStarWidget::update() {
 
     if(!inv) {
@@ -305,13 +376,7 @@ void ReferenceStarWidget::update() {
     }
 
     // Clear the annotated image ready to be filled in with reference stars
-    signal->annotatedImage.clear();
-    signal->annotatedImage.reserve(signal->width * signal->height);
-
-    // Initialise to full transparency
-    for(unsigned int p = 0; p < signal->width * signal->height; p++) {
-        signal->annotatedImage.push_back(0x00000000);
-    }
+    signal->initialiseOverlay();
 
     // Clear the current set of visible reference stars
     visibleReferenceStars.clear();
@@ -330,18 +395,21 @@ void ReferenceStarWidget::update() {
     // Full transformation BCRF->CAM
     Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * r_bcrf_ecef;
 
-    for(ReferenceStar &star : state->refStarCatalogue) {
+    // Retrieving the stars replaces the selected star, so keep hold of its coordinates to find it again
+    bool hasSelection = (selectedRefStar != 0);
+    double selectedRa = hasSelection ? selectedRefStar->ra : 0.0;
+    double selectedDec = hasSelection ? selectedRefStar->dec : 0.0;
+    selectedRefStar = 0;
 
-        // Skip stars fainter than faint mag limit
-        if(star.mag > state->ref_star_faint_mag_limit) {
-            continue;
-        }
+    // Retrieve the stars brighter than the faint mag limit that are visible in the image
+    refStarCache.getVisibleStars(state->refStarCatalogue, *(inv->cam), r_bcrf_cam, state->ref_star_faint_mag_limit, visibleReferenceStarStore);
 
-        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, *(inv->cam));
+    for(ReferenceStar &star : visibleReferenceStarStore) {
 
-        if(star.visible) {
-            // Star is visible in image!
-            visibleReferenceStars.push_back(&star);
+        visibleReferenceStars.push_back(&star);
+
+        if(hasSelection && star.ra == selectedRa && star.dec == selectedDec) {
+            selectedRefStar = &star;
         }
     }
 
@@ -372,25 +440,25 @@ void ReferenceStarWidget::update() {
 
             unsigned int gap_int = (unsigned int)std::round(gap);
 
-            RenderUtil::drawCrossHair(signal->annotatedImage, signal->width, signal->height, ii, jj, 5, gap_int, 0xFF00FFFF);
+            RenderUtil::drawCrossHair(signal->overlay->rawImage, signal->width, signal->height, ii, jj, 5, gap_int, 0xFF00FFFF);
         }
 
         if(selectedRefStar) {
             int ii = (int)std::round(selectedRefStar->i);
             int jj = (int)std::round(selectedRefStar->j);
-            RenderUtil::drawCrossHair(signal->annotatedImage, signal->width, signal->height, ii, jj, 10, 0, 0x0000FFFF);
+            RenderUtil::drawCrossHair(signal->overlay->rawImage, signal->width, signal->height, ii, jj, 10, 0, 0x0000FFFF);
         }
     }
 
     if(displaySources) {
         // Render extracted sources
-        RenderUtil::drawSources(signal->annotatedImage, inv->sources, signal->width, signal->height, false);
+        RenderUtil::drawSources(signal->overlay->rawImage, inv->sources, signal->width, signal->height, false);
     }
 
     if(displaySources && displayRefStars) {
         // Render the cross-matches
         for(std::pair<Source, ReferenceStar> &xm : inv->xms) {
-            RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, xm.first.i, xm.second.i, xm.first.j, xm.second.j, 0xFFAAFFFF);
+            RenderUtil::drawLine(signal->overlay->rawImage, signal->width, signal->height, xm.first.i, xm.second.i, xm.first.j, xm.second.j, 0xFFAAFFFF);
         }
     }
 
@@ -419,7 +487,7 @@ void ReferenceStarWidget::update() {
         for(double x=0; ; x += dxy) {
 
             // New line:
-            double i_start, j_start, i0, j0, i1, j1;
+            double i_start, j_start;
             Eigen::Vector3d r_cam(x,0,1);
             cam.projectVector(r_cam, i_start, j_start);
 
@@ -434,45 +502,9 @@ void ReferenceStarWidget::update() {
 
             i_tmp = i_start;
 
-            // Draw vertical lines in lower right quater of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double y=ddxy; ; y+= ddxy) {
-
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-
-                // Stop drawing line if we've moved outside of the image area
-                if(j1 > signal->height) {
-                    break;
-                }
-
-                // Stop drawing line if the projection has become unphysical
-                if(j1 < j0) {
-                    break;
-                }
-
-                // Draw line
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-
-                // Cache point for next iteration
-                i0 = i1;
-                j0 = j1;
-            }
-
-            // Draw vertical lines in upper right quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double y=-ddxy; ; y-= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(j1 < 0 || j1 > j0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
+            // Draw vertical lines in lower and upper right quarters of image
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, true, x, ddxy, i_start, j_start);
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, true, x, -ddxy, i_start, j_start);
         }
 
         // Draw vertical grid lines on left half of image
@@ -480,7 +512,7 @@ void ReferenceStarWidget::update() {
         for(double x=0; ; x -= dxy) {
 
             // New line:
-            double i_start, j_start, i0, j0, i1, j1;
+            double i_start, j_start;
             Eigen::Vector3d r_cam(x,0,1);
             cam.projectVector(r_cam, i_start, j_start);
 
@@ -490,33 +522,9 @@ void ReferenceStarWidget::update() {
 
             i_tmp = i_start;
 
-            // Draw vertical lines in lower left quater of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double y=ddxy; ; y+= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(j1 > signal->height || j1 < j0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
-
-            // Draw vertical lines in upper left quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double y=-ddxy; ; y-= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(j1 < 0 || j1 > j0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
+            // Draw vertical lines in lower and upper left quarters of image
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, true, x, ddxy, i_start, j_start);
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, true, x, -ddxy, i_start, j_start);
         }
 
         // Draw horizontal grid lines on lower half of image
@@ -524,7 +532,7 @@ void ReferenceStarWidget::update() {
         for(double y=0; ; y += dxy) {
 
             // New line:
-            double i_start, j_start, i0, j0, i1, j1;
+            double i_start, j_start;
             Eigen::Vector3d r_cam(0,y,1);
             cam.projectVector(r_cam, i_start, j_start);
 
@@ -534,33 +542,9 @@ void ReferenceStarWidget::update() {
 
             j_tmp = j_start;
 
-            // Draw horizontal lines in lower right quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double x=ddxy; ; x+= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(i1 > signal->width || i1 < i0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
-
-            // Draw horizontal lines in lower left quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double x=-ddxy; ; x-= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(i1 < 0 || i1 > i0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
+            // Draw horizontal lines in lower right and left quarters of image
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, false, y, ddxy, i_start, j_start);
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, false, y, -ddxy, i_start, j_start);
         }
 
         // Draw horizontal grid lines on upper half of image
@@ -568,7 +552,7 @@ void ReferenceStarWidget::update() {
         for(double y=0; ; y -= dxy) {
 
             // New line:
-            double i_start, j_start, i0, j0, i1, j1;
+            double i_start, j_start;
             Eigen::Vector3d r_cam(0,y,1);
             cam.projectVector(r_cam, i_start, j_start);
 
@@ -578,37 +562,13 @@ void ReferenceStarWidget::update() {
 
             j_tmp = j_start;
 
-            // Draw horizontal lines in upper right quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double x=ddxy; ; x+= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(i1 > signal->width || i1 < i0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
-
-            // Draw horizontal lines in upper left quarter of image
-            i0 = i_start;
-            j0 = j_start;
-            for(double x=-ddxy; ; x-= ddxy) {
-                r_cam = Eigen::Vector3d(x,y,1);
-                cam.projectVector(r_cam, i1, j1);
-                if(i1 < 0 || i1 > i0) {
-                    break;
-                }
-                RenderUtil::drawLine(signal->annotatedImage, signal->width, signal->height, i0, i1, j0, j1, 0x00FFFFFF);
-                i0 = i1;
-                j0 = j1;
-            }
+            // Draw horizontal lines in upper right and left quarters of image
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, false, y, ddxy, i_start, j_start);
+            drawGridLine(cam, signal->overlay->rawImage, signal->width, signal->height, false, y, -ddxy, i_start, j_start);
         }
 
         // Draw a crosshair at the image principal point
-        RenderUtil::drawCrossHair(signal->annotatedImage, signal->width, signal->height, pi, pj, 10, 5, 0xFF0000FF);
+        RenderUtil::drawCrossHair(signal->overlay->rawImage, signal->width, signal->height, pi, pj, 10, 5, 0xFF0000FF);
 
     }
 
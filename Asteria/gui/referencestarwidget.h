@@ -4,6 +4,7 @@
 #include "infra/imageuc.h"
 #include "infra/source.h"
 #include "infra/referencestar.h"
+#include "infra/visiblestarcache.h"
 
 #include <QWidget>
 #include <QMouseEvent>
@@ -44,9 +45,19 @@ public:
      */
     GLMeteorDrawer * signalImageViewer;
 
+    /**
+     * @brief Cache of the reference stars visible to the camera, which is updated as the user adjusts the pointing.
+     */
+    VisibleStarCache refStarCache;
+
     /**
      * @brief Vector of ReferenceStars currently visible.
      */
+    std::vector<ReferenceStar> visibleReferenceStarStore;
+
+    /**
+     * @brief Vector of pointers to the ReferenceStars currently visible; points into visibleReferenceStarStore.
+     */
     std::vector<ReferenceStar *> visibleReferenceStars;
 
     /**
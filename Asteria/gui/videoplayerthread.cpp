@@ -14,7 +14,10 @@ VideoPlayerThread::~VideoPlayerThread() {
     wait();
 }
 
-void VideoPlayerThread::loadClip(std::vector<std::shared_ptr<Imageuc> > images, std::shared_ptr<Imageuc> splash) {
+void VideoPlayerThread::loadClip(std::vector<std::shared_ptr<Imageuc> > images, std::shared_ptr<Imageuc> splash,
+                                 std::vector<MeteorImageLocationMeasurement> locs) {
+
+    QMutexLocker locker(&mutex);
 
     // Stop any current replay
     stop();
@@ -25,6 +28,11 @@ void VideoPlayerThread::loadClip(std::vector<std::shared_ptr<Imageuc> > images,
     frames.insert(frames.end(), images.begin(), images.end());
     // Store splash image
     this->splash = splash;
+    // Store the localisation data
+    this->locs = locs;
+    // Discard the annotated copies of the previous clip
+    annotatedFrames.assign(frames.size(), std::shared_ptr<Imageuc>());
+    annotatedSplash.reset();
     // Reset counter
     idx = 0;
     // Compute clip length
@@ -33,6 +41,18 @@ void VideoPlayerThread::loadClip(std::vector<std::shared_ptr<Imageuc> > images,
 
     // Reset de-interlaced stepping
     deinterlacedStepping = false;
+
+    // The splash image is displayed as soon as the clip is loaded, so annotate it now rather than
+    // waiting for the first time the player thread displays it
+    if(!splash->overlay && !locs.empty()) {
+        annotatedSplash = std::make_shared<Imageuc>(*splash);
+        annotatedSplash->generatePeakholdAnnotatedImage(frames, this->locs);
+    }
+}
+
+std::shared_ptr<Imageuc> VideoPlayerThread::getSplashImage() {
+    QMutexLocker locker(&mutex);
+    return annotatedSplash ? annotatedSplash : splash;
 }
 
 void VideoPlayerThread::toggleDiStepping(int checkBoxState) {
@@ -105,8 +125,29 @@ void VideoPlayerThread::processFrame(unsigned int fIdx, std::shared_ptr<Imageuc>
 
     AnalysisVideoStats stats(clipLengthSecs, frames.size(), framePositionSecs, fIdx, isTopField, isBottomField, utc);
 
+    // Generate the overlay image the first time the frame is displayed. This is drawn on a copy of
+    // the frame, so that the images already handed to the GUI thread are never modified.
+    std::shared_ptr<Imageuc> displayImage = image;
+    if(showOverlayImage && !image->overlay && !locs.empty()) {
+        if(image == splash) {
+            // The splash image is the peak hold image showing the analysis of the whole clip
+            if(!annotatedSplash) {
+                annotatedSplash = std::make_shared<Imageuc>(*image);
+                annotatedSplash->generatePeakholdAnnotatedImage(frames, locs);
+            }
+            displayImage = annotatedSplash;
+        }
+        else if(fIdx < locs.size()) {
+            if(!annotatedFrames[fIdx]) {
+                annotatedFrames[fIdx] = std::make_shared<Imageuc>(*image);
+                annotatedFrames[fIdx]->generateAnnotatedImage(locs[fIdx]);
+            }
+            displayImage = annotatedFrames[fIdx];
+        }
+    }
+
     emit videoStats(stats);
-    emit queueNewFrame(image, showOverlayImage, isTopField, isBottomField);
+    emit queueNewFrame(displayImage, showOverlayImage, isTopField, isBottomField);
     emit queuedFrameIndex(fIdx);
 }
 
@@ -118,6 +159,8 @@ void VideoPlayerThread::run() {
             return;
         }
 
+        mutex.lock();
+
         // Take no action if we have no video
         if(!frames.empty()) {
 
@@ -192,6 +235,8 @@ void VideoPlayerThread::run() {
             }
         }
 
+        mutex.unlock();
+
         // Delay for one frame period
         QThread::usleep(framePeriodUs);
     }
@@ -3,6 +3,7 @@
 
 #include "infra/imageuc.h"
 #include "infra/analysisvideostats.h"
+#include "infra/meteorimagelocationmeasurement.h"
 
 #include <memory>
 
@@ -33,6 +34,24 @@ public:
      */
     std::shared_ptr<Imageuc> splash;
 
+    /**
+     * @brief The localisation measurements for each frame of the clip, used to generate the overlay
+     * images on demand. Empty if the clip has no localisation data.
+     */
+    std::vector<MeteorImageLocationMeasurement> locs;
+
+    /**
+     * @brief Copies of the frames with their overlay images, generated the first time each frame is displayed
+     * with the overlay enabled. The overlays are drawn on copies so that the frames handed to the GUI thread are
+     * never modified after they've been queued for display. Null for frames not yet annotated.
+     */
+    std::vector<std::shared_ptr<Imageuc>> annotatedFrames;
+
+    /**
+     * @brief Copy of the splash image with the peak hold overlay image, or null if it hasn't been generated.
+     */
+    std::shared_ptr<Imageuc> annotatedSplash;
+
     /**
      * @brief The total length of the clip [secs]
      */
@@ -88,6 +107,15 @@ protected:
 
     void processFrame(unsigned int fIdx, std::shared_ptr<Imageuc> image, bool isTopField, bool isBottomField);
 
+public:
+    /**
+     * @brief Get the image to display when the clip is stopped, including the peak hold overlay image if the
+     * clip has localisation data.
+     * @return
+     *  The splash image.
+     */
+    std::shared_ptr<Imageuc> getSplashImage();
+
 public slots:
     /**
      * @brief Load the video clip and prepare for playback
@@ -95,8 +123,12 @@ public slots:
      *      The individual frames of the video clip, in ascending time order.
      * @param splash
      *      The splash image, i.e. the image to display when the clip is stopped.
+     * @param locs
+     *      The localisation measurements for each frame, from which the overlay images are generated
+     *      when they're displayed. If empty, no overlay images are generated.
      */
-    void loadClip(std::vector<std::shared_ptr<Imageuc>> images, std::shared_ptr<Imageuc> splash);
+    void loadClip(std::vector<std::shared_ptr<Imageuc>> images, std::shared_ptr<Imageuc> splash,
+                  std::vector<MeteorImageLocationMeasurement> locs = std::vector<MeteorImageLocationMeasurement>());
 
     /**
      * @brief Toggle the de-interlaced stepping flag.
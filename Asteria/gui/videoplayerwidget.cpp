@@ -118,7 +118,8 @@ VideoPlayerWidget::VideoPlayerWidget(QWidget *parent, const unsigned int &width,
 }
 
 
-void VideoPlayerWidget::loadClip(std::vector<std::shared_ptr<Imageuc> > images, std::shared_ptr<Imageuc> splash) {
+void VideoPlayerWidget::loadClip(std::vector<std::shared_ptr<Imageuc> > images, std::shared_ptr<Imageuc> splash,
+                                 std::vector<MeteorImageLocationMeasurement> locs) {
 
     // Set the range of the slider according to how many frames we have
     slider->setRange(0, images.size()-1);
@@ -150,10 +151,10 @@ void VideoPlayerWidget::loadClip(std::vector<std::shared_ptr<Imageuc> > images,
     }
 
     // Pass the clip to the player
-    replayThread->loadClip(images, splash);
+    replayThread->loadClip(images, splash, locs);
 
-    // Initialise it with the first image
-    display->newFrame(splash, true, true, true);
+    // Initialise it with the splash image, which the player has already annotated with the peak hold overlay
+    display->newFrame(replayThread->getSplashImage(), true, true, true);
 }
 
 void VideoPlayerWidget::updateVideoStats(const AnalysisVideoStats &stats) {
@@ -99,7 +99,8 @@ public:
 signals:
 
 public slots:
-    void loadClip(std::vector<std::shared_ptr<Imageuc>> images, std::shared_ptr<Imageuc> splash);
+    void loadClip(std::vector<std::shared_ptr<Imageuc>> images, std::shared_ptr<Imageuc> splash,
+                  std::vector<MeteorImageLocationMeasurement> locs = std::vector<MeteorImageLocationMeasurement>());
     void updateVideoStats(const AnalysisVideoStats &stats);
 
 private slots:
@@ -2,15 +2,13 @@
 #include "infra/analysisworker.h"
 #include "infra/calibrationworker.h"
 #include "infra/meteorimagelocationmeasurement.h"
-#include "util/jpgutil.h"
 #include "util/fileutil.h"
 #include "util/timeutil.h"
-#include "util/ioutil.h"
-#include "util/v4l2util.h"
+#include "util/framediffutil.h"
+#include "util/threadutil.h"
+#include "infra/v4l2framesource.h"
+#include "infra/replayframesource.h"
 
-#include <linux/videodev2.h>
-//#include <sys/ioctl.h>          // IOCTL etc
-#include <sys/mman.h>           // mmap etc
 #include <memory>               // shared_ptr
 #include <sstream>              // ostringstream
 #include <cmath>                // round(...)
@@ -21,19 +19,39 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <string.h>
 #include <vector>
 #include <algorithm>            // std::find(...)
+#include <thread>               // hardware_concurrency()
 
 #include <QString>
 #include <QCloseEvent>
 #include <QGridLayout>
 #include <QThread>
+#include <QCoreApplication>
+
+/**
+ * @brief Takes ownership of a worker that is to be run on the WorkerPool. The workers are QObjects created on the
+ * acquisition thread, which has no event loop, but the last reference to them is released on a pool thread. They're
+ * moved to the main thread and deleted there with deleteLater(), so they're never destroyed outside their own thread.
+ * @param worker
+ *  The worker, which must have no parent.
+ * @return
+ *  shared_ptr to the worker, for capturing in the jobs submitted to the pool.
+ */
+template<class Worker>
+static std::shared_ptr<Worker> makePoolWorker(Worker * worker) {
+    worker->moveToThread(QCoreApplication::instance()->thread());
+    return std::shared_ptr<Worker>(worker, [](Worker * w) { w->deleteLater(); });
+}
 
 const std::string AcquisitionThread::acquisitionStateNames[] = {"PREVIEWING", "PAUSED", "DETECTING", "RECORDING", "CALIBRATING"};
 const std::string AcquisitionThread::actionNames[] = {"PREVIEW", "PAUSE", "DETECT"};
 
 AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
-    : QThread(parent), state(state), abort(false), detectionHeadBuffer(state->detection_head) {
+    : QThread(parent), state(state), abort(false), capturing(false), sourceFinished(false), detectionHeadBuffer(state->detection_head),
+      firstFrameUpTimeUs(0ll), nClips(0ul), nCalibrations(0ul), overflowsAtStart(0ul) {
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -42,96 +60,28 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
     // TODO: this should be loaded elsewhere as part of application initialisation
-    state->refStarCatalogue = ReferenceStar::loadCatalogue(state->refStarCataloguePath);
-
-    fprintf(stderr, "Loaded %lu ReferenceStars!\n", state->refStarCatalogue.size());
-
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-    //                                                       //
-    //      Set the image size & format for the camera       //
-    //                                                       //
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-
-    format = new v4l2_format();
-    memset(format, 0, sizeof(*format));
-    format->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    format->fmt.pix.pixelformat = state->selectedFormat;
-    format->fmt.pix.width = state->width;
-    format->fmt.pix.height = state->height;
-
-    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_S_FMT, format) < 0) {
-        perror("VIDIOC_S_FMT");
-        ::close(*(this->state->fd));
-        exit(1);
-    }
-
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-    //                                                       //
-    //      Determine interlaced/progressive scan mode       //
-    //                                                       //
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    state->refStarCatalogue.load(state->refStarCataloguePath);
 
-    switch(format->fmt.pix.field) {
-    case V4L2_FIELD_ANY:
-    case V4L2_FIELD_TOP:
-    case V4L2_FIELD_BOTTOM:
-    case V4L2_FIELD_SEQ_TB:
-    case V4L2_FIELD_SEQ_BT:
-    case V4L2_FIELD_ALTERNATE:
-        // Not supported!
-        fprintf(stderr, "Image field format %s not supported!\n", V4L2Util::getV4l2FieldNameFromIndex(format->fmt.pix.field).c_str());
-        ::close(*(this->state->fd));
-        exit(1);
-        break;
-    case V4L2_FIELD_NONE:
-    case V4L2_FIELD_INTERLACED:
-    case V4L2_FIELD_INTERLACED_TB:
-    case V4L2_FIELD_INTERLACED_BT:
-        // Supported!
-        fprintf(stderr, "Image field format %s is supported\n", V4L2Util::getV4l2FieldNameFromIndex(format->fmt.pix.field).c_str());
-        break;
-    }
+    fprintf(stderr, "Loaded %llu ReferenceStars!\n", state->refStarCatalogue.size());
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
-    //        Determine nominal period between frames        //
+    //               Open the source of frames               //
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    // There are several uses for this:
+    // This sets the image size and the nominal period between frames, which has several uses:
     //  - detection of dropped frames, from the time interval between consecutive frames
     //  - setting the maximum number of frames in a clip from the maximum allowed time
     //  - setting the number of frames between calibration runs
-
-    struct v4l2_streamparm parm;
-    memset(&parm, 0, sizeof(parm));
-    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_G_PARM, &parm) < 0) {
-        perror("VIDIOC_G_PARM");
-        ::close(*(this->state->fd));
-        exit(1);
+    if(!this->state->replayPath.empty()) {
+        source = new ReplayFrameSource(this->state, this->state->replayPath, !this->state->replayFast);
+    }
+    else {
+        source = new V4l2FrameSource(this->state);
     }
-    // This struct holds the stream capture parameters
-    v4l2_captureparm cparm = parm.parm.capture;
-    unsigned int numerator = cparm.timeperframe.numerator;
-    unsigned int denominator = cparm.timeperframe.denominator;
-
-    double framePeriodSecs = (double)numerator / (double)denominator;
-    this->state->nominalFramePeriodUs = framePeriodSecs * 1000000;
-
-    // Assume shutter speed (exposure time) is the same as the frame period
-    this->state->nominalExposureTimeUs = this->state->nominalFramePeriodUs;
-
-    fprintf(stderr, "Time per frame = %d / %d  (%f) [seconds] (%d [microseconds]) \n", numerator, denominator, framePeriodSecs, this->state->nominalFramePeriodUs);
-
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-    //                                                       //
-    // Determine any relevant image parameters from V4L2 API //
-    //                                                       //
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    // TODO: do I want to use any of these?
-    V4L2Util::printUserControls(*(this->state->fd));
+    double framePeriodSecs = this->state->nominalFramePeriodUs / 1000000.0;
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -179,61 +129,84 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
-    //     Inform device about buffers & streaming mode      //
+    //   Create the capture queue & pool of recycled images  //
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    // Inform device about buffers to use
-    bufrequest = new v4l2_requestbuffers();
-    memset(bufrequest, 0, sizeof(*bufrequest));
-    bufrequest->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    bufrequest->memory = V4L2_MEMORY_MMAP;
-    bufrequest->count = 32;
-
-    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_REQBUFS, bufrequest) < 0){
-        perror("VIDIOC_REQBUFS");
-        ::close(*(this->state->fd));
-        exit(1);
-    }
+    // The capture queue absorbs short stalls in the detection thread (e.g. while a clip is being handed
+    // off) without dropping frames
+    capturedFrames = new SpscRingBuffer<CapturedFrame>(2 * source->getBufferCount());
+
+    fprintf(stderr, "Length of capture queue = %lu [frames]\n", capturedFrames->capacity());
+
+    // Size the pool to hold the detection head and detection tail, plus the frames in the capture queue and
+    // some headroom for frames queued for display. Long clips overflow the pool; the overflow frames are
+    // allocated on the heap and freed once the clip has been saved. Calibration frames aren't kept.
+    unsigned int poolCapacity = this->state->detection_head + this->state->detection_tail + capturedFrames->capacity() + 16;
+    unsigned int poolPreallocate = this->state->detection_head + 4;
+    // Additional images are held by the source, e.g. queued with the driver
+    poolCapacity += source->getHeldImageCount();
+    poolPreallocate += source->getHeldImageCount();
+    framePool = new ImageucPool(this->state->width, this->state->height, poolCapacity, poolPreallocate);
+
+    fprintf(stderr, "Capacity of frame pool = %d [frames]\n", poolCapacity);
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
-    //  Determine memory requirements and allocate buffers   //
+    //      Create the MJPEG decode threads if required      //
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    // Here, the device informs us how much memory is required for the buffers
-    // given the image format, frame dimensions and number of buffers.
-
-    bufferinfo = new v4l2_buffer();
-    memset(bufferinfo, 0, sizeof(*bufferinfo));
-
-    // Array of pointers to the start of each buffer in memory
-    buffer_start = new unsigned char*[bufrequest->count];
-
-    for(unsigned int b = 0; b < bufrequest->count; b++) {
-
-        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        bufferinfo->memory = V4L2_MEMORY_MMAP;
-        bufferinfo->index = b;
-
-        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QUERYBUF, bufferinfo) < 0){
-            perror("VIDIOC_QUERYBUF");
-            exit(1);
+    // Decoding MJPEG frames on a single core limits the frame rate; if there are spare cores then
+    // decode frames in parallel, leaving one core for the acquisition thread.
+    jpgDecodePool = NULL;
+    if(source->isCompressed()) {
+        unsigned int nThreads = std::min(std::thread::hardware_concurrency(), 5u);
+        if(nThreads > 2) {
+            jpgDecodePool = new JpgDecodePool(nThreads - 1);
+            fprintf(stderr, "Decoding MJPEG frames with %d threads\n", nThreads - 1);
         }
+    }
 
-        // bufferinfo.length: number of bytes of memory required for the buffer
-        // bufferinfo.m.offset: offset from the start of the device memory for this buffer
-        buffer_start[b] = (unsigned char *)mmap(NULL, bufferinfo->length, PROT_READ | PROT_WRITE, MAP_SHARED, *(this->state->fd), bufferinfo->m.offset);
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //   Create the clip analysis & calibration threads      //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-        if(buffer_start[b] == MAP_FAILED){
-            perror("mmap");
-            exit(1);
-        }
+    // Keep the analysis and calibration work off the CPU used for capture, so that a backlog of clips
+    // can't cause frames to be dropped
+    std::vector<unsigned int> processingCpus;
+    ThreadUtil::partitionCpus(captureCpus, processingCpus);
 
-        memset(buffer_start[b], 0, bufferinfo->length);
+    unsigned int nProcessingThreads = this->state->processing_threads;
+    if(nProcessingThreads == 0) {
+        unsigned int nCpus = std::thread::hardware_concurrency();
+        nProcessingThreads = (nCpus > 3) ? nCpus - 2 : 1;
+    }
+    workerPool = new WorkerPool(nProcessingThreads, this->state->processing_queue_length, processingCpus);
+
+    fprintf(stderr, "Processing clips and calibrations with %d threads; queue length = %d [jobs]\n", nProcessingThreads, this->state->processing_queue_length);
+
+    // Queue up any clips that were spilled to disk but not analysed before the application last exited
+    std::string spillPath = this->state->videoDirPath + "/" + AnalysisWorker::spillDirName;
+    DIR *dir;
+    if((dir = opendir(spillPath.c_str())) != NULL) {
+        struct dirent *child;
+        while((child = readdir(dir)) != NULL) {
+            // Spilled clips are stored in directories named by the UTC of the first frame
+            if(!std::regex_search(child->d_name, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
+                continue;
+            }
+            fprintf(stderr, "Recovering spilled clip %s\n", child->d_name);
+            std::vector<std::shared_ptr<Imageuc>> noFrames;
+            std::shared_ptr<AnalysisWorker> worker = makePoolWorker(new AnalysisWorker((QObject *)NULL, this->state, this->state->cal, noFrames));
+            worker->setSpillPath(spillPath + "/" + child->d_name);
+            connect(worker.get(), SIGNAL(finished(std::string)), this, SIGNAL(acquiredClip(std::string)));
+            workerPool->submitSpilled(WorkerPool::CLIP_ANALYSIS, [worker]() { worker->process(); });
+        }
+        closedir(dir);
     }
-
 }
 
 AcquisitionThread::~AcquisitionThread()
@@ -244,27 +217,21 @@ AcquisitionThread::~AcquisitionThread()
 
     wait();
 
-    fprintf(stderr, "Deactivating streaming...\n");
-    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-        perror("VIDIOC_STREAMOFF");
-        exit(1);
-    }
+    stopStreaming();
 
-    fprintf(stderr, "Deallocating image buffers...\n");
-    for(unsigned int b = 0; b < bufrequest->count; b++) {
-        if(munmap(buffer_start[b], bufferinfo->length) < 0) {
-            perror("munmap");
-        }
-    }
-    delete buffer_start;
+    // Wait for the running jobs to finish; clips still waiting are spilled to disk for next time
+    fprintf(stderr, "Stopping clip analysis & calibration threads...\n");
+    delete workerPool;
+
+    // Releases the camera
+    delete source;
+
+    delete jpgDecodePool;
 
-    fprintf(stderr, "Deleting V4L2 structs...\n");
-    delete bufferinfo;
-    delete format;
-    delete bufrequest;
+    delete capturedFrames;
 
-    fprintf(stderr, "Closing the camera...\n");
-    ::close(*(this->state->fd));
+    // Any frames still held elsewhere remain valid after the pool is deleted
+    delete framePool;
 }
 
 void AcquisitionThread::launch() {
@@ -330,6 +297,127 @@ void AcquisitionThread::transitionToState(AcquisitionThread::AcquisitionState ne
     fprintf(stderr, "Transitioned to %s\n", AcquisitionThread::acquisitionStateNames[acqState].c_str());
 }
 
+void AcquisitionThread::startStreaming() {
+    // Reset the benchmark statistics
+    captureLatency = StageLatency();
+    queueLatency = StageLatency();
+    detectionLatency = StageLatency();
+    firstFrameUpTimeUs = 0ll;
+    nClips = 0ul;
+    nCalibrations = 0ul;
+    overflowsAtStart = capturedFrames->getOverflows();
+
+    source->start(framePool);
+    sourceFinished = false;
+    capturing = true;
+    captureThread = std::thread(&AcquisitionThread::capture, this);
+    ThreadUtil::setAffinity(captureThread, captureCpus);
+}
+
+void AcquisitionThread::stopStreaming() {
+    if(captureThread.joinable()) {
+        capturing = false;
+        captureThread.join();
+    }
+    source->stop();
+    // Discard any frames not yet processed by the detection thread
+    while(CapturedFrame * frame = capturedFrames->peek()) {
+        frame->image.reset();
+        capturedFrames->consume();
+    }
+    // Discard any frames still being decoded
+    if(jpgDecodePool) {
+        jpgDecodePool->flush();
+    }
+}
+
+void AcquisitionThread::capture() {
+
+    // Monitor the FPS using a ringbuffer to buffer the image capture times and get a moving average
+    RingBuffer<long long> frameCaptureTimes(100u);
+    double fps = 0.0;
+    // Counter for frames dropped by the camera or driver
+    unsigned int droppedFramesCounter = 0;
+    // Records capture time of the previous frame, for detecting frame drops
+    long long lastFrameCaptureTime = 0ll;
+    // Frames dropped in the pipeline are counted by the capture queue since it was created; only those since
+    // streaming was started (overflowsAtStart) are reported
+    // Number of frames in the current continuous sequence
+    unsigned long nSequenceFrames = 0;
+
+    // Live sources drop frames if the detection thread falls behind; others wait for it to catch up
+    bool live = source->isLive();
+
+    unsigned long i = 0;
+    while(capturing) {
+
+        if(!live) {
+            while(capturing && capturedFrames->size() >= capturedFrames->capacity()) {
+                usleep(100);
+            }
+        }
+
+        long long startUs = TimeUtil::getUpTime();
+
+        if(!source->waitForFrame(100)) {
+            if(source->isFinished()) {
+                // No more frames; all those read have been published
+                sourceFinished = true;
+                return;
+            }
+            continue;
+        }
+
+        // The time spent waiting is only part of the cost of producing a frame for sources that aren't live
+        if(live) {
+            startUs = TimeUtil::getUpTime();
+        }
+
+        // Hand the frame to the detection thread, unless the queue is full in which case it's dropped
+        CapturedFrame * frame = capturedFrames->claim();
+
+        long long epochTimeStamp_us;
+        bool continuous = source->readFrame(frame, epochTimeStamp_us);
+        i++;
+
+        captureLatency.add(TimeUtil::getUpTime() - startUs);
+
+        if(!continuous) {
+            // Restart the FPS and dropped frames monitoring
+            frameCaptureTimes.clear();
+            nSequenceFrames = 0;
+        }
+        nSequenceFrames++;
+
+        // Monitor FPS and dropped FPS, after the first 10 frames
+        if(nSequenceFrames > 2) {
+            frameCaptureTimes.push(epochTimeStamp_us);
+        }
+        if(nSequenceFrames > 10) {
+            long long observedFramePeriodUs = epochTimeStamp_us - lastFrameCaptureTime;
+            // Number of frames periods since the last frame was captured; detects dropped frames
+            unsigned int frames = std::round((float)observedFramePeriodUs / (float)state->nominalFramePeriodUs);
+            // Difference of more than 1 between consecutive frames indicates that frame(s) have been dropped
+            droppedFramesCounter += (frames - 1);
+            // Compute FPS
+            double timeDiffSec = (frameCaptureTimes.back() - frameCaptureTimes.front()) / 1000000.0;
+            fps = (frameCaptureTimes.size()-1) / timeDiffSec;
+        }
+        lastFrameCaptureTime = epochTimeStamp_us;
+
+        if(frame) {
+            frame->epochTimeUs = epochTimeStamp_us;
+            frame->newSequence = !continuous;
+            frame->frameNumber = i;
+            frame->fps = fps;
+            frame->droppedFrames = droppedFramesCounter;
+            frame->pipelineDroppedFrames = capturedFrames->getOverflows() - overflowsAtStart;
+            frame->publishTimeUs = TimeUtil::getUpTime();
+            capturedFrames->publish();
+        }
+    }
+}
+
 void AcquisitionThread::run() {
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
@@ -351,17 +439,16 @@ void AcquisitionThread::run() {
     // Counts the number of frames since we last calibrated
     unsigned int nFramesSinceLastCalibration = 0;
 
-    // Monitor the FPS using a ringbuffer to buffer the image capture times and get a moving average
-    RingBuffer<long long> frameCaptureTimes(100u);
-    double fps = 0.0;
-    // Counter for dropped frames
-    unsigned int droppedFramesCounter = 0;
-    // Records capture time of the previous frame, for detecting frame drops
-    long long lastFrameCaptureTime = 0ll;
+    // System up time at which processing of the current frame started, for measuring the detection latency
+    long long frameStartUs = 0ll;
 
-    unsigned long i = 0;
     forever {
 
+        if(frameStartUs > 0) {
+            detectionLatency.add(TimeUtil::getUpTime() - frameStartUs);
+            frameStartUs = 0ll;
+        }
+
         if(abort) {
             return;
         }
@@ -379,21 +466,7 @@ void AcquisitionThread::run() {
                     break;
                 case PAUSED:
                     // Turn on streaming; transition to PREVIEWING
-                    fprintf(stderr, "Adding buffers to incoming queue...\n");
-                    for(unsigned long k = 0; k<bufrequest->count; k++) {
-                        bufferinfo->index = k;
-                        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                        bufferinfo->memory = V4L2_MEMORY_MMAP;
-                        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-                            perror("VIDIOC_QBUF");
-                            exit(1);
-                        }
-                    }
-                    fprintf(stderr, "Activating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMON");
-                        exit(1);
-                    }
+                    startStreaming();
                     transitionToState(PREVIEWING);
                     break;
                 case DETECTING:
@@ -404,11 +477,13 @@ void AcquisitionThread::run() {
                     // Abort recording; don't save the partial results
                     eventFrames.clear();
                     nFramesSinceLastTrigger = 0;
+                    // Abort any calibration interrupted by the event
+                    calibrationAccumulator.reset();
                     transitionToState(PREVIEWING);
                     break;
                 case CALIBRATING:
                     // Abort calibration; don't save the partial results
-                    calibrationFrames.clear();
+                    calibrationAccumulator.reset();
                     transitionToState(PREVIEWING);
                     break;
                 }
@@ -418,13 +493,7 @@ void AcquisitionThread::run() {
                 switch(acqState) {
                 case PREVIEWING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
-                    i=0;
-                    frameCaptureTimes.clear();
+                    stopStreaming();
                     detectionHeadBuffer.clear();
                     transitionToState(PAUSED);
                     break;
@@ -433,43 +502,27 @@ void AcquisitionThread::run() {
                     break;
                 case DETECTING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
-                    i=0;
-                    frameCaptureTimes.clear();
+                    stopStreaming();
                     detectionHeadBuffer.clear();
                     transitionToState(PAUSED);
                     break;
                 case RECORDING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
-                    i=0;
-                    frameCaptureTimes.clear();
+                    stopStreaming();
                     detectionHeadBuffer.clear();
                     // Abort recording; don't save the partial results
                     eventFrames.clear();
                     nFramesSinceLastTrigger = 0;
+                    // Abort any calibration interrupted by the event
+                    calibrationAccumulator.reset();
                     transitionToState(PAUSED);
                     break;
                 case CALIBRATING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
-                    i=0;
-                    frameCaptureTimes.clear();
+                    stopStreaming();
                     detectionHeadBuffer.clear();
                     // Abort calibration; don't save the partial results
-                    calibrationFrames.clear();
+                    calibrationAccumulator.reset();
                     transitionToState(PAUSED);
                     break;
                 }
@@ -483,21 +536,7 @@ void AcquisitionThread::run() {
                     break;
                 case PAUSED:
                     // Turn on streaming; transition to DETECTING
-                    fprintf(stderr, "Adding buffers to incoming queue...\n");
-                    for(unsigned long k = 0; k<bufrequest->count; k++) {
-                        bufferinfo->index = k;
-                        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                        bufferinfo->memory = V4L2_MEMORY_MMAP;
-                        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-                            perror("VIDIOC_QBUF");
-                            exit(1);
-                        }
-                    }
-                    fprintf(stderr, "Activating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMON");
-                        exit(1);
-                    }
+                    startStreaming();
                     transitionToState(DETECTING);
                     break;
                 case DETECTING:
@@ -520,127 +559,98 @@ void AcquisitionThread::run() {
             continue;
         }
 
-        // Index into circular buffer
-        unsigned int j = (i++) % bufrequest->count;
-
-        bufferinfo->index = j;
-        bufferinfo->memory = V4L2_MEMORY_MMAP;
-
-        // Wait for this buffer to be dequeued then retrieve the image
-        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_DQBUF, bufferinfo) < 0) {
-            perror("VIDIOC_DQBUF");
-            exit(1);
+        // Get the next frame from the capture thread. Read the flag first, so that no frame published before
+        // it was set can be missed.
+        bool finished = sourceFinished;
+        CapturedFrame * frame = capturedFrames->peek();
+        if(!frame) {
+            if(finished) {
+                // All the frames have been replayed: analyse the clip being recorded (if any), then stop
+                if(acqState == RECORDING) {
+                    analyseClip();
+                    nFramesSinceLastTrigger = 0;
+                }
+                stopStreaming();
+                detectionHeadBuffer.clear();
+                calibrationAccumulator.reset();
+                transitionToState(PAUSED);
+                reportBenchmark();
+                emit replayFinished();
+                continue;
+            }
+            QThread::usleep(1000);
+            continue;
         }
 
-        // The image is ready to be read; it is stored in the buffer with index j,
-        // which is mapped into application address space at buffer_start[j]
-
-        // System clock time (since startup/hibernation) of time first byte of data was captured [microseconds]
-        long long temp_us = 1000000LL * bufferinfo->timestamp.tv_sec + (long long) round(bufferinfo->timestamp.tv_usec);
-        // Translate to microseconds since 1970-01-01T00:00:00Z
-        long long epochTimeStamp_us = temp_us +  state->epochTimeDiffUs;
+        frameStartUs = TimeUtil::getUpTime();
+        queueLatency.add(frameStartUs - frame->publishTimeUs);
+        if(firstFrameUpTimeUs == 0ll) {
+            firstFrameUpTimeUs = frameStartUs;
+        }
 
+        bool newSequence = frame->newSequence;
+        long long epochTimeStamp_us = frame->epochTimeUs;
         string utc = TimeUtil::epochToUtcString(epochTimeStamp_us);
 
-
-
-        /////////////////////////////////////////////////////////////// TEMP:
-
-
-        // Get the current epoch time
-//        struct timeval epochtime;
-//        gettimeofday(&epochtime, NULL);
-//        long long epoch_us =  epochtime.tv_sec * 1000000LL  + (long long) epochtime.tv_usec;
-        // Convert this to UTC string
-//        std::string utcStrTmp = TimeUtil::epochToUtcString(epoch_us);
-        // Convert this back to epoch time
-//        long long epochTime_us_tmp = TimeUtil::utcStringToEpoch(utcStrTmp);
-//        long long diff = epochTime_us_tmp - epoch_us;
-//        fprintf(stderr, "epoch_us = %lld\n", epoch_us);
-//        fprintf(stderr, "utcStrTmp = %s\n", utcStrTmp.c_str());
-//        fprintf(stderr, "epochTime_us_tmp = %lld\n", epochTime_us_tmp);
-//        fprintf(stderr, "diff = %lld\n", diff);
-
-
-        //        double jd = TimeUtil::epochToJd(epochTimeStamp_us);
-//        double gmst = TimeUtil::epochToGmst(epochTimeStamp_us);
-//        double lst = TimeUtil::gmstToLst(gmst, state->longitude);
-
-//        // Get decimal minutes and seconds
-//        int gmst_hour, gmst_min;
-//        double gmst_sec;
-//        TimeUtil::decimalHoursToHMS(gmst, gmst_hour, gmst_min, gmst_sec);
-//        int lst_hour, lst_min;
-//        double lst_sec;
-//        TimeUtil::decimalHoursToHMS(lst, lst_hour, lst_min, lst_sec);
-
-//        fprintf(stderr, "JD   = %f\n", jd);
-//        fprintf(stderr, "UTC  = %s\n", utc.c_str());
-//        fprintf(stderr, "GMST = %02.0f:%02.0f:%06.3f\n", std::floor(gmst_hour), std::floor(gmst_min), gmst_sec);
-//        fprintf(stderr, "LST  = %02.0f:%02.0f:%06.3f\n", std::floor(lst_hour), std::floor(lst_min), lst_sec);
-
-        ///////////////////////////////////////////////////////////////
-
-
-
-
-        std::shared_ptr<Imageuc> image = make_shared<Imageuc>(state->width, state->height);
-        image->epochTimeUs = epochTimeStamp_us;
-        image->field = format->fmt.pix.field;
-
-        switch(format->fmt.pix.pixelformat) {
-            case V4L2_PIX_FMT_GREY: {
-                // Read the raw greyscale pixels to the image object
-                unsigned char * pBuf = buffer_start[j];
-                unsigned int nPix = state->width * state->height;
-                for(unsigned int p=0; p<nPix; p++) {
-                    image->rawImage[p] = *(pBuf++);
-                }
-                break;
+        std::shared_ptr<Imageuc> image = frame->image;
+        frame->image.reset();
+
+        AcquisitionVideoStats stats(frame->fps, frame->droppedFrames, frame->pipelineDroppedFrames, frame->frameNumber, utc);
+
+        if(!image) {
+            // Convert the JPEG image to greyscale, in an image recycled from the pool
+            image = framePool->acquire();
+            image->epochTimeUs = epochTimeStamp_us;
+            image->field = source->getField();
+            if(jpgDecodePool) {
+                // Decode in parallel; the decoded frames are retrieved in order below, along with their
+                // sequence flag and stats
+                jpgDecodePool->submit(frame->compressed.data(), frame->compressedSize, image, newSequence, stats);
+                image.reset();
             }
-            case V4L2_PIX_FMT_MJPEG: {
-                // Convert the JPEG image to greyscale
-                JpgUtil::readJpeg((unsigned char *)buffer_start[j], bufferinfo->bytesused, image->rawImage);
-                break;
-            }
-            case V4L2_PIX_FMT_YUYV: {
-                // Convert the YUYV (luminance + chrominance) image to greyscale
-                JpgUtil::convertYuyv422((unsigned char *)buffer_start[j], bufferinfo->bytesused, image->rawImage);
-                break;
+            else if(!jpgDecoder.decode(frame->compressed.data(), frame->compressedSize, image->width, image->height, image->rawImage)) {
+                // Return the image to the pool; the frame is dropped below
+                image.reset();
             }
         }
 
-        // TODO: if the frame number i is less than the number of frames to flush, skip the rest of the
-        // loop.
-
-        // Monitor FPS and dropped FPS, after the first 10 frames
-        if(i > 2) {
-            frameCaptureTimes.push(epochTimeStamp_us);
+        // Return the slot to the capture thread
+        capturedFrames->consume();
+
+        if(state->headless && stats.totalFrames > 10 && source->isLive()) {
+            // Headless mode: print frame stats to console. Skipped when replaying as fast as possible, when the
+            // throughput is reported at the end instead.
+            ImageucPoolStats poolStats = framePool->getStats();
+            WorkerPoolStats workerStats = workerPool->getStats();
+            fprintf(stderr, "+++ FPS: %06f Dropped: %06d (camera) %06d (pipeline) Total: %06d Queue: %03lu/%03lu Pool: %03d/%03d (peak %03d, overflows %lu) Jobs: %02d/%02d (spilled %02d) +++\n",
+                    stats.fps, stats.droppedFrames, stats.pipelineDroppedFrames, stats.totalFrames, capturedFrames->size(), capturedFrames->capacity(),
+                    poolStats.inUse + poolStats.overflowInUse, poolStats.capacity, poolStats.peakInUse, poolStats.overflows,
+                    workerStats.queueLength + workerStats.running, workerStats.maxQueueLength, workerStats.spilledQueueLength);
         }
-        if(i > 10) {
-
-            long long observedFramePeriodUs = epochTimeStamp_us - lastFrameCaptureTime;
-            // Number of frames periods since the last frame was captured; detects dropped frames
-            unsigned int frames = std::round((float)observedFramePeriodUs / (float)state->nominalFramePeriodUs);
-            // Difference of more than 1 between consecutive frames indicates that frame(s) have been dropped
-            droppedFramesCounter += (frames - 1);
-            // Compute FPS
-            double timeDiffSec = (frameCaptureTimes.back() - frameCaptureTimes.front()) / 1000000.0;
-            fps = (frameCaptureTimes.size()-1) / timeDiffSec;
 
-            if(state->headless) {
-                // Headless mode: print frame stats to console
-                fprintf(stderr, "+++ FPS: %06f Dropped: %06d Total: %06lu +++\n", fps, droppedFramesCounter, i);
+        if(jpgDecodePool) {
+            // Retrieve the next decoded frame, which usually lags the current frame by a few frames. Only wait
+            // for it if all of the decode threads are busy.
+            // The sequence flag and stats are those of the decoded frame, not the most recently captured one.
+            if(!jpgDecodePool->next(image, newSequence, stats, jpgDecodePool->pending() > jpgDecodePool->nThreads)) {
+                continue;
             }
+            utc = stats.utc;
         }
-        lastFrameCaptureTime = epochTimeStamp_us;
 
-        AcquisitionVideoStats stats(fps, droppedFramesCounter, i, utc);
+        if(!image) {
+            // Corrupt or truncated frames are dropped rather than differenced with whatever pixels the
+            // recycled image held
+            fprintf(stderr, "Dropping frame that failed to decode\n");
+            if(newSequence) {
+                detectionHeadBuffer.clear();
+            }
+            continue;
+        }
 
-        // Re-enqueue the buffer now we've extracted all the image data
-        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-            perror("VIDIOC_QBUF");
-            exit(1);
+        if(newSequence) {
+            // Don't difference frames from different sequences, e.g. consecutive replayed clips
+            detectionHeadBuffer.clear();
         }
 
         // Retrieve the previous image...
@@ -649,8 +659,10 @@ void AcquisitionThread::run() {
         detectionHeadBuffer.push(image);
 
         if(acqState==PREVIEWING) {
-            // PREVIEWING - don't proceed to event detection and calibration.
-            emit acquiredImage(image, true, true, true);
+            // PREVIEWING - don't proceed to event detection and calibration. There's no overlay to display;
+            // release any retained by a recycled image.
+            image->overlay.reset();
+            emit acquiredImage(image, false, true, true);
             emit videoStats(stats);
             continue;
         }
@@ -665,22 +677,12 @@ void AcquisitionThread::run() {
 
             // Events are detected by counting the number of pixels with significant
             // changes in brightness. If this is above a threshold then an event is detected.
-            unsigned int nChangedPixels = 0;
-
-            for(unsigned int p=0; p< state->width * state->height; p++) {
-
-                unsigned char newPixel = image->rawImage[p];
-                unsigned char oldPixel = prev->rawImage[p];
+            FrameDiffUtil::computeDifference(image->rawImage, prev->rawImage, state->width, state->height, state->pixel_difference_threshold, frameDiff);
+            unsigned int nChangedPixels = frameDiff.nChangedPixels;
 
-                if((unsigned int)abs(newPixel - oldPixel) > state->pixel_difference_threshold) {
-                    nChangedPixels++;
-                    if(newPixel - oldPixel > 0) {
-                        loc.changedPixelsPositive.push_back(p);
-                    }
-                    else {
-                        loc.changedPixelsNegative.push_back(p);
-                    }
-                }
+            // The lists of changed pixels are only needed to draw the overlay image
+            if(!state->headless && showOverlayImage) {
+                frameDiff.getChangedPixels(loc.changedPixelsPositive, loc.changedPixelsNegative);
             }
 
             if(nChangedPixels > state->n_changed_pixels_for_trigger) {
@@ -705,6 +707,7 @@ void AcquisitionThread::run() {
 
             // Transition to CALIBRATING if counter has reached (or passed) limit
             else if(nFramesSinceLastCalibration >= calibration_intervals_frames) {
+                calibrationAccumulator = std::make_shared<CalibrationAccumulator>(state->width, state->height, state->calibration_stack);
                 transitionToState(CALIBRATING);
             }
         }
@@ -724,34 +727,22 @@ void AcquisitionThread::run() {
             // Stop recording if we hit the upper limit on clip length, or when enough frames have passed
             // since the last detected event.
             if(eventFrames.size() >= max_clip_length_frames || nFramesSinceLastTrigger > state->detection_tail) {
-                // Create an AnalysisWorker to analyse the clip in a dedicated thread
-                QThread* thread = new QThread;
-                AnalysisWorker* worker = new AnalysisWorker(NULL, this->state, this->state->cal, eventFrames);
-                worker->moveToThread(thread);
-                connect(thread, SIGNAL(started()), worker, SLOT(process()));
-                connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-                connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
-                connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
-                // Notify listeners when a new clip is available
-                connect(worker, SIGNAL(finished(std::string)), this, SIGNAL(acquiredClip(std::string)));
-                thread->start();
-
-                // Clear the event frame buffer
-                eventFrames.clear();
+                analyseClip();
 
                 // Reset counter
                 nFramesSinceLastTrigger = 0;
 
-                // Back to DETECTING state
-                transitionToState(DETECTING);
+                // Back to DETECTING state, or resume the calibration that was interrupted by the event
+                transitionToState(calibrationAccumulator ? CALIBRATING : DETECTING);
             }
         }
         else if(acqState == CALIBRATING) {
 
             if(event) {
-                // Abort calibration: the calibration algorithms assume the signal is stable, and are compromised
-                // by the occurence of events in the scene.
-                calibrationFrames.clear();
+                // Skip the frame: the calibration algorithms assume the signal is stable, and are compromised
+                // by the occurence of events in the scene. The frames accumulated so far are kept, and the
+                // calibration resumes once the event has been recorded.
+                calibrationAccumulator->skipFrame();
                 // Transition to RECORDING to capture the event
                 transitionToState(RECORDING);
                 // Copy the detection head buffer contents to the event frames buffer
@@ -759,27 +750,23 @@ void AcquisitionThread::run() {
                 eventFrames.insert(eventFrames.end(), detectionHeadFrames.begin(), detectionHeadFrames.end());
             }
             else {
-                // Add the frame to the calibration set
-                calibrationFrames.push_back(image);
+                // Add the frame to the calibration statistics
+                calibrationAccumulator->addFrame(*image);
 
                 // Determine if we've recorded all the calibration frames we need
-                if(calibrationFrames.size() >= state->calibration_stack) {
-                    // Got enough frames: run calibration algorithm
-                    QThread* thread = new QThread;
-                    CalibrationWorker* worker = new CalibrationWorker(NULL, this->state, this->state->cal, calibrationFrames);
-                    worker->moveToThread(thread);
-                    connect(thread, SIGNAL(started()), worker, SLOT(process()));
-                    connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-                    connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
-                    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+                if(calibrationAccumulator->isComplete()) {
+                    // Got enough frames: run calibration algorithm on the worker pool. Calibrations have lower
+                    // priority than clips, and are discarded if the pool is backed up.
+                    std::shared_ptr<CalibrationWorker> worker = makePoolWorker(new CalibrationWorker((QObject *)NULL, this->state, this->state->cal, calibrationAccumulator));
                     // Notify listeners when a new calibration is available
-                    connect(worker, SIGNAL(finished(std::string)), this, SIGNAL(acquiredCalibration(std::string)));
+                    connect(worker.get(), SIGNAL(finished(std::string)), this, SIGNAL(acquiredCalibration(std::string)));
                     // Swap out the current calibration for the new one
-                    connect(worker, SIGNAL(finished(std::shared_ptr<CalibrationInventory>)), this, SLOT(updateCalibration(std::shared_ptr<CalibrationInventory>)));
-                    thread->start();
+                    connect(worker.get(), SIGNAL(finished(std::shared_ptr<CalibrationInventory>)), this, SLOT(updateCalibration(std::shared_ptr<CalibrationInventory>)));
+                    workerPool->submit(WorkerPool::CALIBRATION, [worker]() { worker->process(); });
+                    nCalibrations++;
 
-                    // Clear the calibration buffer, reset the counter
-                    calibrationFrames.clear();
+                    // Clear the calibration statistics, reset the counter
+                    calibrationAccumulator.reset();
                     nFramesSinceLastCalibration = 0;
 
                     // Back to DETECTING state
@@ -788,9 +775,14 @@ void AcquisitionThread::run() {
             }
         }
 
+        // The overlay is only allocated when it's going to be displayed. Recycled images keep their
+        // overlay while it's in use, to avoid reallocating it every frame.
         if(!state->headless && showOverlayImage) {
             image->generateAnnotatedImage(loc);
         }
+        else {
+            image->overlay.reset();
+        }
 
         // Notify attached listeners that a new frame is available
         emit acquiredImage(image, showOverlayImage, true, true);
@@ -798,3 +790,50 @@ void AcquisitionThread::run() {
     }
 
 }
+
+void AcquisitionThread::analyseClip() {
+
+    // Create an AnalysisWorker to analyse the clip on the worker pool. If the pool is backed up then
+    // the clip is spilled to disk, to be analysed once the backlog has cleared.
+    std::shared_ptr<AnalysisWorker> worker = makePoolWorker(new AnalysisWorker((QObject *)NULL, this->state, this->state->cal, eventFrames));
+    // Notify listeners when a new clip is available
+    connect(worker.get(), SIGNAL(finished(std::string)), this, SIGNAL(acquiredClip(std::string)));
+    workerPool->submit(WorkerPool::CLIP_ANALYSIS, [worker]() { worker->process(); }, [worker]() { return worker->spill(); });
+    nClips++;
+
+    // Clear the event frame buffer
+    eventFrames.clear();
+}
+
+void AcquisitionThread::reportBenchmark() {
+
+    long long detectionEndUs = TimeUtil::getUpTime();
+
+    // Include the time to finish analysing the clips
+    workerPool->waitUntilIdle();
+    long long analysisEndUs = TimeUtil::getUpTime();
+
+    WorkerPoolStats workerStats = workerPool->getStats();
+    unsigned long nFrames = detectionLatency.n;
+    double detectionSecs = (detectionEndUs - firstFrameUpTimeUs) / 1000000.0;
+    double totalSecs = (analysisEndUs - firstFrameUpTimeUs) / 1000000.0;
+
+    fprintf(stderr, "+++ Replay finished: %lu frames in %.3f s (%.1f frames/s); %.3f s (%.1f frames/s) including analysis +++\n",
+            nFrames, detectionSecs, nFrames / detectionSecs, totalSecs, nFrames / totalSecs);
+    fprintf(stderr, "+++ Detections: %lu clips, %lu calibrations; dropped frames: %lu (pipeline) +++\n",
+            nClips, nCalibrations, capturedFrames->getOverflows() - overflowsAtStart);
+    fprintf(stderr, "+++ Stage latency [ms]:        mean        max +++\n");
+    fprintf(stderr, "+++   capture          %10.3f %10.3f +++\n", captureLatency.meanMs(), captureLatency.maxUs / 1000.0);
+    fprintf(stderr, "+++   capture queue    %10.3f %10.3f +++\n", queueLatency.meanMs(), queueLatency.maxUs / 1000.0);
+    fprintf(stderr, "+++   detection        %10.3f %10.3f +++\n", detectionLatency.meanMs(), detectionLatency.maxUs / 1000.0);
+    for(unsigned int p = 0; p < WorkerPoolStats::nPriorities; p++) {
+        unsigned long n = workerStats.completed[p];
+        if(n == 0) {
+            continue;
+        }
+        fprintf(stderr, "+++   %-16s %10.3f %10.3f (waiting) +++\n", WorkerPool::priorityNames[p].c_str(),
+                workerStats.totalWaitUs[p] / (1000.0 * n), workerStats.maxWaitUs[p] / 1000.0);
+        fprintf(stderr, "+++   %-16s %10.3f %10.3f (running) +++\n", WorkerPool::priorityNames[p].c_str(),
+                workerStats.totalRunUs[p] / (1000.0 * n), workerStats.maxRunUs[p] / 1000.0);
+    }
+}
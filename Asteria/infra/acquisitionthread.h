@@ -6,11 +6,21 @@
 #include "infra/ringbuffer.h"
 #include "infra/concurrentqueue.h"
 #include "infra/acquisitionvideostats.h"
+#include "infra/framedifference.h"
+#include "infra/imageucpool.h"
+#include "infra/spscringbuffer.h"
+#include "infra/workerpool.h"
+#include "infra/framesource.h"
+#include "infra/calibrationaccumulator.h"
+#include "util/jpgdecoder.h"
+#include "util/jpgdecodepool.h"
 
-#include <linux/videodev2.h>
 #include <vector>
 #include <memory>               // shared_ptr
 #include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>            // max
 
 #include <QThread>
 #include <QMutex>
@@ -44,6 +54,10 @@ signals:
     void acquiredClip(std::string utc);
     void acquiredCalibration(std::string utc);
     void transitionedToState(AcquisitionThread::AcquisitionState);
+    /**
+     * @brief Emitted when the frame source has run out of frames, e.g. at the end of a replay.
+     */
+    void replayFinished();
 
 public slots:
 
@@ -95,31 +109,76 @@ private:
     AsteriaState * state;
 
     /**
-     * \brief Information about the video buffer(s) in use.
-     * See https://www.linuxtv.org/downloads/legacy/video4linux/API/V4L2_API/spec/ch03s05.html
+     * @brief abort
+     * Flag used to abort the acquisition thread and shutdown.
      */
-    struct v4l2_buffer * bufferinfo;
+    bool abort;
 
     /**
-     * \brief The pixel format in use.
+     * @brief source
+     * The source of the frames: the camera, or recorded frames being replayed.
      */
-    struct v4l2_format * format;
+    FrameSource * source;
 
     /**
-     * \brief Information about requested & allocated buffers.
+     * @brief framePool
+     * Pool of recycled images that the captured frames are written to, to avoid allocating a new image
+     * for every frame.
      */
-    struct v4l2_requestbuffers * bufrequest;
+    ImageucPool * framePool;
 
     /**
-     * @brief abort
-     * Flag used to abort the acquisition thread and shutdown.
+     * @brief jpgDecoder
+     * Decoder used for MJPEG frames when they're decoded on the acquisition thread.
      */
-    bool abort;
+    JpgDecoder jpgDecoder;
+
+    /**
+     * @brief jpgDecodePool
+     * Pool of threads used to decode MJPEG frames in parallel, if there are enough cores; otherwise NULL.
+     */
+    JpgDecodePool * jpgDecodePool;
+
+    /**
+     * @brief captureThread
+     * Thread that reads frames from the source (e.g. dequeues them from the driver and re-queues the buffers)
+     * as quickly as possible, handing the frames to the detection thread (the main thread of this class) through the
+     * capturedFrames queue. Running only while streaming.
+     */
+    std::thread captureThread;
+
+    /**
+     * @brief capturing
+     * Flag used to stop the capture thread.
+     */
+    std::atomic<bool> capturing;
+
+    /**
+     * @brief sourceFinished
+     * Flag set by the capture thread once the source has run out of frames (e.g. at the end of a replay)
+     * and all of them have been added to the capture queue.
+     */
+    std::atomic<bool> sourceFinished;
+
+    /**
+     * @brief capturedFrames
+     * Queue of frames passed from the capture thread to the detection thread. If the detection thread falls
+     * so far behind that the queue fills up then new frames are dropped, and counted as pipeline drops.
+     */
+    SpscRingBuffer<CapturedFrame> * capturedFrames;
+
+    /**
+     * @brief captureCpus
+     * The CPUs that the capture thread runs on, which are kept free of the clip analysis and calibration
+     * work. Empty if there are too few CPUs to partition them.
+     */
+    std::vector<unsigned int> captureCpus;
 
     /**
-     * \brief Array of pointers to the start of each image buffer in memory
+     * @brief workerPool
+     * Pool of threads that analyse the recorded clips and process the calibration frames in the background.
      */
-    unsigned char ** buffer_start;
+    WorkerPool * workerPool;
 
     /**
      * @brief detectionHeadBuffer
@@ -135,10 +194,12 @@ private:
     std::vector<std::shared_ptr<Imageuc>> eventFrames;
 
     /**
-     * @brief calibrationFrames
-     * Buffer to store the calibration footage
+     * @brief calibrationAccumulator
+     * Statistics of the calibration footage, accumulated as it's captured. This is null unless a
+     * calibration is in progress; frames containing events are skipped, and the accumulation resumes
+     * once the event has been recorded.
      */
-    std::vector<std::shared_ptr<Imageuc>> calibrationFrames;
+    std::shared_ptr<CalibrationAccumulator> calibrationAccumulator;
 
     /**
      * @brief state
@@ -155,6 +216,13 @@ private:
      */
     ConcurrentQueue<Action> actions;
 
+    /**
+     * @brief frameDiff
+     * Results of differencing the current frame with the previous one. Reused from frame to frame
+     * to avoid reallocating the changed pixel bitmaps.
+     */
+    FrameDifference frameDiff;
+
     /**
      * @brief calibration_intervals_frames
      * Number of frames between calibration intervals.
@@ -183,6 +251,114 @@ private:
      * Function used to perform state transitions internally, so we can log whenever they happen
      */
     void transitionToState(AcquisitionThread::AcquisitionState);
+
+    /**
+     * @brief Starts the frame source and the capture thread.
+     */
+    void startStreaming();
+
+    /**
+     * @brief Stops the capture thread and the frame source, and releases any images held by the source or
+     * waiting in the capture queue.
+     */
+    void stopStreaming();
+
+    /**
+     * @brief Main loop of the capture thread.
+     */
+    void capture();
+
+    /**
+     * @brief Submits the recorded event frames for analysis, and clears them.
+     */
+    void analyseClip();
+
+    /**
+     * @brief Waits for all the clip analysis and calibration jobs to finish, then prints the throughput and
+     * the latency of each stage of the pipeline since streaming was started. Used to benchmark the
+     * processing by replaying recorded frames as fast as possible.
+     */
+    void reportBenchmark();
+
+    /**
+     * @brief Accumulates the time taken by one stage of the pipeline, for benchmarking.
+     */
+    struct StageLatency {
+
+        StageLatency() : n(0ul), totalUs(0ll), maxUs(0ll) {
+
+        }
+
+        void add(long long us) {
+            n++;
+            totalUs += us;
+            maxUs = std::max(maxUs, us);
+        }
+
+        double meanMs() const {
+            return (n > 0) ? totalUs / (1000.0 * n) : 0.0;
+        }
+
+        /**
+         * @brief The number of frames.
+         */
+        unsigned long n;
+
+        /**
+         * @brief The total time taken [microseconds]
+         */
+        long long totalUs;
+
+        /**
+         * @brief The longest time taken for any frame [microseconds]
+         */
+        long long maxUs;
+    };
+
+    /**
+     * @brief captureLatency
+     * Time taken to read each frame from the source, on the capture thread. For live sources this excludes
+     * the time spent waiting for the frame to arrive.
+     */
+    StageLatency captureLatency;
+
+    /**
+     * @brief queueLatency
+     * Time that each frame spends in the capture queue.
+     */
+    StageLatency queueLatency;
+
+    /**
+     * @brief detectionLatency
+     * Time taken to process each frame on the detection thread, i.e. event detection and dispatch of clips
+     * and calibration frames.
+     */
+    StageLatency detectionLatency;
+
+    /**
+     * @brief firstFrameUpTimeUs
+     * System up time at which the detection thread received the first frame since streaming was started [microseconds]
+     */
+    long long firstFrameUpTimeUs;
+
+    /**
+     * @brief nClips
+     * Number of clips recorded since streaming was started.
+     */
+    unsigned long nClips;
+
+    /**
+     * @brief nCalibrations
+     * Number of sets of calibration frames recorded since streaming was started.
+     */
+    unsigned long nCalibrations;
+
+    /**
+     * @brief overflowsAtStart
+     * Number of frames dropped by the capture queue before streaming was started, which is subtracted from the
+     * running total so that only the frames dropped since then are reported.
+     */
+    unsigned long overflowsAtStart;
 };
 
 #endif // ACQUISITIONTHREAD_H
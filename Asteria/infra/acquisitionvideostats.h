@@ -13,7 +13,7 @@ class AcquisitionVideoStats
 public:
     AcquisitionVideoStats();
     AcquisitionVideoStats(const AcquisitionVideoStats &copyme);
-    AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &totalFrames, const std::string &utc);
+    AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &pipelineDroppedFrames, const unsigned int &totalFrames, const std::string &utc);
 
     /**
      * @brief fps
@@ -23,10 +23,16 @@ public:
 
     /**
      * @brief droppedFrames
-     * The number of dropped frames so far
+     * The number of frames dropped by the camera or driver so far, i.e. never delivered to the application
      */
     unsigned int droppedFrames;
 
+    /**
+     * @brief pipelineDroppedFrames
+     * The number of frames captured but then dropped so far because the processing couldn't keep up
+     */
+    unsigned int pipelineDroppedFrames;
+
     /**
      * @brief totalFrames
      * Number of frames captured so far
@@ -3,7 +3,10 @@
 #include "util/fileutil.h"
 #include "util/serializationutil.h"
 #include "util/jpgutil.h"
+#include "util/pixelkernelutil.h"
+#include "util/mathutil.h"
 
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <functional>
@@ -33,12 +36,7 @@ AnalysisInventory::AnalysisInventory(const std::vector<std::shared_ptr<Imageuc>>
     for(unsigned int i = 0; i < eventFrames.size(); ++i) {
         Imageuc &image = *eventFrames[i];
         // Compute peak hold image
-        for(unsigned int k=0; k<image.height; k++) {
-            for(unsigned int l=0; l<image.width; l++) {
-                unsigned int offset = k*image.width + l;
-                peakHold->rawImage[offset] = std::max(peakHold->rawImage[offset], image.rawImage[offset]);
-            }
-        }
+        PixelKernelUtil::max(image.rawImage.data(), peakHold->rawImage.data(), image.width * image.height);
     }
 }
 
@@ -111,12 +109,24 @@ AnalysisInventory *AnalysisInventory::loadFromDir(std::string path) {
     // Sort the location measurements into ascending order of capture time
     std::sort(inv->locs.begin(), inv->locs.end());
 
-    // Generate annnotated images for each raw image, showing analysis of individual frame
-    for(unsigned int i=0; i<inv->eventFrames.size(); i++) {
-        inv->eventFrames[i]->generateAnnotatedImage(inv->locs[i]);
+    // Load the sky coordinates of the centre of flux, which are in the same order
+    std::string skyData = processed + "/skycoords.txt";
+    if(FileUtil::fileExists(skyData)) {
+        std::ifstream ifs(skyData);
+        std::string line;
+        while(std::getline(ifs, line)) {
+            long long epochTimeUs;
+            double az, el;
+            if(sscanf(line.c_str(), "%lld %lf %lf", &epochTimeUs, &az, &el) == 3) {
+                inv->azimuth.push_back(MathUtil::toRadians(az));
+                inv->elevation.push_back(MathUtil::toRadians(el));
+            }
+        }
+        ifs.close();
     }
-    // Generate annotated image for the peakHold image, showing analysis of clip
-    inv->peakHold->generatePeakholdAnnotatedImage(inv->eventFrames, inv->locs);
+
+    // Note that the annotated overlay images showing the analysis of each frame and of the whole clip
+    // are not generated here; they're generated on demand when the frames are displayed.
 
     return inv;
 }
@@ -194,6 +204,19 @@ void AnalysisInventory::saveToDir(std::string topLevelPath) {
     // write class instance to archive
     oa & BOOST_SERIALIZATION_NVP(locs);
     ofs.close();
+
+    // Write out the sky coordinates of the centre of flux, if they were computed
+    if(!azimuth.empty()) {
+        sprintf(filename, "%s/skycoords.txt", processed.c_str());
+        std::ofstream sky(filename);
+        sky << "# Epoch time [us], azimuth (east of north) [deg], elevation [deg]\n";
+        for(unsigned int i = 0; i < locs.size() && i < azimuth.size(); ++i) {
+            char line [100];
+            sprintf(line, "%lld\t%f\t%f\n", locs[i].epochTimeUs, MathUtil::toDegrees(azimuth[i]), MathUtil::toDegrees(elevation[i]));
+            sky << line;
+        }
+        sky.close();
+    }
 }
 
 void AnalysisInventory::deleteClip() {
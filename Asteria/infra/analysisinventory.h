@@ -27,6 +27,14 @@ public:
 
     std::vector<MeteorImageLocationMeasurement> locs;
 
+    /**
+     * @brief Azimuth (east of north) and elevation [radians] of the centre of flux in each frame, computed
+     * using the camera calibration. These are empty if no calibration was available, and NaN for frames
+     * without a localisation.
+     */
+    std::vector<double> azimuth;
+    std::vector<double> elevation;
+
 public slots:
 
     /**
@@ -1,6 +1,11 @@
 #include "analysisworker.h"
 #include "util/timeutil.h"
+#include "util/fileutil.h"
 #include "infra/analysisinventory.h"
+#include "infra/calibrationinventory.h"
+
+#include <cmath>
+#include <fstream>
 
 #include <QString>
 #include <QCloseEvent>
@@ -22,6 +27,51 @@ AnalysisWorker::AnalysisWorker(QObject *parent, AsteriaState * state, const std:
 AnalysisWorker::~AnalysisWorker() {
 }
 
+const std::string AnalysisWorker::spillDirName = "spill";
+
+bool AnalysisWorker::spill() {
+
+    if(eventFrames.empty()) {
+        return false;
+    }
+
+    // Spilled clips are stored in a directory named by the time of the first frame
+    std::string utc = TimeUtil::epochToUtcString(eventFrames[0u]->epochTimeUs);
+
+    std::vector<std::string> subLevels;
+    subLevels.push_back(spillDirName);
+    subLevels.push_back(utc);
+    subLevels.push_back("raw");
+    std::string path = state->videoDirPath + "/" + spillDirName + "/" + utc;
+
+    if(!FileUtil::createDirs(state->videoDirPath, subLevels)) {
+        fprintf(stderr, "Couldn't create directory %s\n", path.c_str());
+        return false;
+    }
+
+    // Use the same layout as the raw frames of a saved clip, so they can be loaded by AnalysisInventory
+    for(unsigned int i = 0; i < eventFrames.size(); ++i) {
+        std::string filename = path + "/raw/" + TimeUtil::epochToUtcString(eventFrames[i]->epochTimeUs) + ".pgm";
+        std::ofstream out(filename);
+        out << *eventFrames[i];
+        out.close();
+        if(!out) {
+            fprintf(stderr, "Couldn't write %s\n", filename.c_str());
+            FileUtil::deleteFilePath(path);
+            return false;
+        }
+    }
+
+    spillPath = path;
+    eventFrames.clear();
+    eventFrames.shrink_to_fit();
+    return true;
+}
+
+void AnalysisWorker::setSpillPath(const std::string &path) {
+    spillPath = path;
+}
+
 void AnalysisWorker::process() {
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
@@ -50,6 +100,22 @@ void AnalysisWorker::process() {
     //  - path deviates from model fit
     //  -
 
+    if(!spillPath.empty()) {
+        // The frames were spilled to disk while the clip was waiting to be analysed; reload them
+        AnalysisInventory * spilled = AnalysisInventory::loadFromDir(spillPath);
+        if(spilled) {
+            eventFrames = spilled->eventFrames;
+            delete spilled;
+        }
+        FileUtil::deleteFilePath(spillPath);
+        spillPath.clear();
+    }
+
+    if(eventFrames.empty()) {
+        fprintf(stderr, "No frames to analyse!\n");
+        return;
+    }
+
     // Initialise an AnalysisInventory with the raw data
     AnalysisInventory inv(eventFrames);
 
@@ -137,6 +203,27 @@ void AnalysisWorker::process() {
         }
     }
 
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //      Convert centres of flux to sky coordinates       //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    std::shared_ptr<const PixelRayMap> rayMap;
+    if(calibration) {
+        rayMap = calibration->getPixelRayMap();
+    }
+
+    if(rayMap) {
+        inv.azimuth.assign(eventFrames.size(), NAN);
+        inv.elevation.assign(eventFrames.size(), NAN);
+        for(unsigned int i = 1; i < eventFrames.size(); ++i) {
+            if(inv.locs[i].coarse_localisation_success) {
+                rayMap->getAzEl(inv.locs[i].x_flux_centroid, inv.locs[i].y_flux_centroid, inv.azimuth[i], inv.elevation[i]);
+            }
+        }
+    }
+
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                         //
     //       Finer localisation: PSF fitting along track       //
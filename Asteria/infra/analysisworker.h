@@ -7,6 +7,7 @@
 #include <linux/videodev2.h>
 #include <vector>               // vector
 #include <memory>               // shared_ptr
+#include <string>
 
 #include <QObject>
 
@@ -19,6 +20,27 @@ public:
                    std::vector<std::shared_ptr<Imageuc>> eventFrames = std::vector<std::shared_ptr<Imageuc>>());
     ~AnalysisWorker();
 
+    /**
+     * @brief Name of the subdirectory of the video directory where clips waiting to be analysed are spilled.
+     */
+    static const std::string spillDirName;
+
+    /**
+     * @brief Writes the event frames to the spill directory and releases them from memory. They are
+     * reloaded (and the spilled copy deleted) when the clip is processed.
+     * @return
+     *  True if the frames were spilled successfully; false otherwise, in which case they remain in memory.
+     */
+    bool spill();
+
+    /**
+     * @brief Sets the path of a previously spilled clip, to be loaded when the clip is processed. Used to
+     * recover clips that were spilled but not processed before the application exited.
+     * @param path
+     *  Path to the spilled clip directory.
+     */
+    void setSpillPath(const std::string &path);
+
 public slots:
     // The command to start processing the images
     void process();
@@ -43,6 +65,12 @@ private:
      * @brief The images containing the event to be analysed.
      */
     std::vector<std::shared_ptr<Imageuc>> eventFrames;
+
+    /**
+     * @brief Path to the directory containing the event frames if they have been spilled to disk, or empty
+     * if they're in memory.
+     */
+    std::string spillPath;
 };
 
 #endif // ANALYSISWORKER_H
@@ -2,6 +2,8 @@
 #define METEORCAPTURESTATE_H
 
 #include "infra/referencestar.h"
+#include "infra/referencestarcatalogue.h"
+#include "infra/visiblestarcache.h"
 #include <linux/videodev2.h>
 #include <string>
 #include <vector>
@@ -47,6 +49,18 @@ public:
      */
     int headless = 0;
 
+    /**
+     * @brief Path to recorded frames to process instead of frames from a camera: either a clip or calibration
+     * directory, or a directory tree of them. Empty if using a camera.
+     */
+    string replayPath;
+
+    /**
+     * @brief Boolean flag to indicate if recorded frames are replayed as fast as possible, rather than at the
+     * rate they were captured.
+     */
+    int replayFast = 0;
+
     /**
      * @brief Chosen pixel format
      */
@@ -165,9 +179,14 @@ public:
     string refStarCataloguePath;
 
     /**
-     * @brief The loaded contents of the reference star catalogue.
+     * @brief The loaded reference star catalogue.
+     */
+    ReferenceStarCatalogue refStarCatalogue;
+
+    /**
+     * @brief Cache of the reference stars visible to the camera, shared by the calibrations.
      */
-    vector<ReferenceStar> refStarCatalogue;
+    VisibleStarCache refStarCache;
 
     /**
      * @brief Path to the JPL Earth ephemeris.
@@ -240,6 +259,18 @@ public:
      */
     double linearity_threshold;
 
+    /**
+     * @brief The number of threads used to analyse clips and process calibration frames. If zero, this is
+     * set automatically from the number of CPUs.
+     */
+    unsigned int processing_threads;
+
+    /**
+     * @brief The maximum number of clip analysis and calibration jobs held in memory waiting for a thread.
+     * When this is exceeded, waiting clips are spilled to disk and calibration jobs are discarded.
+     */
+    unsigned int processing_queue_length;
+
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                              //
     //                   Calibration parameters                     //
@@ -273,6 +304,14 @@ public:
      */
     double source_detection_threshold_sigmas;
 
+    /**
+     * @brief Floor for pixels to be assigned to sources during source detection, in terms of the number of
+     * standard deviations that the pixel lies above the background level [dimensionless]. Pixels below
+     * the floor are skipped, which speeds up the detection considerably. If negative, there is no floor and
+     * all pixels are processed.
+     */
+    double source_detection_floor_sigmas;
+
     /**
      * @brief Faint visual magnitude limit for reference stars used in the calibration [mags]
      */
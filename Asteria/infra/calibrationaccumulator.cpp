@@ -0,0 +1,126 @@
+#include "infra/calibrationaccumulator.h"
+#include "util/pixelkernelutil.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+
+CalibrationAccumulator::CalibrationAccumulator(const unsigned int &width, const unsigned int &height, const unsigned int &nFrames, const double &trim) :
+    width(width), height(height), nFramesTarget(nFrames), outliers(static_cast<unsigned int>(trim * nFrames)), nFrames(0u), nSkipped(0u),
+    firstEpochTimeUs(0ll), lastEpochTimeUs(0ll), sum(width * height, 0u), sumSq(width * height, 0u),
+    lowest(width * height * outliers, 255u), highest(width * height * outliers, 0u) {
+
+    // The blocks of lowest and highest values are initialised to the extremes of the pixel range, which are
+    // displaced by the first values added. Any that remain once there are as many values as the block length
+    // are equal to values that have been added, so the sums don't need to distinguish them.
+}
+
+void CalibrationAccumulator::addFrame(const Imageuc &frame) {
+
+    if(frame.width != width || frame.height != height) {
+        fprintf(stderr, "Skipping calibration frame: image size %dx%d differs from %dx%d\n", frame.width, frame.height, width, height);
+        return;
+    }
+
+    if(nFrames == 0u) {
+        firstEpochTimeUs = frame.epochTimeUs;
+        std::shared_ptr<Imageuc> sample = std::make_shared<Imageuc>(frame);
+        sample->overlay.reset();
+        sampleFrames.push_back(sample);
+    }
+    lastEpochTimeUs = frame.epochTimeUs;
+    nFrames++;
+
+    unsigned int nPixels = width * height;
+    const unsigned char * x = frame.rawImage.data();
+
+    PixelKernelUtil::accumulate(x, sum.data(), sumSq.data(), nPixels);
+
+    if(outliers == 0u) {
+        return;
+    }
+
+    // Update the lowest and highest values of each pixel. Most values lie within the current extremes and are
+    // rejected by a single comparison of each block.
+    for(unsigned int p = 0; p < nPixels; p++) {
+
+        unsigned char value = x[p];
+
+        // Lowest values, with the largest at the end of the block
+        unsigned char * low = &lowest[p * outliers];
+        if(value < low[outliers - 1]) {
+            unsigned int i = outliers - 1;
+            while(i > 0 && low[i - 1] > value) {
+                low[i] = low[i - 1];
+                i--;
+            }
+            low[i] = value;
+        }
+
+        // Highest values, with the smallest at the start of the block
+        unsigned char * high = &highest[p * outliers];
+        if(value > high[0]) {
+            unsigned int i = 0;
+            while(i < outliers - 1 && high[i + 1] < value) {
+                high[i] = high[i + 1];
+                i++;
+            }
+            high[i] = value;
+        }
+    }
+}
+
+void CalibrationAccumulator::skipFrame() {
+    nSkipped++;
+}
+
+bool CalibrationAccumulator::isComplete() const {
+    return nFrames >= nFramesTarget;
+}
+
+unsigned int CalibrationAccumulator::getFrameCount() const {
+    return nFrames;
+}
+
+unsigned int CalibrationAccumulator::getSkippedFrameCount() const {
+    return nSkipped;
+}
+
+long long CalibrationAccumulator::getMidEpochTimeUs() const {
+    return (firstEpochTimeUs + lastEpochTimeUs) >> 1;
+}
+
+std::vector<std::shared_ptr<Imageuc>> CalibrationAccumulator::getSampleFrames() const {
+    return sampleFrames;
+}
+
+void CalibrationAccumulator::getTrimmedMeanStd(std::vector<double> &mean, std::vector<double> &std) const {
+
+    unsigned int nPixels = width * height;
+    mean.resize(nPixels);
+    std.resize(nPixels);
+
+    // The excluded values are only distinct from each other once there are at least twice as many frames
+    unsigned int excluded = (nFrames > 2 * outliers) ? outliers : 0u;
+    double inliers = static_cast<double>(nFrames - 2 * excluded);
+
+    for(unsigned int p = 0; p < nPixels; p++) {
+
+        unsigned int trimmedSum = sum[p];
+        unsigned int trimmedSumSq = sumSq[p];
+
+        for(unsigned int i = 0; i < excluded; i++) {
+            unsigned int low = lowest[p * outliers + i];
+            unsigned int high = highest[p * outliers + i];
+            trimmedSum -= low + high;
+            trimmedSumSq -= low * low + high * high;
+        }
+
+        // Now compute the trimmed mean & sample standard deviation
+        double trimmed_mean = trimmedSum / inliers;
+        double trimmed_mean_of_square = trimmedSumSq / inliers;
+
+        mean[p] = trimmed_mean;
+        std[p] = std::sqrt(std::max(0.0, trimmed_mean_of_square - trimmed_mean * trimmed_mean));
+    }
+}
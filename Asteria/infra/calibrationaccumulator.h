@@ -0,0 +1,156 @@
+#ifndef CALIBRATIONACCUMULATOR_H
+#define CALIBRATIONACCUMULATOR_H
+
+#include "infra/imageuc.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+
+/**
+ * @brief Accumulates the per-pixel statistics of a stack of calibration frames as they arrive, so that
+ * the frames themselves don't need to be kept.
+ *
+ * The calibration uses the trimmed mean and standard deviation of each pixel over the stack, which excludes
+ * a fixed fraction of the lowest and highest values. These are computed exactly from the running sum and
+ * sum-of-squares of each pixel, less the contributions of the excluded values. Only the excluded values need
+ * to be tracked, which for 8-bit pixels and the usual 5% trim is a few bytes per pixel, so the memory used
+ * is fixed by the image size and the number of frames to exclude rather than the number of frames in the
+ * stack. Each frame is added in constant time per pixel, except for the rare values that displace one of
+ * the excluded values.
+ *
+ * Frames can be skipped (e.g. because they contain an event) without affecting the frames already added,
+ * so the accumulation can resume afterwards.
+ */
+class CalibrationAccumulator
+{
+
+public:
+
+    /**
+     * @brief Main constructor.
+     * @param width
+     *  Width of the frames [pixels]
+     * @param height
+     *  Height of the frames [pixels]
+     * @param nFrames
+     *  The number of frames in a complete calibration stack.
+     * @param trim
+     *  The fraction of the values of each pixel to exclude from each end of the range.
+     */
+    CalibrationAccumulator(const unsigned int &width, const unsigned int &height, const unsigned int &nFrames, const double &trim = 0.05);
+
+    /**
+     * @brief Width of the frames [pixels]
+     */
+    unsigned int width;
+
+    /**
+     * @brief Height of the frames [pixels]
+     */
+    unsigned int height;
+
+    /**
+     * @brief Adds a frame to the statistics. The first frame is copied and kept as a sample of the stack.
+     * @param frame
+     *  The frame to add.
+     */
+    void addFrame(const Imageuc &frame);
+
+    /**
+     * @brief Records that a frame was skipped, e.g. because it contained an event.
+     */
+    void skipFrame();
+
+    /**
+     * @brief Indicates whether the stack is complete.
+     * @return
+     *  True if the number of frames added has reached the size of the stack.
+     */
+    bool isComplete() const;
+
+    /**
+     * @brief Gets the number of frames added so far.
+     * @return
+     *  The number of frames added.
+     */
+    unsigned int getFrameCount() const;
+
+    /**
+     * @brief Gets the number of frames skipped so far.
+     * @return
+     *  The number of frames skipped.
+     */
+    unsigned int getSkippedFrameCount() const;
+
+    /**
+     * @brief Gets the average of the capture times of the first and last frames added.
+     * @return
+     *  The mid-point capture time [microseconds since 1970-01-01T00:00:00Z]
+     */
+    long long getMidEpochTimeUs() const;
+
+    /**
+     * @brief Gets the frames kept as a sample of the stack, which are saved with the calibration.
+     * @return
+     *  The sample frames, in ascending time order.
+     */
+    std::vector<std::shared_ptr<Imageuc>> getSampleFrames() const;
+
+    /**
+     * @brief Computes the trimmed mean and standard deviation of each pixel over the frames added. The
+     * number of values excluded from each end of the range is set by the size of the complete stack.
+     * @param mean
+     *  On exit, contains the trimmed mean of each pixel [ADU]
+     * @param std
+     *  On exit, contains the trimmed standard deviation of each pixel [ADU]
+     */
+    void getTrimmedMeanStd(std::vector<double> &mean, std::vector<double> &std) const;
+
+private:
+
+    /**
+     * @brief The number of frames in a complete stack.
+     */
+    unsigned int nFramesTarget;
+
+    /**
+     * @brief The number of values of each pixel excluded from each end of the range.
+     */
+    unsigned int outliers;
+
+    /**
+     * @brief The number of frames added so far.
+     */
+    unsigned int nFrames;
+
+    /**
+     * @brief The number of frames skipped so far.
+     */
+    unsigned int nSkipped;
+
+    /**
+     * @brief The capture times of the first and last frames added [microseconds since 1970-01-01T00:00:00Z]
+     */
+    long long firstEpochTimeUs;
+    long long lastEpochTimeUs;
+
+    /**
+     * @brief Per-pixel sums of the values and squared values of all the frames added.
+     */
+    std::vector<unsigned int> sum;
+    std::vector<unsigned int> sumSq;
+
+    /**
+     * @brief The lowest and highest values of each pixel, in blocks of length outliers per pixel. Each block
+     * is sorted into ascending order.
+     */
+    std::vector<unsigned char> lowest;
+    std::vector<unsigned char> highest;
+
+    /**
+     * @brief The frames kept as a sample of the stack.
+     */
+    std::vector<std::shared_ptr<Imageuc>> sampleFrames;
+};
+
+#endif // CALIBRATIONACCUMULATOR_H
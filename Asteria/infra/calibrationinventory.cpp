@@ -11,10 +11,10 @@
 #include <fstream>
 #include <functional>
 
-CalibrationInventory::CalibrationInventory() {
+CalibrationInventory::CalibrationInventory() : cam(0) {
 }
 
-CalibrationInventory::CalibrationInventory(const std::vector<std::shared_ptr<Imageuc> > &calibrationFrames) : calibrationFrames(calibrationFrames) {
+CalibrationInventory::CalibrationInventory(const std::vector<std::shared_ptr<Imageuc> > &calibrationFrames) : calibrationFrames(calibrationFrames), cam(0) {
 }
 
 CalibrationInventory::~CalibrationInventory() {
@@ -112,6 +112,8 @@ std::shared_ptr<CalibrationInventory> CalibrationInventory::loadFromDir(std::str
         ifs.close();
     }
 
+    inv->processedPath = processed;
+
     return inv;
 }
 
@@ -141,6 +143,7 @@ void CalibrationInventory::saveToDir(std::string topLevelPath) {
     FileUtil::createDir(path, "processed");
     std::string raw = path + "/raw";
     std::string processed = path + "/processed";
+    processedPath = processed;
 
     // Write out the raw calibration frames
     for(unsigned int i = 0; i < calibrationFrames.size(); ++i) {
@@ -276,6 +279,32 @@ void CalibrationInventory::saveToDir(std::string topLevelPath) {
     system(command);
 }
 
+std::shared_ptr<const PixelRayMap> CalibrationInventory::getPixelRayMap() {
+
+    std::lock_guard<std::mutex> lock(rayMapMutex);
+
+    if(!cam) {
+        return NULL;
+    }
+
+    if(rayMap && rayMap->matches(*cam, q_sez_cam)) {
+        return rayMap;
+    }
+
+    // Use the map cached on disk if it was built for the current calibration; otherwise build it
+    auto map = std::make_shared<PixelRayMap>();
+    std::string rayMapPath = processedPath.empty() ? "" : processedPath + "/raymap.bin";
+    if(rayMapPath.empty() || !map->load(rayMapPath, *cam, q_sez_cam)) {
+        map->build(*cam, q_sez_cam);
+        if(!rayMapPath.empty()) {
+            map->save(rayMapPath);
+        }
+    }
+
+    rayMap = map;
+    return rayMap;
+}
+
 void CalibrationInventory::deleteCalibration() {
     // TODO: use this to delete each file of a calibration specifically rather than
     // relying on deleting everything in the directory, which is unsafe.
@@ -5,9 +5,12 @@
 #include "infra/imaged.h"
 #include "infra/source.h"
 #include "infra/referencestar.h"
+#include "infra/pixelraymap.h"
 #include "optics/cameramodelbase.h"
 
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include <Eigen/Dense>
 #include <QObject>
@@ -97,6 +100,16 @@ public:
      */
     double altitude;
 
+    /**
+     * @brief Gets the map of the direction towards each point in the image for this calibration. The map is
+     * built on first use and cached in the processed/ directory of the calibration, if it has one, so that it's
+     * memory mapped rather than rebuilt when the calibration is next loaded. If the camera model or orientation
+     * has changed since the map was built then it's rebuilt. This can be called from any thread.
+     * @return
+     *  The ray map, or NULL if there is no camera model.
+     */
+    std::shared_ptr<const PixelRayMap> getPixelRayMap();
+
 public slots:
 
     static std::shared_ptr<CalibrationInventory> loadFromDir(std::string path);
@@ -105,6 +118,23 @@ public slots:
 
     void deleteCalibration();
 
+private:
+
+    /**
+     * @brief Path to the processed/ directory of the calibration, or empty if it hasn't been loaded or saved.
+     */
+    std::string processedPath;
+
+    /**
+     * @brief The cached ray map; see getPixelRayMap().
+     */
+    std::shared_ptr<const PixelRayMap> rayMap;
+
+    /**
+     * @brief Guards the ray map, which may be requested from several analysis threads at once.
+     */
+    std::mutex rayMapMutex;
+
 };
 
 #endif // CALIBRATIONINVENTORY_H
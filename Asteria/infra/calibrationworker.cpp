@@ -6,6 +6,9 @@
 #include "util/renderutil.h"
 #include "util/coordinateutil.h"
 #include "util/mathutil.h"
+#include "util/medianfilterutil.h"
+#include "util/crossmatchutil.h"
+#include "util/psffitutil.h"
 #include "infra/calibrationinventory.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "optics/pinholecamerawithsipdistortion.h"
@@ -19,6 +22,8 @@
 #include <sys/stat.h>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include <Eigen/Dense>
 
@@ -33,6 +38,12 @@ CalibrationWorker::CalibrationWorker(QObject *parent, AsteriaState * state, cons
 
 }
 
+CalibrationWorker::CalibrationWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> initial,
+                                     std::shared_ptr<CalibrationAccumulator> accumulator)
+    : QObject(parent), state(state), initial(initial), accumulator(accumulator) {
+
+}
+
 CalibrationWorker::~CalibrationWorker() {
 }
 
@@ -44,14 +55,26 @@ void CalibrationWorker::process() {
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    fprintf(stderr, "Got %lu frames for calibration\n", calibrationFrames.size());
+    if(!accumulator) {
+        // Accumulate the statistics of the frames we were given
+        accumulator = std::make_shared<CalibrationAccumulator>(calibrationFrames.front()->width, calibrationFrames.front()->height, calibrationFrames.size());
+        for(unsigned int f = 0; f < calibrationFrames.size(); f++) {
+            accumulator->addFrame(*calibrationFrames[f]);
+        }
+    }
+    else {
+        // Only the sample frames are kept with the calibration
+        calibrationFrames = accumulator->getSampleFrames();
+    }
+
+    fprintf(stderr, "Got %u frames for calibration (%u skipped)\n", accumulator->getFrameCount(), accumulator->getSkippedFrameCount());
 
     // The calibration data is assigned to fields of the CalibrationInventory for storage
     auto calInv = std::make_shared<CalibrationInventory>(calibrationFrames);
 
-    long long midTimeStamp = (calibrationFrames.front()->epochTimeUs + calibrationFrames.back()->epochTimeUs) >> 1;
-    unsigned int width = calibrationFrames.front()->width;
-    unsigned int height = calibrationFrames.front()->height;
+    long long midTimeStamp = accumulator->getMidEpochTimeUs();
+    unsigned int width = accumulator->width;
+    unsigned int height = accumulator->height;
 
     calInv->epochTimeUs = midTimeStamp;
 
@@ -68,60 +91,21 @@ void CalibrationWorker::process() {
     // by using the trimmed mean. The median is quantized and will not be as accurate as the mean given the limited
     // range of values.
 
-    std::vector<double> signal(width * height);
-    std::vector<double> noise(width * height);
-
-    // Loop over the pixels
-    for(unsigned int p=0; p<width * height; p++) {
-
-        // Extract the pixel value in each of the calibration frames
-        std::vector<double> pixels(calibrationFrames.size());
-        for(unsigned int f = 0; f < calibrationFrames.size(); f++) {
-            double pixel = static_cast<double>(calibrationFrames[f]->rawImage[p]);
-            pixels[f] = pixel;
-        }
-
-        // Now compute the trimmed mean & sample standard deviation
-        double trimmed_mean = 0.0;
-        double trimmed_std = 0.0;
-        MathUtil::getTrimmedMeanStd(pixels, trimmed_mean, trimmed_std, 0.05);
-
-        signal[p] = trimmed_mean;
-        noise[p] = trimmed_std;
-    }
+    std::vector<double> signal;
+    std::vector<double> noise;
+    accumulator->getTrimmedMeanStd(signal, noise);
 
     // Now post-process the signal value to get an estimate of the source-free background level in each pixel
-    std::vector<double> background(width * height);
+    std::vector<double> background;
 
     // Algorithm for background calculation: each pixel is the median value of the pixels surrounding it in
-    // a window of some particular width.
-    // Sliding window extends out to this many pixels on each side of the central pixel
-    int hw = (int)state->bkg_median_filter_half_width;
-    for(unsigned int k=0; k<height; k++) {
-        for(unsigned int l=0; l<width; l++) {
-
-            // Compute the boundary of the window region
-            unsigned int k_min = std::max((int)k - hw, 0);
-            unsigned int k_max = std::min((int)k + hw, (int)height);
-            unsigned int l_min = std::max((int)l - hw, 0);
-            unsigned int l_max = std::min((int)l + hw, (int)width);
-
-            // Pixels within the window
-            std::vector<double> pixels;
-            for(unsigned int kp=k_min; kp<k_max; kp++) {
-                for(unsigned int lp=l_min; lp<l_max; lp++) {
-                    unsigned int pixIdx = kp*width + lp;
-                    pixels.push_back(signal[pixIdx]);
-                }
-            }
-
-            // Get the median value in the window
-            double median = MathUtil::getMedian(pixels);
-
-            unsigned int pixIdx = k*width + l;
-            background[pixIdx] = median;
-        }
+    // a window of some particular width. The median filter operates on the signal image quantized to 8 bits,
+    // which allows it to run in constant time per pixel regardless of the window size.
+    std::vector<unsigned char> quantizedSignal(width * height);
+    for(unsigned int p=0; p<width * height; p++) {
+        quantizedSignal[p] = (unsigned char)std::min(255.0, std::max(0.0, std::round(signal[p])));
     }
+    MedianFilterUtil::medianFilter(quantizedSignal, width, height, state->bkg_median_filter_half_width, background);
 
     calInv->noise = make_shared<Imaged>(width, height);
     calInv->noise->epochTimeUs = midTimeStamp;
@@ -141,8 +125,11 @@ void CalibrationWorker::process() {
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
+    // A negative floor disables it, so that every pixel is processed
+    double floor = (state->source_detection_floor_sigmas < 0.0) ? -std::numeric_limits<double>::infinity() : state->source_detection_floor_sigmas;
+
     calInv->sources = SourceDetector::getSources(calInv->signal->rawImage, calInv->background->rawImage, calInv->noise->rawImage,
-                                                             width, height, state->source_detection_threshold_sigmas);
+                                                 width, height, state->source_detection_threshold_sigmas, floor);
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -166,22 +153,9 @@ void CalibrationWorker::process() {
     // Full transformation BCRF->CAM
     Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * r_bcrf_ecef;
 
+    // Retrieve the stars brighter than the faint mag limit that are visible in the image
     std::vector<ReferenceStar> visibleReferenceStars;
-
-    for(ReferenceStar &star : state->refStarCatalogue) {
-
-        // Reject stars fainter than faint mag limit
-        if(star.mag > state->ref_star_faint_mag_limit) {
-            continue;
-        }
-
-        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, *initial->cam);
-
-        if(star.visible) {
-            // Star is visible in image!
-            visibleReferenceStars.push_back(star);
-        }
-    }
+    state->refStarCache.getVisibleStars(state->refStarCatalogue, *initial->cam, r_bcrf_cam, state->ref_star_faint_mag_limit, visibleReferenceStars);
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -201,55 +175,58 @@ void CalibrationWorker::process() {
     // Minimum separation for acceptable cross match in sigmas
     double minSepThreshold = 20.0;
 
-    // Compute the covariance-weighted separations of all pairs of sources and reference stars
-    double covWeightedSep[calInv->sources.size()][visibleReferenceStars.size()];
-    for(unsigned int s1=0; s1<calInv->sources.size(); s1++) {
-
-        Source * source = &(calInv->sources[s1]);
-        Matrix2d s;
-        s << source->c_ii, source->c_ij, source->c_ij, source->c_jj;
+    std::vector<std::pair<unsigned int, unsigned int>> matches;
+    CrossMatchUtil::crossMatch(calInv->sources, visibleReferenceStars, minSepThreshold, matches);
 
-        for(unsigned int s2=0; s2<visibleReferenceStars.size(); s2++) {
+    for(std::pair<unsigned int, unsigned int> &match : matches) {
+        calInv->xms.push_back(pair<Source, ReferenceStar>(calInv->sources[match.first], visibleReferenceStars[match.second]));
+    }
 
-            ReferenceStar * testStar = &(visibleReferenceStars[s2]);
-            MatrixXd r(2,1);
-            r << source->i - testStar->i, source->j - testStar->j;
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //     Refine positions of cross-matched sources         //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-            covWeightedSep[s1][s2] = std::sqrt((r.transpose() * s.colPivHouseholderQr().solve(r))(0,0));
-        }
+    // Replace the flux-weighted centroids of the cross-matched sources with the positions from a PSF fit, which
+    // are unbiased for undersampled stars. The covariance of the fitted position is stored separately from the
+    // dispersion matrix, and is used to weight the source in the calibration fit. All the cross-matches in a fit
+    // must be weighted the same way, so if most of the PSF fits succeed then the cross-matches for which the fit
+    // failed are left out; otherwise none of the positions are refined.
+    std::vector<Source> xmSources;
+    for(pair<Source, ReferenceStar> &xm : calInv->xms) {
+        xmSources.push_back(xm.first);
     }
 
-    for(unsigned int s1=0; s1<calInv->sources.size(); s1++) {
-
-        // Locate the closest reference star to source s1
-        unsigned int closestStarIdx;
-        double minSep = 2.0 * minSepThreshold;
-        for(unsigned int s2=0; s2<visibleReferenceStars.size(); s2++) {
-            if(covWeightedSep[s1][s2] < minSep) {
-                minSep = covWeightedSep[s1][s2];
-                closestStarIdx = s2;
-            }
-        }
+    PsfFitUtil::StampBatch stamps;
+    std::vector<PsfFitUtil::PsfFit> fits;
+    PsfFitUtil::extractStamps(calInv->signal->rawImage, calInv->background->rawImage, calInv->noise->rawImage, width, height, xmSources, stamps);
+    PsfFitUtil::fitStamps(stamps, PsfFitUtil::GAUSSIAN, fits);
 
-        if(minSep > minSepThreshold) {
-            // The closest reference star is too far away to be a positive match
-            continue;
-        }
+    unsigned int nRefined = 0;
+    for(unsigned int k=0; k<fits.size(); k++) {
+        nRefined += fits[k].valid;
+    }
 
-        // Find the closest source to this reference star
-        minSep = 2.0 * minSepThreshold;
-        unsigned int closestSourceIdx;
-        for(unsigned int s2=0; s2<calInv->sources.size(); s2++) {
-            if(covWeightedSep[s2][closestStarIdx] < minSep) {
-                minSep = covWeightedSep[s2][closestStarIdx];
-                closestSourceIdx = s2;
+    if(2 * nRefined >= fits.size()) {
+        std::vector<pair<Source, ReferenceStar>> refinedXms;
+        for(unsigned int k=0; k<fits.size(); k++) {
+            if(fits[k].valid) {
+                Source &source = calInv->xms[k].first;
+                source.i = fits[k].i;
+                source.j = fits[k].j;
+                source.psf = true;
+                source.psf_c_ii = fits[k].c_ii;
+                source.psf_c_ij = fits[k].c_ij;
+                source.psf_c_jj = fits[k].c_jj;
+                refinedXms.push_back(calInv->xms[k]);
             }
         }
-
-        // If the closest source to this reference star is the original source, then we have a match
-        if(closestSourceIdx == s1) {
-            calInv->xms.push_back(pair<Source, ReferenceStar>(calInv->sources[closestSourceIdx], visibleReferenceStars[closestStarIdx]));
-        }
+        calInv->xms = refinedXms;
+        fprintf(stderr, "Refined positions of %d of %d cross-matched sources by PSF fitting; the remainder are excluded\n", nRefined, (unsigned int)fits.size());
+    }
+    else {
+        fprintf(stderr, "Only %d of %d PSF fits succeeded; using the centroids of all cross-matched sources\n", nRefined, (unsigned int)fits.size());
     }
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
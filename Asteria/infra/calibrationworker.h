@@ -4,6 +4,7 @@
 #include "infra/asteriastate.h"
 #include "infra/imageuc.h"
 #include "infra/calibrationinventory.h"
+#include "infra/calibrationaccumulator.h"
 
 #include <linux/videodev2.h>
 #include <vector>               // vector
@@ -30,6 +31,22 @@ public:
      */
     CalibrationWorker(QObject *parent = 0, AsteriaState * state = 0, const std::shared_ptr<CalibrationInventory> initial = 0,
                       std::vector<std::shared_ptr<Imageuc>> calibrationFrames = std::vector<std::shared_ptr<Imageuc>>());
+
+    /**
+     * @brief Constructor for the CalibrationWorker, for calibration frames whose statistics have already
+     * been accumulated as they were captured.
+     * @param parent
+     *  The parent widget, if it exists.
+     * @param state
+     *  Pointer to the AsteriaState object that contains various parameters of the calibration algorithms.
+     * @param initial
+     *  Pointer to the initial CalibrationInventory which will provide initial guess solution and be used to
+     * propagate certain calibrations in time.
+     * @param accumulator
+     *  The accumulated statistics of the calibration frames.
+     */
+    CalibrationWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> initial,
+                      std::shared_ptr<CalibrationAccumulator> accumulator);
     ~CalibrationWorker();
 
 public slots:
@@ -71,6 +88,12 @@ private:
      * @brief Vector of frames to be used to determine calibration.
      */
     std::vector<std::shared_ptr<Imageuc>> calibrationFrames;
+
+    /**
+     * @brief The accumulated statistics of the calibration frames. If the worker was given the frames
+     * themselves, this is created from them when processing starts.
+     */
+    std::shared_ptr<CalibrationAccumulator> accumulator;
 };
 
 #endif // CALIBRATIONWORKER_H
@@ -0,0 +1,67 @@
+#include "framedifference.h"
+
+FrameDifference::FrameDifference() : width(0u), height(0u), wordsPerRow(0u), positiveMask(0), negativeMask(0) {
+    reset(0u, 0u);
+}
+
+void FrameDifference::reset(const unsigned int &width, const unsigned int &height) {
+
+    if(width != this->width || height != this->height) {
+        this->width = width;
+        this->height = height;
+        wordsPerRow = (width + 63u) / 64u;
+        positiveMask.assign(wordsPerRow * height, 0ull);
+        negativeMask.assign(wordsPerRow * height, 0ull);
+    }
+
+    nChangedPixels = 0u;
+    nPositive = 0u;
+    nNegative = 0u;
+    bb_xmin = width;
+    bb_xmax = 0u;
+    bb_ymin = height;
+    bb_ymax = 0u;
+    sum_x = 0ull;
+    sum_y = 0ull;
+}
+
+bool FrameDifference::getCentroid(double &x, double &y) const {
+    if(nChangedPixels == 0u) {
+        return false;
+    }
+    x = (double)sum_x / (double)nChangedPixels;
+    y = (double)sum_y / (double)nChangedPixels;
+    return true;
+}
+
+void FrameDifference::getChangedPixels(std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative) const {
+
+    changedPixelsPositive.clear();
+    changedPixelsNegative.clear();
+    changedPixelsPositive.reserve(nPositive);
+    changedPixelsNegative.reserve(nNegative);
+
+    if(nChangedPixels == 0u) {
+        return;
+    }
+
+    // Only the rows within the bounding box can contain set bits
+    for(unsigned int y = bb_ymin; y <= bb_ymax; y++) {
+        for(unsigned int w = 0; w < wordsPerRow; w++) {
+
+            unsigned int offset = y * width + w * 64u;
+
+            // Extract the set bits by repeatedly clearing the lowest one
+            uint64_t pos = positiveMask[y * wordsPerRow + w];
+            while(pos) {
+                changedPixelsPositive.push_back(offset + __builtin_ctzll(pos));
+                pos &= pos - 1ull;
+            }
+            uint64_t neg = negativeMask[y * wordsPerRow + w];
+            while(neg) {
+                changedPixelsNegative.push_back(offset + __builtin_ctzll(neg));
+                neg &= neg - 1ull;
+            }
+        }
+    }
+}
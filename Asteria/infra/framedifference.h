@@ -0,0 +1,112 @@
+#ifndef FRAMEDIFFERENCE_H
+#define FRAMEDIFFERENCE_H
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Encapsulates the results of differencing two consecutive frames: the number of pixels whose
+ * brightness changed by more than the threshold, packed bitmaps recording which pixels changed (and in
+ * which sense), and the bounding box and first moments of the changed pixels.
+ *
+ * The bitmaps are stored one bit per pixel, with each image row padded to a whole number of 64-bit
+ * words; bit b of word w in row y corresponds to the pixel at (w*64 + b, y). Instances are intended
+ * to be reused from frame to frame so that the bitmaps don't need to be reallocated.
+ *
+ * Lists of the changed pixel indices are not computed by the differencing kernel; they're only built
+ * on request by consumers that need them, e.g. for rendering the overlay image.
+ */
+class FrameDifference
+{
+
+public:
+
+    FrameDifference();
+
+    /**
+     * @brief Width of the differenced images [pixels].
+     */
+    unsigned int width;
+
+    /**
+     * @brief Height of the differenced images [pixels].
+     */
+    unsigned int height;
+
+    /**
+     * @brief Number of 64-bit words used to store each row of the bitmaps.
+     */
+    unsigned int wordsPerRow;
+
+    /**
+     * @brief Packed bitmap of the pixels with a significant positive change.
+     */
+    std::vector<uint64_t> positiveMask;
+
+    /**
+     * @brief Packed bitmap of the pixels with a significant negative change.
+     */
+    std::vector<uint64_t> negativeMask;
+
+    /**
+     * @brief Total number of changed pixels.
+     */
+    unsigned int nChangedPixels;
+
+    /**
+     * @brief Number of pixels with a significant positive change.
+     */
+    unsigned int nPositive;
+
+    /**
+     * @brief Number of pixels with a significant negative change.
+     */
+    unsigned int nNegative;
+
+    /**
+     * @brief Edges of the bounding box that encloses all of the changed pixels (inclusive). These are
+     * only meaningful if nChangedPixels is greater than zero.
+     */
+    unsigned int bb_xmin;
+    unsigned int bb_xmax;
+    unsigned int bb_ymin;
+    unsigned int bb_ymax;
+
+    /**
+     * @brief Sums of the x and y coordinates of the changed pixels, i.e. the first moments.
+     */
+    unsigned long long sum_x;
+    unsigned long long sum_y;
+
+    /**
+     * @brief Resets the counts and moments, and resizes the bitmaps for images of the given size.
+     * The bitmap storage is only reallocated if the image size changes.
+     * @param width
+     *  Width of the images [pixels]
+     * @param height
+     *  Height of the images [pixels]
+     */
+    void reset(const unsigned int &width, const unsigned int &height);
+
+    /**
+     * @brief Computes the (unweighted) centroid of the changed pixels.
+     * @param x
+     *  On exit, contains the x coordinate of the centroid [pixels]
+     * @param y
+     *  On exit, contains the y coordinate of the centroid [pixels]
+     * @return
+     *  True if there are any changed pixels and the centroid is defined; false otherwise.
+     */
+    bool getCentroid(double &x, double &y) const;
+
+    /**
+     * @brief Expands the bitmaps into lists of the indices of the changed pixels.
+     * @param changedPixelsPositive
+     *  On exit, contains the indices of the pixels with a significant positive change
+     * @param changedPixelsNegative
+     *  On exit, contains the indices of the pixels with a significant negative change
+     */
+    void getChangedPixels(std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative) const;
+};
+
+#endif // FRAMEDIFFERENCE_H
@@ -0,0 +1,169 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include "infra/imageuc.h"
+#include "infra/imageucpool.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+
+/**
+ * @brief A frame handed from the capture thread to the detection thread, along with the capture
+ * statistics at the time it was captured.
+ */
+struct CapturedFrame {
+
+    /**
+     * @brief The greyscale image, or NULL if the frame is still JPEG-compressed.
+     */
+    std::shared_ptr<Imageuc> image;
+
+    /**
+     * @brief The compressed frame data, for MJPEG cameras. The vector is reused from frame to frame and
+     * may be larger than the frame data.
+     */
+    std::vector<unsigned char> compressed;
+
+    /**
+     * @brief The number of bytes of compressed frame data.
+     */
+    unsigned long compressedSize;
+
+    /**
+     * @brief The capture time of the frame [microseconds since 1970-01-01T00:00:00Z]
+     */
+    long long epochTimeUs;
+
+    /**
+     * @brief Indicates that the frame doesn't follow on from the previous one, e.g. it's the first frame of
+     * a replayed clip, so the two mustn't be differenced.
+     */
+    bool newSequence;
+
+    /**
+     * @brief The system up time at which the frame was handed to the detection thread [microseconds]
+     */
+    long long publishTimeUs;
+
+    /**
+     * @brief The number of frames captured since streaming was started, including this one.
+     */
+    unsigned long frameNumber;
+
+    /**
+     * @brief The frame rate averaged over recent frames.
+     */
+    double fps;
+
+    /**
+     * @brief The number of frames dropped by the camera or driver since streaming was started.
+     */
+    unsigned int droppedFrames;
+
+    /**
+     * @brief The number of frames dropped because the capture queue was full since streaming was started.
+     */
+    unsigned int pipelineDroppedFrames;
+};
+
+/**
+ * @brief Interface to the source of the frames processed by the AcquisitionThread: either a live camera
+ * (V4l2FrameSource) or frames recorded previously (ReplayFrameSource).
+ *
+ * The source is configured on construction, which sets the image size and nominal frame period in the
+ * AsteriaState. Once started, frames are read on the capture thread by calling waitForFrame() then
+ * readFrame() repeatedly.
+ */
+class FrameSource
+{
+
+public:
+
+    virtual ~FrameSource() {
+
+    }
+
+    /**
+     * @brief Gets the number of frames that the source buffers internally, which is used to size the
+     * capture queue.
+     * @return
+     *  The number of buffers.
+     */
+    virtual unsigned int getBufferCount() = 0;
+
+    /**
+     * @brief Gets the number of images from the frame pool that the source holds while streaming.
+     * @return
+     *  The number of images held.
+     */
+    virtual unsigned int getHeldImageCount() = 0;
+
+    /**
+     * @brief Indicates whether the frames are delivered JPEG-compressed, in which case they must be decoded
+     * by the detection thread.
+     * @return
+     *  True if the frames are compressed.
+     */
+    virtual bool isCompressed() = 0;
+
+    /**
+     * @brief Gets the V4L2 field order of the frames, i.e. whether they're interlaced.
+     * @return
+     *  The v4l2_field value.
+     */
+    virtual unsigned int getField() = 0;
+
+    /**
+     * @brief Indicates whether the frames arrive in real time, in which case they are dropped if the
+     * pipeline can't keep up. Frames from other sources are held until the pipeline has room for them.
+     * @return
+     *  True if the source is live.
+     */
+    virtual bool isLive() = 0;
+
+    /**
+     * @brief Indicates whether the source has delivered all of its frames. Sources that run indefinitely
+     * (e.g. cameras) never finish. This may be called from any thread.
+     * @return
+     *  True if there are no more frames.
+     */
+    virtual bool isFinished() {
+        return false;
+    }
+
+    /**
+     * @brief Starts delivering frames.
+     * @param framePool
+     *  Pool of images that the frames are written to.
+     */
+    virtual void start(ImageucPool * framePool) = 0;
+
+    /**
+     * @brief Stops delivering frames, and releases any images that the source holds.
+     */
+    virtual void stop() = 0;
+
+    /**
+     * @brief Waits for the next frame to be ready.
+     * @param timeoutMs
+     *  The maximum time to wait [milliseconds]
+     * @return
+     *  True if a frame is ready to be read; false if the wait timed out or there are no more frames.
+     */
+    virtual bool waitForFrame(int timeoutMs) = 0;
+
+    /**
+     * @brief Reads the frame that is ready, and releases the resources used to capture it.
+     * @param frame
+     *  The frame to write the image data into, or NULL to discard the frame (e.g. because the pipeline
+     * is full). The statistics fields are not set.
+     * @param epochTimeUs
+     *  On exit, contains the capture time of the frame [microseconds since 1970-01-01T00:00:00Z]
+     * @return
+     *  True if the frame follows on from the previous one; false if it's the first of a new sequence, in which
+     * case the interval since the previous frame isn't meaningful.
+     */
+    virtual bool readFrame(CapturedFrame * frame, long long &epochTimeUs) = 0;
+};
+
+#endif // FRAMESOURCE_H
@@ -1,9 +1,23 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include "util/pagealignedallocator.h"
+
 #include <vector>
 #include <memory>
 
+/**
+ * @brief Selects the container used for the samples of an Image. Images with 8-bit samples are those captured by
+ * cameras, which V4L2 drivers write directly into in user pointer mode, so their samples are page aligned.
+ */
+template<class T> struct ImageData {
+    typedef std::vector<T> type;
+};
+
+template<> struct ImageData<unsigned char> {
+    typedef std::vector<unsigned char, PageAlignedAllocator<unsigned char>> type;
+};
+
 /**
  * @brief The base template class for types representing images with samples of different data types. Primarily this
  * is useful for representing images captured from cameras, for which the samples are positive integers in the
@@ -31,7 +45,7 @@ public:
         // Nothing to do
     }
 
-    ~Image() {
+    virtual ~Image() {
         rawImage.clear();
     }
 
@@ -54,7 +68,7 @@ public:
     /**
      * @brief Raw image data in a 1D flattened vector.
      */
-    std::vector<T> rawImage;
+    typename ImageData<T>::type rawImage;
 
     /**
      * @brief Serialises the Image to a ostream.
@@ -2,42 +2,32 @@
 #include "util/ioutil.h"
 #include "util/v4l2util.h"
 #include "util/renderutil.h"
+#include "util/pixelkernelutil.h"
 
 #include <numeric>
+#include <algorithm>
 
 Imageuc::Imageuc() : Image<unsigned char>() {
 }
 
-Imageuc::Imageuc(const Imageuc& copyme) : Image<unsigned char>(copyme), field(copyme.field), annotatedImage(copyme.annotatedImage) {
+Imageuc::Imageuc(const Imageuc& copyme) : Image<unsigned char>(copyme), field(copyme.field),
+    overlay(copyme.overlay ? std::make_shared<Imageui>(*copyme.overlay) : std::shared_ptr<Imageui>()) {
 }
 
-Imageuc::Imageuc(unsigned int &width, unsigned int &height) : Image<unsigned char>(width, height), field(0u), annotatedImage(width * height) {
+Imageuc::Imageuc(unsigned int &width, unsigned int &height) : Image<unsigned char>(width, height), field(0u) {
 }
 
-Imageuc::Imageuc(unsigned int &width, unsigned int &height, unsigned char val) : Image<unsigned char>(width, height, val), field(0u), annotatedImage(width * height, val) {
+Imageuc::Imageuc(unsigned int &width, unsigned int &height, unsigned char val) : Image<unsigned char>(width, height, val), field(0u) {
 }
 
-Imageuc::Imageuc(const Imaged &convertme) : Image<unsigned char>(convertme.width, convertme.height), field(V4L2_FIELD_NONE), annotatedImage(0u) {
+Imageuc::Imageuc(const Imaged &convertme) : Image<unsigned char>(convertme.width, convertme.height), field(V4L2_FIELD_NONE) {
 
     epochTimeUs = convertme.epochTimeUs;
 
     // Convert the raw data: linearly map the floating-point pixel values to the [0:255] range
-    double min = convertme.rawImage[0];
-    double max = convertme.rawImage[0];
-
-    for(unsigned int p = 0; p < width * height; p++) {
-        min = std::min(min, convertme.rawImage[p]);
-        max = std::max(max, convertme.rawImage[p]);
-    }
-
-    for(unsigned int p = 0; p < width * height; p++) {
-        // Value translated and scaled to [0:255] range
-        double val_d = 255.0 * (convertme.rawImage[p] - min) / (max - min);
-        // Converted to unsigned char
-        unsigned char val_uc = static_cast<unsigned char>(val_d);
-
-        rawImage[p] = val_uc;
-    }
+    double min, max;
+    PixelKernelUtil::minMax(convertme.rawImage.data(), width * height, min, max);
+    PixelKernelUtil::rescale(convertme.rawImage.data(), rawImage.data(), width * height, min, max);
 }
 
 Imageuc::~Imageuc() {
@@ -177,15 +167,22 @@ void Imageuc::readFromStream(std::istream &input) {
     return;
 }
 
+void Imageuc::initialiseOverlay() {
+
+    if(!overlay || overlay->width != width || overlay->height != height) {
+        overlay = std::make_shared<Imageui>(width, height, 0x00000000);
+    }
+    else {
+        // Reset to full transparency
+        std::fill(overlay->rawImage.begin(), overlay->rawImage.end(), 0x00000000);
+    }
+}
+
 void Imageuc::generateAnnotatedImage(const MeteorImageLocationMeasurement &loc) {
 
-    annotatedImage.clear();
-    annotatedImage.reserve(width * height);
+    initialiseOverlay();
 
-    // Initialise to full transparency
-    for(unsigned int p = 0; p < width * height; p++) {
-        annotatedImage.push_back(0x00000000);
-    }
+    std::vector<unsigned int> &annotatedImage = overlay->rawImage;
 
     // Indicate changed pixels
     for(auto const& p: loc.changedPixelsPositive) {
@@ -212,13 +209,7 @@ void Imageuc::generateAnnotatedImage(const MeteorImageLocationMeasurement &loc)
 
 void Imageuc::generatePeakholdAnnotatedImage(std::vector<std::shared_ptr<Imageuc>> &eventFrames, const std::vector<MeteorImageLocationMeasurement> &locs) {
 
-    annotatedImage.clear();
-    annotatedImage.reserve(width * height);
-
-    // Initialise to full transparency
-    for(unsigned int p = 0; p < width * height; p++) {
-        annotatedImage.push_back(0x00000000);
-    }
+    initialiseOverlay();
 
     // Loop over the event images, which are in time sequence
     for(unsigned int i=1; i<eventFrames.size(); i++) {
@@ -229,7 +220,7 @@ void Imageuc::generatePeakholdAnnotatedImage(std::vector<std::shared_ptr<Imageuc
             int x1 = (int) std::round(locs[i].x_flux_centroid);
             int y1 = (int) std::round(locs[i].y_flux_centroid);
 
-            RenderUtil::drawLine(annotatedImage, width, height, x0, x1, y0, y1, 0xFF00FFFF);
+            RenderUtil::drawLine(overlay->rawImage, width, height, x0, x1, y0, y1, 0xFF00FFFF);
         }
     }
 }
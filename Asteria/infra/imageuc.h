@@ -4,8 +4,10 @@
 #include "infra/image.h"
 #include "infra/meteorimagelocationmeasurement.h"
 #include "infra/imaged.h"
+#include "infra/imageui.h"
 
 #include <iostream>
+#include <memory>
 #include <linux/videodev2.h>
 
 /**
@@ -35,14 +37,21 @@ public:
      */
     unsigned int field;
 
-    // Optional RGBA overlay image with annotations, for display.
-    // Not to be computed if it's not being displayed in real time.
-    std::vector<unsigned int> annotatedImage;
+    /**
+     * @brief Optional RGBA overlay image with annotations, for display. This is null unless the overlay
+     * has been generated, which should only be done when it's actually going to be displayed.
+     */
+    std::shared_ptr<Imageui> overlay;
 
     void writeToStream(std::ostream &output) const;
 
     void readFromStream(std::istream &input);
 
+    /**
+     * @brief Creates the overlay image if it doesn't already exist, and initialises it to full transparency.
+     */
+    void initialiseOverlay();
+
     /**
      * @brief Function used to create the annotated image showing the analysis results for the current frame.
      */
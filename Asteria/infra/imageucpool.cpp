@@ -0,0 +1,212 @@
+#include "imageucpool.h"
+
+#include <algorithm>
+#include <new>
+
+/**
+ * @brief Size of each control block slot [bytes]. This comfortably exceeds the size of the shared_ptr
+ * control block holding the PoolDeleter and SlotAllocator; any larger request falls back to the heap.
+ */
+static const std::size_t slotBytes = 128;
+
+ImageucPoolStats::ImageucPoolStats() : capacity(0u), allocated(0u), inUse(0u), peakInUse(0u), acquired(0ul), overflows(0ul), overflowInUse(0u) {
+
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//          Deleter & allocator for the shared_ptrs      //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+/**
+ * @brief Custom shared_ptr deleter that returns pooled images to the pool and frees overflow images.
+ */
+class PoolDeleter {
+
+public:
+    PoolDeleter(const std::shared_ptr<ImageucPool::Core> &core, bool pooled) : core(core), pooled(pooled) {
+
+    }
+
+    void operator()(Imageuc * image) {
+        if(pooled) {
+            core->release(image);
+        }
+        else {
+            delete image;
+            std::lock_guard<std::mutex> lock(core->mutex);
+            core->stats.overflowInUse--;
+        }
+    }
+
+    std::shared_ptr<ImageucPool::Core> core;
+    bool pooled;
+};
+
+/**
+ * @brief Allocator used for the shared_ptr control blocks, which takes them from the fixed set of slots
+ * managed by the pool.
+ */
+template <class T>
+class SlotAllocator {
+
+public:
+    typedef T value_type;
+
+    SlotAllocator(const std::shared_ptr<ImageucPool::Core> &core) : core(core) {
+
+    }
+
+    template <class U>
+    SlotAllocator(const SlotAllocator<U> &other) : core(other.core) {
+
+    }
+
+    T * allocate(std::size_t n) {
+        return static_cast<T *>(core->allocateSlot(n * sizeof(T)));
+    }
+
+    void deallocate(T * p, std::size_t) {
+        core->releaseSlot(p);
+    }
+
+    std::shared_ptr<ImageucPool::Core> core;
+};
+
+template <class T, class U>
+bool operator==(const SlotAllocator<T> &a, const SlotAllocator<U> &b) {
+    return a.core == b.core;
+}
+
+template <class T, class U>
+bool operator!=(const SlotAllocator<T> &a, const SlotAllocator<U> &b) {
+    return a.core != b.core;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                     ImageucPool                       //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+ImageucPool::ImageucPool(unsigned int width, unsigned int height, unsigned int capacity, unsigned int preallocate) :
+    core(std::make_shared<Core>(width, height, capacity)) {
+
+    // Allocate the initial set of images
+    std::lock_guard<std::mutex> lock(core->mutex);
+    for(unsigned int i = 0; i < std::min(preallocate, capacity); i++) {
+        Imageuc * image = new Imageuc(core->width, core->height);
+        core->images.push_back(image);
+        core->freeImages.push_back(image);
+    }
+    core->stats.allocated = core->images.size();
+}
+
+ImageucPool::~ImageucPool() {
+    // Nothing to do: the Core is deleted when the last outstanding image is released
+}
+
+std::shared_ptr<Imageuc> ImageucPool::acquire() {
+    bool pooled;
+    Imageuc * image = core->allocate(pooled);
+    return std::shared_ptr<Imageuc>(image, PoolDeleter(core, pooled), SlotAllocator<Imageuc>(core));
+}
+
+ImageucPoolStats ImageucPool::getStats() {
+    std::lock_guard<std::mutex> lock(core->mutex);
+    return core->stats;
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                   ImageucPool::Core                   //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+ImageucPool::Core::Core(unsigned int width, unsigned int height, unsigned int capacity) :
+    width(width), height(height), slotStorage(2 * capacity * slotBytes) {
+
+    stats.capacity = capacity;
+
+    images.reserve(capacity);
+    freeImages.reserve(capacity);
+    // Twice as many control block slots as images, so that overflow images don't use up the slots
+    // needed by the pooled images
+    freeSlots.reserve(2 * capacity);
+
+    for(unsigned int s = 0; s < 2 * capacity; s++) {
+        freeSlots.push_back(&slotStorage[s * slotBytes]);
+    }
+}
+
+ImageucPool::Core::~Core() {
+    for(unsigned int i = 0; i < images.size(); i++) {
+        delete images[i];
+    }
+}
+
+Imageuc * ImageucPool::Core::allocate(bool &pooled) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    stats.acquired++;
+
+    Imageuc * image = NULL;
+
+    if(!freeImages.empty()) {
+        // Recycle an image
+        image = freeImages.back();
+        freeImages.pop_back();
+        pooled = true;
+        stats.inUse++;
+    }
+    else if(images.size() < stats.capacity) {
+        // Pool hasn't reached capacity yet: grow it
+        image = new Imageuc(width, height);
+        images.push_back(image);
+        stats.allocated++;
+        pooled = true;
+        stats.inUse++;
+    }
+    else {
+        // Pool exhausted: allocate an image that is freed on release
+        image = new Imageuc(width, height);
+        pooled = false;
+        stats.overflows++;
+        stats.overflowInUse++;
+    }
+
+    stats.peakInUse = std::max(stats.peakInUse, stats.inUse + stats.overflowInUse);
+
+    return image;
+}
+
+void ImageucPool::Core::release(Imageuc * image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeImages.push_back(image);
+    stats.inUse--;
+}
+
+void * ImageucPool::Core::allocateSlot(std::size_t bytes) {
+    if(bytes <= slotBytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!freeSlots.empty()) {
+            void * slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+    }
+    return ::operator new(bytes);
+}
+
+void ImageucPool::Core::releaseSlot(void * slot) {
+    unsigned char * p = static_cast<unsigned char *>(slot);
+    if(!slotStorage.empty() && p >= &slotStorage.front() && p <= &slotStorage.back()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(slot);
+    }
+    else {
+        ::operator delete(slot);
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef IMAGEUCPOOL_H
+#define IMAGEUCPOOL_H
+
+#include "infra/imageuc.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+#include <mutex>
+#include <cstddef>
+
+/**
+ * @brief Snapshot of the occupancy statistics of an ImageucPool, used for sizing the pool.
+ */
+class ImageucPoolStats
+{
+
+public:
+    ImageucPoolStats();
+
+    /**
+     * @brief Maximum number of images retained by the pool.
+     */
+    unsigned int capacity;
+
+    /**
+     * @brief Number of pooled images allocated so far (never exceeds the capacity).
+     */
+    unsigned int allocated;
+
+    /**
+     * @brief Number of pooled images currently held by clients.
+     */
+    unsigned int inUse;
+
+    /**
+     * @brief Maximum number of images (pooled and overflow) held by clients at any one time.
+     */
+    unsigned int peakInUse;
+
+    /**
+     * @brief Total number of images handed out by the pool.
+     */
+    unsigned long acquired;
+
+    /**
+     * @brief Number of times the pool was exhausted, so that an overflow image had to be allocated
+     * from the heap and freed on release.
+     */
+    unsigned long overflows;
+
+    /**
+     * @brief Number of overflow images currently held by clients.
+     */
+    unsigned int overflowInUse;
+};
+
+/**
+ * @brief Fixed-capacity pool of pre-sized Imageuc objects, used to avoid allocating a new image for
+ * every frame in the capture loop.
+ *
+ * Images are handed out as shared_ptrs with a custom deleter that returns the image to the pool once
+ * all the clients (detection head buffer, event clip, calibration stack, GUI etc) have released it.
+ * The shared_ptr control blocks are also recycled from a fixed set of slots, so that once the pool has
+ * warmed up acquiring an image performs no heap allocations. If all the pooled images are in use then
+ * an overflow image is allocated from the heap and simply deleted when released; this is recorded in
+ * the statistics so that the capacity can be tuned.
+ *
+ * The internal state is reference counted by the outstanding images, so images may safely outlive the
+ * ImageucPool that created them. All functions are thread safe.
+ */
+class ImageucPool
+{
+
+public:
+
+    /**
+     * @brief Main constructor.
+     * @param width
+     *  Width of the images [pixels]
+     * @param height
+     *  Height of the images [pixels]
+     * @param capacity
+     *  Maximum number of images retained by the pool.
+     * @param preallocate
+     *  Number of images to allocate up front; the rest are allocated on demand, up to the capacity.
+     */
+    ImageucPool(unsigned int width, unsigned int height, unsigned int capacity, unsigned int preallocate);
+
+    ~ImageucPool();
+
+    /**
+     * @brief Gets an image from the pool. The pixel data and other fields are not cleared, and must be
+     * overwritten by the client.
+     * @return
+     *  shared_ptr to the image; the image returns to the pool when the last reference is released.
+     */
+    std::shared_ptr<Imageuc> acquire();
+
+    /**
+     * @brief Gets a snapshot of the current occupancy statistics.
+     * @return
+     *  The ImageucPoolStats.
+     */
+    ImageucPoolStats getStats();
+
+    /**
+     * @brief Internal state of the pool, shared with the deleters and allocators of the outstanding images.
+     */
+    class Core {
+
+    public:
+        Core(unsigned int width, unsigned int height, unsigned int capacity);
+        ~Core();
+
+        unsigned int width;
+        unsigned int height;
+
+        std::mutex mutex;
+
+        /**
+         * @brief All the pooled images, owned by the Core.
+         */
+        std::vector<Imageuc *> images;
+
+        /**
+         * @brief The pooled images that are currently available.
+         */
+        std::vector<Imageuc *> freeImages;
+
+        /**
+         * @brief Storage for the shared_ptr control blocks, in fixed-size slots.
+         */
+        std::vector<unsigned char> slotStorage;
+
+        /**
+         * @brief The control block slots that are currently available.
+         */
+        std::vector<void *> freeSlots;
+
+        ImageucPoolStats stats;
+
+        Imageuc * allocate(bool &pooled);
+        void release(Imageuc * image);
+        void * allocateSlot(std::size_t bytes);
+        void releaseSlot(void * slot);
+    };
+
+private:
+
+    /**
+     * @brief The internal state.
+     */
+    std::shared_ptr<Core> core;
+};
+
+#endif // IMAGEUCPOOL_H
@@ -0,0 +1,295 @@
+#include "infra/pixelraymap.h"
+#include "util/coordinateutil.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace Eigen;
+
+const char PixelRayMap::magicNumber[8] = {'A', 'S', 'T', 'R', 'A', 'Y', 'M', 'P'};
+
+const unsigned int PixelRayMap::currentVersion = 1u;
+
+const unsigned int PixelRayMap::defaultStep = 4u;
+
+const unsigned int PixelRayMap::maxParams;
+
+PixelRayMap::PixelRayMap() : data(0), mappedSize(0), header(0), nodesWidth(0), nodesHeight(0), r(0), az(0), el(0), r_cam_sez(Matrix3d::Identity()) {
+
+}
+
+PixelRayMap::~PixelRayMap() {
+    clear();
+}
+
+void PixelRayMap::clear() {
+    if(mappedSize > 0) {
+        if(munmap((void *)data, mappedSize) < 0) {
+            perror("munmap");
+        }
+    }
+    buffer.clear();
+    data = 0;
+    mappedSize = 0;
+    header = 0;
+    nodesWidth = 0;
+    nodesHeight = 0;
+    r = 0;
+    az = 0;
+    el = 0;
+}
+
+/**
+ * @brief Gets the number of nodes needed to cover an extent of the image.
+ * @param extent
+ *  The width or height of the image [pixels]
+ * @param step
+ *  The spacing of the nodes [pixels]
+ * @return
+ *  The number of nodes, the last of which lies on or beyond the edge of the image.
+ */
+static unsigned int getNodes(const unsigned int &extent, const unsigned int &step) {
+    return (extent + step - 1) / step + 1;
+}
+
+bool PixelRayMap::getHeader(const CameraModelBase &cam, const Quaterniond &q_sez_cam, const unsigned int &step, Header &header) {
+
+    unsigned int nParams = cam.getNumParameters();
+    if(nParams > maxParams) {
+        fprintf(stderr, "Camera model has too many parameters for the ray map: %d\n", nParams);
+        return false;
+    }
+    if(step == 0) {
+        fprintf(stderr, "Ray map node spacing must be positive\n");
+        return false;
+    }
+
+    // Zero everything, including the padding, so that headers can be compared bytewise
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, magicNumber, sizeof(header.magic));
+    header.version = currentVersion;
+    header.width = cam.width;
+    header.height = cam.height;
+    header.nParams = nParams;
+    header.step = step;
+    strncpy(header.model, cam.getModelName().c_str(), sizeof(header.model) - 1);
+    header.q[0] = q_sez_cam.w();
+    header.q[1] = q_sez_cam.x();
+    header.q[2] = q_sez_cam.y();
+    header.q[3] = q_sez_cam.z();
+    cam.getParameters(header.params);
+
+    return true;
+}
+
+size_t PixelRayMap::getSize(const Header &header) {
+    size_t nNodes = (size_t)getNodes(header.width, header.step) * getNodes(header.height, header.step);
+    return sizeof(Header) + 5 * nNodes * sizeof(float);
+}
+
+void PixelRayMap::setPointers() {
+
+    header = (const Header *)data;
+    nodesWidth = getNodes(header->width, header->step);
+    nodesHeight = getNodes(header->height, header->step);
+
+    size_t nNodes = (size_t)nodesWidth * nodesHeight;
+    r  = (const float *)(data + sizeof(Header));
+    az = r + 3 * nNodes;
+    el = r + 4 * nNodes;
+
+    Quaterniond q_sez_cam(header->q[0], header->q[1], header->q[2], header->q[3]);
+    r_cam_sez = q_sez_cam.toRotationMatrix().transpose();
+}
+
+bool PixelRayMap::build(const CameraModelBase &cam, const Quaterniond &q_sez_cam, const unsigned int &step) {
+
+    clear();
+
+    Header h;
+    if(!getHeader(cam, q_sez_cam, step, h)) {
+        return false;
+    }
+
+    unsigned int nodesWidth = getNodes(cam.width, step);
+    unsigned int nodesHeight = getNodes(cam.height, step);
+    size_t nNodes = (size_t)nodesWidth * nodesHeight;
+
+    buffer.resize(getSize(h));
+    memcpy(buffer.data(), &h, sizeof(Header));
+
+    float * pr  = (float *)(buffer.data() + sizeof(Header));
+    float * paz = pr + 3 * nNodes;
+    float * pel = pr + 4 * nNodes;
+
+    Matrix3d r_cam_sez = q_sez_cam.toRotationMatrix().transpose();
+
+    // Deproject one row of nodes at a time
+    std::vector<double> is(nodesWidth);
+    std::vector<double> js(nodesWidth);
+    std::vector<double> xs(nodesWidth);
+    std::vector<double> ys(nodesWidth);
+    std::vector<double> zs(nodesWidth);
+    for(unsigned int i = 0; i < nodesWidth; i++) {
+        is[i] = (double)i * step;
+    }
+
+    for(unsigned int j = 0; j < nodesHeight; j++) {
+
+        std::fill(js.begin(), js.end(), (double)j * step);
+        cam.deprojectPixels(is.data(), js.data(), nodesWidth, xs.data(), ys.data(), zs.data());
+
+        for(unsigned int i = 0; i < nodesWidth; i++) {
+
+            size_t n = (size_t)j * nodesWidth + i;
+            pr[3 * n + 0] = (float)xs[i];
+            pr[3 * n + 1] = (float)ys[i];
+            pr[3 * n + 2] = (float)zs[i];
+
+            // Transform to SEZ frame and convert to azimuth (east of north) and elevation
+            Vector3d r_sez = r_cam_sez * Vector3d(xs[i], ys[i], zs[i]);
+            double r, theta, phi;
+            CoordinateUtil::cartesianToSpherical(r_sez, r, theta, phi);
+            CoordinateUtil::eastOfSouthToEastOfNorth(theta);
+            paz[n] = (float)theta;
+            pel[n] = (float)phi;
+        }
+    }
+
+    data = buffer.data();
+    setPointers();
+
+    return true;
+}
+
+bool PixelRayMap::load(const std::string &path, const CameraModelBase &cam, const Quaterniond &q_sez_cam, const unsigned int &step) {
+
+    clear();
+
+    Header expected;
+    if(!getHeader(cam, q_sez_cam, step, expected)) {
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+
+    // Check the header before mapping the file, so that stale maps are rejected cheaply
+    struct stat st;
+    Header found;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size != getSize(expected) ||
+            read(fd, &found, sizeof(Header)) != sizeof(Header) || memcmp(&found, &expected, sizeof(Header)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    data = (const char *)mapping;
+    mappedSize = st.st_size;
+
+    setPointers();
+
+    return true;
+}
+
+bool PixelRayMap::save(const std::string &path) const {
+
+    if(!header) {
+        return false;
+    }
+
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if(!out.is_open()) {
+        fprintf(stderr, "Couldn't open %s for writing\n", path.c_str());
+        return false;
+    }
+    out.write(data, getSize(*header));
+    out.close();
+
+    return !out.fail();
+}
+
+bool PixelRayMap::matches(const CameraModelBase &cam, const Quaterniond &q_sez_cam) const {
+    Header expected;
+    return header && getHeader(cam, q_sez_cam, header->step, expected) && memcmp(header, &expected, sizeof(Header)) == 0;
+}
+
+unsigned int PixelRayMap::getStep() const {
+    return header ? header->step : 0;
+}
+
+bool PixelRayMap::getDirection(const double &i, const double &j, Vector3d &r_cam) const {
+
+    if(!header || !(i >= 0.0 && i <= header->width && j >= 0.0 && j <= header->height)) {
+        return false;
+    }
+
+    // Bottom left node of the cell containing the point; points on the far edges use the last cell
+    double u = i / header->step;
+    double v = j / header->step;
+    unsigned int i0 = std::min((unsigned int)u, nodesWidth - 2);
+    unsigned int j0 = std::min((unsigned int)v, nodesHeight - 2);
+    double fi = u - i0;
+    double fj = v - j0;
+
+    const float * r00 = r + 3 * ((size_t)j0 * nodesWidth + i0);
+    const float * r01 = r00 + 3 * nodesWidth;
+
+    double w00 = (1.0 - fi) * (1.0 - fj);
+    double w10 = fi * (1.0 - fj);
+    double w01 = (1.0 - fi) * fj;
+    double w11 = fi * fj;
+
+    for(unsigned int k = 0; k < 3; k++) {
+        r_cam[k] = w00 * r00[k] + w10 * r00[k + 3] + w01 * r01[k] + w11 * r01[k + 3];
+    }
+    r_cam.normalize();
+
+    return true;
+}
+
+bool PixelRayMap::getAzEl(const double &i, const double &j, double &az, double &el) const {
+
+    Vector3d r_cam;
+    if(!getDirection(i, j, r_cam)) {
+        return false;
+    }
+
+    Vector3d r_sez = r_cam_sez * r_cam;
+    double r;
+    CoordinateUtil::cartesianToSpherical(r_sez, r, az, el);
+    CoordinateUtil::eastOfSouthToEastOfNorth(az);
+
+    return true;
+}
+
+unsigned int PixelRayMap::getNodesWidth() const {
+    return nodesWidth;
+}
+
+unsigned int PixelRayMap::getNodesHeight() const {
+    return nodesHeight;
+}
+
+const float * PixelRayMap::getAzimuthMap() const {
+    return az;
+}
+
+const float * PixelRayMap::getElevationMap() const {
+    return el;
+}
@@ -0,0 +1,274 @@
+#ifndef PIXELRAYMAP_H
+#define PIXELRAYMAP_H
+
+#include "optics/cameramodelbase.h"
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The PixelRayMap class provides a precomputed map of the direction towards each point in the image
+ * for a camera calibration, so that converting image coordinates to directions or to azimuth and elevation
+ * is a table lookup rather than a deprojection through the camera model (which for the distortion models
+ * involves inverting the distortion).
+ *
+ * The map contains the camera frame unit vector and the azimuth and elevation at a grid of nodes at pixel
+ * coordinates that are multiples of the node spacing, covering the image so that every point in the image lies
+ * within a cell of four nodes. Directions at intermediate points are found by bilinear interpolation of the
+ * unit vectors. With a spacing of one pixel the nodes are at the corners of the pixels; however the full
+ * resolution map is large enough that lookups are limited by memory access, and the default spacing of a
+ * few pixels gives a map that fits in the cache while still being accurate to a small fraction of a pixel
+ * for any realistic distortion.
+ *
+ * The map is stored in a binary file alongside the calibration, which is memory mapped when loaded. The file
+ * consists of a Header, followed by the camera frame unit vector at each node as three 32-bit floats (x, y, z),
+ * then planes of the azimuth (east of north) [radians] and the elevation [radians] at each node as 32-bit
+ * floats, all in row-major order. The vector components are interleaved so that a lookup touches as few cache
+ * lines as possible. The header records the camera model and its orientation; a map that doesn't match
+ * the current calibration is stale and is rebuilt.
+ */
+class PixelRayMap
+{
+
+public:
+
+    PixelRayMap();
+
+    ~PixelRayMap();
+
+    /**
+     * @brief The maximum number of camera model parameters recorded in the header.
+     */
+    static const unsigned int maxParams = 32;
+
+    /**
+     * @brief Header of the binary ray map file.
+     */
+    struct Header {
+        /**
+         * @brief Identifies the file as a binary ray map; equal to magicNumber.
+         */
+        char magic[8];
+        /**
+         * @brief Version of the file format.
+         */
+        unsigned int version;
+        /**
+         * @brief Width of the detector [pixels]
+         */
+        unsigned int width;
+        /**
+         * @brief Height of the detector [pixels]
+         */
+        unsigned int height;
+        /**
+         * @brief Number of camera model parameters.
+         */
+        unsigned int nParams;
+        /**
+         * @brief Spacing of the nodes [pixels]
+         */
+        unsigned int step;
+        unsigned int reserved;
+        /**
+         * @brief Name of the camera model, as returned by CameraModelBase::getModelName().
+         */
+        char model[64];
+        /**
+         * @brief Elements of the quaternion q_sez_cam, in the order w, x, y, z.
+         */
+        double q[4];
+        /**
+         * @brief The camera model parameters.
+         */
+        double params[maxParams];
+    };
+
+    static const char magicNumber[8];
+
+    static const unsigned int currentVersion;
+
+    /**
+     * @brief The default spacing of the nodes [pixels]
+     */
+    static const unsigned int defaultStep;
+
+    /**
+     * @brief Builds the map for a camera calibration, in memory.
+     * @param cam
+     *  The camera model.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame.
+     * @param step
+     *  The spacing of the nodes [pixels]
+     * @return
+     *  True if the map was built; false if the camera model has too many parameters to be recorded.
+     */
+    bool build(const CameraModelBase &cam, const Eigen::Quaterniond &q_sez_cam, const unsigned int &step = defaultStep);
+
+    /**
+     * @brief Loads a map from file. The map is only loaded if it was built for the given camera calibration.
+     * @param path
+     *  The path to the ray map file.
+     * @param cam
+     *  The camera model.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame.
+     * @param step
+     *  The spacing of the nodes [pixels]
+     * @return
+     *  True if the map was loaded; false if the file doesn't exist, is corrupt, is stale or has a different
+     * node spacing, in which case the map is empty.
+     */
+    bool load(const std::string &path, const CameraModelBase &cam, const Eigen::Quaterniond &q_sez_cam, const unsigned int &step = defaultStep);
+
+    /**
+     * @brief Writes the map to file.
+     * @param path
+     *  The path to the ray map file to write.
+     * @return
+     *  True if the map was written; false otherwise.
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * @brief Checks whether the map was built for the given camera calibration.
+     * @param cam
+     *  The camera model.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame.
+     * @return
+     *  True if the map is not empty and the camera model and orientation are identical to the ones the map
+     * was built for.
+     */
+    bool matches(const CameraModelBase &cam, const Eigen::Quaterniond &q_sez_cam) const;
+
+    /**
+     * @brief Spacing of the nodes [pixels]
+     */
+    unsigned int getStep() const;
+
+    /**
+     * @brief Gets the camera frame unit vector towards a point in the image, by bilinear interpolation.
+     * @param i
+     *  i coordinate of the point in the image [pixels]
+     * @param j
+     *  j coordinate of the point in the image [pixels]
+     * @param r_cam
+     *  On exit, contains the camera frame unit vector towards the point.
+     * @return
+     *  True if the point lies within the image; false otherwise, in which case r_cam is not set.
+     */
+    bool getDirection(const double &i, const double &j, Eigen::Vector3d &r_cam) const;
+
+    /**
+     * @brief Gets the azimuth and elevation of a point in the image. The camera frame unit vector is interpolated
+     * and then converted, which avoids the discontinuity in the azimuth at north.
+     * @param i
+     *  i coordinate of the point in the image [pixels]
+     * @param j
+     *  j coordinate of the point in the image [pixels]
+     * @param az
+     *  On exit, contains the azimuth, east of north [radians]
+     * @param el
+     *  On exit, contains the elevation [radians]
+     * @return
+     *  True if the point lies within the image; false otherwise, in which case az and el are not set.
+     */
+    bool getAzEl(const double &i, const double &j, double &az, double &el) const;
+
+    /**
+     * @brief Width of the map, i.e. the number of nodes in each row.
+     */
+    unsigned int getNodesWidth() const;
+
+    /**
+     * @brief Height of the map, i.e. the number of rows of nodes.
+     */
+    unsigned int getNodesHeight() const;
+
+    /**
+     * @brief Get the azimuth (east of north) [radians] at each node of the map, in row-major order. Node (k,l)
+     * is at the pixel coordinates (k*step, l*step).
+     */
+    const float * getAzimuthMap() const;
+
+    /**
+     * @brief Get the elevation [radians] at each node of the map, in row-major order.
+     */
+    const float * getElevationMap() const;
+
+private:
+
+    // The map is backed by a memory mapping or a buffer, which must not be shared between copies
+    PixelRayMap(const PixelRayMap&);
+    PixelRayMap& operator=(const PixelRayMap&);
+
+    /**
+     * @brief Fills in the header fields that identify the camera calibration.
+     * @param cam
+     *  The camera model.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame.
+     * @param step
+     *  The spacing of the nodes [pixels]
+     * @param header
+     *  On exit, contains the identifying fields of the camera calibration.
+     * @return
+     *  True if the header was filled in; false if the camera model has too many parameters.
+     */
+    static bool getHeader(const CameraModelBase &cam, const Eigen::Quaterniond &q_sez_cam, const unsigned int &step, Header &header);
+
+    /**
+     * @brief Gets the size of the map in the binary format.
+     * @param header
+     *  The header of the map.
+     * @return
+     *  The size of the map [bytes]
+     */
+    static size_t getSize(const Header &header);
+
+    /**
+     * @brief Sets the pointers into the map data and the rotation to the SEZ frame from the header.
+     */
+    void setPointers();
+
+    /**
+     * @brief Releases the memory mapping or buffer holding the map.
+     */
+    void clear();
+
+    /**
+     * @brief The map in the binary format, either memory mapped or in the buffer.
+     */
+    const char * data;
+
+    /**
+     * @brief Size of the memory mapping, or zero if the map is held in the buffer [bytes]
+     */
+    size_t mappedSize;
+
+    /**
+     * @brief Holds the map when it wasn't loaded from a binary file.
+     */
+    std::vector<char> buffer;
+
+    /**
+     * @brief Pointers into the map data.
+     */
+    const Header * header;
+    unsigned int nodesWidth;
+    unsigned int nodesHeight;
+    const float * r;
+    const float * az;
+    const float * el;
+
+    /**
+     * @brief The rotation from the CAM frame to the SEZ frame.
+     */
+    Eigen::Matrix3d r_cam_sez;
+};
+
+#endif // PIXELRAYMAP_H
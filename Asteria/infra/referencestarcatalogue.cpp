@@ -0,0 +1,290 @@
+#include "infra/referencestarcatalogue.h"
+#include "util/coordinateutil.h"
+#include "util/mathutil.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace Eigen;
+
+const char ReferenceStarCatalogue::magicNumber[8] = {'A', 'S', 'T', 'S', 'T', 'A', 'R', 'S'};
+
+const unsigned int ReferenceStarCatalogue::currentVersion = 1u;
+
+const unsigned int ReferenceStarCatalogue::defaultBands = 32u;
+
+/**
+ * @brief Gets the band containing a declination.
+ * @param dec
+ *  The declination [radians]
+ * @param nBands
+ *  The number of bands.
+ * @return
+ *  The band index, counting from the south pole.
+ */
+static unsigned int getBand(const double &dec, const unsigned int &nBands) {
+    int b = (int)std::floor((std::sin(dec) + 1.0) * 0.5 * nBands);
+    return (unsigned int)std::min((int)nBands - 1, std::max(0, b));
+}
+
+/**
+ * @brief Gets the tile in right ascension containing a right ascension.
+ * @param ra
+ *  The right ascension [radians]
+ * @param nRaTiles
+ *  The number of tiles in right ascension.
+ * @return
+ *  The tile index, counting from zero right ascension.
+ */
+static unsigned int getRaTile(const double &ra, const unsigned int &nRaTiles) {
+    double wrapped = ra - 2.0 * M_PI * std::floor(ra / (2.0 * M_PI));
+    int k = (int)std::floor(wrapped * nRaTiles / (2.0 * M_PI));
+    return (unsigned int)std::min((int)nRaTiles - 1, std::max(0, k));
+}
+
+ReferenceStarCatalogue::ReferenceStarCatalogue() : data(0), mappedSize(0), header(0), tileOffsets(0), records(0) {
+
+}
+
+ReferenceStarCatalogue::~ReferenceStarCatalogue() {
+    clear();
+}
+
+void ReferenceStarCatalogue::clear() {
+    if(mappedSize > 0) {
+        if(munmap((void *)data, mappedSize) < 0) {
+            perror("munmap");
+        }
+    }
+    buffer.clear();
+    data = 0;
+    mappedSize = 0;
+    header = 0;
+    tileOffsets = 0;
+    records = 0;
+}
+
+bool ReferenceStarCatalogue::load(const std::string &path) {
+
+    clear();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Couldn't open reference star catalogue %s\n", path.c_str());
+        return false;
+    }
+
+    struct stat st;
+    char magic[8];
+    bool isBinary = (fstat(fd, &st) == 0) && ((size_t)st.st_size >= sizeof(Header)) &&
+            (read(fd, magic, sizeof(magic)) == sizeof(magic)) && (memcmp(magic, magicNumber, sizeof(magic)) == 0);
+
+    if(!isBinary) {
+        // Text catalogue: parse it and build the tiles in memory
+        close(fd);
+        std::string textPath = path;
+        std::vector<ReferenceStar> catalogue = ReferenceStar::loadCatalogue(textPath);
+        build(catalogue, defaultBands, buffer);
+        data = buffer.data();
+    }
+    else {
+        void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+        data = (const char *)mapping;
+        mappedSize = st.st_size;
+    }
+
+    header = (const Header *)data;
+
+    // Check the consistency of the header and the file size
+    size_t nTiles = (size_t)header->nBands * header->nRaTiles;
+    size_t expectedSize = sizeof(Header) + (nTiles + 1) * sizeof(unsigned long long) + header->nStars * sizeof(Record);
+    size_t actualSize = mappedSize > 0 ? mappedSize : buffer.size();
+    if(header->version != currentVersion || nTiles == 0 || expectedSize != actualSize) {
+        fprintf(stderr, "Reference star catalogue %s is corrupt or has an unsupported version\n", path.c_str());
+        clear();
+        return false;
+    }
+
+    tileOffsets = (const unsigned long long *)(data + sizeof(Header));
+    records = (const Record *)(data + sizeof(Header) + (nTiles + 1) * sizeof(unsigned long long));
+
+    return true;
+}
+
+bool ReferenceStarCatalogue::convert(const std::string &textPath, const std::string &binaryPath, const unsigned int &nBands) {
+
+    std::string path = textPath;
+    std::vector<ReferenceStar> catalogue = ReferenceStar::loadCatalogue(path);
+    if(catalogue.empty()) {
+        fprintf(stderr, "No reference stars loaded from %s\n", textPath.c_str());
+        return false;
+    }
+
+    std::vector<char> converted;
+    build(catalogue, nBands, converted);
+
+    std::ofstream out(binaryPath, std::ios::out | std::ios::binary);
+    if(!out.is_open()) {
+        fprintf(stderr, "Couldn't open %s for writing\n", binaryPath.c_str());
+        return false;
+    }
+    out.write(converted.data(), converted.size());
+    out.close();
+
+    fprintf(stderr, "Converted %lu reference stars to %s\n", catalogue.size(), binaryPath.c_str());
+
+    return !out.fail();
+}
+
+void ReferenceStarCatalogue::build(const std::vector<ReferenceStar> &catalogue, const unsigned int &nBands, std::vector<char> &buffer) {
+
+    // Tiles in right ascension are as wide at the equator as the equatorial band is high
+    unsigned int nRaTiles = std::max(1u, (unsigned int)std::round(M_PI * nBands));
+    unsigned int nTiles = nBands * nRaTiles;
+
+    // Sort the stars by tile and then magnitude
+    std::vector<unsigned int> tiles(catalogue.size());
+    std::vector<unsigned int> order(catalogue.size());
+    for(unsigned int s = 0; s < catalogue.size(); s++) {
+        tiles[s] = getBand(catalogue[s].dec, nBands) * nRaTiles + getRaTile(catalogue[s].ra, nRaTiles);
+        order[s] = s;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const unsigned int &a, const unsigned int &b) {
+        return (tiles[a] < tiles[b]) || (tiles[a] == tiles[b] && catalogue[a].mag < catalogue[b].mag);
+    });
+
+    buffer.assign(sizeof(Header) + (nTiles + 1) * sizeof(unsigned long long) + catalogue.size() * sizeof(Record), 0);
+
+    Header * header = (Header *)buffer.data();
+    memcpy(header->magic, magicNumber, sizeof(magicNumber));
+    header->version = currentVersion;
+    header->nBands = nBands;
+    header->nRaTiles = nRaTiles;
+    header->nStars = catalogue.size();
+
+    unsigned long long * tileOffsets = (unsigned long long *)(buffer.data() + sizeof(Header));
+    Record * records = (Record *)(buffer.data() + sizeof(Header) + (nTiles + 1) * sizeof(unsigned long long));
+
+    for(unsigned int s = 0; s < catalogue.size(); s++) {
+        const ReferenceStar &star = catalogue[order[s]];
+        records[s].ra = star.ra;
+        records[s].dec = star.dec;
+        records[s].mag = star.mag;
+        tileOffsets[tiles[order[s]] + 1]++;
+    }
+    for(unsigned int t = 0; t < nTiles; t++) {
+        tileOffsets[t + 1] += tileOffsets[t];
+    }
+}
+
+unsigned long long ReferenceStarCatalogue::size() const {
+    return header ? header->nStars : 0ull;
+}
+
+void ReferenceStarCatalogue::getStars(const Vector3d &axis, const double &radius, const double &faintMagLimit, std::vector<ReferenceStar> &stars) const {
+
+    stars.clear();
+
+    if(!header) {
+        return;
+    }
+
+    unsigned int nBands = header->nBands;
+    unsigned int nRaTiles = header->nRaTiles;
+
+    double r, ra0, dec0;
+    CoordinateUtil::cartesianToSpherical(axis, r, ra0, dec0);
+
+    // Range of bands intersecting the region
+    double decMin = dec0 - radius;
+    double decMax = dec0 + radius;
+    bool includesPole = (decMin <= -M_PI / 2.0) || (decMax >= M_PI / 2.0);
+    unsigned int bMin = getBand(std::max(decMin, -M_PI / 2.0), nBands);
+    unsigned int bMax = getBand(std::min(decMax, M_PI / 2.0), nBands);
+
+    // Range of right ascension intersecting the region. Unless it includes a pole, the region lies within
+    // the lune of half-width asin(sin(radius)/cos(dec0)) about the central right ascension.
+    int kMin = 0;
+    int kMax = nRaTiles - 1;
+    if(!includesPole && radius < M_PI / 2.0) {
+        double halfWidth = std::asin(std::min(1.0, std::sin(radius) / std::cos(dec0)));
+        kMin = (int)std::floor((ra0 - halfWidth) * nRaTiles / (2.0 * M_PI));
+        kMax = (int)std::floor((ra0 + halfWidth) * nRaTiles / (2.0 * M_PI));
+        if(kMax - kMin + 1 >= (int)nRaTiles) {
+            kMin = 0;
+            kMax = nRaTiles - 1;
+        }
+    }
+
+    double cosRadius = std::cos(radius);
+
+    for(unsigned int b = bMin; b <= bMax; b++) {
+        for(int k = kMin; k <= kMax; k++) {
+
+            // Wrap around in right ascension
+            unsigned int tile = b * nRaTiles + (unsigned int)((k % (int)nRaTiles + (int)nRaTiles) % (int)nRaTiles);
+
+            for(unsigned long long s = tileOffsets[tile]; s < tileOffsets[tile + 1]; s++) {
+
+                const Record &record = records[s];
+
+                // Stars are in order of increasing magnitude
+                if(record.mag > faintMagLimit) {
+                    break;
+                }
+
+                Vector3d r_bcrf;
+                CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, record.ra, record.dec);
+                if(r_bcrf.dot(axis) >= cosRadius) {
+                    stars.push_back(ReferenceStar(record.ra, record.dec, record.mag));
+                }
+            }
+        }
+    }
+}
+
+void ReferenceStarCatalogue::getStars(const CameraModelBase &cam, const Matrix3d &r_bcrf_cam, const double &faintMagLimit, std::vector<ReferenceStar> &stars) const {
+    Vector3d axis;
+    double radius;
+    getFootprint(cam, r_bcrf_cam, axis, radius);
+    getStars(axis, radius, faintMagLimit, stars);
+}
+
+void ReferenceStarCatalogue::getFootprint(const CameraModelBase &cam, const Matrix3d &r_bcrf_cam, Vector3d &axis, double &radius) {
+
+    // Direction of the centre of the image
+    Vector3d centre = cam.deprojectPixel(cam.width / 2.0, cam.height / 2.0).normalized();
+
+    // Largest angle from the centre to points around the image boundary
+    unsigned int nSteps = 8;
+    double maxAngle = 0.0;
+    for(unsigned int s = 0; s <= nSteps; s++) {
+        double i = (double)cam.width * s / nSteps;
+        double j = (double)cam.height * s / nSteps;
+        Vector3d boundary[4] = {cam.deprojectPixel(i, 0.0), cam.deprojectPixel(i, cam.height),
+                                cam.deprojectPixel(0.0, j), cam.deprojectPixel(cam.width, j)};
+        for(unsigned int p = 0; p < 4; p++) {
+            double cosAngle = std::max(-1.0, std::min(1.0, centre.dot(boundary[p].normalized())));
+            maxAngle = std::max(maxAngle, std::acos(cosAngle));
+        }
+    }
+
+    // Allow a margin for any bulging of the field edges between the boundary points
+    radius = std::min(M_PI, maxAngle * 1.05 + MathUtil::toRadians(0.5));
+
+    // Transform the centre to the BCRF frame
+    axis = r_bcrf_cam.transpose() * centre;
+}
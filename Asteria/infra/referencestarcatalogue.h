@@ -0,0 +1,207 @@
+#ifndef REFERENCESTARCATALOGUE_H
+#define REFERENCESTARCATALOGUE_H
+
+#include "infra/referencestar.h"
+#include "optics/cameramodelbase.h"
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The ReferenceStarCatalogue class provides access to the reference star catalogue, partitioned into
+ * tiles on the sky so that the stars in the field of view can be retrieved without visiting the whole catalogue.
+ *
+ * The sky is divided into bands of equal width in sin(dec), and each band is divided into the same number of
+ * segments of equal width in right ascension, so that all tiles have equal area. The stars in each tile are
+ * sorted into order of increasing magnitude so that a query can stop at the faint magnitude limit.
+ *
+ * The catalogue is stored in a binary file, which is memory mapped when loaded so that startup doesn't depend
+ * on the size of the catalogue. The file consists of a Header, followed by the index of the first star in each
+ * tile (nTiles+1 64-bit integers, the last being the total number of stars), followed by a Record for each star.
+ * Tiles are ordered by band (from south to north) and then by right ascension. The binary file is created
+ * from the text catalogue by convert(); a text catalogue can also be loaded directly, in which case the tiles
+ * are built in memory.
+ */
+class ReferenceStarCatalogue
+{
+
+public:
+
+    ReferenceStarCatalogue();
+
+    ~ReferenceStarCatalogue();
+
+    /**
+     * @brief Header of the binary catalogue file.
+     */
+    struct Header {
+        /**
+         * @brief Identifies the file as a binary reference star catalogue; equal to magicNumber.
+         */
+        char magic[8];
+        /**
+         * @brief Version of the file format.
+         */
+        unsigned int version;
+        /**
+         * @brief Number of bands in declination.
+         */
+        unsigned int nBands;
+        /**
+         * @brief Number of tiles in right ascension in each band.
+         */
+        unsigned int nRaTiles;
+        unsigned int reserved;
+        /**
+         * @brief Total number of stars.
+         */
+        unsigned long long nStars;
+    };
+
+    /**
+     * @brief A single star in the binary catalogue file.
+     */
+    struct Record {
+        /**
+         * @brief Right ascension [radians]
+         */
+        double ra;
+        /**
+         * @brief Declination [radians]
+         */
+        double dec;
+        /**
+         * @brief Apparent magnitude [mag]
+         */
+        double mag;
+    };
+
+    static const char magicNumber[8];
+
+    static const unsigned int currentVersion;
+
+    /**
+     * @brief The default number of bands in declination. The number of tiles in right ascension is chosen to
+     * make the tiles roughly square at the equator.
+     */
+    static const unsigned int defaultBands;
+
+    /**
+     * @brief Loads a reference star catalogue. Binary catalogues are memory mapped; text catalogues are read
+     * using ReferenceStar::loadCatalogue and partitioned into tiles in memory.
+     * @param path
+     *  The path to the reference star catalogue file.
+     * @return
+     *  True if the catalogue was loaded; false otherwise, in which case the catalogue is empty.
+     */
+    bool load(const std::string &path);
+
+    /**
+     * @brief Converts a text reference star catalogue to the binary format.
+     * @param textPath
+     *  The path to the text reference star catalogue file.
+     * @param binaryPath
+     *  The path to the binary reference star catalogue file to write.
+     * @param nBands
+     *  The number of bands in declination.
+     * @return
+     *  True if the catalogue was converted; false otherwise.
+     */
+    static bool convert(const std::string &textPath, const std::string &binaryPath, const unsigned int &nBands = defaultBands);
+
+    /**
+     * @brief Gets the total number of stars in the catalogue.
+     * @return
+     *  The number of stars.
+     */
+    unsigned long long size() const;
+
+    /**
+     * @brief Gets the stars within a circular region of the sky, down to a faint magnitude limit. Only the
+     * tiles that intersect the region are examined.
+     * @param axis
+     *  Unit vector towards the centre of the region, in the BCRF frame.
+     * @param radius
+     *  The angular radius of the region [radians]
+     * @param faintMagLimit
+     *  The faint magnitude limit [mag]
+     * @param stars
+     *  On exit, contains the stars within the region, in order of tile and then increasing magnitude.
+     */
+    void getStars(const Eigen::Vector3d &axis, const double &radius, const double &faintMagLimit, std::vector<ReferenceStar> &stars) const;
+
+    /**
+     * @brief Gets the stars that might be visible to a camera, down to a faint magnitude limit. The stars
+     * still need to be projected into the image to determine whether they're actually visible.
+     * @param cam
+     *  The camera model.
+     * @param r_bcrf_cam
+     *  The rotation from the BCRF frame to the camera frame.
+     * @param faintMagLimit
+     *  The faint magnitude limit [mag]
+     * @param stars
+     *  On exit, contains the stars within the camera footprint.
+     */
+    void getStars(const CameraModelBase &cam, const Eigen::Matrix3d &r_bcrf_cam, const double &faintMagLimit, std::vector<ReferenceStar> &stars) const;
+
+    /**
+     * @brief Computes a circular region of the sky that encloses the field of view of a camera.
+     * @param cam
+     *  The camera model.
+     * @param r_bcrf_cam
+     *  The rotation from the BCRF frame to the camera frame.
+     * @param axis
+     *  On exit, contains the unit vector towards the centre of the region, in the BCRF frame.
+     * @param radius
+     *  On exit, contains the angular radius of the region [radians]
+     */
+    static void getFootprint(const CameraModelBase &cam, const Eigen::Matrix3d &r_bcrf_cam, Eigen::Vector3d &axis, double &radius);
+
+private:
+
+    // The catalogue is backed by a memory mapping or a buffer, which must not be shared between copies
+    ReferenceStarCatalogue(const ReferenceStarCatalogue&);
+    ReferenceStarCatalogue& operator=(const ReferenceStarCatalogue&);
+
+    /**
+     * @brief Partitions the stars into tiles and lays out the catalogue in the binary format.
+     * @param catalogue
+     *  The stars.
+     * @param nBands
+     *  The number of bands in declination.
+     * @param buffer
+     *  On exit, contains the catalogue in the binary format.
+     */
+    static void build(const std::vector<ReferenceStar> &catalogue, const unsigned int &nBands, std::vector<char> &buffer);
+
+    /**
+     * @brief Releases the memory mapping or buffer holding the catalogue.
+     */
+    void clear();
+
+    /**
+     * @brief The catalogue in the binary format, either memory mapped or in the buffer.
+     */
+    const char * data;
+
+    /**
+     * @brief Size of the memory mapping, or zero if the catalogue is held in the buffer [bytes]
+     */
+    size_t mappedSize;
+
+    /**
+     * @brief Holds the catalogue when it wasn't loaded from a binary file.
+     */
+    std::vector<char> buffer;
+
+    /**
+     * @brief Pointers into the catalogue data.
+     */
+    const Header * header;
+    const unsigned long long * tileOffsets;
+    const Record * records;
+};
+
+#endif // REFERENCESTARCATALOGUE_H
@@ -0,0 +1,273 @@
+#include "infra/replayframesource.h"
+#include "util/fileutil.h"
+#include "util/timeutil.h"
+
+#include <linux/videodev2.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <algorithm>
+#include <map>
+
+/**
+ * @brief Lists the raw frames of a clip or calibration directory.
+ * @param path
+ *  Path to the clip or calibration directory.
+ * @return
+ *  The paths to the frames, in time order; empty if there's no raw subdirectory.
+ */
+static std::vector<std::string> listRawFrames(const std::string &path) {
+
+    std::vector<std::string> frames;
+    std::string raw = path + "/raw";
+
+    DIR *dir;
+    if ((dir = opendir (raw.c_str())) == NULL) {
+        return frames;
+    }
+
+    struct dirent *child;
+    while ((child = readdir (dir)) != NULL) {
+        // Match files with names starting with UTC string, e.g. 2017-06-14T19:41:09.282Z.pgm
+        if(std::regex_search(child->d_name, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
+            frames.push_back(raw + "/" + child->d_name);
+        }
+    }
+    closedir (dir);
+
+    // The UTC strings sort into time order
+    std::sort(frames.begin(), frames.end());
+
+    return frames;
+}
+
+ReplayFrameSource::ReplayFrameSource(AsteriaState * state, const std::string &path, bool paced) :
+    state(state), paced(paced), field(V4L2_FIELD_NONE), clipIdx(0), frameIdx(0), newSequence(true), framePool(NULL),
+    anchorEpochTimeUs(0ll), anchorUpTimeUs(0ll), lastUpTimeUs(0ll), finished(false) {
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //                Find the frames to replay              //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    std::vector<std::string> frames = listRawFrames(path);
+    if(!frames.empty()) {
+        // Single clip or calibration
+        clips.push_back(frames);
+    }
+    else {
+        // Directory tree of clips or calibrations, mapped by time
+        std::map<long long, std::string> map = FileUtil::mapVideoDirectory(path);
+        for(std::map<long long, std::string>::iterator it = map.begin(); it != map.end(); ++it) {
+            frames = listRawFrames(it->second);
+            if(!frames.empty()) {
+                clips.push_back(frames);
+            }
+        }
+    }
+
+    if(clips.empty()) {
+        fprintf(stderr, "No frames found to replay in %s\n", path.c_str());
+        exit(1);
+    }
+
+    fprintf(stderr, "Replaying %lu frames from %lu clips %s\n", getFrameCount(), clips.size(), paced ? "at the recorded frame rate" : "as fast as possible");
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //      Determine image size & period between frames     //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The image size is set by the recorded frames, overriding the configured size
+    Imageuc first;
+    std::ifstream input(clips[0][0]);
+    input >> first;
+    input.close();
+
+    if(first.width != state->width || first.height != state->height) {
+        fprintf(stderr, "Replayed frames are %dx%d; overriding configured image size %dx%d\n", first.width, first.height, state->width, state->height);
+    }
+    state->width = first.width;
+    state->height = first.height;
+    field = first.field;
+
+    // Estimate the frame period from the median interval between the first few frames of the first clip with
+    // more than one frame, which is robust to any dropped frames
+    std::vector<long long> intervals;
+    for(unsigned int c = 0; c < clips.size() && intervals.empty(); c++) {
+        long long last = 0ll;
+        for(unsigned int f = 0; f < clips[c].size() && f < 11; f++) {
+            Imageuc image;
+            std::ifstream in(clips[c][f]);
+            in >> image;
+            in.close();
+            if(f > 0) {
+                intervals.push_back(image.epochTimeUs - last);
+            }
+            last = image.epochTimeUs;
+        }
+    }
+
+    if(intervals.empty()) {
+        // Only single-frame clips; assume 25 frames per second
+        state->nominalFramePeriodUs = 40000;
+    }
+    else {
+        std::nth_element(intervals.begin(), intervals.begin() + intervals.size()/2, intervals.end());
+        state->nominalFramePeriodUs = intervals[intervals.size()/2];
+    }
+
+    // Assume shutter speed (exposure time) is the same as the frame period
+    state->nominalExposureTimeUs = state->nominalFramePeriodUs;
+
+    fprintf(stderr, "Time per frame = %d [microseconds]\n", state->nominalFramePeriodUs);
+}
+
+unsigned int ReplayFrameSource::getBufferCount() {
+    return 8;
+}
+
+unsigned int ReplayFrameSource::getHeldImageCount() {
+    // The next frame is held once it's been loaded
+    return 1;
+}
+
+bool ReplayFrameSource::isCompressed() {
+    return false;
+}
+
+unsigned int ReplayFrameSource::getField() {
+    return field;
+}
+
+bool ReplayFrameSource::isLive() {
+    return paced;
+}
+
+bool ReplayFrameSource::isFinished() {
+    return finished;
+}
+
+unsigned long ReplayFrameSource::getFrameCount() {
+    unsigned long n = 0;
+    for(unsigned int c = 0; c < clips.size(); c++) {
+        n += clips[c].size();
+    }
+    return n;
+}
+
+void ReplayFrameSource::start(ImageucPool * framePool) {
+    this->framePool = framePool;
+    // Replay continues from where it was stopped, but the frames aren't continuous across the gap. The pacing
+    // is re-anchored when the next frame is loaded.
+    newSequence = true;
+}
+
+void ReplayFrameSource::stop() {
+    // Release any frame already loaded, returning it to the pool, and step back so that it's loaded
+    // again when streaming restarts
+    if(nextFrame) {
+        nextFrame.reset();
+        if(frameIdx == 0) {
+            clipIdx--;
+            frameIdx = clips[clipIdx].size() - 1;
+        }
+        else {
+            frameIdx--;
+        }
+    }
+}
+
+void ReplayFrameSource::loadNextFrame() {
+
+    while(!nextFrame && clipIdx < clips.size()) {
+
+        std::shared_ptr<Imageuc> image = framePool->acquire();
+        std::ifstream input(clips[clipIdx][frameIdx]);
+        input >> *image;
+        input.close();
+
+        if(image->width != state->width || image->height != state->height) {
+            fprintf(stderr, "Skipping frame %s: image size %dx%d differs from %dx%d\n", clips[clipIdx][frameIdx].c_str(),
+                    image->width, image->height, state->width, state->height);
+        }
+        else {
+            nextFrame = image;
+            if(frameIdx == 0) {
+                newSequence = true;
+            }
+        }
+
+        // Advance to the following frame
+        if(++frameIdx == clips[clipIdx].size()) {
+            clipIdx++;
+            frameIdx = 0;
+        }
+
+        if(nextFrame && newSequence) {
+            // Re-anchor the pacing at the start of each sequence, leaving the usual interval since the last frame
+            anchorEpochTimeUs = nextFrame->epochTimeUs;
+            anchorUpTimeUs = std::max(TimeUtil::getUpTime(), lastUpTimeUs + state->nominalFramePeriodUs);
+        }
+    }
+
+    if(!nextFrame) {
+        finished = true;
+    }
+}
+
+bool ReplayFrameSource::waitForFrame(int timeoutMs) {
+
+    loadNextFrame();
+
+    if(!nextFrame) {
+        // Replay is complete
+        return false;
+    }
+
+    if(!paced) {
+        return true;
+    }
+
+    // Wait until the frame is due
+    long long waitUs = anchorUpTimeUs + (nextFrame->epochTimeUs - anchorEpochTimeUs) - TimeUtil::getUpTime();
+    if(waitUs > timeoutMs * 1000ll) {
+        usleep(timeoutMs * 1000);
+        return false;
+    }
+    if(waitUs > 0) {
+        usleep(waitUs);
+    }
+    return true;
+}
+
+bool ReplayFrameSource::readFrame(CapturedFrame * frame, long long &epochTimeUs) {
+
+    loadNextFrame();
+
+    if(!nextFrame) {
+        return false;
+    }
+
+    epochTimeUs = nextFrame->epochTimeUs;
+    bool continuous = !newSequence;
+
+    if(frame) {
+        frame->image = nextFrame;
+    }
+    nextFrame.reset();
+    newSequence = false;
+    lastUpTimeUs = TimeUtil::getUpTime();
+
+    if(clipIdx == clips.size()) {
+        finished = true;
+    }
+
+    return continuous;
+}
@@ -0,0 +1,141 @@
+#ifndef REPLAYFRAMESOURCE_H
+#define REPLAYFRAMESOURCE_H
+
+#include "infra/framesource.h"
+#include "infra/asteriastate.h"
+
+#include <vector>
+#include <string>
+#include <memory>               // shared_ptr
+#include <atomic>
+
+/**
+ * @brief FrameSource that replays frames recorded previously, for testing and benchmarking the processing
+ * without a camera.
+ *
+ * The frames are read from the raw/ subdirectory of a clip or calibration directory, i.e. the PGM files
+ * written by AnalysisInventory::saveToDir, and delivered with their original capture times. If the path is
+ * instead the top level of a video directory (e.g. the events directory) then all the clips it contains are
+ * replayed in time order.
+ *
+ * In paced mode the frames are delivered at the rate they were captured, like a live camera, and are
+ * dropped if the pipeline can't keep up. Otherwise they're delivered as fast as the pipeline can accept them,
+ * with none dropped.
+ */
+class ReplayFrameSource : public FrameSource
+{
+
+public:
+
+    /**
+     * @brief Main constructor. Finds the frames to replay, and sets the image size and nominal frame period
+     * in the state from the recorded frames.
+     * @param state
+     *  The main state object.
+     * @param path
+     *  Path to a clip or calibration directory, or to a directory tree of them.
+     * @param paced
+     *  If true, the frames are delivered at the rate they were captured; otherwise as fast as possible.
+     */
+    ReplayFrameSource(AsteriaState * state, const std::string &path, bool paced);
+
+    unsigned int getBufferCount();
+
+    unsigned int getHeldImageCount();
+
+    bool isCompressed();
+
+    unsigned int getField();
+
+    bool isLive();
+
+    bool isFinished();
+
+    void start(ImageucPool * framePool);
+
+    void stop();
+
+    bool waitForFrame(int timeoutMs);
+
+    bool readFrame(CapturedFrame * frame, long long &epochTimeUs);
+
+    /**
+     * @brief Gets the total number of frames to replay.
+     * @return
+     *  The number of frames.
+     */
+    unsigned long getFrameCount();
+
+private:
+
+    /**
+     * @brief Loads the next frame into an image from the pool, if it's not already loaded.
+     */
+    void loadNextFrame();
+
+    /**
+     * @brief The main state object.
+     */
+    AsteriaState * state;
+
+    /**
+     * @brief Indicates whether the frames are delivered at the rate they were captured.
+     */
+    bool paced;
+
+    /**
+     * @brief The paths to the frames of each clip, in time order.
+     */
+    std::vector<std::vector<std::string>> clips;
+
+    /**
+     * @brief The field order of the recorded frames.
+     */
+    unsigned int field;
+
+    /**
+     * @brief The index of the clip containing the next frame.
+     */
+    unsigned int clipIdx;
+
+    /**
+     * @brief The index of the next frame within the clip.
+     */
+    unsigned int frameIdx;
+
+    /**
+     * @brief The next frame, if it has been loaded.
+     */
+    std::shared_ptr<Imageuc> nextFrame;
+
+    /**
+     * @brief Indicates whether the next frame starts a new sequence, i.e. it's the first frame of a clip or
+     * the first frame after streaming was restarted.
+     */
+    bool newSequence;
+
+    /**
+     * @brief Pool of recycled images that the frames are loaded into; set while streaming.
+     */
+    ImageucPool * framePool;
+
+    /**
+     * @brief In paced mode, a capture time and the system up time at which the frame with that capture time
+     * is delivered [microseconds]. This is reset at the start of each clip, so that the gaps between clips
+     * aren't replayed.
+     */
+    long long anchorEpochTimeUs;
+    long long anchorUpTimeUs;
+
+    /**
+     * @brief In paced mode, the system up time at which the last frame was delivered [microseconds]
+     */
+    long long lastUpTimeUs;
+
+    /**
+     * @brief Set once all the frames have been read.
+     */
+    std::atomic<bool> finished;
+};
+
+#endif // REPLAYFRAMESOURCE_H
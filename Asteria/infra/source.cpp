@@ -1,11 +1,12 @@
 #include "source.h"
 
-Source::Source() {
+Source::Source() : psf(false), psf_c_ii(0.0), psf_c_ij(0.0), psf_c_jj(0.0) {
 
 }
 
 Source::Source(const Source& copyme) : pixels(copyme.pixels), adu(copyme.adu), sigma_adu(copyme.sigma_adu), i(copyme.i), j(copyme.j),
-c_ii(copyme.c_ii), c_ij(copyme.c_ij), c_jj(copyme.c_jj), l1(copyme.l1), l2(copyme.l2), orientation(copyme.orientation) {
+c_ii(copyme.c_ii), c_ij(copyme.c_ij), c_jj(copyme.c_jj), psf(copyme.psf), psf_c_ii(copyme.psf_c_ii), psf_c_ij(copyme.psf_c_ij),
+psf_c_jj(copyme.psf_c_jj), l1(copyme.l1), l2(copyme.l2), orientation(copyme.orientation) {
 
 }
 
@@ -19,6 +20,10 @@ Source& Source::operator=(const Source& copyme) {
     c_ii = copyme.c_ii;
     c_ij = copyme.c_ij;
     c_jj = copyme.c_jj;
+    psf = copyme.psf;
+    psf_c_ii = copyme.psf_c_ii;
+    psf_c_ij = copyme.psf_c_ij;
+    psf_c_jj = copyme.psf_c_jj;
     l1 = copyme.l1;
     l2 = copyme.l2;
     orientation = copyme.orientation;
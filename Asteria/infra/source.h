@@ -56,6 +56,18 @@ public:
      */
     double c_ii, c_ij, c_jj;
 
+    /**
+     * @brief Indicates whether the position (i, j) has been refined by fitting a PSF, in which case the covariance
+     * matrix of the fitted position is given by psf_c_ii, psf_c_ij and psf_c_jj.
+     */
+    bool psf;
+
+    /**
+     * @brief Covariance matrix of the position from the PSF fit [pixels^2]; only valid if psf is true. Note that this
+     * is the uncertainty on the position, unlike the dispersion matrix which measures the size of the source.
+     */
+    double psf_c_ii, psf_c_ij, psf_c_jj;
+
     /**
      * @brief Eigenvalues of the flux-weighted sample dispersion matrix [pixels^2]
      */
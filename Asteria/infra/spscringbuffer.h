@@ -0,0 +1,197 @@
+#ifndef SPSCRINGBUFFER_H
+#define SPSCRINGBUFFER_H
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <utility>              // move
+
+/**
+ * @brief Bounded single-producer/single-consumer queue, used to hand items from one thread to another
+ * without locks. Every operation completes in a fixed number of steps regardless of what the other thread
+ * is doing (wait-free), so the producer is never held up by a slow consumer: if the queue is full the
+ * producer is told so immediately, and the item is counted as an overflow.
+ *
+ * The slots are allocated once, up front, and reused. Items can be written and read in place using
+ * claim()/publish() and peek()/consume(), so that any storage they own (e.g. vectors) is recycled rather
+ * than reallocated; push() and pop() are provided for convenience.
+ *
+ * Exactly one thread may call the producer functions (claim, publish, push) and exactly one thread may
+ * call the consumer functions (peek, consume, pop).
+ */
+template<class T> class SpscRingBuffer
+{
+
+public:
+
+    /**
+     * @brief Main constructor.
+     * @param cap
+     *  The minimum capacity of the queue [items]; this is rounded up to the next power of two.
+     */
+    SpscRingBuffer(std::size_t cap) : mask(roundUpToPowerOfTwo(cap) - 1), slots(mask + 1), head(0), cachedTail(0), tail(0), cachedHead(0), nOverflows(0) {
+
+    }
+
+    /**
+     * @brief Producer: gets the next free slot for writing, without making it visible to the consumer.
+     * @return
+     *  Pointer to the slot, or NULL if the queue is full (which is counted as an overflow).
+     */
+    T * claim() {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if(t - cachedHead > mask) {
+            // Queue appears full; refresh our view of the consumer position
+            cachedHead = head.load(std::memory_order_acquire);
+            if(t - cachedHead > mask) {
+                nOverflows.fetch_add(1, std::memory_order_relaxed);
+                return NULL;
+            }
+        }
+        return &slots[t & mask];
+    }
+
+    /**
+     * @brief Producer: makes the slot obtained from the last successful call to claim() visible to the consumer.
+     */
+    void publish() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Producer: copies an item into the queue.
+     * @param item
+     *  The item to add.
+     * @return
+     *  True if the item was added; false if the queue was full (which is counted as an overflow).
+     */
+    bool push(const T &item) {
+        T * slot = claim();
+        if(!slot) {
+            return false;
+        }
+        *slot = item;
+        publish();
+        return true;
+    }
+
+    /**
+     * @brief Consumer: gets the oldest item in the queue, without removing it.
+     * @return
+     *  Pointer to the item, or NULL if the queue is empty.
+     */
+    T * peek() {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if(h == cachedTail) {
+            // Queue appears empty; refresh our view of the producer position
+            cachedTail = tail.load(std::memory_order_acquire);
+            if(h == cachedTail) {
+                return NULL;
+            }
+        }
+        return &slots[h & mask];
+    }
+
+    /**
+     * @brief Consumer: removes the item obtained from the last successful call to peek(), returning the slot
+     * to the producer. The slot contents are not cleared.
+     */
+    void consume() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Consumer: moves the oldest item out of the queue.
+     * @param item
+     *  On exit, contains the item.
+     * @return
+     *  True if an item was removed; false if the queue was empty.
+     */
+    bool pop(T &item) {
+        T * slot = peek();
+        if(!slot) {
+            return false;
+        }
+        item = std::move(*slot);
+        consume();
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of items in the queue. This is only a snapshot if called while the other
+     * thread is active.
+     * @return
+     *  The number of items in the queue.
+     */
+    std::size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Gets the maximum number of items the queue can hold.
+     * @return
+     *  The capacity of the queue.
+     */
+    std::size_t capacity() const {
+        return mask + 1;
+    }
+
+    /**
+     * @brief Gets the number of items that the producer was unable to add because the queue was full.
+     * @return
+     *  The number of overflows.
+     */
+    unsigned long getOverflows() const {
+        return nOverflows.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+        std::size_t p = 1;
+        while(p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // Capacity minus one, for wrapping the positions into the slots
+    const std::size_t mask;
+
+    // The items
+    std::vector<T> slots;
+
+    // Size of a cache line [bytes]
+    static const std::size_t cacheLine = 64;
+
+    // The consumer and producer positions are on separate cache lines, along with each side's cached copy
+    // of the other's position, so the two threads don't contend for the same cache line on every item. This
+    // is done with explicit padding rather than alignas, because under C++11 operator new doesn't honour
+    // extended alignment for objects allocated on the heap. There's a whole cache line of padding either side
+    // of each group, so they're on separate cache lines wherever the object starts.
+
+    char pad0[cacheLine];
+
+    // Number of items removed by the consumer so far
+    std::atomic<std::size_t> head;
+
+    // Consumer's copy of the producer position
+    std::size_t cachedTail;
+
+    char pad1[cacheLine];
+
+    // Number of items added by the producer so far
+    std::atomic<std::size_t> tail;
+
+    // Producer's copy of the consumer position
+    std::size_t cachedHead;
+
+    char pad2[cacheLine];
+
+    // Number of items rejected because the queue was full
+    std::atomic<unsigned long> nOverflows;
+
+    char pad3[cacheLine];
+};
+
+#endif // SPSCRINGBUFFER_H
@@ -0,0 +1,407 @@
+#include "infra/v4l2framesource.h"
+#include "util/jpgutil.h"
+#include "util/ioutil.h"
+#include "util/v4l2util.h"
+
+#include <sys/mman.h>           // mmap etc
+#include <poll.h>               // poll(...)
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>                // round(...)
+
+V4l2FrameSource::V4l2FrameSource(AsteriaState * state) : state(state), framePool(NULL), streaming(false) {
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //      Set the image size & format for the camera       //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    format = new v4l2_format();
+    memset(format, 0, sizeof(*format));
+    format->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format->fmt.pix.pixelformat = state->selectedFormat;
+    format->fmt.pix.width = state->width;
+    format->fmt.pix.height = state->height;
+
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_S_FMT, format) < 0) {
+        perror("VIDIOC_S_FMT");
+        ::close(*(this->state->fd));
+        exit(1);
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //      Determine interlaced/progressive scan mode       //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    switch(format->fmt.pix.field) {
+    case V4L2_FIELD_ANY:
+    case V4L2_FIELD_TOP:
+    case V4L2_FIELD_BOTTOM:
+    case V4L2_FIELD_SEQ_TB:
+    case V4L2_FIELD_SEQ_BT:
+    case V4L2_FIELD_ALTERNATE:
+        // Not supported!
+        fprintf(stderr, "Image field format %s not supported!\n", V4L2Util::getV4l2FieldNameFromIndex(format->fmt.pix.field).c_str());
+        ::close(*(this->state->fd));
+        exit(1);
+        break;
+    case V4L2_FIELD_NONE:
+    case V4L2_FIELD_INTERLACED:
+    case V4L2_FIELD_INTERLACED_TB:
+    case V4L2_FIELD_INTERLACED_BT:
+        // Supported!
+        fprintf(stderr, "Image field format %s is supported\n", V4L2Util::getV4l2FieldNameFromIndex(format->fmt.pix.field).c_str());
+        break;
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //        Determine nominal period between frames        //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // There are several uses for this:
+    //  - detection of dropped frames, from the time interval between consecutive frames
+    //  - setting the maximum number of frames in a clip from the maximum allowed time
+    //  - setting the number of frames between calibration runs
+
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_G_PARM, &parm) < 0) {
+        perror("VIDIOC_G_PARM");
+        ::close(*(this->state->fd));
+        exit(1);
+    }
+    // This struct holds the stream capture parameters
+    v4l2_captureparm cparm = parm.parm.capture;
+    unsigned int numerator = cparm.timeperframe.numerator;
+    unsigned int denominator = cparm.timeperframe.denominator;
+
+    double framePeriodSecs = (double)numerator / (double)denominator;
+    this->state->nominalFramePeriodUs = framePeriodSecs * 1000000;
+
+    // Assume shutter speed (exposure time) is the same as the frame period
+    this->state->nominalExposureTimeUs = this->state->nominalFramePeriodUs;
+
+    fprintf(stderr, "Time per frame = %d / %d  (%f) [seconds] (%d [microseconds]) \n", numerator, denominator, framePeriodSecs, this->state->nominalFramePeriodUs);
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    // Determine any relevant image parameters from V4L2 API //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // TODO: do I want to use any of these?
+    V4L2Util::printUserControls(*(this->state->fd));
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //     Inform device about buffers & streaming mode      //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Inform device about buffers to use
+    bufrequest = new v4l2_requestbuffers();
+
+    // Greyscale images that are packed without any row padding can be written by the driver directly
+    // into our own image buffers (user pointer mode), avoiding a copy of every frame. Otherwise, or if
+    // the driver doesn't support user pointers, fall back to memory mapping the driver's buffers.
+    memory = V4L2_MEMORY_MMAP;
+    if(format->fmt.pix.pixelformat == V4L2_PIX_FMT_GREY && format->fmt.pix.bytesperline == this->state->width &&
+            format->fmt.pix.sizeimage <= this->state->width * this->state->height) {
+
+        memset(bufrequest, 0, sizeof(*bufrequest));
+        bufrequest->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        bufrequest->memory = V4L2_MEMORY_USERPTR;
+        bufrequest->count = 32;
+
+        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_REQBUFS, bufrequest) < 0) {
+            fprintf(stderr, "Driver doesn't support user pointer streaming; using memory mapping\n");
+        }
+        else {
+            memory = V4L2_MEMORY_USERPTR;
+            fprintf(stderr, "Using user pointer streaming\n");
+        }
+    }
+
+    bufferinfo = new v4l2_buffer();
+    memset(bufferinfo, 0, sizeof(*bufferinfo));
+    buffer_start = NULL;
+
+    if(memory == V4L2_MEMORY_MMAP) {
+        mapBuffers();
+    }
+    else {
+        // Images currently queued with the driver
+        queuedFrames.resize(bufrequest->count);
+    }
+}
+
+void V4l2FrameSource::mapBuffers() {
+
+    memory = V4L2_MEMORY_MMAP;
+
+    memset(bufrequest, 0, sizeof(*bufrequest));
+    bufrequest->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bufrequest->memory = V4L2_MEMORY_MMAP;
+    bufrequest->count = 32;
+
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_REQBUFS, bufrequest) < 0){
+        perror("VIDIOC_REQBUFS");
+        ::close(*(this->state->fd));
+        exit(1);
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //  Determine memory requirements and allocate buffers   //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Here, the device informs us how much memory is required for the buffers
+    // given the image format, frame dimensions and number of buffers.
+
+    // Array of pointers to the start of each buffer in memory
+    buffer_start = new unsigned char*[bufrequest->count];
+
+    for(unsigned int b = 0; b < bufrequest->count; b++) {
+
+        memset(bufferinfo, 0, sizeof(*bufferinfo));
+        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        bufferinfo->memory = V4L2_MEMORY_MMAP;
+        bufferinfo->index = b;
+
+        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QUERYBUF, bufferinfo) < 0){
+            perror("VIDIOC_QUERYBUF");
+            exit(1);
+        }
+
+        // bufferinfo.length: number of bytes of memory required for the buffer
+        // bufferinfo.m.offset: offset from the start of the device memory for this buffer
+        buffer_start[b] = (unsigned char *)mmap(NULL, bufferinfo->length, PROT_READ | PROT_WRITE, MAP_SHARED, *(this->state->fd), bufferinfo->m.offset);
+
+        if(buffer_start[b] == MAP_FAILED){
+            perror("mmap");
+            exit(1);
+        }
+
+        memset(buffer_start[b], 0, bufferinfo->length);
+    }
+}
+
+V4l2FrameSource::~V4l2FrameSource() {
+
+    stop();
+
+    fprintf(stderr, "Deallocating image buffers...\n");
+    for(unsigned int b = 0; b < bufrequest->count && memory == V4L2_MEMORY_MMAP; b++) {
+        if(munmap(buffer_start[b], bufferinfo->length) < 0) {
+            perror("munmap");
+        }
+    }
+    delete[] buffer_start;
+
+    fprintf(stderr, "Deleting V4L2 structs...\n");
+    delete bufferinfo;
+    delete format;
+    delete bufrequest;
+
+    fprintf(stderr, "Closing the camera...\n");
+    ::close(*(this->state->fd));
+}
+
+unsigned int V4l2FrameSource::getBufferCount() {
+    return bufrequest->count;
+}
+
+unsigned int V4l2FrameSource::getHeldImageCount() {
+    // In user pointer mode, an image is queued with the driver for each buffer
+    return (memory == V4L2_MEMORY_USERPTR) ? bufrequest->count : 0;
+}
+
+bool V4l2FrameSource::isCompressed() {
+    return format->fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG;
+}
+
+unsigned int V4l2FrameSource::getField() {
+    return format->fmt.pix.field;
+}
+
+bool V4l2FrameSource::isLive() {
+    return true;
+}
+
+void V4l2FrameSource::start(ImageucPool * framePool) {
+    this->framePool = framePool;
+    fprintf(stderr, "Adding buffers to incoming queue...\n");
+
+    // Some drivers accept user pointer streaming but then reject the user pointer buffers themselves, e.g.
+    // because of their alignment or size; this shows up when the first one is queued, so fall back to
+    // memory mapping in that case.
+    unsigned long first = 0;
+    if(memory == V4L2_MEMORY_USERPTR) {
+        if(queueBuffer(0)) {
+            first = 1;
+        }
+        else {
+            perror("VIDIOC_QBUF");
+            fprintf(stderr, "Driver rejected a user pointer buffer; using memory mapping\n");
+
+            // Free the user pointer buffers before requesting buffers of a different type
+            queuedFrames.clear();
+            memset(bufrequest, 0, sizeof(*bufrequest));
+            bufrequest->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            bufrequest->memory = V4L2_MEMORY_USERPTR;
+            bufrequest->count = 0;
+            if(IoUtil::xioctl(*(this->state->fd), VIDIOC_REQBUFS, bufrequest) < 0) {
+                perror("VIDIOC_REQBUFS");
+            }
+            mapBuffers();
+        }
+    }
+
+    for(unsigned long k = first; k<bufrequest->count; k++) {
+        if(!queueBuffer(k)) {
+            perror("VIDIOC_QBUF");
+            exit(1);
+        }
+    }
+    fprintf(stderr, "Activating streaming...\n");
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(bufferinfo->type)) < 0){
+        perror("VIDIOC_STREAMON");
+        exit(1);
+    }
+    streaming = true;
+}
+
+void V4l2FrameSource::stop() {
+    if(!streaming) {
+        return;
+    }
+    fprintf(stderr, "Deactivating streaming...\n");
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
+        perror("VIDIOC_STREAMOFF");
+        exit(1);
+    }
+    // The driver has now released all the queued buffers
+    for(unsigned int k = 0; k < queuedFrames.size(); k++) {
+        queuedFrames[k].reset();
+    }
+    streaming = false;
+}
+
+bool V4l2FrameSource::waitForFrame(int timeoutMs) {
+
+    // Wait for a frame without blocking indefinitely in VIDIOC_DQBUF, so that the capture thread can be stopped
+    struct pollfd pfd;
+    pfd.fd = *(this->state->fd);
+    pfd.events = POLLIN;
+
+    int ready = poll(&pfd, 1, timeoutMs);
+    if(ready < 0 && errno != EINTR) {
+        perror("poll");
+        exit(1);
+    }
+    return ready > 0;
+}
+
+bool V4l2FrameSource::readFrame(CapturedFrame * frame, long long &epochTimeUs) {
+
+    bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bufferinfo->memory = memory;
+
+    // Retrieve the next filled buffer
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_DQBUF, bufferinfo) < 0) {
+        perror("VIDIOC_DQBUF");
+        exit(1);
+    }
+
+    // The image is ready to be read. In memory mapping mode it is stored in the buffer with index j,
+    // which is mapped into application address space at buffer_start[j]. In user pointer mode the
+    // driver has written it directly into the image that was queued at the returned index.
+    unsigned int j = bufferinfo->index;
+
+    // System clock time (since startup/hibernation) of time first byte of data was captured [microseconds]
+    long long temp_us = 1000000LL * bufferinfo->timestamp.tv_sec + (long long) round(bufferinfo->timestamp.tv_usec);
+    // Translate to microseconds since 1970-01-01T00:00:00Z
+    epochTimeUs = temp_us +  state->epochTimeDiffUs;
+
+    if(frame) {
+        frame->image.reset();
+
+        if(memory == V4L2_MEMORY_USERPTR) {
+            // Take ownership of the image that the driver has filled; no need to copy the pixels
+            frame->image = queuedFrames[j];
+        }
+        else {
+            switch(format->fmt.pix.pixelformat) {
+                case V4L2_PIX_FMT_GREY: {
+                    // Copy the raw greyscale pixels to an image recycled from the pool
+                    frame->image = framePool->acquire();
+                    memcpy(frame->image->rawImage.data(), buffer_start[j], state->width * state->height);
+                    break;
+                }
+                case V4L2_PIX_FMT_MJPEG: {
+                    // Copy out the compressed frame, which is decoded by the detection thread
+                    if(frame->compressed.size() < bufferinfo->bytesused) {
+                        frame->compressed.resize(bufferinfo->bytesused);
+                    }
+                    memcpy(frame->compressed.data(), buffer_start[j], bufferinfo->bytesused);
+                    frame->compressedSize = bufferinfo->bytesused;
+                    break;
+                }
+                case V4L2_PIX_FMT_YUYV: {
+                    // Extracting the luminance is no more expensive than copying the frame
+                    frame->image = framePool->acquire();
+                    JpgUtil::convertYuyv422((unsigned char *)buffer_start[j], bufferinfo->bytesused, frame->image->rawImage);
+                    break;
+                }
+            }
+        }
+        if(frame->image) {
+            frame->image->epochTimeUs = epochTimeUs;
+            frame->image->field = format->fmt.pix.field;
+        }
+    }
+
+    // Re-enqueue the buffer now we've extracted all the image data. In user pointer mode the driver
+    // is given a different image, and the current one isn't returned to it until the pipeline is done.
+    if(!queueBuffer(j)) {
+        perror("VIDIOC_QBUF");
+        exit(1);
+    }
+
+    return true;
+}
+
+bool V4l2FrameSource::queueBuffer(unsigned int index) {
+
+    bufferinfo->index = index;
+    bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bufferinfo->memory = memory;
+
+    if(memory == V4L2_MEMORY_USERPTR) {
+        // Give the driver a fresh image from the pool to write into. The image previously queued
+        // at this index (if any) is now owned by the pipeline and returns to the pool when released.
+        // The pixel data of captured images is page aligned (see ImageData), as some drivers require.
+        std::shared_ptr<Imageuc> image = framePool->acquire();
+        bufferinfo->m.userptr = (unsigned long)image->rawImage.data();
+        bufferinfo->length = image->rawImage.size();
+        queuedFrames[index] = image;
+    }
+
+    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
+        if(memory == V4L2_MEMORY_USERPTR) {
+            queuedFrames[index].reset();
+        }
+        return false;
+    }
+    return true;
+}
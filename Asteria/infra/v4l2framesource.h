@@ -0,0 +1,116 @@
+#ifndef V4L2FRAMESOURCE_H
+#define V4L2FRAMESOURCE_H
+
+#include "infra/framesource.h"
+#include "infra/asteriastate.h"
+
+#include <linux/videodev2.h>
+#include <vector>
+#include <memory>               // shared_ptr
+
+/**
+ * @brief FrameSource that streams frames from the V4L2 camera opened in the AsteriaState.
+ */
+class V4l2FrameSource : public FrameSource
+{
+
+public:
+
+    /**
+     * @brief Main constructor. Configures the camera for the image size and pixel format in the state,
+     * sets the nominal frame period in the state from the camera frame rate, and allocates the buffers.
+     * @param state
+     *  The main state object.
+     */
+    V4l2FrameSource(AsteriaState * state);
+
+    /**
+     * @brief Deallocates the buffers and closes the camera.
+     */
+    ~V4l2FrameSource();
+
+    unsigned int getBufferCount();
+
+    unsigned int getHeldImageCount();
+
+    bool isCompressed();
+
+    unsigned int getField();
+
+    bool isLive();
+
+    void start(ImageucPool * framePool);
+
+    void stop();
+
+    bool waitForFrame(int timeoutMs);
+
+    bool readFrame(CapturedFrame * frame, long long &epochTimeUs);
+
+private:
+
+    /**
+     * @brief The main state object.
+     */
+    AsteriaState * state;
+
+    /**
+     * \brief Information about the video buffer(s) in use.
+     * See https://www.linuxtv.org/downloads/legacy/video4linux/API/V4L2_API/spec/ch03s05.html
+     */
+    struct v4l2_buffer * bufferinfo;
+
+    /**
+     * \brief The pixel format in use.
+     */
+    struct v4l2_format * format;
+
+    /**
+     * \brief Information about requested & allocated buffers.
+     */
+    struct v4l2_requestbuffers * bufrequest;
+
+    /**
+     * \brief The streaming I/O method in use: V4L2_MEMORY_USERPTR if the driver writes frames directly
+     * into images from the frame pool, or V4L2_MEMORY_MMAP if frames are copied out of the driver's buffers.
+     */
+    unsigned int memory;
+
+    /**
+     * \brief Array of pointers to the start of each image buffer in memory (memory mapping mode only)
+     */
+    unsigned char ** buffer_start;
+
+    /**
+     * \brief The images currently queued with the driver at each buffer index (user pointer mode only)
+     */
+    std::vector<std::shared_ptr<Imageuc>> queuedFrames;
+
+    /**
+     * @brief Pool of recycled images that the frames are written to; set while streaming.
+     */
+    ImageucPool * framePool;
+
+    /**
+     * @brief Indicates whether the camera is streaming.
+     */
+    bool streaming;
+
+    /**
+     * @brief Requests memory mapping buffers from the driver and maps them into application address space,
+     * and switches to memory mapping mode.
+     */
+    void mapBuffers();
+
+    /**
+     * @brief Queues the buffer with the given index with the driver. In user pointer mode, a new image
+     * is taken from the frame pool for the driver to write the next frame into.
+     * @param index
+     *  The index of the buffer.
+     * @return
+     *  True if the buffer was queued; false if the driver rejected it.
+     */
+    bool queueBuffer(unsigned int index);
+};
+
+#endif // V4L2FRAMESOURCE_H
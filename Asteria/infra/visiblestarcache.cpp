@@ -0,0 +1,125 @@
+#include "infra/visiblestarcache.h"
+#include "util/coordinateutil.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace Eigen;
+
+const double VisibleStarCache::defaultMargin = 5.0 * M_PI / 180.0;
+
+VisibleStarCache::VisibleStarCache(const double &margin) : margin(margin), valid(false), cachedCatalogue(0), cachedCatalogueSize(0ull),
+    cachedAxis(Vector3d::UnitZ()), cachedRadius(0.0), cachedMagLimit(0.0), nRefreshes(0u) {
+
+}
+
+void VisibleStarCache::getVisibleStars(const ReferenceStarCatalogue &catalogue, const CameraModelBase &cam, const Matrix3d &r_bcrf_cam,
+                                       const double &faintMagLimit, std::vector<ReferenceStar> &visible) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    visible.clear();
+
+    Vector3d axis;
+    double radius;
+    ReferenceStarCatalogue::getFootprint(cam, r_bcrf_cam, axis, radius);
+
+    // The cached stars can be used if the cached region still encloses the footprint
+    double offset = std::acos(std::max(-1.0, std::min(1.0, axis.dot(cachedAxis))));
+    bool reuse = valid && (cachedCatalogue == &catalogue) && (cachedCatalogueSize == catalogue.size()) &&
+            (offset + radius <= cachedRadius) && (faintMagLimit <= cachedMagLimit);
+
+    if(!reuse) {
+
+        cachedAxis = axis;
+        cachedRadius = std::min(M_PI, radius + margin);
+        cachedMagLimit = faintMagLimit;
+        cachedCatalogue = &catalogue;
+        cachedCatalogueSize = catalogue.size();
+
+        std::vector<ReferenceStar> stars;
+        catalogue.getStars(cachedAxis, cachedRadius, cachedMagLimit, stars);
+
+        ra.resize(stars.size());
+        dec.resize(stars.size());
+        mag.resize(stars.size());
+        x.resize(stars.size());
+        y.resize(stars.size());
+        z.resize(stars.size());
+
+        for(unsigned int s = 0; s < stars.size(); s++) {
+            Vector3d r_bcrf;
+            CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, stars[s].ra, stars[s].dec);
+            ra[s] = stars[s].ra;
+            dec[s] = stars[s].dec;
+            mag[s] = stars[s].mag;
+            x[s] = r_bcrf[0];
+            y[s] = r_bcrf[1];
+            z[s] = r_bcrf[2];
+        }
+
+        valid = true;
+        nRefreshes++;
+    }
+
+    // Only stars within the footprint need to be projected into the image
+    double cosRadius = std::cos(radius);
+    double ax = axis[0];
+    double ay = axis[1];
+    double az = axis[2];
+
+    // Transform the candidates within the footprint to the CAM frame
+    candidates.clear();
+    camX.clear();
+    camY.clear();
+    camZ.clear();
+
+    for(unsigned int s = 0; s < x.size(); s++) {
+
+        if(mag[s] > faintMagLimit || ax * x[s] + ay * y[s] + az * z[s] < cosRadius) {
+            continue;
+        }
+
+        candidates.push_back(s);
+        camX.push_back(r_bcrf_cam(0,0) * x[s] + r_bcrf_cam(0,1) * y[s] + r_bcrf_cam(0,2) * z[s]);
+        camY.push_back(r_bcrf_cam(1,0) * x[s] + r_bcrf_cam(1,1) * y[s] + r_bcrf_cam(1,2) * z[s]);
+        camZ.push_back(r_bcrf_cam(2,0) * x[s] + r_bcrf_cam(2,1) * y[s] + r_bcrf_cam(2,2) * z[s]);
+    }
+
+    // Project them into the image in a single batch
+    unsigned int n = candidates.size();
+    camI.resize(n);
+    camJ.resize(n);
+    camVisible.resize(n);
+    cam.projectVectors(camX.data(), camY.data(), camZ.data(), n, camI.data(), camJ.data(), camVisible.data());
+
+    for(unsigned int c = 0; c < n; c++) {
+
+        if(!camVisible[c]) {
+            continue;
+        }
+
+        unsigned int s = candidates[c];
+        ReferenceStar star(ra[s], dec[s], mag[s]);
+        star.r = Vector3d(camX[c], camY[c], camZ[c]);
+        star.i = camI[c];
+        star.j = camJ[c];
+        star.visible = true;
+        visible.push_back(star);
+    }
+}
+
+void VisibleStarCache::invalidate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    valid = false;
+}
+
+unsigned int VisibleStarCache::getRefreshCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nRefreshes;
+}
+
+unsigned int VisibleStarCache::getCandidateCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return x.size();
+}
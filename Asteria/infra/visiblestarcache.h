@@ -0,0 +1,151 @@
+#ifndef VISIBLESTARCACHE_H
+#define VISIBLESTARCACHE_H
+
+#include "infra/referencestar.h"
+#include "infra/referencestarcatalogue.h"
+#include "optics/cameramodelbase.h"
+
+#include <vector>
+#include <mutex>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The VisibleStarCache class finds the reference stars visible to a camera, for repeated queries with
+ * a slowly changing orientation such as successive calibrations or interactive alignment of the camera.
+ *
+ * The cache holds the stars from the catalogue within a region around the camera footprint that is larger than
+ * the footprint by a margin, with the BCRF unit vector towards each star precomputed and stored in separate
+ * arrays for each component. Each query checks only these candidate stars: a dot product with the footprint
+ * axis rejects those outside the footprint, and the remainder are projected into the image together in a
+ * single call to CameraModelBase::projectVectors. The candidates are retrieved from the catalogue again only
+ * when the footprint moves beyond the margin (e.g. as the sidereal time advances or the orientation is changed)
+ * or a fainter magnitude limit is requested.
+ *
+ * Queries are serialised by an internal mutex so that the cache can be shared between threads.
+ */
+class VisibleStarCache
+{
+
+public:
+
+    /**
+     * @brief Main constructor.
+     * @param margin
+     *  The angle by which the cached region exceeds the camera footprint [radians]
+     */
+    VisibleStarCache(const double &margin = defaultMargin);
+
+    /**
+     * @brief The default margin [radians]; at the sidereal rate the footprint drifts this far in around 20 minutes.
+     */
+    static const double defaultMargin;
+
+    /**
+     * @brief Gets the reference stars visible to a camera, with their camera frame unit vectors and image
+     * coordinates set.
+     * @param catalogue
+     *  The reference star catalogue.
+     * @param cam
+     *  The camera model.
+     * @param r_bcrf_cam
+     *  The rotation from the BCRF frame to the camera frame.
+     * @param faintMagLimit
+     *  The faint magnitude limit [mag]
+     * @param visible
+     *  On exit, contains the visible stars.
+     */
+    void getVisibleStars(const ReferenceStarCatalogue &catalogue, const CameraModelBase &cam, const Eigen::Matrix3d &r_bcrf_cam,
+                         const double &faintMagLimit, std::vector<ReferenceStar> &visible);
+
+    /**
+     * @brief Discards the cached stars, so that they're retrieved from the catalogue on the next query.
+     */
+    void invalidate();
+
+    /**
+     * @brief Gets the number of times the cached stars have been retrieved from the catalogue.
+     * @return
+     *  The number of refreshes.
+     */
+    unsigned int getRefreshCount() const;
+
+    /**
+     * @brief Gets the number of stars currently cached.
+     * @return
+     *  The number of cached stars.
+     */
+    unsigned int getCandidateCount() const;
+
+private:
+
+    // Holds a mutex, so can't be copied
+    VisibleStarCache(const VisibleStarCache&);
+    VisibleStarCache& operator=(const VisibleStarCache&);
+
+    /**
+     * @brief The angle by which the cached region exceeds the camera footprint [radians]
+     */
+    double margin;
+
+    /**
+     * @brief Indicates whether the cached stars are valid.
+     */
+    bool valid;
+
+    /**
+     * @brief The catalogue from which the cached stars were retrieved, and its size at the time.
+     */
+    const ReferenceStarCatalogue * cachedCatalogue;
+    unsigned long long cachedCatalogueSize;
+
+    /**
+     * @brief Unit vector towards the centre of the cached region, in the BCRF frame.
+     */
+    Eigen::Vector3d cachedAxis;
+
+    /**
+     * @brief Angular radius of the cached region [radians]
+     */
+    double cachedRadius;
+
+    /**
+     * @brief Faint magnitude limit of the cached stars [mag]
+     */
+    double cachedMagLimit;
+
+    /**
+     * @brief Right ascension, declination and magnitude of each cached star.
+     */
+    std::vector<double> ra;
+    std::vector<double> dec;
+    std::vector<double> mag;
+
+    /**
+     * @brief Components of the BCRF unit vector towards each cached star.
+     */
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+
+    /**
+     * @brief Workspace for each query: the indices of the cached stars within the footprint, the components of
+     * their CAM frame unit vectors, and their projected image coordinates and visibility.
+     */
+    std::vector<unsigned int> candidates;
+    std::vector<double> camX;
+    std::vector<double> camY;
+    std::vector<double> camZ;
+    std::vector<double> camI;
+    std::vector<double> camJ;
+    std::vector<unsigned char> camVisible;
+
+    /**
+     * @brief The number of times the cached stars have been retrieved from the catalogue.
+     */
+    unsigned int nRefreshes;
+
+    mutable std::mutex mutex;
+};
+
+#endif // VISIBLESTARCACHE_H
@@ -0,0 +1,225 @@
+#include "workerpool.h"
+#include "util/timeutil.h"
+#include "util/threadutil.h"
+
+#include <algorithm>
+
+const std::string WorkerPool::priorityNames[] = {"CLIP_ANALYSIS", "CALIBRATION"};
+
+WorkerPoolStats::WorkerPoolStats() : nThreads(0u), maxQueueLength(0u), queueLength(0u), peakQueueLength(0u), running(0u), spilledQueueLength(0u) {
+    for(unsigned int p = 0; p < nPriorities; p++) {
+        submitted[p] = 0ul;
+        completed[p] = 0ul;
+        spilled[p] = 0ul;
+        discarded[p] = 0ul;
+        totalWaitUs[p] = 0ll;
+        maxWaitUs[p] = 0ll;
+        totalRunUs[p] = 0ll;
+        maxRunUs[p] = 0ll;
+    }
+}
+
+WorkerPool::WorkerPool(unsigned int nThreads, unsigned int maxQueueLength, const std::vector<unsigned int> &cpus) :
+    queues(WorkerPoolStats::nPriorities), stopWorkers(false), stopSpiller(false) {
+
+    stats.nThreads = nThreads;
+    stats.maxQueueLength = maxQueueLength;
+
+    for(unsigned int t = 0; t < nThreads; t++) {
+        workers.push_back(std::thread(&WorkerPool::work, this));
+        ThreadUtil::setAffinity(workers.back(), cpus);
+    }
+    spiller = std::thread(&WorkerPool::spill, this);
+    ThreadUtil::setAffinity(spiller, cpus);
+}
+
+WorkerPool::~WorkerPool() {
+
+    // Let the workers finish their current jobs
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopWorkers = true;
+    }
+    jobAvailable.notify_all();
+    for(unsigned int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    // Spill (or discard) any jobs still waiting, so that they can be run next time
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(unsigned int p = 0; p < queues.size(); p++) {
+            while(!queues[p].empty()) {
+                evict(queues[p].front());
+                queues[p].pop_front();
+                stats.queueLength--;
+            }
+        }
+        stopSpiller = true;
+    }
+    spillAvailable.notify_all();
+    spiller.join();
+}
+
+void WorkerPool::submit(Priority priority, std::function<void()> run, std::function<bool()> spill) {
+
+    Job job;
+    job.priority = priority;
+    job.submitTimeUs = TimeUtil::getUpTime();
+    job.run = run;
+    job.spill = spill;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    stats.submitted[priority]++;
+
+    if(stats.queueLength >= stats.maxQueueLength) {
+        // Queue is full: evict the most recently submitted job of the lowest priority waiting, if that's lower
+        // than the new job, or else the new job itself
+        unsigned int lowest = queues.size() - 1;
+        while(lowest > (unsigned int)priority && queues[lowest].empty()) {
+            lowest--;
+        }
+        if(lowest == (unsigned int)priority) {
+            evict(job);
+            return;
+        }
+        evict(queues[lowest].back());
+        queues[lowest].pop_back();
+        stats.queueLength--;
+    }
+
+    queues[priority].push_back(job);
+    stats.queueLength++;
+    stats.peakQueueLength = std::max(stats.peakQueueLength, stats.queueLength);
+    jobAvailable.notify_one();
+}
+
+void WorkerPool::submitSpilled(Priority priority, std::function<void()> run) {
+
+    Job job;
+    job.priority = priority;
+    job.submitTimeUs = TimeUtil::getUpTime();
+    job.run = run;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.submitted[priority]++;
+    stats.spilledQueueLength++;
+    spilled.push_back(job);
+    jobAvailable.notify_one();
+}
+
+WorkerPoolStats WorkerPool::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void WorkerPool::waitUntilIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobFinished.wait(lock, [this]() { return stats.queueLength == 0 && stats.running == 0 && stats.spilledQueueLength == 0; });
+}
+
+void WorkerPool::evict(Job &job) {
+    if(job.spill) {
+        fprintf(stderr, "Evicted %s job from worker pool queue: spilling to disk\n", priorityNames[job.priority].c_str());
+        toSpill.push_back(job);
+        stats.spilledQueueLength++;
+        spillAvailable.notify_one();
+    }
+    else {
+        fprintf(stderr, "Evicted %s job from worker pool queue: discarding\n", priorityNames[job.priority].c_str());
+        stats.discarded[job.priority]++;
+    }
+}
+
+void WorkerPool::work() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true) {
+
+        jobAvailable.wait(lock, [this]() { return stopWorkers || stats.queueLength > 0 || !spilled.empty(); });
+
+        if(stopWorkers) {
+            return;
+        }
+
+        // Take the oldest job of the highest priority waiting in memory; spilled jobs are only run once
+        // the queue has emptied
+        Job job;
+        unsigned int p = 0;
+        while(p < queues.size() && queues[p].empty()) {
+            p++;
+        }
+        if(p < queues.size()) {
+            job = queues[p].front();
+            queues[p].pop_front();
+            stats.queueLength--;
+        }
+        else {
+            job = spilled.front();
+            spilled.pop_front();
+            stats.spilledQueueLength--;
+        }
+
+        long long startTimeUs = TimeUtil::getUpTime();
+        long long waitUs = startTimeUs - job.submitTimeUs;
+        stats.totalWaitUs[job.priority] += waitUs;
+        stats.maxWaitUs[job.priority] = std::max(stats.maxWaitUs[job.priority], waitUs);
+        stats.running++;
+
+        Priority priority = job.priority;
+
+        lock.unlock();
+        job.run();
+        // Release the job's resources (e.g. its frames) before reporting it as complete
+        job = Job();
+        long long runUs = TimeUtil::getUpTime() - startTimeUs;
+        lock.lock();
+
+        stats.running--;
+        stats.completed[priority]++;
+        stats.totalRunUs[priority] += runUs;
+        stats.maxRunUs[priority] = std::max(stats.maxRunUs[priority], runUs);
+        jobFinished.notify_all();
+
+        fprintf(stderr, "Completed %s job: waited %.3f s, ran %.3f s; %d queued, %d spilled, %d running\n", priorityNames[priority].c_str(),
+                waitUs / 1000000.0, runUs / 1000000.0, stats.queueLength, stats.spilledQueueLength, stats.running);
+    }
+}
+
+void WorkerPool::spill() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true) {
+
+        spillAvailable.wait(lock, [this]() { return stopSpiller || !toSpill.empty(); });
+
+        if(toSpill.empty()) {
+            // Stopping, and there's nothing left to spill
+            return;
+        }
+
+        Job job = toSpill.front();
+        toSpill.pop_front();
+
+        lock.unlock();
+        bool ok = job.spill();
+        // The job no longer needs to spill itself, and shouldn't hold a reference to its in-memory data
+        job.spill = std::function<bool()>();
+        lock.lock();
+
+        if(ok) {
+            stats.spilled[job.priority]++;
+            spilled.push_back(job);
+            jobAvailable.notify_one();
+        }
+        else {
+            fprintf(stderr, "Failed to spill %s job; discarding it\n", priorityNames[job.priority].c_str());
+            stats.spilledQueueLength--;
+            stats.discarded[job.priority]++;
+            jobFinished.notify_all();
+        }
+    }
+}
@@ -0,0 +1,248 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Snapshot of the queue depth, throughput and waiting times of a WorkerPool.
+ */
+class WorkerPoolStats
+{
+
+public:
+    WorkerPoolStats();
+
+    /**
+     * @brief The number of priority levels, which index the per-priority statistics.
+     */
+    static const unsigned int nPriorities = 2;
+
+    /**
+     * @brief The number of worker threads.
+     */
+    unsigned int nThreads;
+
+    /**
+     * @brief The maximum number of jobs held in memory waiting for a worker.
+     */
+    unsigned int maxQueueLength;
+
+    /**
+     * @brief The number of jobs currently held in memory waiting for a worker.
+     */
+    unsigned int queueLength;
+
+    /**
+     * @brief The largest number of jobs held in memory waiting for a worker at any one time.
+     */
+    unsigned int peakQueueLength;
+
+    /**
+     * @brief The number of jobs currently running.
+     */
+    unsigned int running;
+
+    /**
+     * @brief The number of spilled jobs waiting for a worker, including those still being written to disk.
+     */
+    unsigned int spilledQueueLength;
+
+    /**
+     * @brief The number of jobs submitted, at each priority.
+     */
+    unsigned long submitted[nPriorities];
+
+    /**
+     * @brief The number of jobs completed, at each priority.
+     */
+    unsigned long completed[nPriorities];
+
+    /**
+     * @brief The number of jobs spilled to disk because the queue was full, at each priority.
+     */
+    unsigned long spilled[nPriorities];
+
+    /**
+     * @brief The number of jobs discarded because the queue was full, at each priority.
+     */
+    unsigned long discarded[nPriorities];
+
+    /**
+     * @brief The total time that the started jobs spent waiting for a worker, at each priority [microseconds]
+     */
+    long long totalWaitUs[nPriorities];
+
+    /**
+     * @brief The longest time that any job spent waiting for a worker, at each priority [microseconds]
+     */
+    long long maxWaitUs[nPriorities];
+
+    /**
+     * @brief The total time that the completed jobs spent running, at each priority [microseconds]
+     */
+    long long totalRunUs[nPriorities];
+
+    /**
+     * @brief The longest time that any job spent running, at each priority [microseconds]
+     */
+    long long maxRunUs[nPriorities];
+};
+
+/**
+ * @brief Fixed-size pool of threads that run the clip analysis and calibration jobs in the background.
+ *
+ * Jobs wait in a bounded queue and are started in priority order, then in order of submission. When the queue
+ * is full the pool applies its overflow policy, so that a burst of events (e.g. from clouds or aircraft) can't
+ * exhaust the memory or starve the capture of CPU time:
+ *  - if a lower priority job is waiting, it is evicted to make room for the new one;
+ *  - otherwise the new job is evicted.
+ * An evicted job that can be spilled (e.g. a clip, whose frames can be written to disk) is handed to a
+ * background thread that spills it, freeing its memory; it is then run once the queue has emptied. Jobs that
+ * can't be spilled are discarded. Jobs still waiting when the pool is deleted are spilled if possible.
+ *
+ * All functions are thread safe.
+ */
+class WorkerPool
+{
+
+public:
+
+    /**
+     * @brief The Priority enum enumerates the job priorities, highest first.
+     */
+    enum Priority{CLIP_ANALYSIS, CALIBRATION};
+    static const std::string priorityNames[];
+
+    /**
+     * @brief Main constructor.
+     * @param nThreads
+     *  The number of worker threads.
+     * @param maxQueueLength
+     *  The maximum number of jobs that can wait in memory for a worker.
+     * @param cpus
+     *  The CPUs that the worker threads may run on; if empty, they may run on any CPU.
+     */
+    WorkerPool(unsigned int nThreads, unsigned int maxQueueLength, const std::vector<unsigned int> &cpus);
+
+    ~WorkerPool();
+
+    /**
+     * @brief Submits a job to the pool.
+     * @param priority
+     *  The priority of the job.
+     * @param run
+     *  Function that performs the job, on one of the worker threads.
+     * @param spill
+     *  Function called if the job is evicted from a full queue, which should save the job's data to disk and
+     * release it from memory, ready for the job to be run later. This is called on the background spill thread
+     * and should return true if successful. If empty (the default) then evicted jobs are discarded.
+     */
+    void submit(Priority priority, std::function<void()> run, std::function<bool()> spill = std::function<bool()>());
+
+    /**
+     * @brief Submits a job that has already been spilled to disk (e.g. by a previous run of the application),
+     * which is run once the queue has emptied.
+     * @param priority
+     *  The priority of the job.
+     * @param run
+     *  Function that performs the job, on one of the worker threads.
+     */
+    void submitSpilled(Priority priority, std::function<void()> run);
+
+    /**
+     * @brief Gets a snapshot of the current statistics.
+     * @return
+     *  The WorkerPoolStats.
+     */
+    WorkerPoolStats getStats();
+
+    /**
+     * @brief Blocks until there are no jobs running or waiting, including spilled jobs.
+     */
+    void waitUntilIdle();
+
+private:
+
+    /**
+     * @brief A single job.
+     */
+    struct Job {
+        Priority priority;
+        long long submitTimeUs;
+        std::function<void()> run;
+        std::function<bool()> spill;
+    };
+
+    /**
+     * @brief Main loop of the worker threads.
+     */
+    void work();
+
+    /**
+     * @brief Main loop of the spill thread.
+     */
+    void spill();
+
+    /**
+     * @brief Applies the overflow policy to a job evicted from the queue. Must be called with the mutex locked.
+     * @param job
+     *  The evicted job.
+     */
+    void evict(Job &job);
+
+    std::vector<std::thread> workers;
+
+    std::thread spiller;
+
+    std::mutex mutex;
+
+    /**
+     * @brief Signalled when a job is ready to run, or on shutdown.
+     */
+    std::condition_variable jobAvailable;
+
+    /**
+     * @brief Signalled when a job is ready to be spilled, or on shutdown.
+     */
+    std::condition_variable spillAvailable;
+
+    /**
+     * @brief Signalled when a job completes or is discarded.
+     */
+    std::condition_variable jobFinished;
+
+    /**
+     * @brief The jobs waiting in memory for a worker, in a FIFO queue for each priority.
+     */
+    std::vector<std::deque<Job>> queues;
+
+    /**
+     * @brief The jobs waiting to be spilled to disk.
+     */
+    std::deque<Job> toSpill;
+
+    /**
+     * @brief The jobs that have been spilled to disk and are waiting for a worker.
+     */
+    std::deque<Job> spilled;
+
+    WorkerPoolStats stats;
+
+    /**
+     * @brief Flag used to stop the worker threads.
+     */
+    bool stopWorkers;
+
+    /**
+     * @brief Flag used to stop the spill thread, once it has spilled all the remaining jobs.
+     */
+    bool stopSpiller;
+};
+
+#endif // WORKERPOOL_H
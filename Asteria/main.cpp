@@ -12,6 +12,12 @@
 #include "infra/analysisvideostats.h"
 #include "util/testutil.h"
 #include "infra/calibrationinventory.h"
+#include "infra/referencestarcatalogue.h"
+#include "util/syntheticvideogenerator.h"
+#include "util/fileutil.h"
+#include "util/coordinateutil.h"
+#include "util/mathutil.h"
+#include "optics/pinholecamera.h"
 
 #include <Eigen/Dense>
 
@@ -30,6 +36,8 @@ static void usage(FILE *fp, char **argv);
 
 static void catchUnixSignals();
 
+static string generateSyntheticClip(AsteriaState * state, const string &path);
+
 int main(int argc, char **argv)
 {
     QApplication app (argc, argv);
@@ -39,6 +47,28 @@ int main(int argc, char **argv)
 //    TestUtil::testRandomVector();
 //    TestUtil::testRaDecAzElConversion();
 //    TestUtil::testImagedReadWrite();
+//    TestUtil::testFrameDifference();
+//    TestUtil::testImageucPool();
+//    TestUtil::testJpgDecode();
+//    TestUtil::testPixelKernels();
+//    TestUtil::testSpscRingBuffer();
+//    TestUtil::testWorkerPool();
+//    TestUtil::testReplayFrameSource();
+//    TestUtil::testSyntheticVideoGenerator();
+//    TestUtil::testCalibrationAccumulator();
+//    TestUtil::testMedianFilter();
+//    TestUtil::testSourceDetector();
+//    TestUtil::testCrossMatch();
+//    TestUtil::testReferenceStarCatalogue();
+//    TestUtil::testVisibleStarCache();
+//    TestUtil::testBatchProjection();
+//    TestUtil::testInverseDistortion();
+//    TestUtil::testPixelRayMap();
+//    TestUtil::testLevenbergMarquardtSolvers();
+//    TestUtil::testFixedLevenbergMarquardtSolver();
+//    TestUtil::testPsfFit();
+//    TestUtil::testMultiEpochGeoCalFitter();
+//    TestUtil::testAutoDiffPartials();
 //    exit(0);
 
     catchUnixSignals();
@@ -66,9 +96,13 @@ int main(int argc, char **argv)
           /* These options set a flag. */
           {"headless",  no_argument,       &state->headless,  1},
           {"gui",       no_argument,       &state->headless,  0},
+          {"fast",      no_argument,       &state->replayFast, 1},
           /* These options don’t set a flag.  We distinguish them by their indices. */
           {"camera",    required_argument, NULL,              'b'},
           {"config",    required_argument, NULL,              'c'},
+          {"replay",    required_argument, NULL,              'r'},
+          {"convert-catalogue", required_argument, NULL,      'k'},
+          {"synthetic", required_argument, NULL,              's'},
           {0,           0,                 NULL,               0}
     };
 
@@ -78,10 +112,12 @@ int main(int argc, char **argv)
     // Parsed values of the camera and config command line arguments
     char * camera = NULL;
     char * config = NULL;
+    char * replay = NULL;
+    char * synthetic = NULL;
 
     int c;
     // The colon after the character indicates that an argument follows
-    while ((c = getopt_long (argc, argv, "hab:c:", long_options, &option_index)) != -1) {
+    while ((c = getopt_long (argc, argv, "hab:c:r:k:s:", long_options, &option_index)) != -1) {
 
         switch (c) {
             case 0: {
@@ -115,6 +151,23 @@ int main(int argc, char **argv)
                 fprintf(stderr, "Config = %s\n", config);
                 break;
             }
+            case 'r': {
+                replay = optarg;
+                fprintf(stderr, "Replay = %s\n", replay);
+                break;
+            }
+            case 's': {
+                synthetic = optarg;
+                fprintf(stderr, "Synthetic = %s\n", synthetic);
+                break;
+            }
+            case 'k': {
+                // Convert the text reference star catalogue to the binary format alongside it
+                string textPath = string(optarg);
+                string binaryPath = textPath.substr(0, textPath.find_last_of('.')) + ".bin";
+                exit(ReferenceStarCatalogue::convert(textPath, binaryPath) ? 0 : 1);
+                break;
+            }
             case '?': {
                 // getopt_long already printed an option
                 break;
@@ -131,12 +184,24 @@ int main(int argc, char **argv)
         fprintf(stderr, "Headless mode: the config file must be specified!\n");
         exit(0);
     }
-    if(state->headless && !camera) {
-        fprintf(stderr, "Headless mode: the camera must be specified!\n");
+    if(state->headless && !camera && !replay && !synthetic) {
+        fprintf(stderr, "Headless mode: the camera, replay or synthetic path must be specified!\n");
         exit(0);
     }
-    if(config && !camera) {
-        fprintf(stderr, "If config is specified then camera must also be!\n");
+    if(config && !camera && !replay && !synthetic) {
+        fprintf(stderr, "If config is specified then camera, replay or synthetic path must also be!\n");
+        exit(0);
+    }
+    if((replay != NULL) + (camera != NULL) + (synthetic != NULL) > 1) {
+        fprintf(stderr, "Only one of camera, replay and synthetic path can be specified!\n");
+        exit(0);
+    }
+    if(replay && !config) {
+        fprintf(stderr, "Replay mode: the config file must be specified!\n");
+        exit(0);
+    }
+    if(synthetic && !config) {
+        fprintf(stderr, "Synthetic mode: the config file must be specified!\n");
         exit(0);
     }
 
@@ -167,6 +232,13 @@ int main(int argc, char **argv)
             configWin.show();
         }
     }
+    else if(replay) {
+        // Process recorded frames instead of frames from a camera
+        state->replayPath = string(replay);
+    }
+    else if(synthetic) {
+        // The synthetic clip is generated, and replayed, once the config has been loaded
+    }
     else {
         // No camera specified - display camera selection window (only reach this point if we're in GUI mode)
         camWin.show();
@@ -206,11 +278,21 @@ int main(int argc, char **argv)
 
         // All parameters OK.
 
+        if(synthetic) {
+            // Process a synthetic clip rendered from the configured camera instead of frames from a camera
+            state->replayPath = generateSyntheticClip(state, string(synthetic));
+            if(state->replayPath.empty()) {
+                exit(1);
+            }
+        }
+
         if(state->headless) {
             // Headless mode
             // TODO: introduce a small class to encapsulate the thread and close it down cleanly etc
             AcquisitionThread * acqThread = new AcquisitionThread(0, state);
             QObject::connect(qApp, SIGNAL(aboutToQuit()), acqThread, SLOT(shutdown()));
+            // Exit once all the recorded frames have been processed
+            QObject::connect(acqThread, SIGNAL(replayFinished()), qApp, SLOT(quit()));
             acqThread->launch();
         }
         else {
@@ -233,10 +315,84 @@ static void usage(FILE *fp, char **argv)
                  "    --gui           Operate in GUI mode\n"
                  "-b, --camera PATH   Use the camera located at PATH (e.g. /dev/video0)\n"
                  "-c, --config PATH   Use the asteria.config file located at PATH\n"
+                 "-r, --replay PATH   Process the frames recorded in the clip or calibration directory\n"
+                 "                    at PATH (or a directory tree of them) instead of a camera\n"
+                 "    --fast          Replay recorded frames as fast as possible rather than at the\n"
+                 "                    recorded frame rate, and report the throughput on completion\n"
+                 "-k, --convert-catalogue PATH\n"
+                 "                    Convert the text reference star catalogue at PATH to the binary\n"
+                 "                    format, written alongside it with the extension .bin\n"
+                 "-s, --synthetic PATH\n"
+                 "                    Render a synthetic clip of a meteor against the reference stars,\n"
+                 "                    as seen by the configured camera, into the directory at PATH and\n"
+                 "                    process it as in replay mode. The true meteor positions are\n"
+                 "                    written to truth.txt in the clip directory\n"
                  "",
                  argv[0]);
 }
 
+/**
+ * @brief Renders a synthetic clip of a meteor crossing the field of view, against the stars of the
+ * reference star catalogue. The camera is taken from the most recent calibration if there is one,
+ * otherwise it's a pinhole camera built from the nominal camera parameters in the config.
+ * @param state
+ *  The main state object, with the config loaded.
+ * @param path
+ *  Directory to write the clip to.
+ * @return
+ *  Path to the clip directory; empty if the clip couldn't be generated.
+ */
+static string generateSyntheticClip(AsteriaState * state, const string &path) {
+
+    ReferenceStarCatalogue catalogue;
+    if(!catalogue.load(state->refStarCataloguePath)) {
+        return string();
+    }
+
+    std::shared_ptr<CalibrationInventory> cal;
+    std::map<long long, std::string> map = FileUtil::mapVideoDirectory(state->calibrationDirPath);
+    if(!map.empty()) {
+        cal = CalibrationInventory::loadFromDir(map.rbegin()->second);
+    }
+
+    PinholeCamera nominal(state->width, state->height, 1000.0 * state->focal_length / state->pixel_width,
+                          1000.0 * state->focal_length / state->pixel_height, state->width / 2.0, state->height / 2.0);
+    const CameraModelBase * cam = &nominal;
+    Eigen::Quaterniond q_sez_cam(CoordinateUtil::getSezToCamRot(MathUtil::toRadians(state->azimuth),
+                                                                MathUtil::toRadians(state->elevation),
+                                                                MathUtil::toRadians(state->roll)));
+    if(cal && cal->cam && cal->cam->width == state->width && cal->cam->height == state->height) {
+        fprintf(stderr, "Rendering synthetic clip with the calibration from %s\n", TimeUtil::epochToUtcString(cal->epochTimeUs).c_str());
+        cam = cal->cam;
+        q_sez_cam = cal->q_sez_cam;
+    }
+    else {
+        fprintf(stderr, "Rendering synthetic clip with the nominal camera parameters\n");
+    }
+
+    // The whole sky is passed to the generator, which discards the stars outside the field of view
+    double faintMagLimit = 6.0;
+    std::vector<ReferenceStar> stars;
+    catalogue.getStars(Eigen::Vector3d(0.0, 0.0, 1.0), M_PI, faintMagLimit, stars);
+
+    SyntheticVideoGenerator generator(cam, q_sez_cam, MathUtil::toRadians(state->longitude), MathUtil::toRadians(state->latitude), stars);
+    generator.faintMagLimit = faintMagLimit;
+    generator.nFrames = 100;
+
+    // Meteor crossing the centre of the image, lasting one second
+    SyntheticMeteor meteor = {1.0, 1.0, state->width / 2.0, state->height / 2.0, 0.5, 0.3, -2.0};
+    generator.meteors.push_back(meteor);
+
+    string clipPath = generator.generate(path);
+    if(clipPath.empty()) {
+        fprintf(stderr, "Failed to write the synthetic clip to %s\n", path.c_str());
+    }
+    else {
+        fprintf(stderr, "Wrote synthetic clip to %s\n", clipPath.c_str());
+    }
+    return clipPath;
+}
+
 /**
  * Intercept and handle UNIX terminal signals. See https://gist.github.com/azadkuh/a2ac6869661ebd3f8588.
  * @brief catchUnixSignals
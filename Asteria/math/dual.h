@@ -0,0 +1,180 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+
+/**
+ * @brief The Dual class is a dual number for forward mode automatic differentiation: it holds the value of a
+ * quantity along with its partial derivatives with respect to N independent variables, which are propagated through
+ * each arithmetic operation by the chain rule. Evaluating a function templated on the scalar type with Dual arguments
+ * gives the exact partial derivatives of the function in a single pass, rather than the 2N evaluations needed for
+ * central finite differences.
+ *
+ * The partial derivatives are held in a plain array and each operation is a fixed length loop over them, which the
+ * compiler unrolls and vectorises. The independent variables are created with the (value, index) constructor, and
+ * constants are converted implicitly from double.
+ *
+ * Template parameters:
+ * N - number of independent variables
+ */
+template<int N> class Dual
+{
+
+public:
+
+    /**
+     * @brief Creates a dual number with uninitialised value and partial derivatives.
+     */
+    Dual() {
+
+    }
+
+    /**
+     * @brief Creates a constant.
+     * @param a
+     *  The value of the constant.
+     */
+    Dual(const double &a) : a(a) {
+        for(int k=0; k<N; k++) {
+            v[k] = 0.0;
+        }
+    }
+
+    /**
+     * @brief Creates an independent variable.
+     * @param a
+     *  The value of the variable.
+     * @param idx
+     *  The index of the variable, in the range [0:N-1]
+     */
+    Dual(const double &a, const unsigned int &idx) : a(a) {
+        for(int k=0; k<N; k++) {
+            v[k] = 0.0;
+        }
+        v[idx] = 1.0;
+    }
+
+    /**
+     * @brief The value.
+     */
+    double a;
+
+    /**
+     * @brief The partial derivatives with respect to each independent variable.
+     */
+    double v[N];
+};
+
+template<int N> inline Dual<N> operator-(const Dual<N> &x) {
+    Dual<N> r;
+    r.a = -x.a;
+    for(int k=0; k<N; k++) {
+        r.v[k] = -x.v[k];
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator+(const Dual<N> &x, const Dual<N> &y) {
+    Dual<N> r;
+    r.a = x.a + y.a;
+    for(int k=0; k<N; k++) {
+        r.v[k] = x.v[k] + y.v[k];
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator+(const Dual<N> &x, const double &y) {
+    Dual<N> r = x;
+    r.a += y;
+    return r;
+}
+
+template<int N> inline Dual<N> operator+(const double &x, const Dual<N> &y) {
+    Dual<N> r = y;
+    r.a += x;
+    return r;
+}
+
+template<int N> inline Dual<N> operator-(const Dual<N> &x, const Dual<N> &y) {
+    Dual<N> r;
+    r.a = x.a - y.a;
+    for(int k=0; k<N; k++) {
+        r.v[k] = x.v[k] - y.v[k];
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator-(const Dual<N> &x, const double &y) {
+    Dual<N> r = x;
+    r.a -= y;
+    return r;
+}
+
+template<int N> inline Dual<N> operator-(const double &x, const Dual<N> &y) {
+    Dual<N> r = -y;
+    r.a += x;
+    return r;
+}
+
+template<int N> inline Dual<N> operator*(const Dual<N> &x, const Dual<N> &y) {
+    Dual<N> r;
+    r.a = x.a * y.a;
+    for(int k=0; k<N; k++) {
+        r.v[k] = x.v[k] * y.a + y.v[k] * x.a;
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator*(const Dual<N> &x, const double &y) {
+    Dual<N> r;
+    r.a = x.a * y;
+    for(int k=0; k<N; k++) {
+        r.v[k] = x.v[k] * y;
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator*(const double &x, const Dual<N> &y) {
+    return y * x;
+}
+
+template<int N> inline Dual<N> operator/(const Dual<N> &x, const Dual<N> &y) {
+    double inv = 1.0 / y.a;
+    Dual<N> r;
+    r.a = x.a * inv;
+    for(int k=0; k<N; k++) {
+        r.v[k] = (x.v[k] - y.v[k] * r.a) * inv;
+    }
+    return r;
+}
+
+template<int N> inline Dual<N> operator/(const Dual<N> &x, const double &y) {
+    return x * (1.0 / y);
+}
+
+template<int N> inline Dual<N> operator/(const double &x, const Dual<N> &y) {
+    double inv = 1.0 / y.a;
+    Dual<N> r;
+    r.a = x * inv;
+    for(int k=0; k<N; k++) {
+        r.v[k] = -y.v[k] * r.a * inv;
+    }
+    return r;
+}
+
+/**
+ * @brief Square root of a dual number. The partial derivatives of the square root are infinite at zero; these are
+ * set to zero instead, which gives the right answer where the square root is multiplied by a quantity that also
+ * vanishes there, such as the radial distance in a distortion model.
+ */
+template<int N> inline Dual<N> sqrt(const Dual<N> &x) {
+    Dual<N> r;
+    r.a = std::sqrt(x.a);
+    double f = (r.a > 0.0) ? 0.5 / r.a : 0.0;
+    for(int k=0; k<N; k++) {
+        r.v[k] = x.v[k] * f;
+    }
+    return r;
+}
+
+#endif // DUAL_H
@@ -0,0 +1,471 @@
+#ifndef FIXEDLEVENBERGMARQUARDTSOLVER_H
+#define FIXEDLEVENBERGMARQUARDTSOLVER_H
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The FixedLevenbergMarquardtSolver class is a version of the LevenbergMarquardtSolver for small problems
+ * where the number of parameters and the number of data points are known at compile time. It is intended for running
+ * large numbers of independent tiny fits, such as fitting each star in each frame.
+ *
+ * All of the vectors and matrices are fixed size Eigen types held within the object, so a solver can be created
+ * on the stack and a fit performed with no heap memory allocation. A solver can be reused for any number of fits
+ * by calling setData() and setParameters() again. The NxM and MxM linear algebra is unrolled by the compiler,
+ * which avoids the overheads of the general purpose matrix products and decompositions used for the dynamic size
+ * solver. Rejected steps restore the previous model rather than evaluating it again.
+ *
+ * The speedup over the dynamic size solver depends on the problem size, and for most problems it falls well short of
+ * 5x. Fitting polynomials to 16 points it is at least 3.5x for two parameters, 2.5x for three and 1.5x for
+ * five to eight parameters; the O(NM^2) cost of forming the normal equations, which both solvers must pay, grows
+ * relative to the overheads removed. For models dominated by the cost of getModel(), such as the cosine in the
+ * tests, the gain is limited by the number of model evaluations saved and is around 2x.
+ * TestUtil::testFixedLevenbergMarquardtSolver() checks these speedups.
+ *
+ * The customization points are the same as the LevenbergMarquardtSolver: derived classes must implement getModel()
+ * and may implement getJacobian() and finiteDifferencesStepSizePerParam(), using the members params, M and N.
+ * Only diagonal covariance of the data points is supported, and the damped normal equations are always solved by a
+ * Cholesky decomposition. The exit criteria are the same as the dynamic size solver.
+ *
+ * Template parameters:
+ * Params - number of free parameters
+ * Data   - number of data points
+ */
+template<int Params, int Data> class FixedLevenbergMarquardtSolver
+{
+
+    static_assert(Params > 0 && Data > 0, "The numbers of parameters and data points must be fixed at compile time");
+
+public:
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<double, Params, 1> ParameterVector;
+    typedef Eigen::Matrix<double, Params, Params> ParameterMatrix;
+    typedef Eigen::Matrix<double, Data, 1> DataVector;
+    // Row-major so that the Jacobian has the same packing as the dynamic size solver (a single column must be column-major)
+    typedef Eigen::Matrix<double, Data, Params, (Params == 1) ? Eigen::ColMajor : Eigen::RowMajor> JacobianMatrix;
+
+    /**
+     * @brief Number of free parameters.
+     */
+    static const unsigned int M = Params;
+
+    /**
+     * @brief Number of data points.
+     */
+    static const unsigned int N = Data;
+
+    /**
+     * @brief Main constructor.
+     */
+    FixedLevenbergMarquardtSolver() {
+        data.setZero();
+        model.setZero();
+        weights.setOnes();
+        params.setZero();
+    }
+
+    virtual ~FixedLevenbergMarquardtSolver() {
+
+    }
+
+    /**
+     * @brief Set the Nx1 column vector of observed values
+     * @param data
+     * 	Pointer to an N-element array of observed values
+     */
+    void setData(const double * data) {
+        std::copy(data, data + N, this->data.data());
+    }
+
+    /**
+     * @brief Set the Mx1 column vector of initial-guess parameters.
+     * @param params
+     * 	Pointer to an M-element array of initial-guess parameters.
+     */
+    void setParameters(const double * params) {
+        std::copy(params, params + M, this->params.data());
+    }
+
+    /**
+     * @brief Get the Mx1 column vector containing the fitted parameters.
+     * @param params
+     *  Pointer to an M-element array; on exit this will contain the solution
+     */
+    void getParameters(double * params) const {
+        std::copy(this->params.data(), this->params.data() + M, params);
+    }
+
+    /**
+     * @brief Set the Nx1 variance array of the data points. If this is not called then the data points have
+     * unit variance.
+     * @param variance
+     * 	Nx1 array of variance values for each data point.
+     */
+    void setVariance(const double * variance) {
+        for(unsigned int n=0; n<N; n++) {
+            weights[n] = 1.0 / std::sqrt(variance[n]);
+        }
+    }
+
+    /**
+     * @brief Get f(X,P): column vector of model values given x points and current parameters set.
+     *
+     * This method MUST be overridden in the derived class.
+     *
+     * @param model
+     *  Pointer to an N-element array that on exit will contain the model values
+     */
+    virtual void getModel(double * model) =0;
+
+    /**
+     * @brief Get the Jacobian matrix of the model values with respect to the parameters, given the current
+     * parameter set.
+     *
+     * This function MAY be overridden in the derived class if an analytic Jacobian is possible.
+     * A default implementation based on finite differences is provided.
+     *
+     * @param jac
+     *  NxM element array that on exit will contain the Jacobian values, packed in a one
+     * dimensional array in row-major order.
+     */
+    virtual void getJacobian(double * jac) {
+
+        // Get finite step sizes to use for each parameter
+        double steps[Params];
+        finiteDifferencesStepSizePerParam(steps);
+
+        ParameterVector initParams = params;
+
+        for(unsigned int m=0; m<M; m++) {
+
+            // Get f(x+h) and store it in the Jacobian
+            params[m] += steps[m];
+            postParameterUpdateCallback();
+            getModel(residuals.data());
+            for(unsigned int n=0; n<N; n++) {
+                jac[n*M + m] = residuals[n];
+            }
+
+            // Get f(x-h) and compute finite difference (f(x+h) - f(x-h))/2h
+            params = initParams;
+            params[m] -= steps[m];
+            postParameterUpdateCallback();
+            getModel(residuals.data());
+            for(unsigned int n=0; n<N; n++) {
+                jac[n*M + m] = (jac[n*M + m] - residuals[n]) / (2.0 * steps[m]);
+            }
+
+            params = initParams;
+            postParameterUpdateCallback();
+        }
+    }
+
+    /**
+     * @brief Implementing classes should override this to provide appropriate step sizes per parameter for use
+     * in the finite differences Jacobian approximation, if they intend to use that.
+     * @param steps
+     *  Pointer to an M-element array; on exit this contains appropriate finite-difference step sizes for each
+     * parameter.
+     */
+    virtual void finiteDifferencesStepSizePerParam(double * steps) {
+        for(unsigned int m=0; m<M; m++) {
+            steps[m] = 1.0;
+        }
+        fprintf(stderr, "If getJacobian(double * jac) is not overridden then "
+                        "the finiteDifferencesStepSizePerParam() should be overridden!");
+    }
+
+    /**
+     * @brief Method called whenever the algorithm updates the parameters. The default implementation does nothing.
+     */
+    virtual void postParameterUpdateCallback() {
+        // Default implementation does nothing.
+    }
+
+    /**
+     * @brief Perform LM iteration loop until parameters cannot be improved.
+     * @param maxIterations
+     *  Maximum number of allowed iteration before convergence.
+     */
+    void fit(const unsigned int &maxIterations) {
+
+        // The model is kept up to date with the parameters throughout the fit, so each accepted step costs one
+        // evaluation of the model and one of the Jacobian
+        getModel(model.data());
+        double chi2 = getChi2();
+
+        getWhitenedJacobian();
+
+        // Get suitable starting value for damping parameter, from 10^{-3}
+        // times the average of the diagonal elements of JTWJ:
+        double lambda = JTJ.trace() / (M * 1000.0);
+        double maxLambda = lambda * maxDamping;
+
+        nIterations = 0;
+        converged = false;
+
+        while(true) {
+
+            nIterations++;
+
+            // Get J^T*W*(residuals)
+            residuals = (data - model).cwiseProduct(weights);
+            JTr.noalias() = J.transpose() * residuals;
+
+            // Keep the current parameters and model so they can be restored without evaluating the model again
+            ParameterVector initParams = params;
+            initModel = model;
+
+            bool done = true;
+
+            // Search for a good step
+            do {
+                // (J^T*W*J + lambda*diag(J^T*W*J))*delta = J^T*W*(residuals)
+                lhs = JTJ;
+                lhs.diagonal() += lambda * JTJ.diagonal();
+                delta = JTr;
+
+                // If the damped normal matrix is singular the step is treated as a bad step and the damping increased
+                double chi2New = std::numeric_limits<double>::infinity();
+                if(solveCholesky(lhs, delta)) {
+                    params = initParams + delta;
+                    postParameterUpdateCallback();
+
+                    getModel(model.data());
+                    chi2New = getChi2();
+                }
+
+                // If rrise is negative, then current residuals are lower than those found on previous step
+                double rrise = (chi2New - chi2) / chi2New;
+
+                if(rrise < -exitTolerance) {
+                    // Good step! Shrink damping parameter and want more iterations.
+                    chi2 = chi2New;
+                    done = false;
+                    lambda /= boostShrinkFactor;
+                    break;
+                }
+
+                // Residuals changed by a very small amount, or not at all: we're at the minimum, so keep the
+                // previous parameters and stop
+                params = initParams;
+                postParameterUpdateCallback();
+                model = initModel;
+
+                if(std::fabs(rrise) < exitTolerance) {
+                    converged = true;
+                    break;
+                }
+
+                // Bad step (residuals increased)! Try again with larger damping.
+                lambda *= boostShrinkFactor;
+            }
+            while(lambda <= maxLambda);
+
+            if(done || nIterations > maxIterations) {
+                break;
+            }
+
+            // Jacobian for the new parameters
+            getWhitenedJacobian();
+        }
+    }
+
+    /**
+     * @brief Chi-square statistic, (x - f(x))^T*C^{-1}*(x - f(x)), for the current model.
+     */
+    double getChi2() const {
+        return (data - model).cwiseProduct(weights).squaredNorm();
+    }
+
+    /**
+     * @brief Reduced Chi-square statistic.
+     */
+    double getReducedChi2() const {
+        return getChi2() / getDOF();
+    }
+
+    /**
+     * @brief Degrees of freedom of fit.
+     */
+    double getDOF() const {
+        return (double)N - (double)M;
+    }
+
+    /**
+     * @brief Get the number of iterations performed by the most recent call to fit().
+     */
+    unsigned int getNumIterations() const {
+        return nIterations;
+    }
+
+    /**
+     * @brief Indicates that the most recent fit stopped because the chi-square could no longer be reduced, rather
+     * than because the iteration or damping limits were reached.
+     */
+    bool isConverged() const {
+        return converged;
+    }
+
+    /**
+     * @brief Set the exit tolerance on the relative change in the chi-square; see LevenbergMarquardtSolver.
+     */
+    void setExitTolerance(const double &exitTolerance) {
+        this->exitTolerance = exitTolerance;
+    }
+
+    /**
+     * @brief Set the maximum damping factor; see LevenbergMarquardtSolver.
+     */
+    void setMaxDamping(const double &maxDamping) {
+        this->maxDamping = maxDamping;
+    }
+
+    /**
+     * @brief Set the factor by which the Levenberg-Marquardt step is inflated or deflated in order
+     * to find a good parameter step.
+     */
+    void setBoostShrinkFactor(const double &boostShrinkFactor) {
+        this->boostShrinkFactor = boostShrinkFactor;
+    }
+
+    /**
+     * @brief Get the covariance matrix for parameters, scaled by the reduced chi-square in the same way as
+     * LevenbergMarquardtSolver::getParameterCovariance().
+     */
+    ParameterMatrix getParameterCovariance() {
+        getWhitenedJacobian();
+        return (JTJ / getReducedChi2()).inverse();
+    }
+
+    /**
+     * @brief Get the asymptotic standard error for the parameters
+     * @param errors
+     *  Pointer to an M-element array fo doubles; on exit this will contain the asymptotic
+     * standard error for each parameter.
+     */
+    void getAsymptoticStandardError(double * errors) {
+        ParameterMatrix covariance = getParameterCovariance();
+        for(unsigned int m=0; m<M; m++) {
+            errors[m] = std::sqrt(covariance(m, m));
+        }
+    }
+
+protected:
+
+    /**
+     * @brief Mx1 column vector of parameters
+     */
+    ParameterVector params;
+
+    /**
+     * @brief Nx1 column vector of observed values
+     */
+    DataVector data;
+
+    /**
+     * @brief The current model values.
+     */
+    DataVector model;
+
+    /**
+     * @brief Inverse standard deviation of each data point, used to whiten the residuals and Jacobian.
+     */
+    DataVector weights;
+
+    double exitTolerance = 1E-32;
+    double maxDamping = 1E32;
+    double boostShrinkFactor = 10;
+
+private:
+
+    /**
+     * @brief Computes the whitened Jacobian and J^T*W*J for the current parameters.
+     */
+    void getWhitenedJacobian() {
+        getJacobian(J.data());
+
+        // Whiten each row and accumulate its outer product, which is at least as fast as a product of the whole matrices
+        JTJ.setZero();
+        for(unsigned int n=0; n<N; n++) {
+            J.row(n) *= weights[n];
+            JTJ.noalias() += J.row(n).transpose() * J.row(n);
+        }
+    }
+
+    /**
+     * @brief Solves A*x = b in place by Cholesky decomposition. The loops have compile time bounds, so for the
+     * small matrices used here the compiler unrolls them; this is around twice as fast as Eigen's LLT and LDLT.
+     * @param A
+     *  The symmetric positive definite matrix; on exit the lower triangle contains the Cholesky factor L.
+     * @param b
+     *  On entry the right hand side; on exit the solution x.
+     * @return
+     *  True if the matrix is positive definite; false otherwise, in which case b is not valid.
+     */
+    static bool solveCholesky(ParameterMatrix &A, ParameterVector &b) {
+
+        // Decompose A = L*L^T
+        for(int j=0; j<Params; j++) {
+            double d = A(j, j);
+            for(int k=0; k<j; k++) {
+                d -= A(j, k) * A(j, k);
+            }
+            if(!(d > 0.0)) {
+                return false;
+            }
+            d = std::sqrt(d);
+            A(j, j) = d;
+            for(int i=j+1; i<Params; i++) {
+                double s = A(i, j);
+                for(int k=0; k<j; k++) {
+                    s -= A(i, k) * A(j, k);
+                }
+                A(i, j) = s / d;
+            }
+        }
+
+        // Solve L*y = b then L^T*x = y
+        for(int i=0; i<Params; i++) {
+            double s = b(i);
+            for(int k=0; k<i; k++) {
+                s -= A(i, k) * b(k);
+            }
+            b(i) = s / A(i, i);
+        }
+        for(int i=Params-1; i>=0; i--) {
+            double s = b(i);
+            for(int k=i+1; k<Params; k++) {
+                s -= A(k, i) * b(k);
+            }
+            b(i) = s / A(i, i);
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Workspaces for the iterations.
+     */
+    DataVector residuals;
+    DataVector initModel;
+    JacobianMatrix J;
+    ParameterMatrix JTJ;
+    ParameterVector JTr;
+    ParameterMatrix lhs;
+    ParameterVector delta;
+
+    unsigned int nIterations = 0;
+    bool converged = false;
+};
+
+template<int Params, int Data> const unsigned int FixedLevenbergMarquardtSolver<Params, Data>::M;
+template<int Params, int Data> const unsigned int FixedLevenbergMarquardtSolver<Params, Data>::N;
+
+#endif // FIXEDLEVENBERGMARQUARDTSOLVER_H
@@ -4,12 +4,22 @@
 #include "infra/referencestar.h"
 #include "infra/source.h"
 
+#include <vector>
+
 GeoCalFitter::GeoCalFitter(CameraModelBase *cam, Eigen::Quaterniond *q_sez_cam, std::vector<std::pair<Source, ReferenceStar> > *xms, const double &gmst, const double &lon, const double &lat) :
      LevenbergMarquardtSolver(cam->getNumParameters() + 4, xms->size()*2), cam(cam), q_sez_cam(q_sez_cam), xms(xms), gmst(gmst), lon(lon), lat(lat) {
 
-    // The data consists of the (i,j) coordinates of the extracted sources
-    double data[N];
-    double covar[N*N] = {0.0};
+    // The data consists of the (i,j) coordinates of the extracted sources. The covariance matrix is block
+    // diagonal, with one 2x2 block for the (i,j) coordinates of each source. This is the covariance of the
+    // fitted position if every source has been refined by PSF fitting; otherwise the dispersion matrix is
+    // used for every source, so that all sources are weighted consistently.
+    bool usePsf = true;
+    for(const std::pair<Source, ReferenceStar> &xm : *xms) {
+        usePsf &= xm.first.psf;
+    }
+
+    std::vector<double> data(N);
+    std::vector<double> covar(2*N);
     // Index of the Source
     long idx = 0l;
     for(std::pair<Source, ReferenceStar> xm : *xms) {
@@ -17,21 +27,16 @@ GeoCalFitter::GeoCalFitter(CameraModelBase *cam, Eigen::Quaterniond *q_sez_cam,
         data[2*idx+0] = source.i;
         data[2*idx+1] = source.j;
 
-        // Indices of the row-packed covariance matrix elements
-        unsigned int ii = (2 * idx) * (N + 1);
-        unsigned int ij = ii + 1;
-        unsigned int ji = ii + N;
-        unsigned int jj = ji + 1;
-
-        covar[ii] = source.c_ii;
-        covar[ij] = source.c_ij;
-        covar[ji] = source.c_ij;
-        covar[jj] = source.c_jj;
+        // Elements of the row-packed covariance matrix block
+        covar[4*idx+0] = usePsf ? source.psf_c_ii : source.c_ii;
+        covar[4*idx+1] = usePsf ? source.psf_c_ij : source.c_ij;
+        covar[4*idx+2] = usePsf ? source.psf_c_ij : source.c_ij;
+        covar[4*idx+3] = usePsf ? source.psf_c_jj : source.c_jj;
 
         idx++;
     }
-    setData(data);
-    setCovariance(covar);
+    setData(data.data());
+    setBlockDiagonalCovariance(covar.data());
 
     // Set the intial guess parameters
     double initial_params[M];
@@ -65,10 +70,29 @@ void GeoCalFitter::getModel(double *model) {
     // Full transformation BCRF->CAM
     Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * r_bcrf_ecef;
 
+    // Transform the stars to the CAM frame then project them all together
+    unsigned int n = xms->size();
+    std::vector<double> x(n), y(n), z(n), i(n), j(n);
+    std::vector<unsigned char> visible(n);
+
+    for(unsigned int s = 0; s < n; s++) {
+        ReferenceStar &star = (*xms)[s].second;
+        Vector3d r_bcrf;
+        CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, star.ra, star.dec);
+        star.r = r_bcrf_cam * r_bcrf;
+        x[s] = star.r[0];
+        y[s] = star.r[1];
+        z[s] = star.r[2];
+    }
+
+    cam->projectVectors(x.data(), y.data(), z.data(), n, i.data(), j.data(), visible.data());
+
     long idx = 0l;
-    for(std::pair<Source, ReferenceStar> &xm : *xms) {
-        ReferenceStar &star = xm.second;
-        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, *cam);
+    for(unsigned int s = 0; s < n; s++) {
+        ReferenceStar &star = (*xms)[s].second;
+        star.i = i[s];
+        star.j = j[s];
+        star.visible = visible[s];
         model[idx++] = star.i;
         model[idx++] = star.j;
     }
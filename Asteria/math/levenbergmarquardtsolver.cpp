@@ -1,24 +1,33 @@
 #include "levenbergmarquardtsolver.h"
+#include "util/timeutil.h"
 
 #include <iostream>
+#include <cmath>
 
-LevenbergMarquardtSolver::LevenbergMarquardtSolver(unsigned int M, unsigned int N) : M(M), N(N) {
+LevenbergMarquardtSolver::LevenbergMarquardtSolver(unsigned int M, unsigned int N) : M(M), N(N),
+    J(N, M), residuals(N), chi2Residuals(N), JTJ(M, M), JTr(M), lhs(M, M), delta(M), initParams(M), ldlt(M) {
     data = new double[N];
     model = new double[N];
     params = new double[M];
     covariance = new double[N];
+    whitening = new double[N];
     covarianceIsDiagonal = true;
+    covarianceIsBlockDiagonal = false;
     // Initialise covariance to identity matrix
     for(unsigned int n=0; n<N; n++) {
         covariance [n] = 1.0;
+        whitening [n] = 1.0;
     }
+    setLinearSolver(NORMALEQUATIONSLDLT);
+    stats = FitStatistics();
 }
 
 LevenbergMarquardtSolver::~LevenbergMarquardtSolver() {
-    delete data;
-    delete model;
-    delete params;
-    delete covariance;
+    delete[] data;
+    delete[] model;
+    delete[] params;
+    delete[] covariance;
+    delete[] whitening;
 }
 
 
@@ -30,22 +39,139 @@ void LevenbergMarquardtSolver::setData(const double * data) {
 
 void LevenbergMarquardtSolver::setCovariance(const double * covariance) {
     covarianceIsDiagonal = false;
-    delete this->covariance;
+    covarianceIsBlockDiagonal = false;
+    delete[] this->covariance;
     this->covariance = new double[N*N];
     for(unsigned int idx=0; idx<N*N; idx++) {
         this->covariance[idx] = covariance[idx];
     }
+
+    // Compute the Cholesky decomposition once, for use in every iteration
+    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(this->covariance, N, N);
+    covarianceLLT.compute(C);
+    if(covarianceLLT.info() != Success) {
+        fprintf(stderr, "LMA: Covariance matrix is not positive definite\n");
+    }
 }
 
 void LevenbergMarquardtSolver::setVariance(const double * variance) {
     covarianceIsDiagonal = true;
-    delete covariance;
+    covarianceIsBlockDiagonal = false;
+    delete[] covariance;
     covariance = new double[N];
+    delete[] whitening;
+    whitening = new double[N];
     for(unsigned int idx=0; idx<N; idx++) {
         this->covariance[idx] = variance[idx];
+        whitening[idx] = 1.0 / std::sqrt(variance[idx]);
     }
 }
 
+void LevenbergMarquardtSolver::setBlockDiagonalCovariance(const double * blocks) {
+
+    if(N % 2 != 0) {
+        fprintf(stderr, "LMA: Block diagonal covariance requires an even number of data points (%d)\n", N);
+        return;
+    }
+
+    covarianceIsDiagonal = false;
+    covarianceIsBlockDiagonal = true;
+    delete[] covariance;
+    covariance = new double[2*N];
+    for(unsigned int idx=0; idx<2*N; idx++) {
+        this->covariance[idx] = blocks[idx];
+    }
+
+    // Compute the inverse of the Cholesky factor of each block
+    delete[] whitening;
+    whitening = new double[3*N/2];
+    for(unsigned int b=0; b<N/2; b++) {
+
+        double c00 = blocks[4*b + 0];
+        double c10 = blocks[4*b + 2];
+        double c11 = blocks[4*b + 3];
+
+        // Cholesky factor L such that C = L*L^T
+        double l00 = std::sqrt(c00);
+        double l10 = c10 / l00;
+        double l11 = std::sqrt(c11 - l10*l10);
+
+        if(!(l00 > 0.0) || !(l11 > 0.0)) {
+            fprintf(stderr, "LMA: Covariance block %d is not positive definite\n", b);
+        }
+
+        // Inverse of L
+        whitening[3*b + 0] = 1.0 / l00;
+        whitening[3*b + 1] = -l10 / (l00 * l11);
+        whitening[3*b + 2] = 1.0 / l11;
+    }
+}
+
+void LevenbergMarquardtSolver::whiten(double * rows, const unsigned int &nCols) {
+    if(covarianceIsDiagonal) {
+        for(unsigned int n=0; n<N; n++) {
+            double * row = &rows[n * nCols];
+            for(unsigned int c=0; c<nCols; c++) {
+                row[c] *= whitening[n];
+            }
+        }
+    }
+    else if(covarianceIsBlockDiagonal) {
+        for(unsigned int b=0; b<N/2; b++) {
+            double * row0 = &rows[(2*b + 0) * nCols];
+            double * row1 = &rows[(2*b + 1) * nCols];
+            const double &w00 = whitening[3*b + 0];
+            const double &w10 = whitening[3*b + 1];
+            const double &w11 = whitening[3*b + 2];
+            for(unsigned int c=0; c<nCols; c++) {
+                double r0 = row0[c];
+                double r1 = row1[c];
+                row0[c] = w00 * r0;
+                row1[c] = w10 * r0 + w11 * r1;
+            }
+        }
+    }
+    else {
+        // Solve L*x = rows in place
+        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> R(rows, N, nCols);
+        covarianceLLT.matrixL().solveInPlace(R);
+    }
+}
+
+void LevenbergMarquardtSolver::setLinearSolver(const LinearSolverType &solver) {
+
+    solverType = solver;
+
+    // Allocate the workspaces needed by the solver
+    switch(solverType) {
+    case NORMALEQUATIONSLDLT:
+        augmentedJ.resize(0, 0);
+        augmentedR.resize(0);
+        qr = ColPivHouseholderQR<MatrixXd>();
+        svd = JacobiSVD<MatrixXd>();
+        solverWorkspace.resize(0);
+        break;
+    case JACOBIANQR:
+        augmentedJ.resize(N + M, M);
+        augmentedR.resize(N + M);
+        qr = ColPivHouseholderQR<MatrixXd>(N + M, M);
+        svd = JacobiSVD<MatrixXd>();
+        solverWorkspace.resize(1);
+        break;
+    case JACOBIANSVD:
+        augmentedJ.resize(N + M, M);
+        augmentedR.resize(N + M);
+        qr = ColPivHouseholderQR<MatrixXd>();
+        svd = JacobiSVD<MatrixXd>(N + M, M, ComputeThinU | ComputeThinV);
+        solverWorkspace.resize(M);
+        break;
+    }
+}
+
+const LevenbergMarquardtSolver::FitStatistics & LevenbergMarquardtSolver::getFitStatistics() const {
+    return stats;
+}
+
 void LevenbergMarquardtSolver::setParameters(const double *params) {
     for(unsigned int m=0; m<M; m++) {
         this->params[m] = params[m];
@@ -151,13 +277,97 @@ void LevenbergMarquardtSolver::postParameterUpdateCallback() {
     // Default implementation does nothing.
 }
 
+void LevenbergMarquardtSolver::getWhitenedJacobian() {
+
+    // Jacobian for current parameters, written directly into the workspace
+    getJacobian(J.data());
+
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    // Trap any memory allocation by the linear algebra; the triangular solve with a full covariance matrix uses a
+    // blocking workspace for large problems
+    Eigen::internal::set_is_malloc_allowed(!covarianceIsDiagonal && !covarianceIsBlockDiagonal);
+#endif
+
+    // Whiten J, after which W is the identity
+    whiten(J.data(), M);
+
+    // Get J^T*W*J
+    JTJ.noalias() = J.transpose() * J;
+
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+    Eigen::internal::set_is_malloc_allowed(true);
+#endif
+}
+
+void LevenbergMarquardtSolver::solveForUpdate(const double &lambda) {
+
+    switch(solverType) {
+    case NORMALEQUATIONSLDLT:
+        // (J^T*W*J + lambda*diag(J^T*W*J))*delta = J^T*W*(residuals)
+        lhs = JTJ;
+        lhs.diagonal() += lambda * JTJ.diagonal();
+        ldlt.compute(lhs);
+        delta = JTr;
+        ldlt.solveInPlace(delta);
+        break;
+    case JACOBIANQR:
+    case JACOBIANSVD:
+        // Least squares solution of [J; sqrt(lambda*diag(J^T*W*J))]*delta = [residuals; 0], which has the same normal
+        // equations as above
+        augmentedJ.topRows(N) = J;
+        augmentedJ.bottomRows(M).setZero();
+        augmentedJ.bottomRows(M).diagonal() = (lambda * JTJ.diagonal()).cwiseSqrt();
+        augmentedR.head(N) = residuals;
+        augmentedR.tail(M).setZero();
+
+        if(solverType == JACOBIANQR) {
+            // Solve R*P^T*delta = Q^T*[residuals; 0], avoiding the temporaries created by ColPivHouseholderQR::solve
+            qr.compute(augmentedJ);
+            for(unsigned int m=0; m<M; m++) {
+                // Apply the Householder reflectors in turn; applying the HouseholderSequence allocates a temporary
+                augmentedR.tail(N + M - m).applyHouseholderOnTheLeft(qr.matrixQR().col(m).tail(N + M - m - 1), qr.hCoeffs()(m), solverWorkspace.data());
+            }
+            qr.matrixR().topLeftCorner(M, M).triangularView<Upper>().solveInPlace(augmentedR.head(M));
+            delta = qr.colsPermutation() * augmentedR.head(M);
+        }
+        else {
+            svd.compute(augmentedJ);
+            const VectorXd &sv = svd.singularValues();
+            double conditionNumber = sv(0) / sv(M - 1);
+            if(!(conditionNumber <= stats.maxConditionNumber)) {
+                stats.maxConditionNumber = conditionNumber;
+            }
+            // delta = V * S^{-1} * U^T * [residuals; 0]
+            solverWorkspace.noalias() = svd.matrixU().transpose() * augmentedR;
+            for(unsigned int m=0; m<M; m++) {
+                solverWorkspace(m) = (sv(m) > sv(0) * 1e-15) ? solverWorkspace(m) / sv(m) : 0.0;
+            }
+            delta.noalias() = svd.matrixV() * solverWorkspace;
+        }
+        break;
+    }
+}
+
 void LevenbergMarquardtSolver::fit(unsigned int maxIterations, bool verbose) {
 
+    // Reset the statistics; the iteration times are reserved here so that the loop doesn't allocate memory
+    stats.nIterations = 0;
+    stats.nAcceptedSteps = 0;
+    stats.nRejectedSteps = 0;
+    stats.nModelEvaluations = 0;
+    stats.maxConditionNumber = (solverType == JACOBIANSVD) ? 0.0 : NAN;
+    stats.solveTime = 0.0;
+    stats.converged = false;
+    stats.iterationTimes.clear();
+    stats.iterationTimes.reserve(maxIterations + 1);
+
     // Compute the initial model
     getModel(model);
+    stats.nModelEvaluations++;
 
     // Covariance weighted chi-square for current parameter set
     double chi2_initial = getChi2();
+    stats.chi2Initial = chi2_initial;
 
     if(verbose) {
         fprintf(stderr, "LMA: %d data and %d parameters\n", N, M);
@@ -166,32 +376,23 @@ void LevenbergMarquardtSolver::fit(unsigned int maxIterations, bool verbose) {
 
     // Get suitable starting value for damping parameter, from 10^{-3}
     // times the average of the diagonal elements of JTWJ:
-    double jac[N*M];
-    getJacobian(jac);
-
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
-
-    // Compute W*J, where W is the inverse of the covariance matrix
-    MatrixXd WJ(N, M);
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-        }
-    }
-    else {
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> W(covariance, N, N);
-        WJ = W.colPivHouseholderQr().solve(J);
-    }
-    MatrixXd JTWJ = J.transpose() * WJ;
+    getWhitenedJacobian();
 
-    double lambda = JTWJ.trace()/(M*1000.0);
+    double lambda = JTJ.trace()/(M*1000.0);
     double maxLambda = lambda*maxDamping;
 
     unsigned int nIterations = 0;
 
-    while(!iteration(lambda, maxLambda, verbose) && nIterations<maxIterations) {
+    while(true) {
+
+        long long t0 = TimeUtil::getUpTime();
+        bool done = iteration(lambda, maxLambda, verbose);
+        stats.iterationTimes.push_back((TimeUtil::getUpTime() - t0) / 1000000.0);
+        stats.nIterations++;
+
+        if(done || nIterations>=maxIterations) {
+            break;
+        }
 
         if(verbose) {
             fprintf(stderr, "LMA: Iteration %d complete, residual = %3.3f\n", nIterations, getChi2());
@@ -199,13 +400,18 @@ void LevenbergMarquardtSolver::fit(unsigned int maxIterations, bool verbose) {
         nIterations++;
     }
 
+    stats.lambda = lambda;
+    stats.chi2Final = getChi2();
+
     if(verbose) {
         // Chi-square on exit
-        double chi2_final = getChi2();
+        double chi2_final = stats.chi2Final;
         fprintf(stderr, "LMA: Number of iterations = %d\n", nIterations);
         fprintf(stderr, "LMA: Final chi2 = %3.3f\n", chi2_final);
         fprintf(stderr, "LMA: Reduced chi2 = %3.3f\n", getReducedChi2());
         fprintf(stderr, "LMA: Reduction factor = %3.3f\n", chi2_initial/chi2_final);
+        fprintf(stderr, "LMA: %d accepted and %d rejected steps; %d model evaluations; %f [s] in linear algebra\n",
+                stats.nAcceptedSteps, stats.nRejectedSteps, stats.nModelEvaluations, stats.solveTime);
     }
 
     return;
@@ -215,84 +421,56 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
 
     // Compute model
     getModel(model);
+    stats.nModelEvaluations++;
 
     // Compute chi-square prior to parameter update
     double chi2prev = getChi2();
 
-    // Now get Jacobian matrix for current parameters
-    double jac[N*M];
-    getJacobian(jac);
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
-
-    // Compute RHS of LM update equation:
-    // (J^T*W*J + diag(J^T*W*J))*delta = J^T*W*(residuals)
-    MatrixXd WJ(N, M);
-    MatrixXd WR(N, 1);
-
-    // Get residuals array
-    double residuals[N];
-    getResiduals(residuals);
+    // Now get the whitened Jacobian matrix for current parameters
+    getWhitenedJacobian();
 
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-            WR(n, 0) = residuals[n] / covariance[n];
-        }
-    }
-    else {
-        // Load covariance elements into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(covariance, N, N);
-        // Load residuals into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> R(residuals, N, 1);
-
-        ColPivHouseholderQR<Matrix<double, Dynamic, Dynamic, RowMajor>> W = C.colPivHouseholderQr();
-        WR = W.solve(R);
-        WJ = W.solve(J);
-    }
+    // Get the whitened residuals
+    getResiduals(residuals.data());
+    whiten(residuals.data(), 1);
 
     // Get J^T*W*(residuals)
-    MatrixXd RHS = J.transpose() * WR;
-
-    // Get J^T*W*J
-    MatrixXd JTWJ = J.transpose() * WJ;
+    long long t0 = TimeUtil::getUpTime();
+    JTr.noalias() = J.transpose() * residuals;
+    stats.solveTime += (TimeUtil::getUpTime() - t0) / 1000000.0;
 
     // Change in chi-square from one iteration to the next
     double rrise = 0;
 
     // Copy initial parameters so we can restore them if necessary
-    double initParam[M];
-    std::copy(&params[0], &params[M], initParam);
+    std::copy(&params[0], &params[M], initParams.data());
 
     // Exit status
     bool done = true;
 
     // Search for a good step:
     do {
-        // Make damping matrix
-        MatrixXd L = MatrixXd::Constant(M, M, 0.0);
-        // Insert diagonal elements of JTWJ multiplied by damping factor
-        for(unsigned int m=0; m<M; m++) {
-            // Diagonal element
-            L(m, m) = JTWJ(m, m) * lambda;
-        }
-
-        // Add this to Grammian
-        MatrixXd LHS = JTWJ + L;
-
         // Compute parameter adjustment vector
-        MatrixXd delta = LHS.colPivHouseholderQr().solve(RHS);
+        t0 = TimeUtil::getUpTime();
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        // Trap any memory allocation by the linear algebra; the SVD is allowed to allocate
+        Eigen::internal::set_is_malloc_allowed(solverType == JACOBIANSVD);
+#endif
+        solveForUpdate(lambda);
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        Eigen::internal::set_is_malloc_allowed(true);
+#endif
+        stats.solveTime += (TimeUtil::getUpTime() - t0) / 1000000.0;
 
         // Adjust parameters...
         for(unsigned int m=0; m<M; m++) {
-            params[m] += delta(m, 0);
+            params[m] += delta(m);
         }
 
         postParameterUpdateCallback();
 
         // Recompute model
         getModel(model);
+        stats.nModelEvaluations++;
 
         // Get new chi-square statistic
         double chi2 = getChi2();
@@ -305,6 +483,7 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
         // Succesful LM iteration. Shrink damping parameter and quit loop.
         if (rrise < -exitTolerance) {
             // Good step! Want more iterations.
+            stats.nAcceptedSteps++;
             done = false;
             lambda /= boostShrinkFactor;
             break;
@@ -315,10 +494,12 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
         // parameters and quit loop. Algorithm cannot find a better value.
         else if (fabs(rrise) < exitTolerance) {
 
-            std::copy(&initParam[0], &initParam[M], params);
+            std::copy(initParams.data(), initParams.data() + M, params);
 
             // Reset the model
             getModel(model);
+            stats.nModelEvaluations++;
+            stats.converged = true;
 
             // Cannot improve parameters - no further iterations
             if(verbose) {
@@ -330,10 +511,12 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
 
             // Bad step (residuals increased)! Try again with larger damping.
             // Reset parameters to values before previous nudge.
-            std::copy(&initParam[0], &initParam[M], params);
+            std::copy(initParams.data(), initParams.data() + M, params);
+            stats.nRejectedSteps++;
 
             // Reset the model
             getModel(model);
+            stats.nModelEvaluations++;
 
             // Boost damping parameter and try another step.
             lambda *= boostShrinkFactor;
@@ -353,26 +536,12 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
 double LevenbergMarquardtSolver::getChi2() {
 
     // Get residuals array
-    double residuals[N];
-    getResiduals(residuals);
-
-    double chi2 = 0.0;
+    getResiduals(chi2Residuals.data());
 
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            chi2 += (residuals[n] * residuals[n]) / covariance[n];
-        }
-    }
-    else {
-        // Load residuals into a Matrix for full covariance weighted chi-square
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> R(residuals, N, 1);
-        // Load covariance array into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(covariance, N, N);
+    // Sum of squares of the whitened residuals
+    whiten(chi2Residuals.data(), 1);
 
-        chi2 = (R.transpose() * C.jacobiSvd(ComputeThinU | ComputeThinV).solve(R))(0, 0);
-    }
-    return chi2;
+    return chi2Residuals.squaredNorm();
 }
 
 void LevenbergMarquardtSolver::getResiduals(double * residuals) {
@@ -392,25 +561,9 @@ double LevenbergMarquardtSolver::getDOF() {
 
 MatrixXd LevenbergMarquardtSolver::getParameterCovariance() {
 
-    // Get Jacobian matrix for current parameter set
-    double jac[N*M];
-    getJacobian(jac);
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
-
-    // Compute W*J, where W is the inverse of the covariance matrix
-    MatrixXd WJ(N, M);
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-        }
-    }
-    else {
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> W(covariance, N, N);
-        WJ = W.colPivHouseholderQr().solve(J);
-    }
-    MatrixXd JTWJ = J.transpose() * WJ;
+    // Get J^T*W*J for current parameter set
+    getWhitenedJacobian();
+    MatrixXd JTWJ = JTJ;
 
     // This step is thrown in to make results match Gnuplot. Without this scaling, the function
     // gives the same results as the getFourthOrderCovariance() function.
@@ -469,6 +622,13 @@ MatrixXd LevenbergMarquardtSolver::getFourthOrderCovariance() {
             sx_dpdx.row(n) = dpdx.row(n) * covariance[n];
         }
     }
+    else if(covarianceIsBlockDiagonal) {
+        // Multiply each pair of rows of dp/dx by the corresponding covariance block
+        for(unsigned int b=0; b<N/2; b++) {
+            Map<Matrix<double, 2, 2, RowMajor>> sx(&covariance[4*b]);
+            sx_dpdx.middleRows(2*b, 2) = sx * dpdx.middleRows(2*b, 2);
+        }
+    }
     else {
         Map<Matrix<double, Dynamic, Dynamic, RowMajor>> sx(covariance, N, N);
         sx_dpdx = sx * dpdx;
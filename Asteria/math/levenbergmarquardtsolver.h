@@ -65,6 +65,8 @@
  *
  */
 
+#include <vector>
+
 #include <Eigen/Dense>
 
 using namespace Eigen;
@@ -75,7 +77,69 @@ class LevenbergMarquardtSolver
 public:
 
     LevenbergMarquardtSolver(unsigned int M, unsigned int N);
-    ~LevenbergMarquardtSolver();
+    virtual ~LevenbergMarquardtSolver();
+
+    /**
+     * @brief The LinearSolverType enum enumerates the methods available for solving for the parameter update at each
+     * iteration. In each case the residuals and Jacobian are first whitened using the (Cholesky factor of the)
+     * covariance matrix of the data points, so that W is the identity.
+     * - NORMALEQUATIONSLDLT: LDLT decomposition of the damped normal equations (J^T*J + lambda*diag(J^T*J))*delta = J^T*r.
+     *   This is the fastest, and the default.
+     * - JACOBIANQR: QR decomposition of the Jacobian augmented with the damping terms. This avoids squaring the condition
+     *   number of the Jacobian, so is more accurate for poorly conditioned problems.
+     * - JACOBIANSVD: SVD of the Jacobian augmented with the damping terms. This is the slowest and may allocate memory,
+     *   but records the condition number of each step for diagnostics.
+     */
+    enum LinearSolverType{NORMALEQUATIONSLDLT, JACOBIANQR, JACOBIANSVD};
+
+    /**
+     * @brief The FitStatistics struct records the progress of the most recent call to fit().
+     */
+    struct FitStatistics {
+        /**
+         * @brief Number of iterations, i.e. evaluations of the Jacobian in the iteration loop.
+         */
+        unsigned int nIterations;
+        /**
+         * @brief Number of parameter steps that reduced the chi-square and were accepted.
+         */
+        unsigned int nAcceptedSteps;
+        /**
+         * @brief Number of parameter steps that were rejected and retried with larger damping.
+         */
+        unsigned int nRejectedSteps;
+        /**
+         * @brief Number of evaluations of the model made by the solver.
+         */
+        unsigned int nModelEvaluations;
+        /**
+         * @brief The chi-square before and after the fit.
+         */
+        double chi2Initial;
+        double chi2Final;
+        /**
+         * @brief The damping parameter on exit.
+         */
+        double lambda;
+        /**
+         * @brief Largest condition number of the damped, whitened Jacobian; only computed by the JACOBIANSVD solver,
+         * otherwise NaN.
+         */
+        double maxConditionNumber;
+        /**
+         * @brief Total time spent in the linear algebra, i.e. excluding the model and Jacobian evaluation [s]
+         */
+        double solveTime;
+        /**
+         * @brief Time taken by each iteration [s]
+         */
+        std::vector<double> iterationTimes;
+        /**
+         * @brief Indicates that the fit stopped because the chi-square could no longer be reduced, rather than
+         * because the iteration or damping limits were reached.
+         */
+        bool converged;
+    };
 
     /**
      * @brief Set the Nx1 column vector of observed values
@@ -117,6 +181,18 @@ public:
      */
     void setVariance(const double *variance);
 
+    /**
+     * @brief Set the covariance matrix of the data points for applications where it is block diagonal with 2x2
+     * blocks, i.e. the data points are pairs (such as image coordinates) that are correlated with each other but not
+     * with any other pairs. N must be even. The residuals and Jacobian are whitened using the Cholesky factors
+     * of the blocks, which are computed once here, so each iteration costs O(N*M*M) rather than requiring the
+     * factorization of the full NxN covariance matrix.
+     *
+     * @param blocks
+     * 	Array of N/2 2x2 covariance matrix blocks, each packed in row-major order, i.e. 2N elements in total.
+     */
+    void setBlockDiagonalCovariance(const double *blocks);
+
     /**
      * @brief Get f(X,P): column vector of model values given x points and current
      * parameters set.
@@ -229,6 +305,20 @@ public:
      */
     void setBoostShrinkFactor(double boostShrinkFactor);
 
+    /**
+     * @brief Set the method used to solve for the parameter update at each iteration.
+     * @param solver
+     *  The linear solver type; see LinearSolverType.
+     */
+    void setLinearSolver(const LinearSolverType &solver);
+
+    /**
+     * @brief Get the statistics recorded during the most recent call to fit().
+     * @return
+     *  The fit statistics.
+     */
+    const FitStatistics & getFitStatistics() const;
+
     /**
      * @brief This method estimates parameter covariance by propagating data
      * covariance through the system using the following equation:
@@ -330,6 +420,55 @@ protected:
      */
     bool covarianceIsDiagonal;
 
+    /**
+     * @brief Flag that indicates a block diagonal covariance matrix with 2x2 blocks. The blocks are stored in a 2Nx1
+     * array, and the data are weighted using the inverse of the Cholesky factor of each block.
+     */
+    bool covarianceIsBlockDiagonal;
+
+    /**
+     * @brief Factors used to whiten the data, i.e. transform them to unit covariance. For a diagonal covariance matrix
+     * this contains the inverse standard deviation of each data point. For a block diagonal covariance matrix this
+     * contains the inverse of the lower triangular Cholesky factor of each block, stored as the three non-zero elements
+     * (0,0), (1,0) and (1,1). It is not used for a full covariance matrix.
+     */
+    double * whitening;
+
+    /**
+     * @brief For a full covariance matrix, the Cholesky decomposition of the covariance matrix, computed once when
+     * the covariance is set.
+     */
+    LLT<MatrixXd> covarianceLLT;
+
+    /**
+     * @brief The method used to solve for the parameter update.
+     */
+    LinearSolverType solverType;
+
+    /**
+     * @brief Statistics of the most recent fit.
+     */
+    FitStatistics stats;
+
+    /**
+     * @brief Workspaces for the iterations, allocated when the solver is constructed (or when the linear solver
+     * is changed) so that the iteration loop doesn't allocate memory.
+     */
+    Matrix<double, Dynamic, Dynamic, RowMajor> J;
+    VectorXd residuals;
+    VectorXd chi2Residuals;
+    MatrixXd JTJ;
+    VectorXd JTr;
+    MatrixXd lhs;
+    VectorXd delta;
+    VectorXd initParams;
+    Eigen::LDLT<MatrixXd> ldlt;
+    MatrixXd augmentedJ;
+    VectorXd augmentedR;
+    ColPivHouseholderQR<MatrixXd> qr;
+    JacobiSVD<MatrixXd> svd;
+    VectorXd solverWorkspace;
+
     /**
      * @brief Mx1 column vector of parameters
      *
@@ -355,6 +494,30 @@ protected:
      */
     void getResiduals(double *residuals);
 
+    /**
+     * @brief Whiten the rows of an array, i.e. premultiply by the inverse of the Cholesky factor of the covariance
+     * matrix, after which the rows have unit covariance. For a block diagonal covariance matrix each pair of rows
+     * is premultiplied by the inverse of the Cholesky factor of the corresponding covariance block.
+     * @param rows
+     *  Pointer to an array of N rows of nCols elements, packed in row-major order, e.g. the residuals or the Jacobian;
+     * on exit this contains the whitened rows.
+     * @param nCols
+     *  The number of columns.
+     */
+    void whiten(double * rows, const unsigned int &nCols);
+
+    /**
+     * @brief Evaluates and whitens the Jacobian for the current parameters, storing it in J, and computes J^T*J.
+     */
+    void getWhitenedJacobian();
+
+    /**
+     * @brief Solves for the parameter update, given the whitened Jacobian and residuals, using the selected linear solver.
+     * @param lambda
+     *  Current value of the damping parameter.
+     */
+    void solveForUpdate(const double &lambda);
+
     /**
      * @brief Finite difference Jacobian approximation. This is the derivative of the
      * parameters solution with respect to the data, useful in estimating the
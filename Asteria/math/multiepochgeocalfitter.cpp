@@ -0,0 +1,490 @@
+#include "math/multiepochgeocalfitter.h"
+#include "infra/calibrationinventory.h"
+#include "util/coordinateutil.h"
+#include "util/timeutil.h"
+#include "util/mathutil.h"
+#include "util/fileutil.h"
+
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <thread>
+
+using namespace Eigen;
+
+/**
+ * @brief Minimum number of cross-matches in an epoch; the orientation of each epoch has three parameters.
+ */
+static const unsigned int minCrossMatches = 3;
+
+/**
+ * @brief Starting value of the damping parameter.
+ */
+static const double initialDamping = 1E-3;
+
+MultiEpochGeoCalFitter::MultiEpochGeoCalFitter(CameraModelBase *cam) : cam(cam), Nc(cam->getNumParameters()), N(0), usePsf(false), U(Nc, Nc), gc(Nc),
+    deltaC(Nc), nThreads(1), chi2(0.0), nIterations(0), converged(false) {
+
+}
+
+bool MultiEpochGeoCalFitter::addEpoch(const CalibrationInventory &calInv) {
+    return addEpoch(calInv.epochTimeUs, calInv.xms, calInv.q_sez_cam, TimeUtil::epochToGmst(calInv.epochTimeUs),
+                    MathUtil::toRadians(calInv.longitude), MathUtil::toRadians(calInv.latitude));
+}
+
+bool MultiEpochGeoCalFitter::addEpoch(const long long &epochTimeUs, const std::vector<std::pair<Source, ReferenceStar>> &xms,
+                                      const Quaterniond &q_sez_cam, const double &gmst, const double &lon, const double &lat) {
+
+    Epoch epoch;
+    epoch.epochTimeUs = epochTimeUs;
+    epoch.q_sez_cam = q_sez_cam.normalized();
+    epoch.gmst = gmst;
+    epoch.lon = lon;
+    epoch.lat = lat;
+    epoch.chi2 = 0.0;
+    epoch.rmsResidual = 0.0;
+    epoch.maxResidual = 0.0;
+
+    // Full transformation BCRF->SEZ, which is fixed for the epoch
+    Matrix3d r_bcrf_ecef = CoordinateUtil::getBcrfToEcefRot(gmst);
+    Matrix3d r_ecef_sez  = CoordinateUtil::getEcefToSezRot(lon, lat);
+    Matrix3d r_bcrf_sez = r_ecef_sez * r_bcrf_ecef;
+
+    // All the sources in the fit must be weighted the same way
+    bool epochUsesPsf = true;
+    for(const std::pair<Source, ReferenceStar> &xm : xms) {
+        epochUsesPsf &= xm.first.psf;
+    }
+    if(!epochs.empty() && epochUsesPsf != usePsf) {
+        fprintf(stderr, "Skipping epoch %s: the sources are %s refined by PSF fitting, unlike the previous epochs\n",
+                TimeUtil::epochToUtcString(epochTimeUs).c_str(), epochUsesPsf ? "all" : "not all");
+        return false;
+    }
+
+    Observations obs;
+    for(const std::pair<Source, ReferenceStar> &xm : xms) {
+        const Source &source = xm.first;
+        double c_ii = epochUsesPsf ? source.psf_c_ii : source.c_ii;
+        double c_ij = epochUsesPsf ? source.psf_c_ij : source.c_ij;
+        double c_jj = epochUsesPsf ? source.psf_c_jj : source.c_jj;
+
+        // Inverse of the Cholesky factor of the source position covariance
+        double l00 = std::sqrt(c_ii);
+        double l10 = c_ij / l00;
+        double l11 = std::sqrt(c_jj - l10 * l10);
+        if(!(l00 > 0.0) || !(l11 > 0.0)) {
+            fprintf(stderr, "Skipping cross-match with invalid source covariance at (%f, %f) in epoch %s\n",
+                    source.i, source.j, TimeUtil::epochToUtcString(epochTimeUs).c_str());
+            continue;
+        }
+
+        Vector3d r_bcrf;
+        CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, xm.second.ra, xm.second.dec);
+        obs.r_sez.push_back(r_bcrf_sez * r_bcrf);
+        obs.data.push_back(source.i);
+        obs.data.push_back(source.j);
+        obs.whitening.push_back(1.0 / l00);
+        obs.whitening.push_back(-l10 / (l00 * l11));
+        obs.whitening.push_back(1.0 / l11);
+        epoch.xms.push_back(xm);
+    }
+
+    if(epoch.xms.size() < minCrossMatches) {
+        fprintf(stderr, "Skipping epoch %s: too few cross-matches (%d)\n", TimeUtil::epochToUtcString(epochTimeUs).c_str(), (unsigned int)epoch.xms.size());
+        return false;
+    }
+
+    EpochBlocks block;
+    block.W.resize(Nc, 3);
+
+    N += 2 * epoch.xms.size();
+    usePsf = epochUsesPsf;
+    epochs.push_back(epoch);
+    observations.push_back(obs);
+    blocks.push_back(block);
+
+    return true;
+}
+
+unsigned int MultiEpochGeoCalFitter::addEpochs(const std::string &calibrationDirPath, const long long &startUs, const long long &endUs) {
+
+    // The calibration directories are mapped by epoch time in milliseconds
+    std::map<long long, std::string> map = FileUtil::mapVideoDirectory(calibrationDirPath);
+
+    unsigned int nAdded = 0;
+    for(std::map<long long, std::string>::const_iterator it = map.lower_bound(startUs / 1000ll); it != map.end() && it->first <= endUs / 1000ll; ++it) {
+        // The calibration is released as soon as the cross-matches have been copied
+        std::shared_ptr<CalibrationInventory> calInv = CalibrationInventory::loadFromDir(it->second);
+        if(!calInv) {
+            fprintf(stderr, "Failed to load calibration from %s\n", it->second.c_str());
+            continue;
+        }
+        if(addEpoch(*calInv)) {
+            nAdded++;
+        }
+        else {
+            fprintf(stderr, "Failed to add calibration %s\n", it->second.c_str());
+        }
+    }
+
+    return nAdded;
+}
+
+const std::vector<MultiEpochGeoCalFitter::Epoch, Eigen::aligned_allocator<MultiEpochGeoCalFitter::Epoch>> & MultiEpochGeoCalFitter::getEpochs() const {
+    return epochs;
+}
+
+void MultiEpochGeoCalFitter::evaluateEpoch(const unsigned int &e, MatrixXd * blockU, VectorXd * blockGc, const bool &updateStars) {
+
+    Epoch &epoch = epochs[e];
+    const Observations &obs = observations[e];
+    EpochBlocks &block = blocks[e];
+
+    Matrix3d r_sez_cam = epoch.q_sez_cam.toRotationMatrix();
+
+    // Derivatives of the quaternion elements (w,x,y,z) with respect to a small rotation about each axis of the
+    // CAM frame, i.e. q -> (1, theta/2) * q
+    Matrix<double, 4, 3> dq_dtheta;
+    for(unsigned int k=0; k<3; k++) {
+        Vector3d axis = Vector3d::Zero();
+        axis[k] = 0.5;
+        Quaterniond dq = Quaterniond(0.0, axis[0], axis[1], axis[2]) * epoch.q_sez_cam;
+        dq_dtheta.col(k) << dq.w(), dq.x(), dq.y(), dq.z();
+    }
+
+    if(blockU) {
+        block.V.setZero();
+        block.W.setZero();
+        block.g.setZero();
+    }
+
+    std::vector<double> intrinsic(blockU ? 2 * Nc : 0);
+    Matrix<double, 2, Dynamic> Jc(2, Nc);
+    Matrix<double, 2, 3> Je;
+
+    double epochChi2 = 0.0;
+    double sumSq = 0.0;
+    double maxSq = 0.0;
+
+    for(unsigned int s = 0; s < obs.r_sez.size(); s++) {
+
+        Vector3d r_cam = r_sez_cam * obs.r_sez[s];
+        double i, j;
+        bool visible = cam->projectVector(r_cam, i, j);
+
+        // Whitened residuals
+        double ri = obs.data[2*s + 0] - i;
+        double rj = obs.data[2*s + 1] - j;
+        const double * w = &obs.whitening[3*s];
+        Vector2d r(w[0] * ri, w[1] * ri + w[2] * rj);
+        epochChi2 += r.squaredNorm();
+
+        if(updateStars) {
+            ReferenceStar &star = epoch.xms[s].second;
+            star.r = r_cam;
+            star.i = i;
+            star.j = j;
+            star.visible = visible;
+            sumSq += ri * ri + rj * rj;
+            maxSq = std::max(maxSq, ri * ri + rj * rj);
+        }
+
+        if(blockU) {
+            cam->getIntrinsicPartialDerivatives(intrinsic.data(), r_cam);
+            double extrinsic[8];
+            cam->getExtrinsicPartialDerivatives(extrinsic, obs.r_sez[s], epoch.q_sez_cam);
+
+            // Whitened rows of the Jacobian for the intrinsic parameters and the rotation
+            for(unsigned int c=0; c<Nc; c++) {
+                Jc(0, c) = w[0] * intrinsic[2*c];
+                Jc(1, c) = w[1] * intrinsic[2*c] + w[2] * intrinsic[2*c + 1];
+            }
+            for(unsigned int k=0; k<3; k++) {
+                double di = 0.0;
+                double dj = 0.0;
+                for(unsigned int m=0; m<4; m++) {
+                    di += extrinsic[2*m + 0] * dq_dtheta(m, k);
+                    dj += extrinsic[2*m + 1] * dq_dtheta(m, k);
+                }
+                Je(0, k) = w[0] * di;
+                Je(1, k) = w[1] * di + w[2] * dj;
+            }
+
+            blockU->noalias() += Jc.transpose() * Jc;
+            blockGc->noalias() += Jc.transpose() * r;
+            block.W.noalias() += Jc.transpose() * Je;
+            block.V.noalias() += Je.transpose() * Je;
+            block.g.noalias() += Je.transpose() * r;
+        }
+    }
+
+    epoch.chi2 = epochChi2;
+    if(updateStars) {
+        epoch.rmsResidual = std::sqrt(sumSq / obs.r_sez.size());
+        epoch.maxResidual = std::sqrt(maxSq);
+    }
+}
+
+double MultiEpochGeoCalFitter::evaluate(const bool &normalEquations, const bool &updateStars) {
+
+    unsigned int nEpochs = epochs.size();
+    unsigned int nBlocks = std::max(1u, std::min(nThreads, nEpochs));
+
+    // Each block of epochs accumulates its own contribution to the normal equations for the intrinsic parameters
+    std::vector<MatrixXd> Us(normalEquations ? nBlocks : 0, MatrixXd::Zero(Nc, Nc));
+    std::vector<VectorXd> gcs(normalEquations ? nBlocks : 0, VectorXd::Zero(Nc));
+
+    auto evaluateBlock = [&](unsigned int t) {
+        unsigned int first = (t * nEpochs) / nBlocks;
+        unsigned int last = ((t + 1) * nEpochs) / nBlocks;
+        for(unsigned int e = first; e < last; e++) {
+            evaluateEpoch(e, normalEquations ? &Us[t] : 0, normalEquations ? &gcs[t] : 0, updateStars);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int t = 1; t < nBlocks; t++) {
+        workers.push_back(std::thread(evaluateBlock, t));
+    }
+    evaluateBlock(0u);
+    for(unsigned int w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+
+    if(normalEquations) {
+        U.setZero();
+        gc.setZero();
+        for(unsigned int t = 0; t < nBlocks; t++) {
+            U += Us[t];
+            gc += gcs[t];
+        }
+    }
+
+    double total = 0.0;
+    for(const Epoch &epoch : epochs) {
+        total += epoch.chi2;
+    }
+    return total;
+}
+
+bool MultiEpochGeoCalFitter::solveForUpdate(const double &lambda) {
+
+    // Reduced system for the intrinsic parameters: (U - sum(W*V^{-1}*W^T))*deltaC = gc - sum(W*V^{-1}*g)
+    MatrixXd S = U;
+    S.diagonal() += lambda * U.diagonal();
+    VectorXd rhs = gc;
+
+    Matrix<double, Dynamic, 3> Y(Nc, 3);
+    for(EpochBlocks &block : blocks) {
+        Matrix3d V = block.V;
+        V.diagonal() += lambda * block.V.diagonal();
+        bool invertible;
+        V.computeInverseWithCheck(block.VInv, invertible);
+        if(!invertible) {
+            return false;
+        }
+        Y.noalias() = block.W * block.VInv;
+        S.noalias() -= Y * block.W.transpose();
+        rhs.noalias() -= Y * block.g;
+    }
+
+    // The intrinsic parameters span many orders of magnitude, so scale the reduced system to unit diagonal before
+    // solving it
+    VectorXd scale = S.diagonal().cwiseSqrt().cwiseInverse();
+    if(!scale.allFinite()) {
+        return false;
+    }
+    LDLT<MatrixXd> ldlt(scale.asDiagonal() * S * scale.asDiagonal());
+    if(ldlt.info() != Success) {
+        return false;
+    }
+    deltaC = scale.asDiagonal() * ldlt.solve(scale.asDiagonal() * rhs);
+
+    // Back-substitute for the rotation of each epoch
+    for(EpochBlocks &block : blocks) {
+        block.delta.noalias() = block.VInv * (block.g - block.W.transpose() * deltaC);
+    }
+
+    return true;
+}
+
+void MultiEpochGeoCalFitter::fit(unsigned int maxIterations, bool verbose, unsigned int nThreads) {
+
+    nIterations = 0;
+    converged = false;
+
+    if(epochs.empty()) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: no epochs to fit\n");
+        return;
+    }
+
+    // Each epoch has enough cross-matches to constrain its own orientation, but there may still be too few in total
+    // to constrain the intrinsic parameters
+    if(getDOF() <= 0) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: too few data (%d) to fit %d parameters\n", N, Nc + 3 * (unsigned int)epochs.size());
+        return;
+    }
+
+    if(nThreads == 0u) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->nThreads = nThreads;
+
+    unsigned int nEpochs = epochs.size();
+    unsigned int M = Nc + 3 * nEpochs;
+
+    // Copies of the parameters so that they can be restored after a bad step
+    std::vector<double> camParams(Nc);
+    std::vector<double> initCamParams(Nc);
+    std::vector<Quaterniond, aligned_allocator<Quaterniond>> initQs(nEpochs);
+
+    chi2 = evaluate(false, false);
+    double chi2Initial = chi2;
+
+    if(verbose) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: %d epochs; %d data and %d parameters\n", nEpochs, N, M);
+        fprintf(stderr, "MultiEpochGeoCalFitter: Initial chi2 = %3.3f\n", chi2);
+    }
+
+    // The damping is relative to the diagonal of J^T*W*J, so the starting value is independent of the scale of the
+    // parameters; the camera parameters span many orders of magnitude, so a starting value scaled by the trace
+    // of J^T*W*J would be far too large
+    double lambda = initialDamping;
+    double maxLambda = lambda * maxDamping;
+
+    while(true) {
+
+        // Normal equations at the current parameters
+        chi2 = evaluate(true, false);
+
+
+        cam->getParameters(initCamParams.data());
+        for(unsigned int e = 0; e < nEpochs; e++) {
+            initQs[e] = epochs[e].q_sez_cam;
+        }
+
+        bool done = true;
+
+        // Search for a good step
+        do {
+            if(!solveForUpdate(lambda)) {
+                lambda *= boostShrinkFactor;
+                continue;
+            }
+
+            // Adjust parameters
+            for(unsigned int c = 0; c < Nc; c++) {
+                camParams[c] = initCamParams[c] + deltaC[c];
+            }
+            cam->setParameters(camParams.data());
+            for(unsigned int e = 0; e < nEpochs; e++) {
+                const Vector3d &theta = blocks[e].delta;
+                epochs[e].q_sez_cam = (Quaterniond(1.0, 0.5 * theta[0], 0.5 * theta[1], 0.5 * theta[2]) * initQs[e]).normalized();
+            }
+
+            double chi2New = evaluate(false, false);
+            double rrise = (chi2New - chi2) / chi2New;
+
+            if(rrise < -exitTolerance) {
+                // Good step
+                chi2 = chi2New;
+                done = false;
+                lambda /= boostShrinkFactor;
+                break;
+            }
+
+            // Reset parameters to values before the step
+            cam->setParameters(initCamParams.data());
+            for(unsigned int e = 0; e < nEpochs; e++) {
+                epochs[e].q_sez_cam = initQs[e];
+            }
+
+            if(std::fabs(rrise) < exitTolerance) {
+                // We appear to be at the minimum
+                converged = true;
+                if(verbose) {
+                    fprintf(stderr, "MultiEpochGeoCalFitter: Residual threshold exceeded\n");
+                }
+                break;
+            }
+
+            // Bad step; try again with larger damping
+            lambda *= boostShrinkFactor;
+        }
+        while(lambda <= maxLambda);
+
+        if(lambda > maxLambda && verbose) {
+            fprintf(stderr, "MultiEpochGeoCalFitter: Damping threshold exceeded (%f > %f)\n", lambda, maxLambda);
+        }
+
+        nIterations++;
+
+        if(done || nIterations >= maxIterations) {
+            break;
+        }
+
+        if(verbose) {
+            fprintf(stderr, "MultiEpochGeoCalFitter: Iteration %d complete, residual = %3.3f\n", nIterations, chi2);
+        }
+    }
+
+    // Project the reference stars and compute the residuals of each epoch at the solution
+    chi2 = evaluate(false, true);
+
+    if(verbose) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: Number of iterations = %d\n", nIterations);
+        fprintf(stderr, "MultiEpochGeoCalFitter: Final chi2 = %3.3f\n", chi2);
+        fprintf(stderr, "MultiEpochGeoCalFitter: Reduced chi2 = %3.3f\n", getReducedChi2());
+        fprintf(stderr, "MultiEpochGeoCalFitter: Reduction factor = %3.3f\n", chi2Initial / chi2);
+        for(const Epoch &epoch : epochs) {
+            fprintf(stderr, "MultiEpochGeoCalFitter: %s: %d cross-matches; chi2 = %3.3f; RMS residual = %f; max residual = %f [pixels]\n",
+                    TimeUtil::epochToUtcString(epoch.epochTimeUs).c_str(), (unsigned int)epoch.xms.size(), epoch.chi2, epoch.rmsResidual, epoch.maxResidual);
+        }
+    }
+}
+
+double MultiEpochGeoCalFitter::getChi2() const {
+    return chi2;
+}
+
+double MultiEpochGeoCalFitter::getReducedChi2() const {
+    return chi2 / getDOF();
+}
+
+int MultiEpochGeoCalFitter::getDOF() const {
+    return (int)N - (int)Nc - 3 * (int)epochs.size();
+}
+
+unsigned int MultiEpochGeoCalFitter::getNumIterations() const {
+    return nIterations;
+}
+
+bool MultiEpochGeoCalFitter::isConverged() const {
+    return converged;
+}
+
+MatrixXd MultiEpochGeoCalFitter::getIntrinsicCovariance() {
+
+    // Undamped Schur complement at the current parameters
+    evaluate(true, false);
+    MatrixXd S = U;
+    for(EpochBlocks &block : blocks) {
+        S.noalias() -= block.W * block.V.inverse() * block.W.transpose();
+    }
+
+    S /= getReducedChi2();
+
+    return S.inverse();
+}
+
+void MultiEpochGeoCalFitter::setExitTolerance(double exitTolerance) {
+    this->exitTolerance = exitTolerance;
+}
+
+void MultiEpochGeoCalFitter::setMaxDamping(double maxDamping) {
+    this->maxDamping = maxDamping;
+}
+
+void MultiEpochGeoCalFitter::setBoostShrinkFactor(double boostShrinkFactor) {
+    this->boostShrinkFactor = boostShrinkFactor;
+}
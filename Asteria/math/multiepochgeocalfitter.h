@@ -0,0 +1,370 @@
+#ifndef MULTIEPOCHGEOCALFITTER_H
+#define MULTIEPOCHGEOCALFITTER_H
+
+#include "infra/source.h"
+#include "infra/referencestar.h"
+#include "optics/cameramodelbase.h"
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+class CalibrationInventory;
+
+/**
+ * @brief The MultiEpochGeoCalFitter class performs a joint (bundle adjustment) fit of the camera intrinsic
+ * parameters to the cross-matches from many calibrations, with one orientation of the camera per calibration
+ * epoch. The intrinsic parameters, particularly the distortion terms, are poorly constrained by the stars in a
+ * single calibration, whereas the camera optics are the same from night to night and only the orientation is
+ * expected to drift.
+ *
+ * The parameters are the intrinsic parameters of the camera model, which are shared by all the epochs, and
+ * a rotation for each epoch. The orientation of each epoch is updated by a small rotation about the three axes
+ * of the CAM frame, so that there is no redundant quaternion norm to constrain. Each epoch only depends on the
+ * shared parameters and its own rotation, so the normal equations have an arrow structure: the 3x3 diagonal
+ * blocks of the rotations are eliminated by the Schur complement, leaving a system the size of the intrinsic
+ * parameters. The cost of each iteration is then linear in the number of epochs, rather than cubic in the total
+ * number of parameters as for a dense Levenberg-Marquardt fit such as the GeoCalFitter. The model and Jacobian
+ * are evaluated for blocks of epochs in parallel.
+ *
+ * To first order a rotation that is common to every epoch is equivalent to a shift of the principal point, and
+ * for the PinholeCameraWithSipDistortion a change to the quadratic coefficients, so those parameters remain
+ * poorly determined even though the projections are well constrained.
+ *
+ * The damping and the step acceptance follow the LevenbergMarquardtSolver, except that the damping parameter
+ * starts from a fixed value rather than one scaled by the trace of J^T*W*J.
+ */
+class MultiEpochGeoCalFitter
+{
+public:
+
+    /**
+     * @brief The Epoch struct contains the cross-matches from a single calibration, along with the orientation
+     * of the camera fitted to them and the residuals of the fit.
+     */
+    struct Epoch {
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        /**
+         * @brief The epoch time of the calibration [microseconds since 1970-01-01T00:00:00Z]
+         */
+        long long epochTimeUs;
+
+        /**
+         * @brief Source / ReferenceStar cross-matches. On exit from fit(), the (i,j) coordinates of the reference
+         * stars are updated to the projections with the fitted parameters.
+         */
+        std::vector<std::pair<Source, ReferenceStar>> xms;
+
+        /**
+         * @brief The orientation of the CAM frame with respect to the SEZ frame; contains the initial guess
+         * before the fit and the fitted orientation afterwards.
+         */
+        Eigen::Quaterniond q_sez_cam;
+
+        /**
+         * @brief Greenwich mean sidereal time of the calibration [radians]
+         */
+        double gmst;
+
+        /**
+         * @brief Longitude and latitude of the observing site [radians]
+         */
+        double lon, lat;
+
+        /**
+         * @brief Covariance weighted chi-square of the cross-matches in this epoch.
+         */
+        double chi2;
+
+        /**
+         * @brief Root-mean-square and largest distance between the sources and the projected reference stars [pixels]
+         */
+        double rmsResidual;
+        double maxResidual;
+    };
+
+    /**
+     * @brief Main constructor for the MultiEpochGeoCalFitter.
+     * @param cam
+     *  The camera model to fit, which contains the initial guess values for the intrinsic parameters. This is
+     * updated to the fitted parameters by fit().
+     */
+    MultiEpochGeoCalFitter(CameraModelBase * cam);
+
+    /**
+     * @brief Pointer to the camera model that is being fitted.
+     */
+    CameraModelBase * cam;
+
+    /**
+     * @brief Adds the cross-matches from a calibration to the fit; the orientation of the calibration is used
+     * as the initial guess.
+     * @param calInv
+     *  The calibration.
+     * @return
+     *  True if the epoch was added; false if there are too few cross-matches to constrain the orientation, or if
+     * the sources are weighted differently to the epochs already added.
+     */
+    bool addEpoch(const CalibrationInventory &calInv);
+
+    /**
+     * @brief Adds a set of cross-matches to the fit. The sources are weighted by the covariance of their PSF fitted
+     * positions if every source has been refined by PSF fitting, otherwise by their dispersion matrices. All epochs
+     * must be weighted the same way as the first one added.
+     * @param epochTimeUs
+     *  The epoch time of the cross-matches [microseconds since 1970-01-01T00:00:00Z]
+     * @param xms
+     *  The Source / ReferenceStar cross-matches.
+     * @param q_sez_cam
+     *  Initial guess for the orientation of the CAM frame with respect to the SEZ frame.
+     * @param gmst
+     *  Greenwich mean sidereal time of the cross-matches [radians]
+     * @param lon
+     *  Longitude of the observing site [radians]
+     * @param lat
+     *  Latitude of the observing site [radians]
+     * @return
+     *  True if the epoch was added; false if there are too few cross-matches to constrain the orientation, or if
+     * the sources are weighted differently to the epochs already added.
+     */
+    bool addEpoch(const long long &epochTimeUs, const std::vector<std::pair<Source, ReferenceStar>> &xms, const Eigen::Quaterniond &q_sez_cam,
+                  const double &gmst, const double &lon, const double &lat);
+
+    /**
+     * @brief Adds the cross-matches from each calibration stored under the calibration directory with an epoch time
+     * in the given range. The calibrations are loaded one at a time, so that only the cross-matches are held in memory.
+     * @param calibrationDirPath
+     *  The top level calibration directory.
+     * @param startUs
+     *  The earliest epoch time to include [microseconds since 1970-01-01T00:00:00Z]
+     * @param endUs
+     *  The latest epoch time to include [microseconds since 1970-01-01T00:00:00Z]
+     * @return
+     *  The number of epochs that were added.
+     */
+    unsigned int addEpochs(const std::string &calibrationDirPath, const long long &startUs, const long long &endUs);
+
+    /**
+     * @brief Get the epochs included in the fit, in the order that they were added.
+     */
+    const std::vector<Epoch, Eigen::aligned_allocator<Epoch>> & getEpochs() const;
+
+    /**
+     * @brief Performs the fit; on exit the camera model contains the fitted intrinsic parameters and each epoch
+     * contains the fitted orientation and its residuals. Nothing is done if there are no epochs, or if there are
+     * too few cross-matches in total to constrain the parameters (see getDOF()).
+     * @param maxIterations
+     *  The maximum number of iterations.
+     * @param verbose
+     *  If true, the progress of the fit is logged.
+     * @param nThreads
+     *  The number of threads to use; if zero, one is used for each CPU.
+     */
+    void fit(unsigned int maxIterations, bool verbose, unsigned int nThreads = 0);
+
+    /**
+     * @brief Covariance weighted chi-square over all epochs.
+     */
+    double getChi2() const;
+
+    /**
+     * @brief Reduced chi-square over all epochs.
+     */
+    double getReducedChi2() const;
+
+    /**
+     * @brief Get the number of degrees of freedom of the fit. This is zero or negative if there are too few
+     * cross-matches in total to constrain the intrinsic parameters, in which case fit() does nothing.
+     */
+    int getDOF() const;
+
+    /**
+     * @brief Get the number of iterations made by the most recent call to fit().
+     */
+    unsigned int getNumIterations() const;
+
+    /**
+     * @brief Indicates that the most recent call to fit() stopped because the chi-square could no longer be reduced,
+     * rather than because the iteration or damping limits were reached.
+     */
+    bool isConverged() const;
+
+    /**
+     * @brief Get the covariance of the fitted intrinsic parameters, marginalised over the orientation of each epoch.
+     * This is the inverse of the Schur complement of the normal equations at the solution, scaled by the reduced
+     * chi-square as in LevenbergMarquardtSolver::getParameterCovariance().
+     * @return
+     *  The covariance matrix, with one row and column for each parameter of the camera model.
+     */
+    Eigen::MatrixXd getIntrinsicCovariance();
+
+    /**
+     * @brief Set the exit tolerance; see LevenbergMarquardtSolver::setExitTolerance().
+     * @param exitTolerance
+     *  The exit tolerance to set
+     */
+    void setExitTolerance(double exitTolerance);
+
+    /**
+     * @brief Set the maximum damping factor; see LevenbergMarquardtSolver::setMaxDamping().
+     * @param maxDamping
+     *  The max damping factor to set
+     */
+    void setMaxDamping(double maxDamping);
+
+    /**
+     * @brief Set the factor by which the damping parameter is inflated or deflated in order to find a good step.
+     * @param boostShrinkFactor
+     *  The boost/shrink factor
+     */
+    void setBoostShrinkFactor(double boostShrinkFactor);
+
+private:
+
+    /**
+     * @brief Fixed quantities for the cross-matches in one epoch, computed when the epoch is added.
+     */
+    struct Observations {
+        /**
+         * @brief Unit vector towards each reference star in the SEZ frame.
+         */
+        std::vector<Eigen::Vector3d> r_sez;
+        /**
+         * @brief The (i,j) coordinates of each source, packed in pairs [pixels]
+         */
+        std::vector<double> data;
+        /**
+         * @brief Inverse of the lower Cholesky factor of the covariance of each source, which whitens the residuals;
+         * packed in threes as the (0,0), (1,0) and (1,1) elements.
+         */
+        std::vector<double> whitening;
+    };
+
+    /**
+     * @brief The blocks of the normal equations that belong to one epoch.
+     */
+    struct EpochBlocks {
+        /**
+         * @brief J^T*W*J for the rotation of the epoch.
+         */
+        Eigen::Matrix3d V;
+        /**
+         * @brief J^T*W*J between the intrinsic parameters and the rotation of the epoch.
+         */
+        Eigen::Matrix<double, Eigen::Dynamic, 3> W;
+        /**
+         * @brief J^T*W*(residuals) for the rotation of the epoch.
+         */
+        Eigen::Vector3d g;
+        /**
+         * @brief Inverse of the damped V.
+         */
+        Eigen::Matrix3d VInv;
+        /**
+         * @brief The step in the rotation of the epoch [radians]
+         */
+        Eigen::Vector3d delta;
+    };
+
+    /**
+     * @brief Computes the model for one epoch with the current parameters, and optionally accumulates the blocks of
+     * the normal equations.
+     * @param e
+     *  Index of the epoch.
+     * @param blockU
+     *  If not NULL, J^T*W*J for the intrinsic parameters is accumulated into this.
+     * @param blockGc
+     *  If blockU is not NULL, J^T*W*(residuals) for the intrinsic parameters is accumulated into this.
+     * @param updateStars
+     *  If true, the projected coordinates of the reference stars and the residuals of the epoch are updated.
+     */
+    void evaluateEpoch(const unsigned int &e, Eigen::MatrixXd * blockU, Eigen::VectorXd * blockGc, const bool &updateStars);
+
+    /**
+     * @brief Evaluates every epoch, in parallel.
+     * @param normalEquations
+     *  If true, the normal equations are accumulated into U and gc.
+     * @param updateStars
+     *  See evaluateEpoch().
+     * @return
+     *  The chi-square over all epochs.
+     */
+    double evaluate(const bool &normalEquations, const bool &updateStars);
+
+    /**
+     * @brief Solves the damped normal equations for the parameter steps by eliminating the rotation of each epoch.
+     * @param lambda
+     *  The damping parameter.
+     * @return
+     *  True if the reduced system could be solved.
+     */
+    bool solveForUpdate(const double &lambda);
+
+    /**
+     * @brief The epochs included in the fit.
+     */
+    std::vector<Epoch, Eigen::aligned_allocator<Epoch>> epochs;
+
+    /**
+     * @brief Fixed quantities for each epoch.
+     */
+    std::vector<Observations> observations;
+
+    /**
+     * @brief Blocks of the normal equations for each epoch.
+     */
+    std::vector<EpochBlocks> blocks;
+
+    /**
+     * @brief Number of intrinsic parameters.
+     */
+    unsigned int Nc;
+
+    /**
+     * @brief Total number of data, i.e. twice the number of cross-matches.
+     */
+    unsigned int N;
+
+    /**
+     * @brief Indicates whether the sources are weighted by the covariance of their PSF fitted positions rather
+     * than their dispersion matrices; this is set by the first epoch added.
+     */
+    bool usePsf;
+
+    /**
+     * @brief J^T*W*J and J^T*W*(residuals) for the intrinsic parameters.
+     */
+    Eigen::MatrixXd U;
+    Eigen::VectorXd gc;
+
+    /**
+     * @brief The step in the intrinsic parameters.
+     */
+    Eigen::VectorXd deltaC;
+
+    /**
+     * @brief Number of threads used to evaluate the epochs.
+     */
+    unsigned int nThreads;
+
+    /**
+     * @brief The chi-square at the current parameters.
+     */
+    double chi2;
+
+    unsigned int nIterations;
+
+    bool converged;
+
+    double exitTolerance = 1E-32;
+
+    double maxDamping = 1E32;
+
+    double boostShrinkFactor = 10;
+};
+
+#endif // MULTIEPOCHGEOCALFITTER_H
@@ -25,3 +25,24 @@ CameraModelBase * CameraModelBase::getCameraModelFromEnum(const CameraModelType
     case PINHOLECAMERAWITHSIPDISTORTION: return new PinholeCameraWithSipDistortion();
     }
 }
+
+void CameraModelBase::getPartialDerivatives(double * intrinsic, double * extrinsic, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam) const {
+    getIntrinsicPartialDerivatives(intrinsic, q_sez_cam * r_sez);
+    getExtrinsicPartialDerivatives(extrinsic, r_sez, q_sez_cam);
+}
+
+void CameraModelBase::deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const {
+    for(unsigned int p = 0; p < n; p++) {
+        Eigen::Vector3d r_cam = deprojectPixel(i[p], j[p]);
+        x[p] = r_cam[0];
+        y[p] = r_cam[1];
+        z[p] = r_cam[2];
+    }
+}
+
+void CameraModelBase::projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                                     double * i, double * j, unsigned char * visible) const {
+    for(unsigned int p = 0; p < n; p++) {
+        visible[p] = projectVector(Eigen::Vector3d(x[p], y[p], z[p]), i[p], j[p]) ? 1 : 0;
+    }
+}
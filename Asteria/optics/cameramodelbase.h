@@ -130,6 +130,25 @@ public:
      */
     virtual void getExtrinsicPartialDerivatives(double * derivs, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam) const =0;
 
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to both the intrinsic and the
+     * extrinsic parameters of the camera model, in a single call, using the analytic partial derivatives provided by
+     * getIntrinsicPartialDerivatives and getExtrinsicPartialDerivatives. AutoDiffUtil::getPartialDerivatives computes
+     * the same values by automatic differentiation of the templated projection of each camera model, and is used
+     * to check them.
+     * @param intrinsic
+     *  Pointer to the start of the array of double values that on exit will contain the partial derivatives
+     * with respect to the intrinsic parameters; see getIntrinsicPartialDerivatives.
+     * @param extrinsic
+     *  Pointer to the start of the array of eight double values that on exit will contain the partial derivatives
+     * with respect to the extrinsic parameters; see getExtrinsicPartialDerivatives.
+     * @param r_sez
+     *  Position vector of the point in the SEZ frame.
+     * @param q_sez_cam
+     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
+     */
+    void getPartialDerivatives(double * intrinsic, double * extrinsic, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam) const;
+
     /**
      * @brief Set the parameters of the geometric optics model.
      * @param params Pointer to the start of the array of double values containing
@@ -171,6 +190,50 @@ public:
 	 */
     virtual bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const =0;
 
+    /**
+     * @brief Get the unit vectors towards many detector pixel coordinates. This is equivalent to calling
+     * deprojectPixel for each pixel, but the camera models override it with a loop over the arrays that avoids
+     * the per-point overheads. The coordinates are held in separate arrays for each component.
+     *
+     * @param i
+     *  Array of n i coordinates of pixels in image [pixels]
+     * @param j
+     *  Array of n j coordinates of pixels in image [pixels]
+     * @param n
+     *  The number of pixels.
+     * @param x
+     *  Array of n elements that on exit contains the x components of the camera frame unit vectors.
+     * @param y
+     *  Array of n elements that on exit contains the y components of the camera frame unit vectors.
+     * @param z
+     *  Array of n elements that on exit contains the z components of the camera frame unit vectors.
+     */
+    virtual void deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const;
+
+    /**
+     * @brief Project many camera frame position vectors into the image plane. This is equivalent to calling
+     * projectVector for each vector, but the camera models override it with a loop over the arrays that avoids
+     * the per-point overheads. The coordinates are held in separate arrays for each component.
+     *
+     * @param x
+     *  Array of n x components of the camera frame position vectors.
+     * @param y
+     *  Array of n y components of the camera frame position vectors.
+     * @param z
+     *  Array of n z components of the camera frame position vectors.
+     * @param n
+     *  The number of vectors.
+     * @param i
+     *  Array of n elements that on exit contains the i image coordinates [pixels]
+     * @param j
+     *  Array of n elements that on exit contains the j image coordinates [pixels]
+     * @param visible
+     *  Array of n elements that on exit contains 1 for the vectors that project to a visible point in the
+     * image and 0 otherwise; see projectVector.
+     */
+    virtual void projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                                double * i, double * j, unsigned char * visible) const;
+
     /**
      * @brief Get the principal point of the camera, i.e. the point where the camera boresight intersects
      * the image, also the projection of the camera centre.
@@ -0,0 +1,122 @@
+#include "optics/inversedistortionpolynomial.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+const unsigned int InverseDistortionPolynomial::order;
+
+const double InverseDistortionPolynomial::tolerance = 0.001;
+
+InverseDistortionPolynomial::InverseDistortionPolynomial(const unsigned int &width, const unsigned int &height, const double &pi, const double &pj,
+                                                         const DistortionUtil::DistortionOffset &forward) : maxError(0.0), valid(false), pi(pi), pj(pj) {
+
+    // The fitted region extends a little beyond the image
+    const double margin = 8.0;
+    iMin = -margin;
+    iMax = width + margin;
+    jMin = -margin;
+    jMax = height + margin;
+
+    scale = 2.0 / std::max(1u, std::max(width, height));
+
+    const unsigned int nTerms = (order + 1) * (order + 2) / 2;
+    std::fill(a, a + nTerms, 0.0);
+    std::fill(b, b + nTerms, 0.0);
+
+    // The exact inverse is computed at the nodes of a grid of nCells x nCells over the fitted region
+    const unsigned int nCells = 24;
+    const unsigned int nNodes = nCells + 1;
+
+    auto getTerms = [&](const double &ip, const double &jp, double * terms) {
+        double u = (ip - pi) * scale;
+        double v = (jp - pj) * scale;
+        unsigned int t = 0;
+        double vq = 1.0;
+        for(unsigned int q = 0; q <= order; q++) {
+            double term = vq;
+            for(unsigned int p = 0; p + q <= order; p++) {
+                terms[t++] = term;
+                term *= u;
+            }
+            vq *= v;
+        }
+    };
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //        Fit the polynomials to the exact inverse       //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    MatrixXd design(nNodes * nNodes, nTerms);
+    VectorXd offsetI(nNodes * nNodes);
+    VectorXd offsetJ(nNodes * nNodes);
+
+    double dip = 0.0;
+    double djp = 0.0;
+    for(unsigned int y = 0; y < nNodes; y++) {
+        for(unsigned int x = 0; x < nNodes; x++) {
+
+            double ip = iMin + (iMax - iMin) * x / nCells;
+            double jp = jMin + (jMax - jMin) * y / nCells;
+
+            // The offset at the previous node is a good initial guess
+            double i = ip + dip;
+            double j = jp + djp;
+            if(!DistortionUtil::invertDistortion(forward, ip, jp, i, j)) {
+                return;
+            }
+            dip = i - ip;
+            djp = j - jp;
+
+            unsigned int n = y * nNodes + x;
+            double terms[nTerms];
+            getTerms(ip, jp, terms);
+            for(unsigned int t = 0; t < nTerms; t++) {
+                design(n, t) = terms[t];
+            }
+            offsetI[n] = dip;
+            offsetJ[n] = djp;
+        }
+    }
+
+    ColPivHouseholderQR<MatrixXd> qr = design.colPivHouseholderQr();
+    VectorXd coeffsI = qr.solve(offsetI);
+    VectorXd coeffsJ = qr.solve(offsetJ);
+    for(unsigned int t = 0; t < nTerms; t++) {
+        a[t] = coeffsI[t];
+        b[t] = coeffsJ[t];
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //      Check the fit at the centre of each grid cell    //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    valid = true;
+    for(unsigned int y = 0; y < nCells && valid; y++) {
+        for(unsigned int x = 0; x < nCells && valid; x++) {
+
+            double ip = iMin + (iMax - iMin) * (x + 0.5) / nCells;
+            double jp = jMin + (jMax - jMin) * (y + 0.5) / nCells;
+
+            getOffset(ip, jp, dip, djp);
+
+            double i = ip + dip;
+            double j = jp + djp;
+            if(!DistortionUtil::invertDistortion(forward, ip, jp, i, j)) {
+                valid = false;
+                break;
+            }
+
+            maxError = std::max(maxError, std::sqrt((i - ip - dip) * (i - ip - dip) + (j - jp - djp) * (j - jp - djp)));
+        }
+    }
+
+    valid = valid && (maxError <= tolerance);
+}
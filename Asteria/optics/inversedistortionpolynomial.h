@@ -0,0 +1,133 @@
+#ifndef INVERSEDISTORTIONPOLYNOMIAL_H
+#define INVERSEDISTORTIONPOLYNOMIAL_H
+
+#include "util/distortionutil.h"
+
+#include <vector>
+
+/**
+ * @brief The InverseDistortionPolynomial class provides a fast approximation to the inverse of a camera
+ * distortion model, i.e. the offset from an observed (distorted) pixel coordinate to the ideal (undistorted)
+ * one, in the form of a pair of polynomials in the distorted coordinates relative to the distortion centre.
+ * This is the same approach as the AP and BP inverse coefficients of the SIP convention.
+ *
+ * The polynomials are fitted by least squares to the exact inverse, computed by Newton's method on a grid of
+ * points covering the image. The fit is then checked against the exact inverse at the centre of each grid cell;
+ * if the error exceeds the tolerance anywhere the polynomial is marked as invalid and getOffset() returns false,
+ * so that the caller falls back to the exact inverse.
+ *
+ * The polynomial is immutable once fitted, so it can be shared between threads.
+ */
+class InverseDistortionPolynomial
+{
+
+public:
+
+    /**
+     * @brief Main constructor; fits the polynomials.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param pi
+     *  Coordinate of the distortion centre in the i (horizontal) direction [pixels]
+     * @param pj
+     *  Coordinate of the distortion centre in the j (vertical) direction [pixels]
+     * @param forward
+     *  The forward distortion offset of the camera model.
+     */
+    InverseDistortionPolynomial(const unsigned int &width, const unsigned int &height, const double &pi, const double &pj,
+                                const DistortionUtil::DistortionOffset &forward);
+
+    /**
+     * @brief Order of the polynomials; all terms up to this total order are included.
+     */
+    static const unsigned int order = 5;
+
+    /**
+     * @brief The maximum permitted error of the fitted inverse at the check points [pixels]
+     */
+    static const double tolerance;
+
+    /**
+     * @brief The largest difference between the fitted and exact inverse found at the check points [pixels]
+     */
+    double maxError;
+
+    /**
+     * @brief Indicates whether the fitted inverse meets the tolerance.
+     */
+    bool valid;
+
+    /**
+     * @brief Gets the offset from the observed (distorted) pixel coordinate (ip, jp) to the ideal (undistorted)
+     * pixel coordinate.
+     * @param ip
+     *  The observed (distorted) pixel coordinate i^prime
+     * @param jp
+     *  The observed (distorted) pixel coordinate j^prime
+     * @param dip
+     *  On exit, contains the offset to the ideal (undistorted) pixel coordinate i
+     * @param djp
+     *  On exit, contains the offset to the ideal (undistorted) pixel coordinate j
+     * @return
+     *  True if the offset was computed; false if the polynomial is invalid or the point lies outside the fitted
+     * region, in which case the exact inverse must be used.
+     */
+    bool getOffset(const double &ip, const double &jp, double &dip, double &djp) const {
+
+        if(!valid || !(ip >= iMin && ip <= iMax && jp >= jMin && jp <= jMax)) {
+            return false;
+        }
+
+        double u = (ip - pi) * scale;
+        double v = (jp - pj) * scale;
+
+        // Sum the terms u^p v^q in order of increasing q then p
+        dip = 0.0;
+        djp = 0.0;
+        unsigned int t = 0;
+        double vq = 1.0;
+        for(unsigned int q = 0; q <= order; q++) {
+            double term = vq;
+            for(unsigned int p = 0; p + q <= order; p++) {
+                dip += a[t] * term;
+                djp += b[t] * term;
+                term *= u;
+                t++;
+            }
+            vq *= v;
+        }
+
+        return true;
+    }
+
+private:
+
+    /**
+     * @brief The distortion centre [pixels]
+     */
+    double pi;
+    double pj;
+
+    /**
+     * @brief Scale factor applied to the coordinates relative to the distortion centre, to condition the fit.
+     */
+    double scale;
+
+    /**
+     * @brief Limits of the fitted region [pixels]
+     */
+    double iMin;
+    double iMax;
+    double jMin;
+    double jMax;
+
+    /**
+     * @brief Coefficients of the polynomials for the offset in i and j.
+     */
+    double a[(order + 1) * (order + 2) / 2];
+    double b[(order + 1) * (order + 2) / 2];
+};
+
+#endif // INVERSEDISTORTIONPOLYNOMIAL_H
@@ -3,6 +3,8 @@
 #include "optics/pinholecamerawithsipdistortion.h"
 #include "util/coordinateutil.h"
 
+#include <cmath>
+
 BOOST_CLASS_EXPORT(PinholeCamera)
 
 PinholeCamera::PinholeCamera() : CameraModelBase(), fi(0.0), fj(0.0), pi(0.0), pj(0.0) {
@@ -50,7 +52,7 @@ PinholeCameraWithSipDistortion * PinholeCamera::convertToPinholeCameraWithSipDis
 }
 
 unsigned int PinholeCamera::getNumParameters() const {
-    return 4;
+    return nParams;
 }
 
 void PinholeCamera::getParameters(double *params) const {
@@ -159,6 +161,40 @@ bool PinholeCamera::projectVector(const Eigen::Vector3d & r_cam, double & i, dou
     return true;
 }
 
+void PinholeCamera::deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const {
+
+    // Only the non-zero elements of the inverse camera matrix contribute
+    double a = kInv(0,0);
+    double b = kInv(0,2);
+    double c = kInv(1,1);
+    double d = kInv(1,2);
+
+    for(unsigned int p = 0; p < n; p++) {
+        double xx = a * i[p] + b;
+        double yy = c * j[p] + d;
+        double norm = std::sqrt(xx * xx + yy * yy + 1.0);
+        x[p] = xx / norm;
+        y[p] = yy / norm;
+        z[p] = 1.0 / norm;
+    }
+}
+
+void PinholeCamera::projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                                   double * i, double * j, unsigned char * visible) const {
+
+    double w = width;
+    double h = height;
+
+    for(unsigned int p = 0; p < n; p++) {
+        double ii = (fi * x[p] + pi * z[p]) / z[p];
+        double jj = (fj * y[p] + pj * z[p]) / z[p];
+        i[p] = ii;
+        j[p] = jj;
+        // Same visibility checks as projectVector
+        visible[p] = !(z[p] < 0.0 || ii < 0.0 || ii > w || jj < 0.0 || jj > h);
+    }
+}
+
 void PinholeCamera::getPrincipalPoint(double &pi, double &pj) const {
     pi = this->pi;
     pj = this->pj;
@@ -75,6 +75,32 @@ public:
      */
     Eigen::Matrix3d kInv;
 
+    /**
+     * @brief Number of free parameters of the camera model; see getNumParameters().
+     */
+    static const unsigned int nParams = 4;
+
+    /**
+     * @brief Projects a camera frame position vector into the image plane, given the parameters of the model.
+     * This is templated on the scalar types so that it can be evaluated with Dual numbers to get the exact partial
+     * derivatives of the (i,j) coordinates by automatic differentiation; see AutoDiffUtil. The parameters and the
+     * position vector have separate types so that either can be held constant as plain doubles, in which case the
+     * partial derivatives are only propagated with respect to the other. No visibility checks are made.
+     * @param params
+     *  Array of nParams parameters of the model, in the order returned by getParameters().
+     * @param r_cam
+     *  Array containing the three components of the camera frame position vector.
+     * @param i
+     *  On exit, contains the i image coordinate [pixels]
+     * @param j
+     *  On exit, contains the j image coordinate [pixels]
+     */
+    template<typename P, typename T, typename R>
+    static void project(const P * params, const T * r_cam, R & i, R & j) {
+        i = params[0] * (r_cam[0] / r_cam[2]) + params[2];
+        j = params[1] * (r_cam[1] / r_cam[2]) + params[3];
+    }
+
     PinholeCamera * convertToPinholeCamera() const;
 
     PinholeCameraWithRadialDistortion * convertToPinholeCameraWithRadialDistortion() const;
@@ -95,6 +121,11 @@ public:
 
     bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const;
 
+    void deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const;
+
+    void projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                        double * i, double * j, unsigned char * visible) const;
+
     void getPrincipalPoint(double &pi, double &pj) const;
 
     void zoom(double &factor);
@@ -1,6 +1,7 @@
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "optics/pinholecamerawithsipdistortion.h"
 #include "util/coordinateutil.h"
+#include "util/distortionutil.h"
 
 BOOST_CLASS_EXPORT(PinholeCameraWithRadialDistortion)
 
@@ -55,78 +56,72 @@ void PinholeCameraWithRadialDistortion::init() {
     // Call init() of superclass
     PinholeCamera::init();
 
-    // Compute the maximum distance that an undistorted point can lie from the projection centre
-    // and still be visible in the image, given the distortion. This is done by looping around the
-    // border of the image and computing the distorted location of each edge pixel, and looking
-    // for the point furthest from the principal point.
-
-    r_max = 0.0;
+    // The derived quantities depend on all the parameters and the detector size, so are only updated if any of
+    // them have changed. Repeated calls with the same parameters (e.g. when computing the model and then the
+    // Jacobian in the same fitting iteration) do nothing.
+    std::vector<double> params(getNumParameters());
+    getParameters(params.data());
+    params.push_back(width);
+    params.push_back(height);
 
-    double r, i, j, dip, djp;
+    if(params == initParams) {
+        return;
+    }
+    initParams = params;
 
-    // Loop along top and bottom edges
-    for(double ip=0; ip<=(double)width; ip+=1.0) {
+    // Compute the maximum distance that an undistorted point can lie from the projection centre
+    // and still be visible in the image, given the distortion. This is the undistorted point on the
+    // border of the image that lies furthest from the principal point.
+    r_max = DistortionUtil::getMaxUndistortedRadius(width, height, pi, pj,
+        [this](const double &ip, const double &jp, double &dip, double &djp) {
+            invertDistortion(ip, jp, dip, djp);
+        });
+}
 
-        // Remove distortion from point at top
-        double jp = 0;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
+void PinholeCameraWithRadialDistortion::invertDistortion(const double &ip, const double &jp, double &dip, double &djp) const {
 
-        i = ip + dip;
-        j = jp + djp;
+    // Distorted radius in normalised coordinates
+    double x = (ip - pi) / fi;
+    double y = (jp - pj) / fj;
+    double rp = std::sqrt(x * x + y * y);
 
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
+    if(rp == 0.0) {
+        dip = 0.0;
+        djp = 0.0;
+        return;
+    }
 
-        if(r > r_max) {
-            r_max = r;
+    // Solve r * (1 + k1*r + k2*r^2) = rp for the undistorted radius r
+    double r = rp;
+    bool converged = false;
+    for(unsigned int k = 0; k < 50; k++) {
+        double f = r * (1.0 + k1 * r + k2 * r * r) - rp;
+        double df = 1.0 + 2.0 * k1 * r + 3.0 * k2 * r * r;
+        if(!(df > 0.0)) {
+            // Distortion function is not monotonic here
+            break;
         }
-
-        // Remove distortion from point at bottom
-        jp = height;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
-
-        i = ip + dip;
-        j = jp + djp;
-
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
-
-        if(r > r_max) {
-            r_max = r;
+        double dr = f / df;
+        r -= dr;
+        if(std::fabs(dr) < 1e-12 * std::max(1.0, r)) {
+            converged = (r >= 0.0);
+            break;
         }
     }
 
-    // Loop along left and right edges
-    for(double jp=0; jp<=(double)height; jp+=1.0) {
-
-        // Remove distortion from point at top
-        double ip = 0;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
-
-        i = ip + dip;
-        j = jp + djp;
-
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
-
-        if(r > r_max) {
-            r_max = r;
-        }
-
-        // Remove distortion from point at bottom
-        ip = width;
+    if(!converged) {
         getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
-
-        i = ip + dip;
-        j = jp + djp;
-
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
-
-        if(r > r_max) {
-            r_max = r;
-        }
+        return;
     }
+
+    // The undistorted point lies in the same direction from the distortion centre
+    double s = r / rp - 1.0;
+    dip = (ip - pi) * s;
+    djp = (jp - pj) * s;
 }
 
 unsigned int PinholeCameraWithRadialDistortion::getNumParameters() const {
-    return 6;
+    return nParams;
 }
 
 void PinholeCameraWithRadialDistortion::getParameters(double * params) const {
@@ -269,7 +264,7 @@ Eigen::Vector3d PinholeCameraWithRadialDistortion::deprojectPixel(const double &
 
     // Remove the distortion to get the undistorted pixel coordinates
     double dip, djp;
-    getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
+    invertDistortion(ip, jp, dip, djp);
 
     double i = ip + dip;
     double j = jp + djp;
@@ -314,6 +309,60 @@ bool PinholeCameraWithRadialDistortion::projectVector(const Eigen::Vector3d & r_
     return true;
 }
 
+void PinholeCameraWithRadialDistortion::deprojectPixels(const double * ip, const double * jp, const unsigned int & n, double * x, double * y, double * z) const {
+
+    double a = kInv(0,0);
+    double b = kInv(0,2);
+    double c = kInv(1,1);
+    double d = kInv(1,2);
+
+    for(unsigned int p = 0; p < n; p++) {
+
+        // Remove the distortion to get the undistorted pixel coordinates
+        double dip, djp;
+        invertDistortion(ip[p], jp[p], dip, djp);
+
+        // Deproject the undistorted pixel coordinates as in the superclass
+        double xx = a * (ip[p] + dip) + b;
+        double yy = c * (jp[p] + djp) + d;
+        double norm = std::sqrt(xx * xx + yy * yy + 1.0);
+        x[p] = xx / norm;
+        y[p] = yy / norm;
+        z[p] = 1.0 / norm;
+    }
+}
+
+void PinholeCameraWithRadialDistortion::projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                                                       double * ip, double * jp, unsigned char * visible) const {
+
+    double w = width;
+    double h = height;
+
+    for(unsigned int p = 0; p < n; p++) {
+
+        // Undistorted pixel coordinates relative to the distortion centre
+        double ii = (fi * x[p] + pi * z[p]) / z[p] - pi;
+        double jj = (fj * y[p] + pj * z[p]) / z[p] - pj;
+
+        // Apply distortion
+        double ri = ii / fi;
+        double rj = jj / fj;
+        double rr = std::sqrt(ri * ri + rj * rj);
+        double factor = getDistortionFactor<double>(k1, k2, rr);
+        double di = factor * ii;
+        double dj = factor * jj;
+
+        double iip = ii + pi + di;
+        double jjp = jj + pj + dj;
+        ip[p] = iip;
+        jp[p] = jjp;
+
+        // Same visibility checks as projectVector
+        double r = std::sqrt(ii * ii + jj * jj);
+        visible[p] = !(z[p] < 0.0 || r > r_max || iip < 0.0 || iip > w || jjp < 0.0 || jjp > h);
+    }
+}
+
 std::string PinholeCameraWithRadialDistortion::getModelName() const {
     return "PinholeCameraWithRadialDistortion";
 }
@@ -321,9 +370,10 @@ std::string PinholeCameraWithRadialDistortion::getModelName() const {
 void PinholeCameraWithRadialDistortion::getForwardDistortionOffset(const double &i, const double &j, double &di, double &dj) const {
 
     double r = std::sqrt(((i-pi)/fi)*((i-pi)/fi) + ((j-pj)/fj)*((j-pj)/fj));
+    double factor = getDistortionFactor<double>(k1, k2, r);
 
-    di = (k1 * r + k2 * r * r) * (i - pi);
-    dj = (k1 * r + k2 * r * r) * (j - pj);
+    di = factor * (i - pi);
+    dj = factor * (j - pj);
 }
 
 void PinholeCameraWithRadialDistortion::getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp, const double tol) const {
@@ -3,6 +3,9 @@
 
 #include "optics/pinholecamera.h"
 
+#include <cmath>
+#include <vector>
+
 /**
  * @brief The PinholeCameraWithRadialDistortion class provides an implementation of the
  * CameraModelBase for modelling pinhole cameras with low order radial distortion.
@@ -73,6 +76,61 @@ public:
      */
     double r_max;
 
+    /**
+     * @brief Number of free parameters of the camera model; see getNumParameters().
+     */
+    static const unsigned int nParams = 6;
+
+    /**
+     * @brief Computes the radial distortion factor C(R) = k1*R + k2*R^2, by which the pixel coordinates relative
+     * to the distortion centre are scaled to get the distortion offset. This is the distortion polynomial shared by
+     * project() and the double precision projections, and is templated on the scalar types for the same reasons.
+     * @param k1
+     *  The first order distortion coefficient.
+     * @param k2
+     *  The second order distortion coefficient.
+     * @param rr
+     *  Radial distance from the distortion centre, normalised by the focal length.
+     * @return
+     *  The distortion factor.
+     */
+    template<typename R, typename C, typename T>
+    static R getDistortionFactor(const C & k1, const C & k2, const T & rr) {
+        return k1 * rr + k2 * rr * rr;
+    }
+
+    /**
+     * @brief Projects a camera frame position vector into the image plane, given the parameters of the model;
+     * see PinholeCamera::project(). This is the same projection as projectVectors().
+     * @param params
+     *  Array of nParams parameters of the model, in the order returned by getParameters().
+     * @param r_cam
+     *  Array containing the three components of the camera frame position vector.
+     * @param ip
+     *  On exit, contains the distorted i image coordinate [pixels]
+     * @param jp
+     *  On exit, contains the distorted j image coordinate [pixels]
+     */
+    template<typename P, typename T, typename R>
+    static void project(const P * params, const T * r_cam, R & ip, R & jp) {
+        using std::sqrt;
+
+        // Radial distance from the distortion centre, normalised by the focal length
+        T ri = r_cam[0] / r_cam[2];
+        T rj = r_cam[1] / r_cam[2];
+        T rr = sqrt(ri * ri + rj * rj);
+
+        // Undistorted pixel coordinates relative to the distortion centre
+        R ii = params[0] * ri;
+        R jj = params[1] * rj;
+
+        // Apply distortion
+        R factor = getDistortionFactor<R>(params[4], params[5], rr);
+
+        ip = ii + params[2] + factor * ii;
+        jp = jj + params[3] + factor * jj;
+    }
+
     PinholeCamera * convertToPinholeCamera() const;
 
     PinholeCameraWithRadialDistortion * convertToPinholeCameraWithRadialDistortion() const;
@@ -93,6 +151,11 @@ public:
 
     bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const;
 
+    void deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const;
+
+    void projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                        double * i, double * j, unsigned char * visible) const;
+
     std::string getModelName() const;
 
     void init();
@@ -166,6 +229,30 @@ public:
         this->init();
     }
 
+private:
+
+    /**
+     * @brief Computes the exact offset from the observed (distorted) pixel coordinate to the ideal (undistorted)
+     * pixel coordinate. Radial distortion preserves the direction from the distortion centre, so this only
+     * requires the undistorted radius, which is found by Newton's method; getInverseDistortionOffset is used
+     * if that fails to converge.
+     *
+     * @param ip
+     *  The observed (distorted) pixel coordinate i^prime
+     * @param jp
+     *  The observed (distorted) pixel coordinate j^prime
+     * @param dip
+     *  On exit, contains the displacement to the ideal (undistorted) pixel coordinate i
+     * @param djp
+     *  On exit, contains the displacement to the ideal (undistorted) pixel coordinate j
+     */
+    void invertDistortion(const double &ip, const double &jp, double &dip, double &djp) const;
+
+    /**
+     * @brief The parameters and detector size when init() last updated the derived quantities.
+     */
+    std::vector<double> initParams;
+
 };
 
 #endif // PINHOLECAMERAWITHRADIALDISTORTION_H
@@ -1,6 +1,7 @@
 #include "optics/pinholecamerawithsipdistortion.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "util/coordinateutil.h"
+#include "util/distortionutil.h"
 
 BOOST_CLASS_EXPORT(PinholeCameraWithSipDistortion)
 
@@ -55,78 +56,66 @@ void PinholeCameraWithSipDistortion::init() {
     // Call init() of superclass
     PinholeCamera::init();
 
-    // Compute the maximum distance that an undistorted point can lie from the projection centre
-    // and still be visible in the image, given the distortion. This is done by looping around the
-    // border of the image and computing the distorted location of each edge pixel, and looking
-    // for the point furthest from the principal point.
-
-    r_max = 0.0;
-
-    double r, i, j, dip, djp;
-
-    // Loop along top and bottom edges
-    for(double ip=0; ip<=(double)width; ip+=1.0) {
-
-        // Remove distortion from point at top
-        double jp = 0;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
+    // The derived quantities depend on all the parameters and the detector size, so are only updated if any of
+    // them have changed. Repeated calls with the same parameters (e.g. when computing the model and then the
+    // Jacobian in the same fitting iteration) do nothing.
+    std::vector<double> params(getNumParameters());
+    getParameters(params.data());
+    params.push_back(width);
+    params.push_back(height);
 
-        i = ip + dip;
-        j = jp + djp;
-
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
+    if(params == initParams) {
+        return;
+    }
+    initParams = params;
 
-        if(r > r_max) {
-            r_max = r;
-        }
+    // The fitted inverse is out of date; it's fitted again when next used
+    inversePolynomial.reset();
 
-        // Remove distortion from point at bottom
-        jp = height;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
+    // Compute the maximum distance that an undistorted point can lie from the projection centre
+    // and still be visible in the image, given the distortion. This is the undistorted point on the
+    // border of the image that lies furthest from the principal point.
+    r_max = DistortionUtil::getMaxUndistortedRadius(width, height, pi, pj,
+        [this](const double &ip, const double &jp, double &dip, double &djp) {
+            invertDistortion(ip, jp, dip, djp);
+        });
+}
 
-        i = ip + dip;
-        j = jp + djp;
+std::shared_ptr<const InverseDistortionPolynomial> PinholeCameraWithSipDistortion::getInverseDistortionPolynomial() const {
 
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
+    std::shared_ptr<const InverseDistortionPolynomial> polynomial = std::atomic_load(&inversePolynomial);
 
-        if(r > r_max) {
-            r_max = r;
-        }
+    if(!polynomial) {
+        // Threads that find the polynomial missing at the same time each fit it; the fits are identical
+        polynomial = std::make_shared<const InverseDistortionPolynomial>(width, height, pi, pj,
+            [this](const double &i, const double &j, double &di, double &dj) {
+                getForwardDistortionOffset(i, j, di, dj);
+            });
+        std::atomic_store(&inversePolynomial, polynomial);
     }
 
-    // Loop along left and right edges
-    for(double jp=0; jp<=(double)height; jp+=1.0) {
-
-        // Remove distortion from point at top
-        double ip = 0;
-        getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
-
-        i = ip + dip;
-        j = jp + djp;
+    return polynomial;
+}
 
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
+void PinholeCameraWithSipDistortion::invertDistortion(const double &ip, const double &jp, double &dip, double &djp) const {
 
-        if(r > r_max) {
-            r_max = r;
-        }
+    double i = ip;
+    double j = jp;
+    bool converged = DistortionUtil::invertDistortion([this](const double &i, const double &j, double &di, double &dj) {
+            getForwardDistortionOffset(i, j, di, dj);
+        }, ip, jp, i, j);
 
-        // Remove distortion from point at bottom
-        ip = width;
+    if(!converged) {
         getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
-
-        i = ip + dip;
-        j = jp + djp;
-
-        r = std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
-
-        if(r > r_max) {
-            r_max = r;
-        }
+        return;
     }
+
+    dip = i - ip;
+    djp = j - jp;
 }
 
 unsigned int PinholeCameraWithSipDistortion::getNumParameters() const {
-    return 18;
+    return nParams;
 }
 
 void PinholeCameraWithSipDistortion::setParameters(const double *params) {
@@ -291,9 +280,11 @@ void PinholeCameraWithSipDistortion::getExtrinsicPartialDerivatives(double *deri
 
 Eigen::Vector3d PinholeCameraWithSipDistortion::deprojectPixel(const double & ip, const double & jp) const {
 
-    // Remove the distortion to get the undistorted pixel coordinates
+    // Remove the distortion to get the undistorted pixel coordinates, using the fitted inverse where it's valid
     double dip, djp;
-    getInverseDistortionOffset(ip, jp, dip, djp, 0.0001);
+    if(!getInverseDistortionPolynomial()->getOffset(ip, jp, dip, djp)) {
+        invertDistortion(ip, jp, dip, djp);
+    }
 
     double i = ip + dip;
     double j = jp + djp;
@@ -339,6 +330,60 @@ bool PinholeCameraWithSipDistortion::projectVector(const Eigen::Vector3d & r_cam
     return true;
 }
 
+void PinholeCameraWithSipDistortion::deprojectPixels(const double * ip, const double * jp, const unsigned int & n, double * x, double * y, double * z) const {
+
+    double a = kInv(0,0);
+    double b = kInv(0,2);
+    double c = kInv(1,1);
+    double d = kInv(1,2);
+
+    std::shared_ptr<const InverseDistortionPolynomial> polynomial = getInverseDistortionPolynomial();
+
+    for(unsigned int p = 0; p < n; p++) {
+
+        // Remove the distortion to get the undistorted pixel coordinates
+        double dip, djp;
+        if(!polynomial->getOffset(ip[p], jp[p], dip, djp)) {
+            invertDistortion(ip[p], jp[p], dip, djp);
+        }
+
+        // Deproject the undistorted pixel coordinates as in the superclass
+        double xx = a * (ip[p] + dip) + b;
+        double yy = c * (jp[p] + djp) + d;
+        double norm = std::sqrt(xx * xx + yy * yy + 1.0);
+        x[p] = xx / norm;
+        y[p] = yy / norm;
+        z[p] = 1.0 / norm;
+    }
+}
+
+void PinholeCameraWithSipDistortion::projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                                                    double * ip, double * jp, unsigned char * visible) const {
+
+    double w = width;
+    double h = height;
+
+    for(unsigned int p = 0; p < n; p++) {
+
+        // Undistorted pixel coordinates relative to the distortion centre
+        double ii = (fi * x[p] + pi * z[p]) / z[p] - pi;
+        double jj = (fj * y[p] + pj * z[p]) / z[p] - pj;
+
+        // Apply distortion
+        double di, dj;
+        getDistortionOffset(d0, d1, d2, d3, d4, d5, d6, e0, e1, e2, e3, e4, e5, e6, ii, jj, di, dj);
+
+        double iip = ii + pi + di;
+        double jjp = jj + pj + dj;
+        ip[p] = iip;
+        jp[p] = jjp;
+
+        // Same visibility checks as projectVector
+        double r = std::sqrt(ii * ii + jj * jj);
+        visible[p] = !(z[p] < 0.0 || r > r_max || iip < 0.0 || iip > w || jjp < 0.0 || jjp > h);
+    }
+}
+
 std::string PinholeCameraWithSipDistortion::getModelName() const {
     return "PinholeCameraWithSipDistortion";
 }
@@ -348,8 +393,7 @@ void PinholeCameraWithSipDistortion::getForwardDistortionOffset(const double &i,
     double ii = i - pi;
     double jj = j - pj;
 
-    di = d0*ii*ii + d1*jj*jj + d2*ii*jj + d3*ii*ii*jj + d4*ii*jj*jj + d5*ii*ii*ii + d6*jj*jj*jj;
-    dj = e0*ii*ii + e1*jj*jj + e2*ii*jj + e3*ii*ii*jj + e4*ii*jj*jj + e5*ii*ii*ii + e6*jj*jj*jj;
+    getDistortionOffset(d0, d1, d2, d3, d4, d5, d6, e0, e1, e2, e3, e4, e5, e6, ii, jj, di, dj);
 }
 
 void PinholeCameraWithSipDistortion::getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp, const double tol) const {
@@ -2,6 +2,9 @@
 #define PINHOLECAMERAWITHRADIALANDTANGENTIALDISTORTION_H
 
 #include "optics/pinholecamera.h"
+#include "optics/inversedistortionpolynomial.h"
+
+#include <memory>
 
 /**
  * @brief The PinholeCameraWithSipDistortion class provides an implementation of the
@@ -62,6 +65,67 @@ public:
      */
     double r_max;
 
+    /**
+     * @brief Number of free parameters of the camera model; see getNumParameters().
+     */
+    static const unsigned int nParams = 18;
+
+    /**
+     * @brief Computes the distortion offset of an undistorted point from the SIP polynomials. This is the distortion
+     * shared by project() and the double precision projections, and is templated on the scalar types for the same
+     * reasons.
+     * @param d0, d1, d2, d3, d4, d5, d6
+     *  The coefficients of the polynomial in the i direction.
+     * @param e0, e1, e2, e3, e4, e5, e6
+     *  The coefficients of the polynomial in the j direction.
+     * @param ii
+     *  The undistorted i coordinate relative to the distortion centre [pixels]
+     * @param jj
+     *  The undistorted j coordinate relative to the distortion centre [pixels]
+     * @param di
+     *  On exit, contains the distortion offset in the i direction [pixels]
+     * @param dj
+     *  On exit, contains the distortion offset in the j direction [pixels]
+     */
+    template<typename C, typename R>
+    static void getDistortionOffset(const C & d0, const C & d1, const C & d2, const C & d3, const C & d4, const C & d5, const C & d6,
+                                    const C & e0, const C & e1, const C & e2, const C & e3, const C & e4, const C & e5, const C & e6,
+                                    const R & ii, const R & jj, R & di, R & dj) {
+        R ii2 = ii * ii;
+        R jj2 = jj * jj;
+        R iijj = ii * jj;
+        di = d0*ii2 + d1*jj2 + d2*iijj + d3*ii2*jj + d4*ii*jj2 + d5*ii2*ii + d6*jj2*jj;
+        dj = e0*ii2 + e1*jj2 + e2*iijj + e3*ii2*jj + e4*ii*jj2 + e5*ii2*ii + e6*jj2*jj;
+    }
+
+    /**
+     * @brief Projects a camera frame position vector into the image plane, given the parameters of the model;
+     * see PinholeCamera::project(). This is the same projection as projectVectors().
+     * @param params
+     *  Array of nParams parameters of the model, in the order returned by getParameters().
+     * @param r_cam
+     *  Array containing the three components of the camera frame position vector.
+     * @param ip
+     *  On exit, contains the distorted i image coordinate [pixels]
+     * @param jp
+     *  On exit, contains the distorted j image coordinate [pixels]
+     */
+    template<typename P, typename T, typename R>
+    static void project(const P * params, const T * r_cam, R & ip, R & jp) {
+
+        // Undistorted pixel coordinates relative to the distortion centre
+        R ii = params[0] * (r_cam[0] / r_cam[2]);
+        R jj = params[1] * (r_cam[1] / r_cam[2]);
+
+        // Apply distortion
+        R di, dj;
+        getDistortionOffset(params[4], params[5], params[6], params[7], params[8], params[9], params[10],
+                            params[11], params[12], params[13], params[14], params[15], params[16], params[17], ii, jj, di, dj);
+
+        ip = ii + params[2] + di;
+        jp = jj + params[3] + dj;
+    }
+
     PinholeCamera * convertToPinholeCamera() const;
 
     PinholeCameraWithRadialDistortion * convertToPinholeCameraWithRadialDistortion() const;
@@ -82,6 +146,11 @@ public:
 
     bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const;
 
+    void deprojectPixels(const double * i, const double * j, const unsigned int & n, double * x, double * y, double * z) const;
+
+    void projectVectors(const double * x, const double * y, const double * z, const unsigned int & n,
+                        double * i, double * j, unsigned char * visible) const;
+
     std::string getModelName() const;
 
     void init();
@@ -118,6 +187,15 @@ public:
      */
     void getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp, const double tol) const;
 
+    /**
+     * @brief Gets the fitted inverse of the distortion for the current parameters, fitting it if the parameters
+     * have changed since it was last used. This is a fast alternative to inverting the distortion iteratively.
+     *
+     * @return
+     *  The fitted inverse distortion polynomial.
+     */
+    std::shared_ptr<const InverseDistortionPolynomial> getInverseDistortionPolynomial() const;
+
     /**
      * @brief Get the partial derivatives of the distortion offset in (i,j) with respect to each of
      * the intrinsic parameters of the camera model.
@@ -167,6 +245,34 @@ public:
         this->init();
     }
 
+private:
+
+    /**
+     * @brief Computes the exact offset from the observed (distorted) pixel coordinate to the ideal (undistorted)
+     * pixel coordinate by Newton's method, falling back to getInverseDistortionOffset if that fails to converge.
+     *
+     * @param ip
+     *  The observed (distorted) pixel coordinate i^prime
+     * @param jp
+     *  The observed (distorted) pixel coordinate j^prime
+     * @param dip
+     *  On exit, contains the displacement to the ideal (undistorted) pixel coordinate i
+     * @param djp
+     *  On exit, contains the displacement to the ideal (undistorted) pixel coordinate j
+     */
+    void invertDistortion(const double &ip, const double &jp, double &dip, double &djp) const;
+
+    /**
+     * @brief The parameters and detector size when init() last updated the derived quantities.
+     */
+    std::vector<double> initParams;
+
+    /**
+     * @brief The fitted inverse distortion, or null if it needs to be fitted. This is accessed atomically so that
+     * it can be fitted on first use from const functions called in different threads.
+     */
+    mutable std::shared_ptr<const InverseDistortionPolynomial> inversePolynomial;
+
 };
 
 #endif // PINHOLECAMERAWITHRADIALDISTORTION_H
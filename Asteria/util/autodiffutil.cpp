@@ -0,0 +1,5 @@
+#include "util/autodiffutil.h"
+
+AutoDiffUtil::AutoDiffUtil() {
+
+}
@@ -0,0 +1,241 @@
+#ifndef AUTODIFFUTIL_H
+#define AUTODIFFUTIL_H
+
+#include "math/dual.h"
+#include "util/coordinateutil.h"
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The AutoDiffUtil class computes the partial derivatives of the (i,j) coordinates of a projected point
+ * with respect to the parameters of a camera model by forward mode automatic differentiation. The camera model
+ * type must provide the number of intrinsic parameters as a static constant nParams, and the projection from the
+ * CAM frame to the image as a static function templated on the scalar types of the parameters, the position vector
+ * and the result:
+ *
+ * template<typename P, typename T, typename R>
+ * static void project(const P * params, const T * r_cam, R & i, R & j);
+ *
+ * which is evaluated using Dual numbers in place of doubles. The partial derivatives are exact to rounding error,
+ * and a new camera model only needs to implement the projection to get them.
+ *
+ * The existing camera models use their hand-coded analytic partial derivatives, and this class is used to check them.
+ * Automatic differentiation is about as fast as the analytic partial derivatives for the radial distortion model, but
+ * slower for the pinhole and SIP models, by factors of about 1.6 and 2.5, because every operation carries the
+ * partial derivatives with respect to all the parameters whereas the analytic partial derivatives exploit the
+ * linearity of the SIP polynomials. It is faster than central finite differences for all three models; see
+ * TestUtil::testAutoDiffPartials().
+ */
+class AutoDiffUtil
+{
+public:
+    AutoDiffUtil();
+
+    /**
+     * @brief Rotates a position vector from the SEZ frame to the CAM frame. The rotation matrix is formed from the
+     * quaternion elements without assuming that they have unit norm, so that the partial derivatives with respect
+     * to them match those of CoordinateUtil::getSezToCamPartials.
+     * @param q
+     *  Array containing the (w,x,y,z) elements of the unit quaternion that rotates vectors from the SEZ frame to
+     * the CAM frame.
+     * @param r_sez
+     *  Position vector in the SEZ frame.
+     * @param r_cam
+     *  Array of three elements that on exit contains the position vector in the CAM frame.
+     */
+    template<typename T>
+    static void rotateSezToCam(const T * q, const Eigen::Vector3d & r_sez, T * r_cam) {
+
+        const T &q0 = q[0];
+        const T &q1 = q[1];
+        const T &q2 = q[2];
+        const T &q3 = q[3];
+
+        T q00 = q0 * q0;
+        T q11 = q1 * q1;
+        T q22 = q2 * q2;
+        T q33 = q3 * q3;
+        T q01 = q0 * q1;
+        T q02 = q0 * q2;
+        T q03 = q0 * q3;
+        T q12 = q1 * q2;
+        T q13 = q1 * q3;
+        T q23 = q2 * q3;
+
+        double x = r_sez[0];
+        double y = r_sez[1];
+        double z = r_sez[2];
+
+        r_cam[0] = (q00 + q11 - q22 - q33) * x + 2.0 * (q12 - q03) * y + 2.0 * (q13 + q02) * z;
+        r_cam[1] = 2.0 * (q12 + q03) * x + (q00 - q11 + q22 - q33) * y + 2.0 * (q23 - q01) * z;
+        r_cam[2] = 2.0 * (q13 - q02) * x + 2.0 * (q23 + q01) * y + (q00 - q11 - q22 + q33) * z;
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to each of the intrinsic parameters
+     * of the camera model; see CameraModelBase::getIntrinsicPartialDerivatives.
+     * @param cam
+     *  The camera model.
+     * @param derivs
+     *  Pointer to the start of the array of 2*Camera::nParams double values that on exit will contain the partial
+     * derivatives, interleaved as di/dp0, dj/dp0, di/dp1, ...
+     * @param r_cam
+     *  Position vector of the point in the CAM frame.
+     */
+    template<typename Camera>
+    static void getIntrinsicPartialDerivatives(const Camera & cam, double * derivs, const Eigen::Vector3d & r_cam) {
+
+        const int N = Camera::nParams;
+        typedef Dual<N> D;
+
+        double p[N];
+        cam.getParameters(p);
+
+        D params[N];
+        setIndependentVariables(p, params);
+
+        // The position vector is constant
+        D i, j;
+        Camera::project(params, r_cam.data(), i, j);
+
+        for(int k=0; k<N; k++) {
+            derivs[2*k + 0] = i.v[k];
+            derivs[2*k + 1] = j.v[k];
+        }
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to each of the four quaternion
+     * elements that specify the orientation of the camera; see CameraModelBase::getExtrinsicPartialDerivatives.
+     * @param cam
+     *  The camera model.
+     * @param derivs
+     *  Pointer to the start of the array of eight double values that on exit will contain the partial derivatives,
+     * interleaved as di/dq0, dj/dq0, di/dq1, ...
+     * @param r_sez
+     *  Position vector of the point in the SEZ frame.
+     * @param q_sez_cam
+     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
+     */
+    template<typename Camera>
+    static void getExtrinsicPartialDerivatives(const Camera & cam, double * derivs, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam) {
+
+        double p[Camera::nParams];
+        cam.getParameters(p);
+
+        Dual<4> r_cam[3];
+        getExtrinsicPartialDerivativesFromParameters<Camera>(p, derivs, r_sez, q_sez_cam, r_cam);
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to both the intrinsic and the
+     * extrinsic parameters; see CameraModelBase::getPartialDerivatives. The projection is evaluated once for
+     * each block of parameters, with the other held constant, which is cheaper than a single evaluation with
+     * respect to all of the parameters because the partial derivatives with respect to one block are not
+     * propagated through the operations that only depend on the other.
+     * @param cam
+     *  The camera model.
+     * @param intrinsic
+     *  Pointer to the start of the array of 2*Camera::nParams double values that on exit will contain the partial
+     * derivatives with respect to the intrinsic parameters.
+     * @param extrinsic
+     *  Pointer to the start of the array of eight double values that on exit will contain the partial derivatives
+     * with respect to the quaternion elements.
+     * @param r_sez
+     *  Position vector of the point in the SEZ frame.
+     * @param q_sez_cam
+     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
+     */
+    template<typename Camera>
+    static void getPartialDerivatives(const Camera & cam, double * intrinsic, double * extrinsic, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam) {
+
+        const int N = Camera::nParams;
+        typedef Dual<N> D;
+
+        double p[N];
+        cam.getParameters(p);
+
+        // Extrinsic parameters, which also gives the position vector in the CAM frame
+        Dual<4> r_cam[3];
+        getExtrinsicPartialDerivativesFromParameters<Camera>(p, extrinsic, r_sez, q_sez_cam, r_cam);
+
+        // Intrinsic parameters
+        D params[N];
+        setIndependentVariables(p, params);
+        double r[3] = {r_cam[0].a, r_cam[1].a, r_cam[2].a};
+
+        D i, j;
+        Camera::project(params, r, i, j);
+
+        for(int k=0; k<N; k++) {
+            intrinsic[2*k + 0] = i.v[k];
+            intrinsic[2*k + 1] = j.v[k];
+        }
+    }
+
+private:
+
+    /**
+     * @brief Sets each element of an array of Dual numbers to an independent variable, with the partial derivative
+     * with respect to itself equal to one. The elements are written in place rather than assigned from the
+     * Dual(value, index) constructor, because the compiler copies the temporaries through memory with loads that
+     * straddle the preceding stores, which doubles the cost of the intrinsic pass for the pinhole model.
+     * @param values
+     *  Array of N values of the variables.
+     * @param vars
+     *  Array of N Dual numbers that on exit contains the independent variables.
+     */
+    template<int N>
+    static void setIndependentVariables(const double * values, Dual<N> * vars) {
+        for(int k=0; k<N; k++) {
+            vars[k].a = values[k];
+            for(int l=0; l<N; l++) {
+                vars[k].v[l] = (l == k) ? 1.0 : 0.0;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to each of the four quaternion
+     * elements, given the parameters of the camera model, which are held constant. The rotation to the CAM frame
+     * is common to all camera models, so the partial derivatives of the position vector in the CAM frame are seeded
+     * from CoordinateUtil::getSezToCamPartials rather than propagated through the rotation.
+     * @param params
+     *  Array of Camera::nParams parameters of the camera model.
+     * @param derivs
+     *  Pointer to the start of the array of eight double values that on exit will contain the partial derivatives.
+     * @param r_sez
+     *  Position vector of the point in the SEZ frame.
+     * @param q_sez_cam
+     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
+     * @param r_cam
+     *  Array of three elements that on exit contains the position vector in the CAM frame and its partial
+     * derivatives with respect to the quaternion elements.
+     */
+    template<typename Camera>
+    static void getExtrinsicPartialDerivativesFromParameters(const double * params, double * derivs, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam, Dual<4> * r_cam) {
+
+        typedef Dual<4> D;
+
+        Eigen::Vector3d r = q_sez_cam.toRotationMatrix() * r_sez;
+        Eigen::Vector3d dr_cam_dq[4];
+        CoordinateUtil::getSezToCamPartials(r_sez, q_sez_cam, dr_cam_dq[0], dr_cam_dq[1], dr_cam_dq[2], dr_cam_dq[3]);
+
+        for(int c=0; c<3; c++) {
+            r_cam[c].a = r[c];
+            for(int k=0; k<4; k++) {
+                r_cam[c].v[k] = dr_cam_dq[k][c];
+            }
+        }
+
+        D i, j;
+        Camera::project(params, r_cam, i, j);
+
+        for(int k=0; k<4; k++) {
+            derivs[2*k + 0] = i.v[k];
+            derivs[2*k + 1] = j.v[k];
+        }
+    }
+};
+
+#endif // AUTODIFFUTIL_H
@@ -0,0 +1,202 @@
+#include "crossmatchutil.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+CrossMatchUtil::CrossMatchUtil() {
+
+}
+
+void CrossMatchUtil::crossMatch(const std::vector<Source> &sources, const std::vector<ReferenceStar> &stars, const double &threshold,
+                                std::vector<std::pair<unsigned int, unsigned int>> &matches) {
+
+    matches.clear();
+
+    if(sources.empty() || stars.empty()) {
+        return;
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //          Bin the reference stars into a grid          //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    double iMin = stars[0].i, iMax = stars[0].i;
+    double jMin = stars[0].j, jMax = stars[0].j;
+    for(const ReferenceStar &star : stars) {
+        iMin = std::min(iMin, star.i);
+        iMax = std::max(iMax, star.i);
+        jMin = std::min(jMin, star.j);
+        jMax = std::max(jMax, star.j);
+    }
+
+    // Cells are sized to hold about one star each
+    double cellSize = std::max(1.0, std::sqrt((iMax - iMin) * (jMax - jMin) / stars.size()));
+    int nCellsI = (int)((iMax - iMin) / cellSize) + 1;
+    int nCellsJ = (int)((jMax - jMin) / cellSize) + 1;
+
+    auto getCellI = [&](const double &i) {
+        return std::min(nCellsI - 1, std::max(0, (int)std::floor((i - iMin) / cellSize)));
+    };
+    auto getCellJ = [&](const double &j) {
+        return std::min(nCellsJ - 1, std::max(0, (int)std::floor((j - jMin) / cellSize)));
+    };
+
+    // Star indices sorted by cell; the stars in cell c are cellStars[cellStart[c]] to cellStars[cellStart[c+1]-1],
+    // in order of index
+    std::vector<unsigned int> cellStart(nCellsI * nCellsJ + 1, 0u);
+    std::vector<unsigned int> starCell(stars.size());
+    for(unsigned int s = 0; s < stars.size(); s++) {
+        starCell[s] = getCellJ(stars[s].j) * nCellsI + getCellI(stars[s].i);
+        cellStart[starCell[s] + 1]++;
+    }
+    for(unsigned int c = 0; c < cellStart.size() - 1; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    std::vector<unsigned int> cellStars(stars.size());
+    std::vector<unsigned int> cellFill(cellStart.begin(), cellStart.end() - 1);
+    for(unsigned int s = 0; s < stars.size(); s++) {
+        cellStars[cellFill[starCell[s]]++] = s;
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //         Match each source to the closest star         //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Only separations below the threshold matter: if the closest star to a source lies within it then so
+    // does the closest source to that star. Ties go to the lowest index.
+
+    std::vector<int> closestStar(sources.size(), -1);
+    std::vector<int> closestSource(stars.size(), -1);
+    std::vector<double> closestSourceSep(stars.size(), std::numeric_limits<double>::infinity());
+
+    for(unsigned int s1 = 0; s1 < sources.size(); s1++) {
+
+        const Source &source = sources[s1];
+
+        // Inverse of the dispersion matrix [a b; b c]
+        double a = source.c_ii;
+        double b = source.c_ij;
+        double c = source.c_jj;
+        double det = a * c - b * b;
+        if(!(det > 0.0) || !(a > 0.0)) {
+            continue;
+        }
+        double inv_a = c / det;
+        double inv_b = -b / det;
+        double inv_c = a / det;
+
+        // The separation is at least the distance in pixels divided by the square root of the largest
+        // eigenvalue, which limits the search to a square around the source
+        double tr = a + c;
+        double l1 = tr / 2.0 + std::sqrt(std::max(0.0, tr * tr / 4.0 - det));
+        double reach = threshold * std::sqrt(l1);
+
+        int ciMin = getCellI(source.i - reach);
+        int ciMax = getCellI(source.i + reach);
+        int cjMin = getCellJ(source.j - reach);
+        int cjMax = getCellJ(source.j + reach);
+
+        double minSep = std::numeric_limits<double>::infinity();
+
+        for(int cj = cjMin; cj <= cjMax; cj++) {
+            for(int ci = ciMin; ci <= ciMax; ci++) {
+                unsigned int cell = cj * nCellsI + ci;
+                for(unsigned int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+
+                    unsigned int s2 = cellStars[k];
+                    double di = source.i - stars[s2].i;
+                    double dj = source.j - stars[s2].j;
+                    double sep = std::sqrt(inv_a * di * di + 2.0 * inv_b * di * dj + inv_c * dj * dj);
+
+                    if(sep > threshold) {
+                        continue;
+                    }
+
+                    if(sep < minSep || (sep == minSep && (int)s2 < closestStar[s1])) {
+                        minSep = sep;
+                        closestStar[s1] = s2;
+                    }
+
+                    // Sources are processed in order of index, so ties keep the first
+                    if(sep < closestSourceSep[s2]) {
+                        closestSourceSep[s2] = sep;
+                        closestSource[s2] = s1;
+                    }
+                }
+            }
+        }
+    }
+
+    // A match is a source and star that are the closest to each other
+    for(unsigned int s1 = 0; s1 < sources.size(); s1++) {
+        if(closestStar[s1] >= 0 && closestSource[closestStar[s1]] == (int)s1) {
+            matches.push_back(std::pair<unsigned int, unsigned int>(s1, closestStar[s1]));
+        }
+    }
+}
+
+void CrossMatchUtil::crossMatchDirect(const std::vector<Source> &sources, const std::vector<ReferenceStar> &stars, const double &threshold,
+                                      std::vector<std::pair<unsigned int, unsigned int>> &matches) {
+
+    matches.clear();
+
+    // Compute the covariance-weighted separations of all pairs of sources and reference stars
+    std::vector<double> covWeightedSep(sources.size() * stars.size());
+    for(unsigned int s1=0; s1<sources.size(); s1++) {
+
+        const Source * source = &(sources[s1]);
+        Matrix2d s;
+        s << source->c_ii, source->c_ij, source->c_ij, source->c_jj;
+
+        for(unsigned int s2=0; s2<stars.size(); s2++) {
+
+            const ReferenceStar * testStar = &(stars[s2]);
+            MatrixXd r(2,1);
+            r << source->i - testStar->i, source->j - testStar->j;
+
+            covWeightedSep[s1 * stars.size() + s2] = std::sqrt((r.transpose() * s.colPivHouseholderQr().solve(r))(0,0));
+        }
+    }
+
+    for(unsigned int s1=0; s1<sources.size(); s1++) {
+
+        // Locate the closest reference star to source s1
+        unsigned int closestStarIdx = 0;
+        double minSep = 2.0 * threshold;
+        for(unsigned int s2=0; s2<stars.size(); s2++) {
+            if(covWeightedSep[s1 * stars.size() + s2] < minSep) {
+                minSep = covWeightedSep[s1 * stars.size() + s2];
+                closestStarIdx = s2;
+            }
+        }
+
+        if(minSep > threshold) {
+            // The closest reference star is too far away to be a positive match
+            continue;
+        }
+
+        // Find the closest source to this reference star
+        minSep = 2.0 * threshold;
+        unsigned int closestSourceIdx = 0;
+        for(unsigned int s2=0; s2<sources.size(); s2++) {
+            if(covWeightedSep[s2 * stars.size() + closestStarIdx] < minSep) {
+                minSep = covWeightedSep[s2 * stars.size() + closestStarIdx];
+                closestSourceIdx = s2;
+            }
+        }
+
+        // If the closest source to this reference star is the original source, then we have a match
+        if(closestSourceIdx == s1) {
+            matches.push_back(std::pair<unsigned int, unsigned int>(s1, closestStarIdx));
+        }
+    }
+}
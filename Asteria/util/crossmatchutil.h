@@ -0,0 +1,59 @@
+#ifndef CROSSMATCHUTIL_H
+#define CROSSMATCHUTIL_H
+
+#include "infra/source.h"
+#include "infra/referencestar.h"
+
+#include <vector>
+#include <utility>
+
+/**
+ * @brief Provides the spatial cross-matching of the sources detected in the calibration image to the
+ * reference stars projected into it.
+ *
+ * The separation of a source and a star is weighted by the dispersion matrix of the source, i.e. it is the
+ * Mahalanobis distance sqrt(r^T S^{-1} r) of the star from the source centroid. A source and a star are a
+ * match if the star is the closest to the source, the source is the closest to the star, and the separation
+ * lies below a threshold.
+ *
+ * The reference stars are binned into a uniform grid over their image positions, and each source looks up
+ * only the stars in the cells within reach of the threshold, so the cost is roughly linear in the number of
+ * sources and stars rather than proportional to their product.
+ */
+class CrossMatchUtil
+{
+public:
+    CrossMatchUtil();
+
+    /**
+     * @brief Cross-matches sources and reference stars using the grid of reference star positions.
+     * @param sources
+     *  The sources detected in the image; the dispersion matrix of each must be positive definite.
+     * @param stars
+     *  The reference stars, with their positions in the image.
+     * @param threshold
+     *  The largest covariance-weighted separation of a source and star that can be a match [sigmas]
+     * @param matches
+     *  On exit, contains the indices of the matching source and star of each match, in order of source index.
+     */
+    static void crossMatch(const std::vector<Source> &sources, const std::vector<ReferenceStar> &stars, const double &threshold,
+                           std::vector<std::pair<unsigned int, unsigned int>> &matches);
+
+    /**
+     * @brief Cross-matches sources and reference stars by computing the separation of every pair. Produces
+     * the same matches as crossMatch, but is much slower for large numbers of sources and stars; used as a
+     * reference for testing.
+     * @param sources
+     *  The sources detected in the image; the dispersion matrix of each must be positive definite.
+     * @param stars
+     *  The reference stars, with their positions in the image.
+     * @param threshold
+     *  The largest covariance-weighted separation of a source and star that can be a match [sigmas]
+     * @param matches
+     *  On exit, contains the indices of the matching source and star of each match, in order of source index.
+     */
+    static void crossMatchDirect(const std::vector<Source> &sources, const std::vector<ReferenceStar> &stars, const double &threshold,
+                                 std::vector<std::pair<unsigned int, unsigned int>> &matches);
+};
+
+#endif // CROSSMATCHUTIL_H
@@ -0,0 +1,108 @@
+#include "util/distortionutil.h"
+
+#include <cmath>
+#include <algorithm>
+
+DistortionUtil::DistortionUtil() {
+
+}
+
+bool DistortionUtil::invertDistortion(const DistortionOffset &forward, const double &ip, const double &jp, double &i, double &j) {
+
+    // Step used to compute the Jacobian by finite differences [pixels]
+    const double h = 0.001;
+
+    // Convergence threshold on the difference between the observed point and the distorted ideal point [pixels]
+    const double tol = 1e-8;
+
+    const unsigned int maxIterations = 50;
+
+    for(unsigned int k = 0; k < maxIterations; k++) {
+
+        double di, dj;
+        forward(i, j, di, dj);
+
+        double ri = i + di - ip;
+        double rj = j + dj - jp;
+
+        if(!std::isfinite(ri) || !std::isfinite(rj)) {
+            return false;
+        }
+        if(ri * ri + rj * rj < tol * tol) {
+            return true;
+        }
+
+        // Jacobian of the distorted coordinates with respect to the undistorted ones
+        double di_i, dj_i, di_j, dj_j;
+        forward(i + h, j, di_i, dj_i);
+        forward(i, j + h, di_j, dj_j);
+
+        double a = 1.0 + (di_i - di) / h;
+        double b = (di_j - di) / h;
+        double c = (dj_i - dj) / h;
+        double d = 1.0 + (dj_j - dj) / h;
+        double det = a * d - b * c;
+
+        if(det == 0.0 || !std::isfinite(det)) {
+            return false;
+        }
+
+        i -= ( d * ri - b * rj) / det;
+        j -= (-c * ri + a * rj) / det;
+    }
+
+    return false;
+}
+
+double DistortionUtil::getMaxUndistortedRadius(const unsigned int &width, const unsigned int &height, const double &pi, const double &pj,
+                                               const DistortionOffset &inverse) {
+
+    // Step between the initial samples along each edge [pixels]
+    const unsigned int step = 8;
+
+    auto getRadius = [&](const double &ip, const double &jp) {
+        double dip, djp;
+        inverse(ip, jp, dip, djp);
+        double i = ip + dip;
+        double j = jp + djp;
+        return std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj));
+    };
+
+    // Start point, direction and length of the top, bottom, left and right edges
+    double i0[4] = {0.0, 0.0, 0.0, (double)width};
+    double j0[4] = {0.0, (double)height, 0.0, 0.0};
+    double di[4] = {1.0, 1.0, 0.0, 0.0};
+    double dj[4] = {0.0, 0.0, 1.0, 1.0};
+    unsigned int length[4] = {width, width, height, height};
+
+    double r_max = 0.0;
+
+    for(unsigned int e = 0; e < 4; e++) {
+
+        unsigned int best = 0;
+        double bestR = -1.0;
+
+        for(unsigned int t = 0; ; t += step) {
+            unsigned int tt = std::min(t, length[e]);
+            double r = getRadius(i0[e] + tt * di[e], j0[e] + tt * dj[e]);
+            if(r > bestR) {
+                bestR = r;
+                best = tt;
+            }
+            if(tt == length[e]) {
+                break;
+            }
+        }
+
+        // Refine around the most distant sample
+        unsigned int tMin = (best >= step) ? best - step + 1 : 0;
+        unsigned int tMax = std::min(length[e], best + step - 1);
+        for(unsigned int t = tMin; t <= tMax; t++) {
+            bestR = std::max(bestR, getRadius(i0[e] + t * di[e], j0[e] + t * dj[e]));
+        }
+
+        r_max = std::max(r_max, bestR);
+    }
+
+    return r_max;
+}
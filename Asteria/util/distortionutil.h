@@ -0,0 +1,58 @@
+#ifndef DISTORTIONUTIL_H
+#define DISTORTIONUTIL_H
+
+#include <functional>
+
+/**
+ * @brief The DistortionUtil class provides functions for inverting the distortion models of the cameras.
+ */
+class DistortionUtil
+{
+public:
+
+    DistortionUtil();
+
+    /**
+     * @brief Function computing a distortion offset (di,dj) at the pixel coordinate (i,j).
+     */
+    typedef std::function<void(const double &i, const double &j, double &di, double &dj)> DistortionOffset;
+
+    /**
+     * @brief Inverts a distortion model at a single point by Newton's method, with the Jacobian of the forward
+     * distortion computed by finite differences. This converges in a few iterations even for strong distortion.
+     * @param forward
+     *  The forward distortion offset, from the ideal (undistorted) to the observed (distorted) pixel coordinates.
+     * @param ip
+     *  The observed (distorted) pixel coordinate i^prime
+     * @param jp
+     *  The observed (distorted) pixel coordinate j^prime
+     * @param i
+     *  On entry, contains the initial guess for the ideal (undistorted) pixel coordinate i; on exit, contains the solution.
+     * @param j
+     *  On entry, contains the initial guess for the ideal (undistorted) pixel coordinate j; on exit, contains the solution.
+     * @return
+     *  True if the inversion converged to within 1e-8 pixels.
+     */
+    static bool invertDistortion(const DistortionOffset &forward, const double &ip, const double &jp, double &i, double &j);
+
+    /**
+     * @brief Finds the largest radial distance of an undistorted point on the image border from the distortion centre.
+     * Each edge of the image is sampled every few pixels, then at every pixel around the most distant sample.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param pi
+     *  Coordinate of the distortion centre in the i (horizontal) direction [pixels]
+     * @param pj
+     *  Coordinate of the distortion centre in the j (vertical) direction [pixels]
+     * @param inverse
+     *  The inverse distortion offset, from the observed (distorted) to the ideal (undistorted) pixel coordinates.
+     * @return
+     *  The largest radial distance [pixels]
+     */
+    static double getMaxUndistortedRadius(const unsigned int &width, const unsigned int &height, const double &pi, const double &pj,
+                                          const DistortionOffset &inverse);
+};
+
+#endif // DISTORTIONUTIL_H
@@ -0,0 +1,209 @@
+#include "framediffutil.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define FRAMEDIFF_HAVE_AVX2
+#endif
+
+FrameDiffUtil::FrameDiffUtil() {
+
+}
+
+/**
+ * @brief Signature of the functions that difference a run of (up to) 64 consecutive pixels and
+ * pack the results into bitmask words.
+ */
+typedef void (*WordKernel)(const unsigned char * cur, const unsigned char * prev, const unsigned char thresh,
+                           const unsigned int n, uint64_t &pos, uint64_t &neg);
+
+/**
+ * @brief Scalar kernel; handles any number of pixels up to 64.
+ */
+static void differenceWordScalar(const unsigned char * cur, const unsigned char * prev, const unsigned char thresh,
+                                 const unsigned int n, uint64_t &pos, uint64_t &neg) {
+    pos = 0ull;
+    neg = 0ull;
+    for(unsigned int b = 0; b < n; b++) {
+        int d = (int)cur[b] - (int)prev[b];
+        pos |= (uint64_t)(d > (int)thresh) << b;
+        neg |= (uint64_t)(-d > (int)thresh) << b;
+    }
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief SSE2 kernel; processes 64 pixels as four 16-byte vectors. Falls back to the scalar kernel
+ * for the partial word at the end of a row.
+ */
+static void differenceWordSse2(const unsigned char * cur, const unsigned char * prev, const unsigned char thresh,
+                               const unsigned int n, uint64_t &pos, uint64_t &neg) {
+    if(n < 64u) {
+        differenceWordScalar(cur, prev, thresh, n, pos, neg);
+        return;
+    }
+    const __m128i t = _mm_set1_epi8((char)thresh);
+    const __m128i zero = _mm_setzero_si128();
+    pos = 0ull;
+    neg = 0ull;
+    for(unsigned int k = 0; k < 4u; k++) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur + 16u * k));
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prev + 16u * k));
+        // Saturating differences in each sense; x > t is equivalent to (x -sat t) != 0
+        __m128i dPos = _mm_subs_epu8(_mm_subs_epu8(c, p), t);
+        __m128i dNeg = _mm_subs_epu8(_mm_subs_epu8(p, c), t);
+        uint64_t mPos = (~_mm_movemask_epi8(_mm_cmpeq_epi8(dPos, zero))) & 0xFFFF;
+        uint64_t mNeg = (~_mm_movemask_epi8(_mm_cmpeq_epi8(dNeg, zero))) & 0xFFFF;
+        pos |= mPos << (16u * k);
+        neg |= mNeg << (16u * k);
+    }
+}
+#endif
+
+#if defined(FRAMEDIFF_HAVE_AVX2)
+/**
+ * @brief AVX2 kernel; processes 64 pixels as two 32-byte vectors. Compiled for AVX2 regardless of the
+ * global compiler flags, and only selected if the CPU supports it.
+ */
+__attribute__((target("avx2")))
+static void differenceWordAvx2(const unsigned char * cur, const unsigned char * prev, const unsigned char thresh,
+                               const unsigned int n, uint64_t &pos, uint64_t &neg) {
+    if(n < 64u) {
+        differenceWordScalar(cur, prev, thresh, n, pos, neg);
+        return;
+    }
+    const __m256i t = _mm256_set1_epi8((char)thresh);
+    const __m256i zero = _mm256_setzero_si256();
+    pos = 0ull;
+    neg = 0ull;
+    for(unsigned int k = 0; k < 2u; k++) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cur + 32u * k));
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(prev + 32u * k));
+        __m256i dPos = _mm256_subs_epu8(_mm256_subs_epu8(c, p), t);
+        __m256i dNeg = _mm256_subs_epu8(_mm256_subs_epu8(p, c), t);
+        uint64_t mPos = (uint32_t)(~_mm256_movemask_epi8(_mm256_cmpeq_epi8(dPos, zero)));
+        uint64_t mNeg = (uint32_t)(~_mm256_movemask_epi8(_mm256_cmpeq_epi8(dNeg, zero)));
+        pos |= mPos << (32u * k);
+        neg |= mNeg << (32u * k);
+    }
+}
+#endif
+
+/**
+ * @brief Computes the sum of the positions of the set bits in the word, using one population count
+ * per bit of the position index.
+ */
+static inline unsigned int bitPositionSum(const uint64_t &bits) {
+    return      __builtin_popcountll(bits & 0xAAAAAAAAAAAAAAAAull)
+         + 2u * __builtin_popcountll(bits & 0xCCCCCCCCCCCCCCCCull)
+         + 4u * __builtin_popcountll(bits & 0xF0F0F0F0F0F0F0F0ull)
+         + 8u * __builtin_popcountll(bits & 0xFF00FF00FF00FF00ull)
+         + 16u * __builtin_popcountll(bits & 0xFFFF0000FFFF0000ull)
+         + 32u * __builtin_popcountll(bits & 0xFFFFFFFF00000000ull);
+}
+
+/**
+ * @brief Drives the given word kernel over the whole image, storing the bitmaps and accumulating the
+ * counts, bounding box and moments of the changed pixels from the packed words.
+ */
+static void differenceImage(const ImageData<unsigned char>::type &current, const ImageData<unsigned char>::type &previous,
+                            const unsigned int &width, const unsigned int &height, const unsigned int &threshold,
+                            FrameDifference &diff, WordKernel kernel) {
+
+    diff.reset(width, height);
+
+    // Absolute differences can't exceed 255, so larger thresholds can be clamped
+    const unsigned char thresh = (unsigned char)std::min(threshold, 255u);
+
+    const unsigned char * pCur = current.data();
+    const unsigned char * pPrev = previous.data();
+
+    for(unsigned int y = 0; y < height; y++) {
+
+        unsigned int nRow = 0u;
+
+        for(unsigned int w = 0; w < diff.wordsPerRow; w++) {
+
+            unsigned int x0 = w * 64u;
+            unsigned int n = std::min(64u, width - x0);
+            unsigned int offset = y * width + x0;
+
+            uint64_t pos, neg;
+            kernel(pCur + offset, pPrev + offset, thresh, n, pos, neg);
+
+            diff.positiveMask[y * diff.wordsPerRow + w] = pos;
+            diff.negativeMask[y * diff.wordsPerRow + w] = neg;
+
+            uint64_t any = pos | neg;
+            if(!any) {
+                continue;
+            }
+
+            unsigned int nPos = __builtin_popcountll(pos);
+            unsigned int nNeg = __builtin_popcountll(neg);
+            unsigned int nAny = nPos + nNeg;
+
+            diff.nPositive += nPos;
+            diff.nNegative += nNeg;
+            nRow += nAny;
+
+            diff.bb_xmin = std::min(diff.bb_xmin, x0 + __builtin_ctzll(any));
+            diff.bb_xmax = std::max(diff.bb_xmax, x0 + 63u - __builtin_clzll(any));
+            diff.sum_x += (unsigned long long)nAny * x0 + bitPositionSum(any);
+        }
+
+        if(nRow > 0u) {
+            diff.nChangedPixels += nRow;
+            diff.bb_ymin = std::min(diff.bb_ymin, y);
+            diff.bb_ymax = y;
+            diff.sum_y += (unsigned long long)nRow * y;
+        }
+    }
+}
+
+#if defined(FRAMEDIFF_HAVE_AVX2)
+/**
+ * @brief Checks once whether the CPU supports AVX2.
+ */
+static bool cpuHasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+void FrameDiffUtil::computeDifference(const ImageData<unsigned char>::type &current, const ImageData<unsigned char>::type &previous,
+                                      const unsigned int &width, const unsigned int &height, const unsigned int &threshold, FrameDifference &diff) {
+#if defined(FRAMEDIFF_HAVE_AVX2)
+    if(cpuHasAvx2()) {
+        differenceImage(current, previous, width, height, threshold, diff, differenceWordAvx2);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    differenceImage(current, previous, width, height, threshold, diff, differenceWordSse2);
+#else
+    differenceImage(current, previous, width, height, threshold, diff, differenceWordScalar);
+#endif
+}
+
+void FrameDiffUtil::computeDifferenceScalar(const ImageData<unsigned char>::type &current, const ImageData<unsigned char>::type &previous,
+                                            const unsigned int &width, const unsigned int &height, const unsigned int &threshold, FrameDifference &diff) {
+    differenceImage(current, previous, width, height, threshold, diff, differenceWordScalar);
+}
+
+const char * FrameDiffUtil::getKernelName() {
+#if defined(FRAMEDIFF_HAVE_AVX2)
+    if(cpuHasAvx2()) {
+        return "AVX2";
+    }
+#endif
+#if defined(__SSE2__)
+    return "SSE2";
+#else
+    return "Scalar";
+#endif
+}
@@ -0,0 +1,67 @@
+#ifndef FRAMEDIFFUTIL_H
+#define FRAMEDIFFUTIL_H
+
+#include "infra/framedifference.h"
+#include "infra/image.h"
+
+#include <vector>
+
+/**
+ * @brief Provides the fused frame differencing kernel used for event detection. A single pass over
+ * the two images counts the pixels whose brightness changed by more than the threshold, records them
+ * in packed bitmaps and accumulates the bounding box and first moments of the changed pixels.
+ *
+ * On x86 the kernel is vectorised using AVX2 when the CPU supports it (detected at runtime) or SSE2
+ * otherwise, with a portable scalar implementation used on other platforms and for testing.
+ */
+class FrameDiffUtil
+{
+public:
+    FrameDiffUtil();
+
+    /**
+     * @brief Differences two images using the fastest kernel available on this CPU.
+     * @param current
+     *  The pixels of the current image.
+     * @param previous
+     *  The pixels of the previous image.
+     * @param width
+     *  Width of the images [pixels]
+     * @param height
+     *  Height of the images [pixels]
+     * @param threshold
+     *  Pixels are considered to have changed if the absolute difference exceeds this value [ADU]
+     * @param diff
+     *  On exit, contains the results of the differencing.
+     */
+    static void computeDifference(const ImageData<unsigned char>::type &current, const ImageData<unsigned char>::type &previous,
+                                  const unsigned int &width, const unsigned int &height, const unsigned int &threshold, FrameDifference &diff);
+
+    /**
+     * @brief Differences two images using the portable scalar kernel. Produces identical results to
+     * computeDifference; used as the fallback and as a reference for testing.
+     * @param current
+     *  The pixels of the current image.
+     * @param previous
+     *  The pixels of the previous image.
+     * @param width
+     *  Width of the images [pixels]
+     * @param height
+     *  Height of the images [pixels]
+     * @param threshold
+     *  Pixels are considered to have changed if the absolute difference exceeds this value [ADU]
+     * @param diff
+     *  On exit, contains the results of the differencing.
+     */
+    static void computeDifferenceScalar(const ImageData<unsigned char>::type &current, const ImageData<unsigned char>::type &previous,
+                                        const unsigned int &width, const unsigned int &height, const unsigned int &threshold, FrameDifference &diff);
+
+    /**
+     * @brief Gets the name of the kernel selected by computeDifference on this CPU.
+     * @return
+     *  One of "AVX2", "SSE2" or "Scalar".
+     */
+    static const char * getKernelName();
+};
+
+#endif // FRAMEDIFFUTIL_H
@@ -0,0 +1,126 @@
+#include "jpgdecodepool.h"
+#include "util/jpgdecoder.h"
+
+#include <cstring>
+
+JpgDecodePool::JpgDecodePool(unsigned int nThreads) : nThreads(nThreads), stop(false) {
+    for(unsigned int t = 0; t < nThreads; t++) {
+        workers.push_back(std::thread(&JpgDecodePool::work, this));
+    }
+}
+
+JpgDecodePool::~JpgDecodePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobSubmitted.notify_all();
+    for(unsigned int t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+void JpgDecodePool::submit(const unsigned char *buffer, const unsigned long insize, std::shared_ptr<Imageuc> image,
+                           bool newSequence, const AcquisitionVideoStats &stats) {
+
+    std::shared_ptr<Job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!spareJobs.empty()) {
+            job = spareJobs.back();
+            spareJobs.pop_back();
+        }
+    }
+    if(!job) {
+        job = std::make_shared<Job>();
+    }
+
+    // Copy the compressed data; the buffer only grows, so it's reused between frames
+    if(job->data.size() < insize) {
+        job->data.resize(insize);
+    }
+    memcpy(job->data.data(), buffer, insize);
+    job->insize = insize;
+    job->image = image;
+    job->newSequence = newSequence;
+    job->stats = stats;
+    job->done = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+        todo.push_back(job);
+    }
+    jobSubmitted.notify_one();
+}
+
+bool JpgDecodePool::next(std::shared_ptr<Imageuc> &image, bool wait) {
+    bool newSequence;
+    AcquisitionVideoStats stats;
+    return next(image, newSequence, stats, wait);
+}
+
+bool JpgDecodePool::next(std::shared_ptr<Imageuc> &image, bool &newSequence, AcquisitionVideoStats &stats, bool wait) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if(jobs.empty()) {
+        return false;
+    }
+
+    if(wait) {
+        jobDone.wait(lock, [this]{ return jobs.front()->done; });
+    }
+    else if(!jobs.front()->done) {
+        return false;
+    }
+
+    std::shared_ptr<Job> job = jobs.front();
+    jobs.pop_front();
+    image = job->decoded ? job->image : std::shared_ptr<Imageuc>();
+    newSequence = job->newSequence;
+    stats = job->stats;
+    job->image.reset();
+    spareJobs.push_back(job);
+    return true;
+}
+
+unsigned int JpgDecodePool::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size();
+}
+
+void JpgDecodePool::flush() {
+    std::shared_ptr<Imageuc> image;
+    while(next(image, true)) {
+        image.reset();
+    }
+}
+
+void JpgDecodePool::work() {
+
+    JpgDecoder decoder;
+
+    while(true) {
+
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobSubmitted.wait(lock, [this]{ return stop || !todo.empty(); });
+            if(stop) {
+                return;
+            }
+            job = todo.front();
+            todo.pop_front();
+        }
+
+        bool decoded = decoder.decode(job->data.data(), job->insize, job->image->width, job->image->height, job->image->rawImage);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job->decoded = decoded;
+            job->done = true;
+        }
+        jobDone.notify_all();
+    }
+}
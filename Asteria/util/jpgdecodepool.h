@@ -0,0 +1,150 @@
+#ifndef JPGDECODEPOOL_H
+#define JPGDECODEPOOL_H
+
+#include "infra/imageuc.h"
+#include "infra/acquisitionvideostats.h"
+
+#include <vector>
+#include <deque>
+#include <memory>               // shared_ptr
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Small pool of worker threads that decode JPEG frames in parallel while preserving their order,
+ * so that MJPEG cameras can run at frame rates that a single core can't decode.
+ *
+ * Frames are submitted in capture order along with the image to decode them into; the compressed
+ * data is copied so that the camera buffer can be re-queued immediately. Decoded images are retrieved
+ * in the same order that they were submitted, along with the sequence flag and statistics of the
+ * captured frame, as these lag the most recently captured frame. Each worker has its own JpgDecoder, and the job storage
+ * is recycled so that submitting a frame does not allocate once the pool has warmed up.
+ */
+class JpgDecodePool
+{
+
+public:
+
+    /**
+     * @brief Main constructor.
+     * @param nThreads
+     *  The number of decode worker threads.
+     */
+    JpgDecodePool(unsigned int nThreads);
+
+    ~JpgDecodePool();
+
+    /**
+     * @brief Submits a frame for decoding.
+     * @param buffer
+     *  Pointer to the start of the memory buffer containing the JPEG image data; this is copied.
+     * @param insize
+     *  Length of the JPEG image data [bytes].
+     * @param image
+     *  The image to decode the frame into.
+     * @param newSequence
+     *  Indicates that the frame is the first of a new sequence; returned with the decoded image.
+     * @param stats
+     *  The statistics of the captured frame; returned with the decoded image.
+     */
+    void submit(const unsigned char *buffer, const unsigned long insize, std::shared_ptr<Imageuc> image,
+                bool newSequence = false, const AcquisitionVideoStats &stats = AcquisitionVideoStats());
+
+    /**
+     * @brief Retrieves the next decoded image, in submission order.
+     * @param image
+     *  On exit, contains the next decoded image (if available). This is null if the frame couldn't be decoded,
+     * because it was corrupt, truncated or of the wrong size; the image it was to be decoded into has been
+     * returned to its pool, and the frame should be dropped.
+     * @param wait
+     *  If true, blocks until the next image has been decoded; otherwise returns immediately.
+     * @return
+     *  True if an image was retrieved; false if there are no images pending or (when not waiting)
+     * the next image hasn't finished decoding yet.
+     */
+    bool next(std::shared_ptr<Imageuc> &image, bool wait);
+
+    /**
+     * @brief Retrieves the next decoded image, in submission order, along with the sequence flag and statistics
+     * that were submitted with it; see next(std::shared_ptr<Imageuc> &, bool).
+     * @param image
+     *  On exit, contains the next decoded image (if available), or null if the frame couldn't be decoded.
+     * @param newSequence
+     *  On exit, contains the sequence flag submitted with the frame.
+     * @param stats
+     *  On exit, contains the statistics submitted with the frame.
+     * @param wait
+     *  If true, blocks until the next image has been decoded; otherwise returns immediately.
+     * @return
+     *  True if an image was retrieved.
+     */
+    bool next(std::shared_ptr<Imageuc> &image, bool &newSequence, AcquisitionVideoStats &stats, bool wait);
+
+    /**
+     * @brief Gets the number of frames submitted but not yet retrieved.
+     * @return
+     *  The number of pending frames.
+     */
+    unsigned int pending();
+
+    /**
+     * @brief Waits for all pending frames to be decoded then discards them.
+     */
+    void flush();
+
+    /**
+     * @brief The number of decode worker threads.
+     */
+    const unsigned int nThreads;
+
+private:
+
+    /**
+     * @brief A single frame to be decoded.
+     */
+    struct Job {
+        std::vector<unsigned char> data;
+        unsigned long insize;
+        std::shared_ptr<Imageuc> image;
+        bool newSequence;
+        AcquisitionVideoStats stats;
+        bool decoded;
+        bool done;
+    };
+
+    void work();
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+
+    /**
+     * @brief Signalled when a new job is submitted, or on shutdown.
+     */
+    std::condition_variable jobSubmitted;
+
+    /**
+     * @brief Signalled when a job has been decoded.
+     */
+    std::condition_variable jobDone;
+
+    /**
+     * @brief All jobs submitted but not yet retrieved, in submission order.
+     */
+    std::deque<std::shared_ptr<Job>> jobs;
+
+    /**
+     * @brief The jobs waiting for a worker.
+     */
+    std::deque<std::shared_ptr<Job>> todo;
+
+    /**
+     * @brief Recycled jobs, whose data buffers can be reused.
+     */
+    std::vector<std::shared_ptr<Job>> spareJobs;
+
+    bool stop;
+};
+
+#endif // JPGDECODEPOOL_H
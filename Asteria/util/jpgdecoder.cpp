@@ -0,0 +1,67 @@
+#include "jpgdecoder.h"
+
+#include <algorithm>
+
+JpgDecoder::JpgDecoder() {
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    jpeg_create_decompress(&cinfo);
+}
+
+JpgDecoder::~JpgDecoder() {
+    jpeg_destroy_decompress(&cinfo);
+}
+
+void JpgDecoder::errorExit(j_common_ptr cinfo) {
+    ErrorManager * err = (ErrorManager *) cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmpBuffer, 1);
+}
+
+bool JpgDecoder::decode(unsigned char *buffer, const unsigned long insize, const unsigned int &width, const unsigned int &height,
+                        ImageData<unsigned char>::type &decodedImage) {
+
+    if(setjmp(jerr.setjmpBuffer)) {
+        // libjpeg signalled an error; reset the decompressor so it can be reused for the next frame
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+
+    // libjpeg only warns about truncated or corrupt entropy-coded data, and fills in the missing pixels
+    jerr.pub.num_warnings = 0;
+
+    // Read JPEG from memory buffer
+    jpeg_mem_src(&cinfo, buffer, insize);
+
+    (void) jpeg_read_header(&cinfo, TRUE);
+
+    // Only decode the luminance channel
+    cinfo.out_color_space = JCS_GRAYSCALE;
+
+    (void) jpeg_start_decompress(&cinfo);
+
+    // Frames that don't match the configured image size can't be written into it
+    if(cinfo.output_width != width || cinfo.output_height != height || decodedImage.size() < width * height) {
+        fprintf(stderr, "JPEG frame size %dx%d doesn't match the image size %dx%d\n", cinfo.output_width, cinfo.output_height, width, height);
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+
+    // Request a whole MCU row of scanlines per call, rather than one at a time, and have libjpeg write
+    // them straight to the output image
+    rows.resize(std::max(cinfo.max_v_samp_factor * DCTSIZE, cinfo.rec_outbuf_height));
+
+    while (cinfo.output_scanline < height) {
+        unsigned int first = cinfo.output_scanline;
+        unsigned int nRows = std::min((unsigned int)rows.size(), height - first);
+        for(unsigned int r = 0; r < nRows; r++) {
+            rows[r] = &decodedImage[(first + r) * width];
+        }
+        (void) jpeg_read_scanlines(&cinfo, rows.data(), nRows);
+    }
+
+    (void) jpeg_finish_decompress(&cinfo);
+
+    // Reject frames with missing or corrupt data rather than returning partially decoded pixels
+    return (jerr.pub.num_warnings == 0);
+}
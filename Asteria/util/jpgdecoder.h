@@ -0,0 +1,76 @@
+#ifndef JPGDECODER_H
+#define JPGDECODER_H
+
+#include "infra/image.h"
+
+#include <vector>
+#include <csetjmp>
+#include <stdio.h>
+extern "C" {
+    #include <jpeglib.h>
+}
+
+/**
+ * @brief Decodes JPEG images (e.g. the frames from MJPEG cameras) to 8-bit greyscale.
+ *
+ * Unlike JpgUtil::readJpeg, the libjpeg decompressor is created once and reused for every frame, and
+ * libjpeg is asked for JCS_GRAYSCALE output directly so that only the luminance channel is decoded: the
+ * inverse DCT, upsampling and colour conversion of the chrominance channels are skipped entirely. The
+ * scanlines are decoded straight into the output image, several at a time.
+ *
+ * Note that the greyscale level is the JPEG luminance (Y = 0.299R + 0.587G + 0.114B) rather than the
+ * unweighted mean of the RGB channels used by JpgUtil::readJpeg.
+ *
+ * Instances are not thread safe; use one per thread.
+ */
+class JpgDecoder
+{
+
+public:
+    JpgDecoder();
+    ~JpgDecoder();
+
+    /**
+     * @brief Decodes a JPEG image to an array of 8-bit greyscale pixels.
+     * @param buffer
+     *  Pointer to the start of the memory buffer containing the JPEG image data.
+     * @param insize
+     *  Length of the JPEG image data [bytes].
+     * @param width
+     *  The expected width of the image [pixels]
+     * @param height
+     *  The expected height of the image [pixels]
+     * @param decodedImage
+     *  Vector to which the image data will be written as 8-bit greyscale pixel values. This must contain
+     * at least width*height elements.
+     * @return
+     *  True if the image was decoded successfully; false if the JPEG data was corrupt or truncated, or the
+     * image is not of the expected size. The contents of decodedImage are undefined in that case.
+     */
+    bool decode(unsigned char *buffer, const unsigned long insize, const unsigned int &width, const unsigned int &height,
+                ImageData<unsigned char>::type &decodedImage);
+
+private:
+
+    /**
+     * @brief Extends the libjpeg error manager so that errors return control to the decoder rather than
+     * exiting the application, which is not acceptable for the occasional corrupt frame from a camera.
+     */
+    struct ErrorManager {
+        struct jpeg_error_mgr pub;
+        jmp_buf setjmpBuffer;
+    };
+
+    static void errorExit(j_common_ptr cinfo);
+
+    struct jpeg_decompress_struct cinfo;
+
+    ErrorManager jerr;
+
+    /**
+     * @brief Pointers to the output rows for each call to jpeg_read_scanlines.
+     */
+    std::vector<JSAMPROW> rows;
+};
+
+#endif // JPGDECODER_H
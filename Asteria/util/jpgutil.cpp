@@ -1,28 +1,18 @@
 #include "jpgutil.h"
+#include "util/pixelkernelutil.h"
+
+#include <algorithm>
 
 JpgUtil::JpgUtil() {
 
 }
 
-void JpgUtil::convertYuyv422(unsigned char * buffer, const unsigned long insize, std::vector<unsigned char> &decodedImage) {
-
-    // Pointer to data in input image buffer
-    unsigned char * pBuf = buffer;
-
-    unsigned int pix = 0;
+void JpgUtil::convertYuyv422(unsigned char * buffer, const unsigned long insize, ImageData<unsigned char>::type &decodedImage) {
 
-    // Pixels are encoded in groups of four bytes
-    for(unsigned int p=0; p<insize; p += 4) {
-
-        char y1 = *(pBuf++);
-        char cr = *(pBuf++);
-        char y2 = *(pBuf++);
-        char cb = *(pBuf++);
-
-        // Discard the colour information, or use it somehow?
-        decodedImage[pix++] = y1;
-        decodedImage[pix++] = y2;
-    }
+    // Pixels are encoded in groups of four bytes (Y1 Cr Y2 Cb); discard the colour information and keep
+    // the luminance of each pixel
+    unsigned int nPixels = std::min(insize / 2ul, (unsigned long)decodedImage.size());
+    PixelKernelUtil::extractLuma(buffer, decodedImage.data(), nPixels);
 }
 
 void JpgUtil::readJpeg(unsigned char * buffer, const unsigned long insize, std::vector<unsigned char> &decodedImage) {
@@ -82,7 +72,7 @@ void JpgUtil::readJpeg(unsigned char * buffer, const unsigned long insize, std::
     jpeg_destroy_decompress(&cinfo);
 }
 
-void JpgUtil::writeJpeg(std::vector<unsigned char> &image, const unsigned int width, const unsigned int height, char *filename) {
+void JpgUtil::writeJpeg(ImageData<unsigned char>::type &image, const unsigned int width, const unsigned int height, char *filename) {
 
     FILE *outfile = fopen( filename, "wb" );
     if ( !outfile )
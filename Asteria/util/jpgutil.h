@@ -1,6 +1,8 @@
 #ifndef JPGUTIL_H
 #define JPGUTIL_H
 
+#include "infra/image.h"
+
 #include <vector>
 #include <stdio.h>
 extern "C" {
@@ -35,10 +37,10 @@ public:
      * @param filename
      *  The path to the JPEG file.
      */
-    static void writeJpeg(std::vector<unsigned char> &image, const unsigned int width, const unsigned int height, char *filename);
+    static void writeJpeg(ImageData<unsigned char>::type &image, const unsigned int width, const unsigned int height, char *filename);
 
 
-    static void convertYuyv422(unsigned char * buffer, const unsigned long insize, std::vector<unsigned char> &decodedImage);
+    static void convertYuyv422(unsigned char * buffer, const unsigned long insize, ImageData<unsigned char>::type &decodedImage);
 };
 
 #endif // JPGUTIL_H
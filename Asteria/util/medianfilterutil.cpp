@@ -0,0 +1,198 @@
+#include "medianfilterutil.h"
+#include "util/mathutil.h"
+
+#include <thread>
+#include <algorithm>
+
+/**
+ * @brief The number of levels of the 8-bit pixel values.
+ */
+static const unsigned int nLevels = 256;
+
+/**
+ * @brief The number of levels in each bin of the coarse histograms, which are used to locate the median
+ * quickly in the full histograms.
+ */
+static const unsigned int coarseWidth = 16;
+static const unsigned int nCoarse = nLevels / coarseWidth;
+
+/**
+ * @brief Finds the value with a given rank in a window, from the full and coarse histograms of the pixel values.
+ * @param fine
+ *  The full histogram of the window.
+ * @param coarse
+ *  The coarse histogram of the window.
+ * @param rank
+ *  The rank of the value to find, counting from zero.
+ * @return
+ *  The value with the given rank.
+ */
+static unsigned int getValueWithRank(const unsigned int * fine, const unsigned int * coarse, unsigned int rank) {
+    unsigned int b = 0;
+    while(rank >= coarse[b]) {
+        rank -= coarse[b];
+        b++;
+    }
+    unsigned int v = b * coarseWidth;
+    while(rank >= fine[v]) {
+        rank -= fine[v];
+        v++;
+    }
+    return v;
+}
+
+MedianFilterUtil::MedianFilterUtil() {
+
+}
+
+void MedianFilterUtil::medianFilter(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                                    const unsigned int &hw, std::vector<double> &median, unsigned int nThreads) {
+
+    median.resize(width * height);
+
+    if(hw == 0u) {
+        std::copy(image.begin(), image.end(), median.begin());
+        return;
+    }
+
+    if(nThreads == 0u) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Each band starts by building the column histograms from scratch, which costs as much as moving the
+    // window down 2*hw rows, so bands are made no shorter than that
+    unsigned int nBands = std::max(1u, std::min(nThreads, height / (2 * hw)));
+
+    std::vector<std::thread> workers;
+    for(unsigned int b = 1; b < nBands; b++) {
+        unsigned int rowMin = (b * height) / nBands;
+        unsigned int rowMax = ((b + 1) * height) / nBands;
+        workers.push_back(std::thread(&MedianFilterUtil::medianFilterBand, std::cref(image), width, height, hw, rowMin, rowMax, std::ref(median)));
+    }
+    medianFilterBand(image, width, height, hw, 0u, height / nBands, median);
+    for(unsigned int w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
+
+void MedianFilterUtil::medianFilterBand(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                                        const unsigned int &hw, const unsigned int &rowMin, const unsigned int &rowMax, std::vector<double> &median) {
+
+    // Full and coarse histograms of the pixels in the window rows, for each column
+    std::vector<unsigned short> colFine(width * nLevels, 0u);
+    std::vector<unsigned short> colCoarse(width * nCoarse, 0u);
+
+    // Full and coarse histograms of the pixels in the whole window
+    unsigned int fine[nLevels];
+    unsigned int coarse[nCoarse];
+
+    // Adds or removes one row of pixels to or from the column histograms
+    auto updateColumns = [&](const unsigned int &row, const int &delta) {
+        const unsigned char * pixels = &image[row * width];
+        for(unsigned int c = 0; c < width; c++) {
+            colFine[c * nLevels + pixels[c]] += delta;
+            colCoarse[c * nCoarse + pixels[c] / coarseWidth] += delta;
+        }
+    };
+
+    // Adds or removes one column histogram to or from the window histogram
+    auto updateWindow = [&](const unsigned int &col, const int &delta) {
+        const unsigned short * f = &colFine[col * nLevels];
+        const unsigned short * c = &colCoarse[col * nCoarse];
+        for(unsigned int v = 0; v < nLevels; v++) {
+            fine[v] += delta * f[v];
+        }
+        for(unsigned int b = 0; b < nCoarse; b++) {
+            coarse[b] += delta * c[b];
+        }
+    };
+
+    // Initialise the column histograms with the rows of the window for the first row of the band
+    for(unsigned int r = (rowMin > hw ? rowMin - hw : 0u); r < std::min(height, rowMin + hw); r++) {
+        updateColumns(r, 1);
+    }
+
+    for(unsigned int k = rowMin; k < rowMax; k++) {
+
+        // Move the window down one row
+        if(k > rowMin) {
+            if(k - 1 >= hw) {
+                updateColumns(k - 1 - hw, -1);
+            }
+            if(k - 1 + hw < height) {
+                updateColumns(k - 1 + hw, 1);
+            }
+        }
+
+        unsigned int nRows = std::min(height, k + hw) - (k > hw ? k - hw : 0u);
+
+        // Initialise the window histogram with the columns of the window for the first pixel of the row
+        std::fill(fine, fine + nLevels, 0u);
+        std::fill(coarse, coarse + nCoarse, 0u);
+        for(unsigned int c = 0; c < std::min(width, hw); c++) {
+            updateWindow(c, 1);
+        }
+
+        double * out = &median[k * width];
+
+        for(unsigned int l = 0; l < width; l++) {
+
+            // Move the window along one column
+            if(l > 0) {
+                if(l - 1 >= hw) {
+                    updateWindow(l - 1 - hw, -1);
+                }
+                if(l - 1 + hw < width) {
+                    updateWindow(l - 1 + hw, 1);
+                }
+            }
+
+            unsigned int nCols = std::min(width, l + hw) - (l > hw ? l - hw : 0u);
+            unsigned int n = nRows * nCols;
+
+            if(n % 2 == 0) {
+                // Even number of elements - take average of central two
+                unsigned int a = getValueWithRank(fine, coarse, n / 2);
+                unsigned int b = getValueWithRank(fine, coarse, n / 2 - 1);
+                out[l] = (a + b) / 2.0;
+            }
+            else {
+                // Odd number of elements - pick central one
+                out[l] = getValueWithRank(fine, coarse, n / 2);
+            }
+        }
+    }
+}
+
+void MedianFilterUtil::medianFilterDirect(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                                          const unsigned int &hw, std::vector<double> &median) {
+
+    median.resize(width * height);
+
+    if(hw == 0u) {
+        std::copy(image.begin(), image.end(), median.begin());
+        return;
+    }
+
+    for(unsigned int k=0; k<height; k++) {
+        for(unsigned int l=0; l<width; l++) {
+
+            // Compute the boundary of the window region
+            unsigned int k_min = std::max((int)k - (int)hw, 0);
+            unsigned int k_max = std::min((int)k + (int)hw, (int)height);
+            unsigned int l_min = std::max((int)l - (int)hw, 0);
+            unsigned int l_max = std::min((int)l + (int)hw, (int)width);
+
+            // Pixels within the window
+            std::vector<double> pixels;
+            for(unsigned int kp=k_min; kp<k_max; kp++) {
+                for(unsigned int lp=l_min; lp<l_max; lp++) {
+                    pixels.push_back(image[kp*width + lp]);
+                }
+            }
+
+            // Get the median value in the window
+            median[k*width + l] = MathUtil::getMedian(pixels);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef MEDIANFILTERUTIL_H
+#define MEDIANFILTERUTIL_H
+
+#include <vector>
+
+/**
+ * @brief Provides the sliding window median filter used to estimate the background level in the calibration
+ * signal image.
+ *
+ * The window for each pixel covers the rows and columns from hw before it to hw-1 after it, clipped to the
+ * image boundaries, and the median of an even number of values is the average of the central two. The
+ * filter operates on 8-bit images using the constant time algorithm of Perreault & Hebert (2007): a
+ * histogram is kept for each column of the window and updated by one pixel as the window moves down the
+ * image, and the histogram of the whole window is updated by one column histogram as it moves along each
+ * row. The cost per pixel is therefore independent of the window size. The image is divided into bands
+ * of rows that are filtered in parallel.
+ */
+class MedianFilterUtil
+{
+public:
+    MedianFilterUtil();
+
+    /**
+     * @brief Applies the median filter to an image.
+     * @param image
+     *  The pixels of the input image.
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param hw
+     *  Half-width of the window [pixels]; if zero, the output is a copy of the input.
+     * @param median
+     *  On exit, contains the median filtered image.
+     * @param nThreads
+     *  The number of threads to use; if zero, one is used for each CPU.
+     */
+    static void medianFilter(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                             const unsigned int &hw, std::vector<double> &median, unsigned int nThreads = 0);
+
+    /**
+     * @brief Applies the median filter to an image by sorting the pixels in the window around each pixel.
+     * Produces identical results to medianFilter, but is much slower for large windows; used as a reference
+     * for testing.
+     * @param image
+     *  The pixels of the input image.
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param hw
+     *  Half-width of the window [pixels]; if zero, the output is a copy of the input.
+     * @param median
+     *  On exit, contains the median filtered image.
+     */
+    static void medianFilterDirect(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                                   const unsigned int &hw, std::vector<double> &median);
+
+private:
+
+    /**
+     * @brief Applies the median filter to one band of rows of the image.
+     * @param image
+     *  The pixels of the input image.
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param hw
+     *  Half-width of the window [pixels]
+     * @param rowMin
+     *  The first row of the band.
+     * @param rowMax
+     *  One past the last row of the band.
+     * @param median
+     *  The median filtered image, to which the band is written.
+     */
+    static void medianFilterBand(const std::vector<unsigned char> &image, const unsigned int &width, const unsigned int &height,
+                                 const unsigned int &hw, const unsigned int &rowMin, const unsigned int &rowMax, std::vector<double> &median);
+};
+
+#endif // MEDIANFILTERUTIL_H
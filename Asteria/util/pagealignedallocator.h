@@ -0,0 +1,58 @@
+#ifndef PAGEALIGNEDALLOCATOR_H
+#define PAGEALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+/**
+ * @brief The PageAlignedAllocator class is an allocator for standard containers that places each allocation at
+ * the start of a memory page, and rounds its size up to a whole number of pages. This is used for the pixel
+ * data of captured images, which V4L2 drivers write directly into in user pointer mode; some drivers reject
+ * user pointer buffers that aren't page aligned.
+ *
+ * Template parameters:
+ * T - type of the elements allocated
+ */
+template <class T>
+class PageAlignedAllocator {
+
+public:
+    typedef T value_type;
+
+    PageAlignedAllocator() {
+
+    }
+
+    template <class U>
+    PageAlignedAllocator(const PageAlignedAllocator<U> &) {
+
+    }
+
+    T * allocate(std::size_t n) {
+        std::size_t page = getpagesize();
+        std::size_t bytes = ((n * sizeof(T) + page - 1) / page) * page;
+        void * p = NULL;
+        if(posix_memalign(&p, page, bytes == 0 ? page : bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T * p, std::size_t) {
+        free(p);
+    }
+};
+
+template <class T, class U>
+bool operator==(const PageAlignedAllocator<T> &, const PageAlignedAllocator<U> &) {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const PageAlignedAllocator<T> &, const PageAlignedAllocator<U> &) {
+    return false;
+}
+
+#endif // PAGEALIGNEDALLOCATOR_H
@@ -0,0 +1,480 @@
+#include "pixelkernelutil.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define PIXELKERNEL_HAVE_X86
+    // The AVX-512BW intrinsics need GCC 5 or later; clang reports itself as GCC 4.2 but supports them
+    #if defined(__clang__) || (__GNUC__ >= 5)
+        #define PIXELKERNEL_HAVE_AVX512
+    #endif
+#endif
+
+PixelKernelUtil::PixelKernelUtil() {
+
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                    Scalar kernels                     //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+void PixelKernelUtil::extractLumaScalar(const unsigned char * yuyv, unsigned char * luma, const unsigned int n) {
+    for(unsigned int p = 0; p < n; p++) {
+        luma[p] = yuyv[2u * p];
+    }
+}
+
+void PixelKernelUtil::maxScalar(const unsigned char * src, unsigned char * dst, const unsigned int n) {
+    for(unsigned int p = 0; p < n; p++) {
+        dst[p] = std::max(dst[p], src[p]);
+    }
+}
+
+void PixelKernelUtil::minMaxScalar(const double * x, const unsigned int n, double &min, double &max) {
+    min = x[0];
+    max = x[0];
+    for(unsigned int p = 0; p < n; p++) {
+        min = std::min(min, x[p]);
+        max = std::max(max, x[p]);
+    }
+}
+
+/**
+ * @brief Rescales a single value; shared by the scalar kernel and the tails of the vector kernels.
+ */
+static inline unsigned char rescaleValue(const double x, const double min, const double range) {
+    double val = 255.0 * (x - min) / range;
+    val = std::min(std::max(val, 0.0), 255.0);
+    return static_cast<unsigned char>(val);
+}
+
+void PixelKernelUtil::rescaleScalar(const double * x, unsigned char * out, const unsigned int n, const double min, const double max) {
+    if(!(max > min)) {
+        std::fill(out, out + n, 0);
+        return;
+    }
+    const double range = max - min;
+    for(unsigned int p = 0; p < n; p++) {
+        out[p] = rescaleValue(x[p], min, range);
+    }
+}
+
+void PixelKernelUtil::accumulateScalar(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n) {
+    for(unsigned int p = 0; p < n; p++) {
+        unsigned int val = x[p];
+        sum[p] += val;
+        sumSq[p] += val * val;
+    }
+}
+
+#if defined(PIXELKERNEL_HAVE_X86)
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                     SSE2 kernels                      //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+// Note that the vector kernels are compiled for their instruction set regardless of the global compiler
+// flags, and are only selected if the CPU supports it. Each one finishes off the remaining elements that
+// don't fill a whole vector using the scalar kernel.
+
+__attribute__((target("sse2")))
+static void extractLumaSse2(const unsigned char * yuyv, unsigned char * luma, const unsigned int n) {
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv + 2u * p)), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv + 2u * p + 16u)), mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(luma + p), _mm_packus_epi16(a, b));
+    }
+    PixelKernelUtil::extractLumaScalar(yuyv + 2u * p, luma + p, n - p);
+}
+
+__attribute__((target("sse2")))
+static void maxSse2(const unsigned char * src, unsigned char * dst, const unsigned int n) {
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + p));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + p));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + p), _mm_max_epu8(s, d));
+    }
+    PixelKernelUtil::maxScalar(src + p, dst + p, n - p);
+}
+
+__attribute__((target("sse2")))
+static void minMaxSse2(const double * x, const unsigned int n, double &min, double &max) {
+    PixelKernelUtil::minMaxScalar(x, 1u, min, max);
+    __m128d vMin = _mm_set1_pd(min);
+    __m128d vMax = vMin;
+    unsigned int p = 0;
+    for(; p + 4u <= n; p += 4u) {
+        __m128d a = _mm_loadu_pd(x + p);
+        __m128d b = _mm_loadu_pd(x + p + 2u);
+        vMin = _mm_min_pd(vMin, _mm_min_pd(a, b));
+        vMax = _mm_max_pd(vMax, _mm_max_pd(a, b));
+    }
+    double mins[2], maxs[2];
+    _mm_storeu_pd(mins, vMin);
+    _mm_storeu_pd(maxs, vMax);
+    min = std::min(mins[0], mins[1]);
+    max = std::max(maxs[0], maxs[1]);
+    for(; p < n; p++) {
+        min = std::min(min, x[p]);
+        max = std::max(max, x[p]);
+    }
+}
+
+/**
+ * @brief Rescales two values and converts them to integers in the low half of the result.
+ */
+__attribute__((target("sse2")))
+static inline __m128i rescale2Sse2(const double * x, const __m128d &vMin, const __m128d &vRange) {
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d full = _mm_set1_pd(255.0);
+    __m128d val = _mm_div_pd(_mm_mul_pd(full, _mm_sub_pd(_mm_loadu_pd(x), vMin)), vRange);
+    return _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(val, zero), full));
+}
+
+__attribute__((target("sse2")))
+static void rescaleSse2(const double * x, unsigned char * out, const unsigned int n, const double min, const double max) {
+    if(!(max > min)) {
+        std::fill(out, out + n, 0);
+        return;
+    }
+    const double range = max - min;
+    const __m128d vMin = _mm_set1_pd(min);
+    const __m128d vRange = _mm_set1_pd(range);
+    unsigned int p = 0;
+    for(; p + 8u <= n; p += 8u) {
+        __m128i a = _mm_unpacklo_epi64(rescale2Sse2(x + p, vMin, vRange), rescale2Sse2(x + p + 2u, vMin, vRange));
+        __m128i b = _mm_unpacklo_epi64(rescale2Sse2(x + p + 4u, vMin, vRange), rescale2Sse2(x + p + 6u, vMin, vRange));
+        __m128i words = _mm_packs_epi32(a, b);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + p), _mm_packus_epi16(words, words));
+    }
+    for(; p < n; p++) {
+        out[p] = rescaleValue(x[p], min, range);
+    }
+}
+
+__attribute__((target("sse2")))
+static void accumulateSse2(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n) {
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + p));
+        // Widen to 16 bits; the squares of 8-bit values fit in 16 bits
+        __m128i w[2] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)};
+        for(unsigned int h = 0; h < 2u; h++) {
+            __m128i sq = _mm_mullo_epi16(w[h], w[h]);
+            __m128i vals[2] = {_mm_unpacklo_epi16(w[h], zero), _mm_unpackhi_epi16(w[h], zero)};
+            __m128i sqs[2] = {_mm_unpacklo_epi16(sq, zero), _mm_unpackhi_epi16(sq, zero)};
+            for(unsigned int q = 0; q < 2u; q++) {
+                unsigned int offset = p + 8u * h + 4u * q;
+                __m128i * pSum = reinterpret_cast<__m128i *>(sum + offset);
+                __m128i * pSumSq = reinterpret_cast<__m128i *>(sumSq + offset);
+                _mm_storeu_si128(pSum, _mm_add_epi32(_mm_loadu_si128(pSum), vals[q]));
+                _mm_storeu_si128(pSumSq, _mm_add_epi32(_mm_loadu_si128(pSumSq), sqs[q]));
+            }
+        }
+    }
+    PixelKernelUtil::accumulateScalar(x + p, sum + p, sumSq + p, n - p);
+}
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                     AVX2 kernels                      //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+__attribute__((target("avx2")))
+static void extractLumaAvx2(const unsigned char * yuyv, unsigned char * luma, const unsigned int n) {
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    unsigned int p = 0;
+    for(; p + 32u <= n; p += 32u) {
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(yuyv + 2u * p)), mask);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(yuyv + 2u * p + 32u)), mask);
+        // The pack works within each 128-bit lane, so the 64-bit blocks have to be put back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(luma + p), packed);
+    }
+    PixelKernelUtil::extractLumaScalar(yuyv + 2u * p, luma + p, n - p);
+}
+
+__attribute__((target("avx2")))
+static void maxAvx2(const unsigned char * src, unsigned char * dst, const unsigned int n) {
+    unsigned int p = 0;
+    for(; p + 32u <= n; p += 32u) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + p));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + p));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + p), _mm256_max_epu8(s, d));
+    }
+    PixelKernelUtil::maxScalar(src + p, dst + p, n - p);
+}
+
+__attribute__((target("avx2")))
+static void minMaxAvx2(const double * x, const unsigned int n, double &min, double &max) {
+    PixelKernelUtil::minMaxScalar(x, 1u, min, max);
+    __m256d vMin = _mm256_set1_pd(min);
+    __m256d vMax = vMin;
+    unsigned int p = 0;
+    for(; p + 8u <= n; p += 8u) {
+        __m256d a = _mm256_loadu_pd(x + p);
+        __m256d b = _mm256_loadu_pd(x + p + 4u);
+        vMin = _mm256_min_pd(vMin, _mm256_min_pd(a, b));
+        vMax = _mm256_max_pd(vMax, _mm256_max_pd(a, b));
+    }
+    double mins[4], maxs[4];
+    _mm256_storeu_pd(mins, vMin);
+    _mm256_storeu_pd(maxs, vMax);
+    min = *std::min_element(mins, mins + 4);
+    max = *std::max_element(maxs, maxs + 4);
+    for(; p < n; p++) {
+        min = std::min(min, x[p]);
+        max = std::max(max, x[p]);
+    }
+}
+
+/**
+ * @brief Rescales four values and converts them to integers.
+ */
+__attribute__((target("avx2")))
+static inline __m128i rescale4Avx2(const double * x, const __m256d &vMin, const __m256d &vRange) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d full = _mm256_set1_pd(255.0);
+    __m256d val = _mm256_div_pd(_mm256_mul_pd(full, _mm256_sub_pd(_mm256_loadu_pd(x), vMin)), vRange);
+    return _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(val, zero), full));
+}
+
+__attribute__((target("avx2")))
+static void rescaleAvx2(const double * x, unsigned char * out, const unsigned int n, const double min, const double max) {
+    if(!(max > min)) {
+        std::fill(out, out + n, 0);
+        return;
+    }
+    const double range = max - min;
+    const __m256d vMin = _mm256_set1_pd(min);
+    const __m256d vRange = _mm256_set1_pd(range);
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m128i a = _mm_packs_epi32(rescale4Avx2(x + p, vMin, vRange), rescale4Avx2(x + p + 4u, vMin, vRange));
+        __m128i b = _mm_packs_epi32(rescale4Avx2(x + p + 8u, vMin, vRange), rescale4Avx2(x + p + 12u, vMin, vRange));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + p), _mm_packus_epi16(a, b));
+    }
+    for(; p < n; p++) {
+        out[p] = rescaleValue(x[p], min, range);
+    }
+}
+
+__attribute__((target("avx2")))
+static void accumulateAvx2(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n) {
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m256i w = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(x + p)));
+        __m256i sq = _mm256_mullo_epi16(w, w);
+        for(unsigned int h = 0; h < 2u; h++) {
+            __m256i vals = _mm256_cvtepu16_epi32(h ? _mm256_extracti128_si256(w, 1) : _mm256_castsi256_si128(w));
+            __m256i sqs = _mm256_cvtepu16_epi32(h ? _mm256_extracti128_si256(sq, 1) : _mm256_castsi256_si128(sq));
+            __m256i * pSum = reinterpret_cast<__m256i *>(sum + p + 8u * h);
+            __m256i * pSumSq = reinterpret_cast<__m256i *>(sumSq + p + 8u * h);
+            _mm256_storeu_si256(pSum, _mm256_add_epi32(_mm256_loadu_si256(pSum), vals));
+            _mm256_storeu_si256(pSumSq, _mm256_add_epi32(_mm256_loadu_si256(pSumSq), sqs));
+        }
+    }
+    PixelKernelUtil::accumulateScalar(x + p, sum + p, sumSq + p, n - p);
+}
+
+#if defined(PIXELKERNEL_HAVE_AVX512)
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                    AVX-512 kernels                    //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+__attribute__((target("avx512f,avx512bw")))
+static void extractLumaAvx512(const unsigned char * yuyv, unsigned char * luma, const unsigned int n) {
+    const __m512i mask = _mm512_set1_epi16(0x00FF);
+    const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    unsigned int p = 0;
+    for(; p + 64u <= n; p += 64u) {
+        __m512i a = _mm512_and_si512(_mm512_loadu_si512(yuyv + 2u * p), mask);
+        __m512i b = _mm512_and_si512(_mm512_loadu_si512(yuyv + 2u * p + 64u), mask);
+        __m512i packed = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b));
+        _mm512_storeu_si512(luma + p, packed);
+    }
+    PixelKernelUtil::extractLumaScalar(yuyv + 2u * p, luma + p, n - p);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void maxAvx512(const unsigned char * src, unsigned char * dst, const unsigned int n) {
+    unsigned int p = 0;
+    for(; p + 64u <= n; p += 64u) {
+        __m512i s = _mm512_loadu_si512(src + p);
+        __m512i d = _mm512_loadu_si512(dst + p);
+        _mm512_storeu_si512(dst + p, _mm512_max_epu8(s, d));
+    }
+    PixelKernelUtil::maxScalar(src + p, dst + p, n - p);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void minMaxAvx512(const double * x, const unsigned int n, double &min, double &max) {
+    PixelKernelUtil::minMaxScalar(x, 1u, min, max);
+    __m512d vMin = _mm512_set1_pd(min);
+    __m512d vMax = vMin;
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m512d a = _mm512_loadu_pd(x + p);
+        __m512d b = _mm512_loadu_pd(x + p + 8u);
+        vMin = _mm512_min_pd(vMin, _mm512_min_pd(a, b));
+        vMax = _mm512_max_pd(vMax, _mm512_max_pd(a, b));
+    }
+    // Reduce the lanes by hand, as _mm512_reduce_min_pd and _mm512_reduce_max_pd need GCC 7 or later
+    double mins[8], maxs[8];
+    _mm512_storeu_pd(mins, vMin);
+    _mm512_storeu_pd(maxs, vMax);
+    min = *std::min_element(mins, mins + 8);
+    max = *std::max_element(maxs, maxs + 8);
+    for(; p < n; p++) {
+        min = std::min(min, x[p]);
+        max = std::max(max, x[p]);
+    }
+}
+
+/**
+ * @brief Rescales eight values and converts them to integers.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m256i rescale8Avx512(const double * x, const __m512d &vMin, const __m512d &vRange) {
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d full = _mm512_set1_pd(255.0);
+    __m512d val = _mm512_div_pd(_mm512_mul_pd(full, _mm512_sub_pd(_mm512_loadu_pd(x), vMin)), vRange);
+    return _mm512_cvttpd_epi32(_mm512_min_pd(_mm512_max_pd(val, zero), full));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void rescaleAvx512(const double * x, unsigned char * out, const unsigned int n, const double min, const double max) {
+    if(!(max > min)) {
+        std::fill(out, out + n, 0);
+        return;
+    }
+    const double range = max - min;
+    const __m512d vMin = _mm512_set1_pd(min);
+    const __m512d vRange = _mm512_set1_pd(range);
+    unsigned int p = 0;
+    for(; p + 16u <= n; p += 16u) {
+        __m512i ints = _mm512_inserti64x4(_mm512_castsi256_si512(rescale8Avx512(x + p, vMin, vRange)), rescale8Avx512(x + p + 8u, vMin, vRange), 1);
+        // Values are already clamped to [0:255] so the narrowing conversion is exact
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + p), _mm512_cvtepi32_epi8(ints));
+    }
+    for(; p < n; p++) {
+        out[p] = rescaleValue(x[p], min, range);
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void accumulateAvx512(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n) {
+    unsigned int p = 0;
+    for(; p + 32u <= n; p += 32u) {
+        __m512i w = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + p)));
+        __m512i sq = _mm512_mullo_epi16(w, w);
+        for(unsigned int h = 0; h < 2u; h++) {
+            __m512i vals = _mm512_cvtepu16_epi32(h ? _mm512_extracti64x4_epi64(w, 1) : _mm512_castsi512_si256(w));
+            __m512i sqs = _mm512_cvtepu16_epi32(h ? _mm512_extracti64x4_epi64(sq, 1) : _mm512_castsi512_si256(sq));
+            unsigned int * pSum = sum + p + 16u * h;
+            unsigned int * pSumSq = sumSq + p + 16u * h;
+            _mm512_storeu_si512(pSum, _mm512_add_epi32(_mm512_loadu_si512(pSum), vals));
+            _mm512_storeu_si512(pSumSq, _mm512_add_epi32(_mm512_loadu_si512(pSumSq), sqs));
+        }
+    }
+    PixelKernelUtil::accumulateScalar(x + p, sum + p, sumSq + p, n - p);
+}
+
+#endif
+
+#endif
+
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+//                                                       //
+//                   Runtime dispatch                    //
+//                                                       //
+//+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+/**
+ * @brief The set of kernel implementations for one instruction set.
+ */
+struct PixelKernels {
+    const char * name;
+    void (*extractLuma)(const unsigned char *, unsigned char *, const unsigned int);
+    void (*max)(const unsigned char *, unsigned char *, const unsigned int);
+    void (*minMax)(const double *, const unsigned int, double &, double &);
+    void (*rescale)(const double *, unsigned char *, const unsigned int, const double, const double);
+    void (*accumulate)(const unsigned char *, unsigned int *, unsigned int *, const unsigned int);
+};
+
+static const PixelKernels kernelTable[] = {
+    {"Scalar", PixelKernelUtil::extractLumaScalar, PixelKernelUtil::maxScalar, PixelKernelUtil::minMaxScalar,
+     PixelKernelUtil::rescaleScalar, PixelKernelUtil::accumulateScalar},
+#if defined(PIXELKERNEL_HAVE_X86)
+    {"SSE2", extractLumaSse2, maxSse2, minMaxSse2, rescaleSse2, accumulateSse2},
+    {"AVX2", extractLumaAvx2, maxAvx2, minMaxAvx2, rescaleAvx2, accumulateAvx2},
+#endif
+#if defined(PIXELKERNEL_HAVE_AVX512)
+    {"AVX-512", extractLumaAvx512, maxAvx512, minMaxAvx512, rescaleAvx512, accumulateAvx512}
+#endif
+};
+
+PixelKernelUtil::InstructionSet PixelKernelUtil::getSupportedInstructionSet() {
+#if defined(PIXELKERNEL_HAVE_X86)
+    static const InstructionSet supported =
+#if defined(PIXELKERNEL_HAVE_AVX512)
+            (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) ? AVX512 :
+#endif
+            __builtin_cpu_supports("avx2") ? AVX2 :
+            __builtin_cpu_supports("sse2") ? SSE2 : SCALAR;
+    return supported;
+#else
+    return SCALAR;
+#endif
+}
+
+/**
+ * @brief Gets the kernels currently in use, which are selected on first use.
+ */
+static const PixelKernels *& activeKernels() {
+    static const PixelKernels * kernels = &kernelTable[PixelKernelUtil::getSupportedInstructionSet()];
+    return kernels;
+}
+
+PixelKernelUtil::InstructionSet PixelKernelUtil::setInstructionSet(InstructionSet isa) {
+    InstructionSet used = std::min(isa, getSupportedInstructionSet());
+    activeKernels() = &kernelTable[used];
+    return used;
+}
+
+const char * PixelKernelUtil::getKernelName() {
+    return activeKernels()->name;
+}
+
+void PixelKernelUtil::extractLuma(const unsigned char * yuyv, unsigned char * luma, const unsigned int n) {
+    activeKernels()->extractLuma(yuyv, luma, n);
+}
+
+void PixelKernelUtil::max(const unsigned char * src, unsigned char * dst, const unsigned int n) {
+    activeKernels()->max(src, dst, n);
+}
+
+void PixelKernelUtil::minMax(const double * x, const unsigned int n, double &min, double &max) {
+    activeKernels()->minMax(x, n, min, max);
+}
+
+void PixelKernelUtil::rescale(const double * x, unsigned char * out, const unsigned int n, const double min, const double max) {
+    activeKernels()->rescale(x, out, n, min, max);
+}
+
+void PixelKernelUtil::accumulate(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n) {
+    activeKernels()->accumulate(x, sum, sumSq, n);
+}
@@ -0,0 +1,141 @@
+#ifndef PIXELKERNELUTIL_H
+#define PIXELKERNELUTIL_H
+
+/**
+ * @brief Provides the vectorised kernels for the per-pixel loops used in frame conversion, peak hold
+ * image construction, image rescaling and calibration statistics.
+ *
+ * On x86 each kernel has SSE2, AVX2 and AVX-512 implementations; the best one supported by the CPU is
+ * selected at runtime (by CPUID) the first time a kernel is used. Each kernel also has a portable scalar
+ * implementation that defines the expected results, is used on other platforms and is exposed for testing.
+ * All kernels accept unaligned arrays of any length.
+ */
+class PixelKernelUtil
+{
+public:
+    PixelKernelUtil();
+
+    /**
+     * @brief The instruction sets for which kernels are provided, in order of preference.
+     */
+    enum InstructionSet {SCALAR, SSE2, AVX2, AVX512};
+
+    /**
+     * @brief Gets the most capable instruction set supported by this CPU and the compiler.
+     * @return
+     *  The InstructionSet.
+     */
+    static InstructionSet getSupportedInstructionSet();
+
+    /**
+     * @brief Limits the instruction set used by the kernels, for testing and benchmarking each implementation.
+     * The kernels use the lower of this and the supported instruction set. This must not be called while
+     * any other thread is using the kernels.
+     * @param isa
+     *  The most capable InstructionSet to use.
+     * @return
+     *  The InstructionSet that will actually be used.
+     */
+    static InstructionSet setInstructionSet(InstructionSet isa);
+
+    /**
+     * @brief Gets the name of the instruction set in use.
+     * @return
+     *  Human-readable name of the instruction set, e.g. "AVX2".
+     */
+    static const char * getKernelName();
+
+    /**
+     * @brief Extracts the luminance channel from an image in packed YUYV 4:2:2 format, i.e. every other byte.
+     * @param yuyv
+     *  Pointer to the YUYV data, which must contain 2*n bytes.
+     * @param luma
+     *  Pointer to the output array of n pixels.
+     * @param n
+     *  The number of pixels.
+     */
+    static void extractLuma(const unsigned char * yuyv, unsigned char * luma, const unsigned int n);
+
+    /**
+     * @brief Updates a peak hold image with the elementwise maximum of it and another image.
+     * @param src
+     *  Pointer to the n pixels of the image to combine.
+     * @param dst
+     *  Pointer to the n pixels of the peak hold image, which is updated in place.
+     * @param n
+     *  The number of pixels.
+     */
+    static void max(const unsigned char * src, unsigned char * dst, const unsigned int n);
+
+    /**
+     * @brief Finds the minimum and maximum values in an array. The array must not contain NaNs.
+     * @param x
+     *  Pointer to the array of (at least one) values.
+     * @param n
+     *  The number of values.
+     * @param min
+     *  On exit, contains the minimum value.
+     * @param max
+     *  On exit, contains the maximum value.
+     */
+    static void minMax(const double * x, const unsigned int n, double &min, double &max);
+
+    /**
+     * @brief Linearly maps floating point values from the range [min:max] to [0:255] and converts them to
+     * unsigned char, truncating towards zero. Values outside the range are clamped. If max <= min then all
+     * the outputs are zero.
+     * @param x
+     *  Pointer to the array of values.
+     * @param out
+     *  Pointer to the output array.
+     * @param n
+     *  The number of values.
+     * @param min
+     *  The value that maps to 0.
+     * @param max
+     *  The value that maps to 255.
+     */
+    static void rescale(const double * x, unsigned char * out, const unsigned int n, const double min, const double max);
+
+    /**
+     * @brief Adds the values and squared values of each pixel in an image to per-pixel running totals, for
+     * computing the mean and variance of each pixel over a stack of frames. The sums of squares can hold at
+     * least 66051 frames before overflowing.
+     * @param x
+     *  Pointer to the n pixels of the image.
+     * @param sum
+     *  Pointer to the n per-pixel sums of the pixel values, which are updated in place.
+     * @param sumSq
+     *  Pointer to the n per-pixel sums of the squared pixel values, which are updated in place.
+     * @param n
+     *  The number of pixels.
+     */
+    static void accumulate(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n);
+
+    /**
+     * @brief Scalar implementation of extractLuma.
+     */
+    static void extractLumaScalar(const unsigned char * yuyv, unsigned char * luma, const unsigned int n);
+
+    /**
+     * @brief Scalar implementation of max.
+     */
+    static void maxScalar(const unsigned char * src, unsigned char * dst, const unsigned int n);
+
+    /**
+     * @brief Scalar implementation of minMax.
+     */
+    static void minMaxScalar(const double * x, const unsigned int n, double &min, double &max);
+
+    /**
+     * @brief Scalar implementation of rescale.
+     */
+    static void rescaleScalar(const double * x, unsigned char * out, const unsigned int n, const double min, const double max);
+
+    /**
+     * @brief Scalar implementation of accumulate.
+     */
+    static void accumulateScalar(const unsigned char * x, unsigned int * sum, unsigned int * sumSq, const unsigned int n);
+};
+
+#endif // PIXELKERNELUTIL_H
@@ -0,0 +1,348 @@
+#include "psffitutil.h"
+#include "math/fixedlevenbergmarquardtsolver.h"
+
+#include <thread>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+const double PsfFitUtil::moffatBeta = 2.5;
+
+/**
+ * @brief The smallest number of stamps worth giving to a thread.
+ */
+static const unsigned int minStampsPerThread = 64;
+
+/**
+ * @brief Floor on the variance of the pixels [ADU^2]. This is the quantization noise of the 8-bit pixel values,
+ * and prevents pixels whose values didn't change over the calibration frames from getting infinite weight.
+ */
+static const double minVariance = 1.0 / 12.0;
+
+/**
+ * @brief Number of parameters of each PSF model: flux, i, j, width and background, with the position in the
+ * coordinates of the stamp.
+ */
+static const int nPsfParams = 5;
+
+typedef FixedLevenbergMarquardtSolver<nPsfParams, PsfFitUtil::stampPixels> PsfFitter;
+
+/**
+ * @brief Fits a circular Gaussian integrated over the area of each pixel. The Gaussian is separable, so the
+ * integral over each pixel is the product of the integrals along each axis, and evaluating the model requires
+ * only one pair of error functions per row and column of the stamp rather than one exponential per pixel.
+ */
+class GaussianPsfFitter : public PsfFitter {
+
+public:
+
+    /**
+     * @brief Converts the standard deviation of a Gaussian to the width parameter of this model.
+     */
+    static double getWidthFromSigma(const double &sigma) {
+        return sigma;
+    }
+
+    void getModel(double * model) {
+        getIntegrals();
+        for(unsigned int y = 0; y < PsfFitUtil::stampWidth; y++) {
+            for(unsigned int x = 0; x < PsfFitUtil::stampWidth; x++) {
+                model[y * PsfFitUtil::stampWidth + x] = params[0] * ex[x] * ey[y] + params[4];
+            }
+        }
+    }
+
+    void getJacobian(double * jac) {
+        getIntegrals();
+        for(unsigned int y = 0; y < PsfFitUtil::stampWidth; y++) {
+            for(unsigned int x = 0; x < PsfFitUtil::stampWidth; x++) {
+                double * row = &jac[(y * PsfFitUtil::stampWidth + x) * M];
+                row[0] = ex[x] * ey[y];
+                row[1] = params[0] * dex_di[x] * ey[y];
+                row[2] = params[0] * ex[x] * dey_dj[y];
+                row[3] = params[0] * (dex_ds[x] * ey[y] + ex[x] * dey_ds[y]);
+                row[4] = 1.0;
+            }
+        }
+    }
+
+    void postParameterUpdateCallback() {
+        // The model depends only on the magnitude of the width
+        params[3] = std::fabs(params[3]);
+    }
+
+private:
+
+    /**
+     * @brief Computes the integral of the unit Gaussian over each column and row of pixels, and the derivatives
+     * of these with respect to the position and width.
+     */
+    void getIntegrals() {
+        getIntegrals(params[1], params[3], ex, dex_di, dex_ds);
+        getIntegrals(params[2], params[3], ey, dey_dj, dey_ds);
+    }
+
+    static void getIntegrals(const double &c, const double &s, double * e, double * de_dc, double * de_ds) {
+        const double invSqrt2 = 1.0 / std::sqrt(2.0);
+        const double invSqrt2Pi = 1.0 / std::sqrt(2.0 * M_PI);
+
+        // The pixel edges are at half integer coordinates; values at the shared edges are reused
+        double uMinus = (-0.5 - c) / s;
+        double erfMinus = std::erf(uMinus * invSqrt2);
+        double phiMinus = invSqrt2Pi * std::exp(-0.5 * uMinus * uMinus);
+        for(unsigned int k = 0; k < PsfFitUtil::stampWidth; k++) {
+            double uPlus = (k + 0.5 - c) / s;
+            double erfPlus = std::erf(uPlus * invSqrt2);
+            double phiPlus = invSqrt2Pi * std::exp(-0.5 * uPlus * uPlus);
+            e[k] = 0.5 * (erfPlus - erfMinus);
+            de_dc[k] = -(phiPlus - phiMinus) / s;
+            de_ds[k] = -(uPlus * phiPlus - uMinus * phiMinus) / s;
+            uMinus = uPlus;
+            erfMinus = erfPlus;
+            phiMinus = phiPlus;
+        }
+    }
+
+    double ex[PsfFitUtil::stampWidth];
+    double dex_di[PsfFitUtil::stampWidth];
+    double dex_ds[PsfFitUtil::stampWidth];
+    double ey[PsfFitUtil::stampWidth];
+    double dey_dj[PsfFitUtil::stampWidth];
+    double dey_ds[PsfFitUtil::stampWidth];
+};
+
+/**
+ * @brief Fits a circular Moffat profile, with fixed exponent beta, sampled at the centre of each pixel.
+ */
+class MoffatPsfFitter : public PsfFitter {
+
+public:
+
+    /**
+     * @brief Converts the standard deviation of a Gaussian to the width parameter of this model, by matching the
+     * full width at half maximum.
+     */
+    static double getWidthFromSigma(const double &sigma) {
+        return 2.0 * std::sqrt(2.0 * std::log(2.0)) * sigma / (2.0 * std::sqrt(std::pow(2.0, 1.0 / PsfFitUtil::moffatBeta) - 1.0));
+    }
+
+    void getModel(double * model) {
+        const double beta = PsfFitUtil::moffatBeta;
+        double a2 = params[3] * params[3];
+        double norm = params[0] * (beta - 1.0) / (M_PI * a2);
+        for(unsigned int y = 0; y < PsfFitUtil::stampWidth; y++) {
+            double dy = y - params[2];
+            for(unsigned int x = 0; x < PsfFitUtil::stampWidth; x++) {
+                double dx = x - params[1];
+                double q = 1.0 + (dx * dx + dy * dy) / a2;
+                model[y * PsfFitUtil::stampWidth + x] = norm * std::pow(q, -beta) + params[4];
+            }
+        }
+    }
+
+    void getJacobian(double * jac) {
+        const double beta = PsfFitUtil::moffatBeta;
+        double a2 = params[3] * params[3];
+        double norm = (beta - 1.0) / (M_PI * a2);
+        for(unsigned int y = 0; y < PsfFitUtil::stampWidth; y++) {
+            double dy = y - params[2];
+            for(unsigned int x = 0; x < PsfFitUtil::stampWidth; x++) {
+                double dx = x - params[1];
+                double r2 = dx * dx + dy * dy;
+                double q = 1.0 + r2 / a2;
+                double profile = norm * std::pow(q, -beta);
+                double * row = &jac[(y * PsfFitUtil::stampWidth + x) * M];
+                row[0] = profile;
+                row[1] = params[0] * profile * 2.0 * beta * dx / (a2 * q);
+                row[2] = params[0] * profile * 2.0 * beta * dy / (a2 * q);
+                row[3] = params[0] * profile * (-2.0 / params[3] + 2.0 * beta * r2 / (a2 * params[3] * q));
+                row[4] = 1.0;
+            }
+        }
+    }
+
+    void postParameterUpdateCallback() {
+        // The model depends only on the magnitude of the width
+        params[3] = std::fabs(params[3]);
+    }
+};
+
+PsfFitUtil::PsfFitUtil() {
+
+}
+
+unsigned int PsfFitUtil::StampBatch::size() const {
+    return i0.size();
+}
+
+void PsfFitUtil::StampBatch::resize(const unsigned int &nStamps) {
+    i0.resize(nStamps);
+    j0.resize(nStamps);
+    signal.resize(nStamps * stampPixels);
+    variance.resize(nStamps * stampPixels);
+}
+
+void PsfFitUtil::extractStamps(const std::vector<double> &signal, const std::vector<double> &background, const std::vector<double> &noise,
+                               const unsigned int &width, const unsigned int &height, const std::vector<Source> &sources, StampBatch &stamps) {
+
+    stamps.resize(sources.size());
+
+    for(unsigned int s = 0; s < sources.size(); s++) {
+
+        int i0 = (int)std::lround(sources[s].i) - (int)stampHalfWidth;
+        int j0 = (int)std::lround(sources[s].j) - (int)stampHalfWidth;
+        stamps.i0[s] = i0;
+        stamps.j0[s] = j0;
+
+        double * stampSignal = &stamps.signal[s * stampPixels];
+        double * stampVariance = &stamps.variance[s * stampPixels];
+
+        for(unsigned int y = 0; y < stampWidth; y++) {
+            int j = j0 + (int)y;
+            for(unsigned int x = 0; x < stampWidth; x++) {
+                int i = i0 + (int)x;
+                unsigned int p = y * stampWidth + x;
+                if(i < 0 || j < 0 || i >= (int)width || j >= (int)height) {
+                    // Pixels outside the image get zero weight
+                    stampSignal[p] = 0.0;
+                    stampVariance[p] = std::numeric_limits<double>::infinity();
+                }
+                else {
+                    unsigned int idx = (unsigned int)j * width + (unsigned int)i;
+                    stampSignal[p] = signal[idx] - background[idx];
+                    stampVariance[p] = std::max(noise[idx] * noise[idx], minVariance);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Fits the PSF model to a contiguous block of stamps.
+ * @param stamps
+ *  The stamps to fit.
+ * @param first
+ *  Index of the first stamp in the block.
+ * @param last
+ *  Index of one past the last stamp in the block.
+ * @param fits
+ *  On exit, elements first to last-1 contain the results of the fits.
+ */
+template<class Fitter> static void fitStampBlock(const PsfFitUtil::StampBatch &stamps, const unsigned int &first, const unsigned int &last,
+                                                 std::vector<PsfFitUtil::PsfFit> &fits) {
+
+    const unsigned int w = PsfFitUtil::stampWidth;
+
+    // One fitter is reused for all the stamps in the block
+    Fitter fitter;
+
+    // The position of the star has converged far below its uncertainty long before the relative change in the
+    // chi-square reaches the default exit tolerance
+    fitter.setExitTolerance(1e-9);
+
+    for(unsigned int s = first; s < last; s++) {
+
+        const double * signal = &stamps.signal[s * PsfFitUtil::stampPixels];
+        const double * variance = &stamps.variance[s * PsfFitUtil::stampPixels];
+
+        // Initial guess from the moments of the positive pixels
+        double sum = 0.0;
+        double sumPos = 0.0;
+        double sumX = 0.0;
+        double sumY = 0.0;
+        for(unsigned int y = 0; y < w; y++) {
+            for(unsigned int x = 0; x < w; x++) {
+                unsigned int p = y * w + x;
+                if(std::isinf(variance[p])) {
+                    continue;
+                }
+                sum += signal[p];
+                if(signal[p] > 0.0) {
+                    sumPos += signal[p];
+                    sumX += x * signal[p];
+                    sumY += y * signal[p];
+                }
+            }
+        }
+
+        PsfFitUtil::PsfFit &fit = fits[s];
+        fit.valid = false;
+        if(sumPos <= 0.0) {
+            continue;
+        }
+
+        double ci = sumX / sumPos;
+        double cj = sumY / sumPos;
+        double sumR2 = 0.0;
+        for(unsigned int y = 0; y < w; y++) {
+            for(unsigned int x = 0; x < w; x++) {
+                unsigned int p = y * w + x;
+                if(!std::isinf(variance[p]) && signal[p] > 0.0) {
+                    sumR2 += ((x - ci) * (x - ci) + (y - cj) * (y - cj)) * signal[p];
+                }
+            }
+        }
+        double sigma = std::min(2.5, std::max(0.5, std::sqrt(sumR2 / (2.0 * sumPos))));
+
+        double initialGuess[nPsfParams] = {std::max(sum, sumPos / 2.0), ci, cj, Fitter::getWidthFromSigma(sigma), 0.0};
+
+        fitter.setData(signal);
+        fitter.setVariance(variance);
+        fitter.setParameters(initialGuess);
+        fitter.fit(100);
+
+        double solution[nPsfParams];
+        fitter.getParameters(solution);
+
+        typename Fitter::ParameterMatrix covariance = fitter.getParameterCovariance();
+
+        fit.i = stamps.i0[s] + solution[1];
+        fit.j = stamps.j0[s] + solution[2];
+        fit.c_ii = covariance(1, 1);
+        fit.c_ij = covariance(1, 2);
+        fit.c_jj = covariance(2, 2);
+        fit.flux = solution[0];
+        fit.sigma_flux = std::sqrt(covariance(0, 0));
+        fit.width = solution[3];
+        fit.background = solution[4];
+        fit.reducedChi2 = fitter.getReducedChi2();
+
+        // Reject fits that wandered off the star or have degenerate covariance
+        fit.valid = (solution[0] > 0.0) && (solution[3] > 0.2) && (solution[3] < PsfFitUtil::stampHalfWidth) &&
+                (solution[1] >= 0.0) && (solution[1] <= w - 1.0) && (solution[2] >= 0.0) && (solution[2] <= w - 1.0) &&
+                (fit.c_ii > 0.0) && (fit.c_jj > 0.0) && (fit.c_ii * fit.c_jj > fit.c_ij * fit.c_ij) && std::isfinite(fit.sigma_flux);
+    }
+}
+
+void PsfFitUtil::fitStamps(const StampBatch &stamps, const PsfModel &model, std::vector<PsfFit> &fits, unsigned int nThreads) {
+
+    unsigned int nStamps = stamps.size();
+    fits.resize(nStamps);
+
+    if(nThreads == 0u) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    nThreads = std::max(1u, std::min(nThreads, nStamps / minStampsPerThread));
+
+    auto fitBlock = [&](unsigned int t) {
+        unsigned int first = (t * nStamps) / nThreads;
+        unsigned int last = ((t + 1) * nStamps) / nThreads;
+        switch(model) {
+        case GAUSSIAN:
+            fitStampBlock<GaussianPsfFitter>(stamps, first, last, fits);
+            break;
+        case MOFFAT:
+            fitStampBlock<MoffatPsfFitter>(stamps, first, last, fits);
+            break;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int t = 1; t < nThreads; t++) {
+        workers.push_back(std::thread(fitBlock, t));
+    }
+    fitBlock(0u);
+    for(unsigned int w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
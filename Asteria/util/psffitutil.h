@@ -0,0 +1,161 @@
+#ifndef PSFFITUTIL_H
+#define PSFFITUTIL_H
+
+#include "infra/source.h"
+
+#include <vector>
+
+/**
+ * @brief The PsfFitUtil class fits a model of the point spread function (PSF) to each of a large batch of
+ * stars, to obtain unbiased sub-pixel positions and fluxes along with their covariances. The flux-weighted
+ * centroids measured by the SourceDetector are biased towards the pixel centres for undersampled stars, and
+ * are noisy for faint stars because every pixel is given the same weight regardless of the noise.
+ *
+ * The stars are first cut out of the background-subtracted signal image into fixed size postage stamps, which
+ * are held in a StampBatch. Each stamp is then fitted independently using a FixedLevenbergMarquardtSolver, so
+ * that the fits involve no memory allocation; the stamps are divided between threads in contiguous blocks.
+ */
+class PsfFitUtil
+{
+public:
+    PsfFitUtil();
+
+    /**
+     * @brief The PsfModel enum enumerates the models of the PSF that can be fitted.
+     * - GAUSSIAN: circular Gaussian integrated over the area of each pixel, which is accurate for undersampled
+     *   stars. The width parameter is the standard deviation.
+     * - MOFFAT: circular Moffat profile with a fixed exponent (moffatBeta) sampled at the centre of each pixel,
+     *   which has broader wings than the Gaussian. The width parameter is alpha.
+     */
+    enum PsfModel{GAUSSIAN, MOFFAT};
+
+    /**
+     * @brief Half-width of the postage stamps [pixels]; the full size is (2N+1)x(2N+1).
+     */
+    static const unsigned int stampHalfWidth = 4;
+
+    /**
+     * @brief Width of the postage stamps [pixels]
+     */
+    static const unsigned int stampWidth = 2 * stampHalfWidth + 1;
+
+    /**
+     * @brief Number of pixels in each postage stamp.
+     */
+    static const unsigned int stampPixels = stampWidth * stampWidth;
+
+    /**
+     * @brief Exponent of the Moffat profile.
+     */
+    static const double moffatBeta;
+
+    /**
+     * @brief A batch of postage stamps, in structure-of-arrays layout: each field is held in a separate array,
+     * with the pixels of each stamp contiguous and in row-major order.
+     */
+    class StampBatch {
+
+    public:
+
+        /**
+         * @brief Get the number of stamps in the batch.
+         */
+        unsigned int size() const;
+
+        /**
+         * @brief Sets the number of stamps in the batch.
+         * @param nStamps
+         *  The number of stamps.
+         */
+        void resize(const unsigned int &nStamps);
+
+        /**
+         * @brief Image coordinates of the first pixel of each stamp [pixels]
+         */
+        std::vector<int> i0;
+        std::vector<int> j0;
+
+        /**
+         * @brief Background-subtracted signal in each pixel of each stamp [ADU]
+         */
+        std::vector<double> signal;
+
+        /**
+         * @brief Variance of the signal in each pixel of each stamp [ADU^2]. This is infinite for pixels that lie
+         * outside the image, which are then ignored in the fit.
+         */
+        std::vector<double> variance;
+    };
+
+    /**
+     * @brief Results of the PSF fit to a single stamp.
+     */
+    struct PsfFit {
+        /**
+         * @brief Fitted position of the star in the image [pixels]
+         */
+        double i, j;
+        /**
+         * @brief Covariance matrix of the fitted position [pixels^2]
+         */
+        double c_ii, c_ij, c_jj;
+        /**
+         * @brief Fitted integrated flux of the star, and its uncertainty (one standard deviation) [ADU]
+         */
+        double flux, sigma_flux;
+        /**
+         * @brief Fitted width of the PSF [pixels]; see PsfModel.
+         */
+        double width;
+        /**
+         * @brief Fitted residual background level [ADU/pixel]
+         */
+        double background;
+        /**
+         * @brief Reduced chi-square of the fit.
+         */
+        double reducedChi2;
+        /**
+         * @brief Indicates that the fit converged to a physically reasonable solution with the star inside the
+         * stamp; the other fields are only meaningful if this is true.
+         */
+        bool valid;
+    };
+
+    /**
+     * @brief Cuts a postage stamp around each source out of the background-subtracted signal image. The stamps
+     * are centred on the pixel containing the flux-weighted centroid of the source.
+     * @param signal
+     *  Vector of all pixel values (row-packed) [ADU]
+     * @param background
+     *  Vector of pixel background values (row-packed) [ADU]
+     * @param noise
+     *  Vector of pixel noise values, in terms of the standard deviation (row-packed) [ADU]
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param sources
+     *  The sources to cut out.
+     * @param stamps
+     *  On exit, contains one stamp for each source, in the same order.
+     */
+    static void extractStamps(const std::vector<double> &signal, const std::vector<double> &background, const std::vector<double> &noise,
+                              const unsigned int &width, const unsigned int &height, const std::vector<Source> &sources, StampBatch &stamps);
+
+    /**
+     * @brief Fits the PSF model to each stamp. The initial guess for each star is obtained from the moments of
+     * the stamp.
+     * @param stamps
+     *  The stamps to fit.
+     * @param model
+     *  The PSF model to fit.
+     * @param fits
+     *  On exit, contains the results of the fit to each stamp, in the same order.
+     * @param nThreads
+     *  The number of threads to use; if zero, one is used for each CPU.
+     */
+    static void fitStamps(const StampBatch &stamps, const PsfModel &model, std::vector<PsfFit> &fits, unsigned int nThreads = 0);
+};
+
+#endif // PSFFITUTIL_H
@@ -14,9 +14,12 @@
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/export.hpp>
+#include <boost/serialization/version.hpp>
 
 BOOST_CLASS_IMPLEMENTATION(std::vector<MeteorImageLocationMeasurement>, boost::serialization::object_serializable)
 BOOST_CLASS_IMPLEMENTATION(MeteorImageLocationMeasurement, boost::serialization::object_serializable)
+// Version 1 of the Source adds the PSF fit fields
+BOOST_CLASS_VERSION(Source, 1)
 
 /**
  * Provides non-intrusive Boost serialization support for various classes. A few notes:
@@ -116,6 +119,12 @@ namespace boost {
             ar & BOOST_SERIALIZATION_NVP(s.c_ii);
             ar & BOOST_SERIALIZATION_NVP(s.c_ij);
             ar & BOOST_SERIALIZATION_NVP(s.c_jj);
+            if(version > 0) {
+                ar & BOOST_SERIALIZATION_NVP(s.psf);
+                ar & BOOST_SERIALIZATION_NVP(s.psf_c_ii);
+                ar & BOOST_SERIALIZATION_NVP(s.psf_c_ij);
+                ar & BOOST_SERIALIZATION_NVP(s.psf_c_jj);
+            }
             ar & BOOST_SERIALIZATION_NVP(s.l1);
             ar & BOOST_SERIALIZATION_NVP(s.l2);
             ar & BOOST_SERIALIZATION_NVP(s.orientation);
@@ -2,13 +2,223 @@
 
 #include <algorithm>
 #include <set>
+#include <queue>
+#include <thread>
+#include <cmath>
+#include <stdio.h>
 
 SourceDetector::SourceDetector() {
 
 }
 
 /**
- * Main workhorse algorithm for source detection. The samples in the image are sorted into
+ * Main workhorse algorithm for source detection. The samples in the image are processed in descending
+ * order of level. The sources are gradually formed by either assigning an isolated sample to a new source,
+ * or assigning a sample that touches exactly one existing source to that source; samples touching two or
+ * more sources are left unlabelled. The significance of each source is measured by reference to the noise
+ * image and the background level. Sources falling below the given significance threshold are culled.
+ *
+ * The samples are quantized to 8-bit levels, and ordered by a counting sort with samples at the same level
+ * in order of index. The labels are held in a flat array, with each source labelled by the index of its
+ * first (brightest) sample plus one. To process the image in parallel it is divided into bands of rows
+ * (tiles), and each tile is labelled independently as though the rest of the image were absent. The
+ * labels along the seams between the tiles are then recomputed in the global processing order, and any
+ * change is propagated to the fainter neighbours of the sample, so that the final labels are identical to
+ * those obtained by processing the whole image in order (i.e. getSourcesReference).
+ *
+ * @param signal
+ *            Vector of all pixel values; this is the measured image from which sources are to be extracted (row-packed) [ADU]
+ * @param background
+ *            Vector of pixel background values (row-packed) [ADU]
+ * @param noise
+ *            Vector of pixel noise values, in terms of the standard deviation (row-packed) [ADU]
+ * @param width
+ *            Width of the image [pixels]
+ * @param height
+ *            Height of the image [pixels]
+ * @param source_detection_threshold_sigmas
+ *            Threshold for detection of significant sources, in terms of the number of standard deviations
+ *            that the integrated flux lies above the background level [dimensionless].
+ * @param source_detection_floor_sigmas
+ *            Samples that lie less than this number of standard deviations above the background level are
+ *            not assigned to any source, and are not processed [dimensionless]. By default all samples
+ *            are processed.
+ * @param nThreads
+ *            The number of threads to use; if zero, one is used for each CPU.
+ * @return Vector containing the Sources detected in the window
+ */
+std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
+                                               unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas,
+                                               const double &source_detection_floor_sigmas, unsigned int nThreads) {
+
+    unsigned int nPixels = width * height;
+
+    // Quantized level of each sample; zero for samples below the significance floor, which are skipped
+    std::vector<unsigned char> levels(nPixels);
+    std::vector<unsigned char> active(nPixels);
+
+    // Source label of each sample; zero means unlabelled
+    std::vector<unsigned int> labels(nPixels, 0u);
+
+    if(nThreads == 0u) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Tiles of at least 16 rows, so that the seams are a small fraction of the image
+    unsigned int nTiles = std::max(1u, std::min(nThreads, height / 16u));
+
+    bool useFloor = (source_detection_floor_sigmas > -std::numeric_limits<double>::infinity());
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //               Label each tile separately              //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    auto labelTile = [&](unsigned int t) {
+
+        unsigned int rowMin = (t * height) / nTiles;
+        unsigned int rowMax = ((t + 1) * height) / nTiles;
+
+        // Quantize the samples in the tile, and count the number at each level
+        unsigned int counts[256] = {0u};
+        for(unsigned int p = rowMin * width; p < rowMax * width; p++) {
+            levels[p] = (unsigned char)std::min(255.0, std::max(0.0, signal[p]));
+            active[p] = !useFloor || (signal[p] - background[p] >= source_detection_floor_sigmas * noise[p]);
+            if(active[p]) {
+                counts[levels[p]]++;
+            }
+        }
+
+        // Counting sort into order of decreasing level
+        unsigned int offsets[256];
+        unsigned int nActive = 0u;
+        for(int level = 255; level >= 0; level--) {
+            offsets[level] = nActive;
+            nActive += counts[level];
+        }
+        std::vector<unsigned int> order(nActive);
+        for(unsigned int p = rowMin * width; p < rowMax * width; p++) {
+            if(active[p]) {
+                order[offsets[levels[p]]++] = p;
+            }
+        }
+
+        // Process the samples in order; neighbours that haven't been processed yet are still unlabelled
+        for(unsigned int s = 0; s < nActive; s++) {
+            labels[order[s]] = getLabel(order[s], labels, levels, width, rowMin, rowMax);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int t = 1; t < nTiles; t++) {
+        workers.push_back(std::thread(labelTile, t));
+    }
+    labelTile(0u);
+    for(unsigned int w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //               Merge labels across seams               //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Indicates whether sample a is processed before sample b
+    auto isEarlier = [&](const unsigned int &a, const unsigned int &b) {
+        return (levels[a] > levels[b]) || (levels[a] == levels[b] && a < b);
+    };
+
+    // Queue of samples whose label must be recomputed, with the first to be processed at the top
+    auto isLater = [&](const unsigned int &a, const unsigned int &b) {
+        return isEarlier(b, a);
+    };
+    std::priority_queue<unsigned int, std::vector<unsigned int>, decltype(isLater)> queue(isLater);
+    std::vector<unsigned char> queued(nPixels, 0u);
+
+    // The samples on each side of each seam may have neighbours across it that were ignored
+    for(unsigned int t = 1; t < nTiles; t++) {
+        unsigned int seam = (t * height) / nTiles;
+        for(unsigned int p = (seam - 1) * width; p < (seam + 1) * width; p++) {
+            if(active[p]) {
+                queue.push(p);
+                queued[p] = 1u;
+            }
+        }
+    }
+
+    // Recompute the labels in processing order. The label of a sample depends only on the labels of its
+    // neighbours processed before it, which are final by the time it reaches the top of the queue; if it
+    // changes then the neighbours processed after it must be recomputed too.
+    while(!queue.empty()) {
+
+        unsigned int p = queue.top();
+        queue.pop();
+        queued[p] = 0u;
+
+        unsigned int label = getLabel(p, labels, levels, width, 0u, height);
+        if(label == labels[p]) {
+            continue;
+        }
+        labels[p] = label;
+
+        int i = p % width;
+        int j = p / width;
+        for(int dj = -1; dj < 2; dj++) {
+            for(int di = -1; di < 2; di++) {
+                int ni = i + di;
+                int nj = j + dj;
+                if((di == 0 && dj == 0) || ni < 0 || ni >= (int)width || nj < 0 || nj >= (int)height) {
+                    continue;
+                }
+                unsigned int q = nj * width + ni;
+                if(active[q] && !queued[q] && isEarlier(p, q)) {
+                    queue.push(q);
+                    queued[q] = 1u;
+                }
+            }
+        }
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //            Extract the samples of each source         //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The first sample of each source is the one whose index gives its label. Sources are numbered in the
+    // order in which their first samples are processed.
+    std::vector<unsigned int> firstSamples;
+    for(unsigned int p = 0; p < nPixels; p++) {
+        if(labels[p] == p + 1) {
+            firstSamples.push_back(p);
+        }
+    }
+    std::sort(firstSamples.begin(), firstSamples.end(), isEarlier);
+
+    // Map from the label to the source number
+    std::vector<unsigned int> labelToSource(nPixels + 1, 0u);
+    for(unsigned int s = 0; s < firstSamples.size(); s++) {
+        labelToSource[firstSamples[s] + 1] = s;
+    }
+
+    std::vector<Source> sources(firstSamples.size());
+
+    // Assign each labelled sample to the right source, in order of index
+    for(unsigned int p = 0; p < nPixels; p++) {
+        if(labels[p] != 0u) {
+            sources[labelToSource[labels[p]]].pixels.push_back(p);
+        }
+    }
+
+    return measureSources(sources, signal, background, noise, width, source_detection_threshold_sigmas);
+}
+
+/**
+ * Reference implementation of the source detection algorithm, which processes the whole image in order
+ * using a Sample object for each pixel. Produces identical results to getSources with no significance
+ * floor, but is much slower; used for testing. The samples in the image are sorted into
  * descending order. The sources are gradually formed by either assigning an isolated sample
  * to a new source, or assigning a non-isolated sample to an existing source. The significance
  * of each source is measured by reference to the noise image and the background level. Sources
@@ -29,8 +239,8 @@ SourceDetector::SourceDetector() {
  *            that the integrated flux lies above the background level [dimensionless].
  * @return Vector containing the Sources detected in the window
  */
-std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
-                                               unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas) {
+std::vector<Source> SourceDetector::getSourcesReference(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
+                                                        unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas) {
 
     // Create an array and List of Samples. The array is used to get a sample for a given coordinate, and
     // the list is used so that we can process the samples in intensity order
@@ -43,8 +253,8 @@ std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std:
         sortedSamples.push_back(sample);
     }
 
-    // Sort the vector into order of decreasing intensity
-    std::sort(sortedSamples.begin(), sortedSamples.end(), Sample<double>::compareSamplePtrDecreasing);
+    // Sort the vector into order of decreasing intensity; samples at the same level stay in order of index
+    std::stable_sort(sortedSamples.begin(), sortedSamples.end(), Sample<double>::compareSamplePtrDecreasing);
 
     // Current source label; incremented each time a new source is found
     unsigned int currentLabel = 1;
@@ -87,6 +297,36 @@ std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std:
         }
     }
 
+    for (Sample<double> * sample : allSamples) {
+        delete sample;
+    }
+
+    return measureSources(sources, signal, background, noise, width, source_detection_threshold_sigmas);
+}
+
+
+/**
+ * Measures the integrated flux, centroid and dispersion of each source, and purges the insignificant ones
+ * and any that aren't consistent with a stellar image.
+ *
+ * @param sources
+ *            Vector of sources, with the indices of the samples assigned to each.
+ * @param signal
+ *            Vector of all pixel values (row-packed) [ADU]
+ * @param background
+ *            Vector of pixel background values (row-packed) [ADU]
+ * @param noise
+ *            Vector of pixel noise values, in terms of the standard deviation (row-packed) [ADU]
+ * @param width
+ *            Width of the image [pixels]
+ * @param source_detection_threshold_sigmas
+ *            Threshold for detection of significant sources, in terms of the number of standard deviations
+ *            that the integrated flux lies above the background level [dimensionless].
+ * @return Vector containing the significant stellar Sources
+ */
+std::vector<Source> SourceDetector::measureSources(std::vector<Source> &sources, std::vector<double> &signal, std::vector<double> &background,
+                                                   std::vector<double> &noise, unsigned int &width, double &source_detection_threshold_sigmas) {
+
     std::vector<Source> significantSources;
 
     // Post-process the sources to purge insignificant ones
@@ -262,3 +502,71 @@ std::vector<unsigned int> SourceDetector::getNeighbourUniqueLabels(Sample<double
 
     return neighbourUniqueLabels;
 }
+
+/**
+ * @brief SourceDetector::getLabel
+ * Determines the label of a sample from the labels of the neighbouring samples that are processed before it.
+ * @param index
+ *  The index of the sample
+ * @param labels
+ *  The labels of all the samples
+ * @param levels
+ *  The quantized levels of all the samples, which set the order in which they're processed
+ * @param width
+ *  The image width [pixels]
+ * @param rowMin
+ *  The first row of the region whose samples are considered as neighbours
+ * @param rowMax
+ *  One past the last row of the region whose samples are considered as neighbours
+ * @return
+ *  A new label (the sample index plus one) if none of the neighbours are labelled; the label of the
+ * neighbours if they share the same label; otherwise zero.
+ */
+unsigned int SourceDetector::getLabel(const unsigned int &index, const std::vector<unsigned int> &labels, const std::vector<unsigned char> &levels,
+                                      const unsigned int &width, const unsigned int &rowMin, const unsigned int &rowMax) {
+
+    int i = index % width;
+    int j = index / width;
+    unsigned char level = levels[index];
+
+    unsigned int label = 0u;
+
+    // Loop over eight neighbouring pixels
+    for(int dj = -1; dj < 2; dj++) {
+        int nj = j + dj;
+        if(nj < (int)rowMin || nj >= (int)rowMax) {
+            continue;
+        }
+        for(int di = -1; di < 2; di++) {
+            int ni = i + di;
+            if((di == 0 && dj == 0) || ni < 0 || ni >= (int)width) {
+                continue;
+            }
+
+            unsigned int sIdx = nj * width + ni;
+
+            // Ignore neighbours that are processed after this sample
+            if(levels[sIdx] < level || (levels[sIdx] == level && sIdx > index)) {
+                continue;
+            }
+
+            if(labels[sIdx] != 0u) {
+                if(label == 0u) {
+                    label = labels[sIdx];
+                }
+                else if(labels[sIdx] != label) {
+                    // Multiple labels! This is a faint sample sandwiched between two unconnected
+                    // brighter samples - leave it unlabelled.
+                    return 0u;
+                }
+            }
+        }
+    }
+
+    // Isolated sample - initialise new source
+    if(label == 0u) {
+        label = index + 1;
+    }
+
+    return label;
+}
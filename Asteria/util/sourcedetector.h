@@ -6,6 +6,7 @@
 
 #include <vector>
 #include <set>
+#include <limits>
 
 class SourceDetector
 {
@@ -13,10 +14,21 @@ public:
     SourceDetector();
 
     static std::vector<Source> getSources(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
-                                          unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas);
+                                          unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas,
+                                          const double &source_detection_floor_sigmas = -std::numeric_limits<double>::infinity(),
+                                          unsigned int nThreads = 0);
+
+    static std::vector<Source> getSourcesReference(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
+                                                   unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas);
 
 private:
     static std::vector<unsigned int> getNeighbourUniqueLabels(Sample<double> *&sample, const std::vector<Sample<double> *> &samples, unsigned int &width, unsigned int &height);
+
+    static unsigned int getLabel(const unsigned int &index, const std::vector<unsigned int> &labels, const std::vector<unsigned char> &levels,
+                                 const unsigned int &width, const unsigned int &rowMin, const unsigned int &rowMax);
+
+    static std::vector<Source> measureSources(std::vector<Source> &sources, std::vector<double> &signal, std::vector<double> &background,
+                                              std::vector<double> &noise, unsigned int &width, double &source_detection_threshold_sigmas);
 };
 
 #endif // SOURCEDETECTOR_H
@@ -0,0 +1,427 @@
+#include "util/syntheticvideogenerator.h"
+#include "util/coordinateutil.h"
+#include "util/timeutil.h"
+#include "util/fileutil.h"
+
+#include <linux/videodev2.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <fstream>
+#include <random>
+#include <thread>
+#include <algorithm>
+
+/**
+ * @brief The number of rows in each band of the image that the background and noise are added to in parallel.
+ */
+static const unsigned int bandRows = 64;
+
+/**
+ * @brief The number of entries in the table of normal deviates; must be a power of two.
+ */
+static const unsigned int nNormalDeviates = 1u << 16;
+
+/**
+ * @brief The number of steps that the motion of meteors and aircraft is divided into within each exposure.
+ */
+static const unsigned int nExposureSteps = 8;
+
+/**
+ * @brief Mixes the bits of a 64-bit value (the SplitMix64 finaliser), used to derive independent seeds
+ * for each frame and band from the main seed.
+ * @param x
+ *  The value to mix.
+ * @return
+ *  The mixed value.
+ */
+static unsigned long long mix(unsigned long long x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+SyntheticVideoGenerator::SyntheticVideoGenerator(const CameraModelBase * cam, const Eigen::Quaterniond &q_sez_cam, const double &lon, const double &lat,
+                                                 const std::vector<ReferenceStar> &catalogue) :
+    startEpochTimeUs(1500000000000000ll), framePeriodUs(40000ll), nFrames(250), skyBackground(20.0), readNoise(2.0), gain(1.0),
+    zeroMagFlux(2000.0), psfSigma(1.0), faintMagLimit(6.0), twinkle(0.05), nHotPixels(20), hotPixelLevel(150.0), seed(0),
+    nThreads(std::max(1u, std::thread::hardware_concurrency())), cam(cam) {
+
+    r_sez_cam = q_sez_cam.toRotationMatrix();
+    r_ecef_sez = CoordinateUtil::getEcefToSezRot(lon, lat);
+
+    // The BCRF directions to the stars are fixed, so are computed once
+    for(unsigned int s = 0; s < catalogue.size(); s++) {
+        Eigen::Vector3d r_bcrf;
+        CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, catalogue[s].ra, catalogue[s].dec);
+        starDirs.push_back(r_bcrf);
+        starMags.push_back(catalogue[s].mag);
+    }
+
+    // Drawing a fresh normal deviate for every pixel would dominate the rendering time for large images, so
+    // they're drawn from a table instead, indexed by a fast random number generator
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    normalDeviates.resize(nNormalDeviates);
+    for(unsigned int n = 0; n < nNormalDeviates; n++) {
+        normalDeviates[n] = normal(gen);
+    }
+}
+
+bool SyntheticVideoGenerator::getMeteorPosition(const SyntheticMeteor &meteor, const double &t, double &i, double &j) const {
+
+    // The meteor moves along the great circle through its start point, in the initial direction of motion
+    Eigen::Vector3d r0 = cam->deprojectPixel(meteor.i, meteor.j);
+    Eigen::Vector3d r1 = cam->deprojectPixel(meteor.i + cos(meteor.positionAngle), meteor.j + sin(meteor.positionAngle));
+    Eigen::Vector3d axis = r0.cross(r1).normalized();
+
+    Eigen::Vector3d r_cam = Eigen::AngleAxisd(meteor.angularSpeed * (t - meteor.startTimeS), axis) * r0;
+
+    return cam->projectVector(r_cam, i, j);
+}
+
+void SyntheticVideoGenerator::renderFrame(const unsigned int &f, Imageuc &image, std::vector<SyntheticTruth> &truth) {
+
+    unsigned int width = cam->width;
+    unsigned int height = cam->height;
+
+    image.width = width;
+    image.height = height;
+    image.field = V4L2_FIELD_NONE;
+    image.epochTimeUs = startEpochTimeUs + f * framePeriodUs;
+    image.rawImage.resize(width * height);
+
+    signal.assign(width * height, 0.0f);
+
+    // The exposure covers the frame period following the capture time
+    double framePeriodS = framePeriodUs / 1000000.0;
+    double t0 = f * framePeriodS;
+    double t1 = t0 + framePeriodS;
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //                   Render the stars                    //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Stars move by much less than a pixel during the exposure, so are rendered at their mid-exposure positions
+    double gmst = TimeUtil::epochToGmst(image.epochTimeUs + framePeriodUs / 2);
+    Eigen::Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+    std::mt19937 gen(mix(((unsigned long long)seed << 32) + f));
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    for(unsigned int s = 0; s < starDirs.size(); s++) {
+        if(starMags[s] > faintMagLimit) {
+            continue;
+        }
+        Eigen::Vector3d r_cam = r_bcrf_cam * starDirs[s];
+        double i, j;
+        if(cam->projectVector(r_cam, i, j)) {
+            double scintillation = std::max(0.0, 1.0 + twinkle * normal(gen));
+            addPointSource(i, j, zeroMagFlux * pow(10.0, -0.4 * starMags[s]) * scintillation);
+        }
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //                   Render the meteors                  //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    for(unsigned int m = 0; m < meteors.size(); m++) {
+
+        const SyntheticMeteor &meteor = meteors[m];
+
+        // Portion of the exposure during which the meteor is present
+        double start = std::max(t0, meteor.startTimeS);
+        double end = std::min(t1, meteor.startTimeS + meteor.durationS);
+        if(end <= start) {
+            continue;
+        }
+
+        double peakFlux = zeroMagFlux * pow(10.0, -0.4 * meteor.peakMag);
+
+        SyntheticTruth record;
+        record.frame = f;
+        record.meteor = true;
+        record.id = m;
+        record.flux = 0.0;
+        bool visible = false;
+
+        // The motion is divided into short straight sections, which follow the curvature of the path in the
+        // image and the variation in brightness
+        double dt = (end - start) / nExposureSteps;
+        for(unsigned int step = 0; step < nExposureSteps; step++) {
+            double ta = start + step * dt;
+            double tb = ta + dt;
+            double ia, ja, ib, jb;
+            if(!getMeteorPosition(meteor, ta, ia, ja) || !getMeteorPosition(meteor, tb, ib, jb)) {
+                continue;
+            }
+            // Brightness rises and falls as a half sine wave over the duration of the meteor
+            double phase = M_PI * ((ta + tb) / 2.0 - meteor.startTimeS) / meteor.durationS;
+            double flux = peakFlux * sin(phase) * dt / framePeriodS;
+            addStreak(ia, ja, ib, jb, flux);
+
+            if(!visible) {
+                record.iStart = ia;
+                record.jStart = ja;
+                visible = true;
+            }
+            record.iEnd = ib;
+            record.jEnd = jb;
+            record.flux += flux;
+        }
+
+        if(visible) {
+            truth.push_back(record);
+        }
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //                  Render the aircraft                  //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    for(unsigned int a = 0; a < aircraft.size(); a++) {
+
+        const SyntheticAircraft &plane = aircraft[a];
+        double flux = zeroMagFlux * pow(10.0, -0.4 * plane.mag);
+
+        SyntheticTruth record;
+        record.frame = f;
+        record.meteor = false;
+        record.id = a;
+        record.flux = 0.0;
+        bool visible = false;
+
+        double dt = framePeriodS / nExposureSteps;
+        for(unsigned int step = 0; step < nExposureSteps; step++) {
+            double ta = t0 + step * dt;
+            double tb = ta + dt;
+            // The light is on or off for the whole step
+            double blinkPhase = fmod((ta + tb) / 2.0, plane.blinkPeriodS) / plane.blinkPeriodS;
+            if(blinkPhase >= plane.blinkDutyCycle) {
+                continue;
+            }
+            double ia = plane.i + plane.vi * ta;
+            double ja = plane.j + plane.vj * ta;
+            double ib = plane.i + plane.vi * tb;
+            double jb = plane.j + plane.vj * tb;
+            if(ia < 0 || ia > width || ja < 0 || ja > height) {
+                continue;
+            }
+            addStreak(ia, ja, ib, jb, flux / nExposureSteps);
+
+            if(!visible) {
+                record.iStart = ia;
+                record.jStart = ja;
+                visible = true;
+            }
+            record.iEnd = ib;
+            record.jEnd = jb;
+            record.flux += flux / nExposureSteps;
+        }
+
+        if(visible) {
+            truth.push_back(record);
+        }
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //            Add hot pixels, background & noise         //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The hot pixels are at the same positions in every frame
+    if(hotPixels.size() != nHotPixels) {
+        std::mt19937 hotGen(mix(seed));
+        std::uniform_int_distribution<unsigned int> pixel(0, width * height - 1);
+        hotPixels.clear();
+        for(unsigned int p = 0; p < nHotPixels; p++) {
+            hotPixels.push_back(pixel(hotGen));
+        }
+    }
+    for(unsigned int p = 0; p < hotPixels.size(); p++) {
+        signal[hotPixels[p]] += hotPixelLevel;
+    }
+
+    // Each band has its own noise seed, so the frames don't depend on the number of threads
+    unsigned int nBands = (height + bandRows - 1) / bandRows;
+    unsigned int nWorkers = std::max(1u, std::min(nThreads, nBands));
+
+    auto work = [&](unsigned int worker) {
+        for(unsigned int band = worker; band < nBands; band += nWorkers) {
+            addNoise(f, band, image);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int w = 1; w < nWorkers; w++) {
+        workers.push_back(std::thread(work, w));
+    }
+    work(0);
+    for(unsigned int w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
+
+void SyntheticVideoGenerator::addPointSource(const double &i, const double &j, const double &flux) {
+
+    int width = cam->width;
+    int height = cam->height;
+
+    // The Gaussian is separable, so the weights are computed once for each row and column of the stamp
+    int radius = (int)ceil(3.0 * psfSigma);
+    int iMin = std::max(0, (int)floor(i) - radius);
+    int iMax = std::min(width - 1, (int)floor(i) + radius);
+    int jMin = std::max(0, (int)floor(j) - radius);
+    int jMax = std::min(height - 1, (int)floor(j) + radius);
+    if(iMin > iMax || jMin > jMax) {
+        return;
+    }
+
+    double norm = flux / (2.0 * M_PI * psfSigma * psfSigma);
+    double twoSigma2 = 2.0 * psfSigma * psfSigma;
+
+    float wi[iMax - iMin + 1];
+    for(int x = iMin; x <= iMax; x++) {
+        // Pixel centres are at half-integer coordinates
+        double di = x + 0.5 - i;
+        wi[x - iMin] = exp(-di * di / twoSigma2);
+    }
+
+    for(int y = jMin; y <= jMax; y++) {
+        double dj = y + 0.5 - j;
+        float wj = norm * exp(-dj * dj / twoSigma2);
+        float * row = &signal[y * width];
+        for(int x = iMin; x <= iMax; x++) {
+            row[x] += wj * wi[x - iMin];
+        }
+    }
+}
+
+void SyntheticVideoGenerator::addStreak(const double &i0, const double &j0, const double &i1, const double &j1, const double &flux) {
+
+    // Trail the source along the streak in steps of no more than half a pixel
+    double length = sqrt((i1 - i0) * (i1 - i0) + (j1 - j0) * (j1 - j0));
+    unsigned int n = std::max(1u, (unsigned int)ceil(length / 0.5));
+
+    for(unsigned int s = 0; s < n; s++) {
+        double frac = (s + 0.5) / n;
+        addPointSource(i0 + frac * (i1 - i0), j0 + frac * (j1 - j0), flux / n);
+    }
+}
+
+void SyntheticVideoGenerator::addNoise(const unsigned int &f, const unsigned int &band, Imageuc &image) {
+
+    unsigned int width = cam->width;
+    unsigned int height = cam->height;
+
+    unsigned int yMin = band * bandRows;
+    unsigned int yMax = std::min(height, yMin + bandRows);
+
+    // Xorshift generator used to index the table of normal deviates
+    unsigned long long state = mix(mix(((unsigned long long)seed << 32) + f) + band);
+    if(state == 0ull) {
+        state = 1ull;
+    }
+
+    float readVar = readNoise * readNoise;
+    float invGain = 1.0f / gain;
+    float background = skyBackground;
+
+    for(unsigned int p = yMin * width; p < yMax * width; p++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        // Shot noise on the total signal plus read noise
+        float value = signal[p] + background;
+        float sigma = sqrtf(value * invGain + readVar);
+        value += sigma * normalDeviates[state & (nNormalDeviates - 1)];
+
+        image.rawImage[p] = (unsigned char)std::min(255.0f, std::max(0.0f, value + 0.5f));
+    }
+}
+
+std::string SyntheticVideoGenerator::generate(const std::string &videoDirPath) {
+
+    // Create the clip directory, following the layout used by AnalysisInventory::saveToDir
+    std::string utc = TimeUtil::epochToUtcString(startEpochTimeUs);
+    std::string yyyy = TimeUtil::extractYearFromUtcString(utc);
+    std::string mm = TimeUtil::extractMonthFromUtcString(utc);
+    std::string dd = TimeUtil::extractDayFromUtcString(utc);
+
+    std::vector<std::string> subLevels;
+    subLevels.push_back(yyyy);
+    subLevels.push_back(mm);
+    subLevels.push_back(dd);
+    subLevels.push_back(utc);
+    std::string path = videoDirPath + "/" + yyyy + "/" + mm + "/" + dd + "/" + utc;
+
+    if(!FileUtil::createDirs(videoDirPath, subLevels) || !FileUtil::createDir(path, "raw")) {
+        fprintf(stderr, "Couldn't create directory %s\n", path.c_str());
+        return "";
+    }
+    std::string raw = path + "/raw";
+
+    std::vector<SyntheticTruth> truth;
+    Imageuc image;
+
+    long long t0 = TimeUtil::getUpTime();
+
+    for(unsigned int f = 0; f < nFrames; f++) {
+        renderFrame(f, image, truth);
+
+        char filename [100];
+        std::string utcFrame = TimeUtil::epochToUtcString(image.epochTimeUs);
+        sprintf(filename, "%s/%s.pgm", raw.c_str(), utcFrame.c_str());
+
+        std::ofstream out(filename);
+        out << image;
+        out.close();
+    }
+
+    long long t1 = TimeUtil::getUpTime();
+
+    // Write out the ground truth
+    std::ofstream out(path + "/truth.txt");
+    out << "# Ground truth for synthetic clip " << utc << "\n";
+    out << "# clip width height nFrames framePeriodUs startEpochTimeUs\n";
+    out << "clip " << cam->width << " " << cam->height << " " << nFrames << " " << framePeriodUs << " " << startEpochTimeUs << "\n";
+    out << "# meteor id startEpochTimeUs endEpochTimeUs i j positionAngle[radians] angularSpeed[radians/s] peakMag\n";
+    for(unsigned int m = 0; m < meteors.size(); m++) {
+        const SyntheticMeteor &meteor = meteors[m];
+        out << "meteor " << m << " " << startEpochTimeUs + (long long)(meteor.startTimeS * 1000000.0) << " "
+            << startEpochTimeUs + (long long)((meteor.startTimeS + meteor.durationS) * 1000000.0) << " " << meteor.i << " " << meteor.j << " "
+            << meteor.positionAngle << " " << meteor.angularSpeed << " " << meteor.peakMag << "\n";
+    }
+    out << "# aircraft id i j vi[pixels/s] vj[pixels/s] mag blinkPeriodS blinkDutyCycle\n";
+    for(unsigned int a = 0; a < aircraft.size(); a++) {
+        const SyntheticAircraft &plane = aircraft[a];
+        out << "aircraft " << a << " " << plane.i << " " << plane.j << " " << plane.vi << " " << plane.vj << " " << plane.mag << " "
+            << plane.blinkPeriodS << " " << plane.blinkDutyCycle << "\n";
+    }
+    out << "# hotpixel i j level[ADU]\n";
+    for(unsigned int p = 0; p < hotPixels.size(); p++) {
+        out << "hotpixel " << hotPixels[p] % cam->width << " " << hotPixels[p] / cam->width << " " << hotPixelLevel << "\n";
+    }
+    out << "# frame index epochTimeUs type id iStart jStart iEnd jEnd flux[ADU]\n";
+    for(unsigned int t = 0; t < truth.size(); t++) {
+        const SyntheticTruth &record = truth[t];
+        out << "frame " << record.frame << " " << startEpochTimeUs + record.frame * framePeriodUs << " " << (record.meteor ? "meteor " : "aircraft ")
+            << record.id << " " << record.iStart << " " << record.jStart << " " << record.iEnd << " " << record.jEnd << " " << record.flux << "\n";
+    }
+    out.close();
+
+    double elapsed = (t1 - t0) / 1000000.0;
+    fprintf(stderr, "Generated %u synthetic frames (%dx%d) in %s: %f [s], %f frames per second\n", nFrames, cam->width, cam->height, path.c_str(),
+            elapsed, nFrames / elapsed);
+
+    return path;
+}
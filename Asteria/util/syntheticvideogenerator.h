@@ -0,0 +1,347 @@
+#ifndef SYNTHETICVIDEOGENERATOR_H
+#define SYNTHETICVIDEOGENERATOR_H
+
+#include "infra/imageuc.h"
+#include "infra/referencestar.h"
+#include "optics/cameramodelbase.h"
+
+#include <vector>
+#include <string>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief Specifies a meteor to be rendered into a synthetic clip. The meteor moves along a great circle
+ * at constant angular speed, with a brightness that rises and falls smoothly over its duration.
+ */
+struct SyntheticMeteor {
+
+    /**
+     * @brief The time of the start of the meteor, measured from the start of the clip [seconds]
+     */
+    double startTimeS;
+
+    /**
+     * @brief The duration of the meteor [seconds]
+     */
+    double durationS;
+
+    /**
+     * @brief The image coordinates of the meteor at the start [pixels]
+     */
+    double i;
+    double j;
+
+    /**
+     * @brief The initial direction of motion in the image, measured from the i axis towards the j axis [radians]
+     */
+    double positionAngle;
+
+    /**
+     * @brief The angular speed of the meteor across the sky [radians per second]
+     */
+    double angularSpeed;
+
+    /**
+     * @brief The apparent magnitude of the meteor at its brightest [mag]
+     */
+    double peakMag;
+};
+
+/**
+ * @brief Specifies an aircraft to be rendered into a synthetic clip, as a distractor. The aircraft moves
+ * slowly in a straight line across the image, showing a light that blinks on and off.
+ */
+struct SyntheticAircraft {
+
+    /**
+     * @brief The image coordinates of the aircraft at the start of the clip [pixels]
+     */
+    double i;
+    double j;
+
+    /**
+     * @brief The velocity of the aircraft across the image [pixels per second]
+     */
+    double vi;
+    double vj;
+
+    /**
+     * @brief The apparent magnitude of the light when it's on [mag]
+     */
+    double mag;
+
+    /**
+     * @brief The period of the blinking [seconds]
+     */
+    double blinkPeriodS;
+
+    /**
+     * @brief The fraction of the period that the light is on; 1 for a steady light.
+     */
+    double blinkDutyCycle;
+};
+
+/**
+ * @brief Records the ground truth for a moving object (meteor or aircraft) in one frame of a synthetic clip.
+ */
+struct SyntheticTruth {
+
+    /**
+     * @brief The index of the frame within the clip.
+     */
+    unsigned int frame;
+
+    /**
+     * @brief Indicates whether the object is a meteor; otherwise it's an aircraft.
+     */
+    bool meteor;
+
+    /**
+     * @brief The index of the object in the list of meteors or aircraft.
+     */
+    unsigned int id;
+
+    /**
+     * @brief The image coordinates of the object at the start and end of the exposure [pixels]
+     */
+    double iStart;
+    double jStart;
+    double iEnd;
+    double jEnd;
+
+    /**
+     * @brief The total signal from the object in the frame [ADU]
+     */
+    double flux;
+};
+
+/**
+ * @brief Renders synthetic clips with a known ground truth, for testing and benchmarking the event detection.
+ *
+ * Each frame contains the star field seen by the camera at the time of the frame, with read noise, shot
+ * noise and a sky background, plus any meteors and distractors (hot pixels, twinkling stars and aircraft).
+ * The stars are projected through the camera model, so any of the supported models can be used. Frames are
+ * rendered as local stamps around each object plus one pass over the image to add the background and noise,
+ * which is split across threads, so the generator scales to large images and high frame rates.
+ *
+ * Clips are written in the layout used by AnalysisInventory::saveToDir, so they can be replayed through
+ * the detection pipeline with ReplayFrameSource. The ground truth is written alongside the frames.
+ */
+class SyntheticVideoGenerator
+{
+
+public:
+
+    /**
+     * @brief Main constructor. The parameters of the clip are set to defaults that resemble a typical
+     * low-light camera, and can be changed before rendering.
+     * @param cam
+     *  The camera model used to project the stars and meteors, which also sets the image size.
+     * @param q_sez_cam
+     *  The orientation of the camera frame relative to the SEZ frame.
+     * @param lon
+     *  The longitude of the observing site [radians]
+     * @param lat
+     *  The latitude of the observing site [radians]
+     * @param catalogue
+     *  The reference star catalogue rendered into the star field.
+     */
+    SyntheticVideoGenerator(const CameraModelBase * cam, const Eigen::Quaterniond &q_sez_cam, const double &lon, const double &lat,
+                            const std::vector<ReferenceStar> &catalogue);
+
+    /**
+     * @brief The capture time of the first frame [microseconds since 1970-01-01T00:00:00Z]
+     */
+    long long startEpochTimeUs;
+
+    /**
+     * @brief The time between frames, which is also the exposure time [microseconds]
+     */
+    long long framePeriodUs;
+
+    /**
+     * @brief The number of frames in the clip.
+     */
+    unsigned int nFrames;
+
+    /**
+     * @brief The sky background level [ADU per pixel]
+     */
+    double skyBackground;
+
+    /**
+     * @brief The standard deviation of the read noise [ADU]
+     */
+    double readNoise;
+
+    /**
+     * @brief The number of photoelectrons per ADU, which sets the level of the shot noise.
+     */
+    double gain;
+
+    /**
+     * @brief The total signal from a magnitude zero source in one frame [ADU]
+     */
+    double zeroMagFlux;
+
+    /**
+     * @brief The standard deviation of the Gaussian point spread function [pixels]
+     */
+    double psfSigma;
+
+    /**
+     * @brief Stars fainter than this are not rendered [mag]
+     */
+    double faintMagLimit;
+
+    /**
+     * @brief The fractional standard deviation of the random variation in the brightness of the stars from
+     * frame to frame, i.e. the twinkling.
+     */
+    double twinkle;
+
+    /**
+     * @brief The number of hot pixels, which are placed at random.
+     */
+    unsigned int nHotPixels;
+
+    /**
+     * @brief The signal added to each hot pixel [ADU]
+     */
+    double hotPixelLevel;
+
+    /**
+     * @brief Seed for the random number generators; clips are reproducible for the same seed and parameters.
+     */
+    unsigned int seed;
+
+    /**
+     * @brief The number of threads used to add the background and noise.
+     */
+    unsigned int nThreads;
+
+    /**
+     * @brief The meteors to render.
+     */
+    std::vector<SyntheticMeteor> meteors;
+
+    /**
+     * @brief The aircraft to render.
+     */
+    std::vector<SyntheticAircraft> aircraft;
+
+    /**
+     * @brief Renders one frame of the clip.
+     * @param f
+     *  The index of the frame.
+     * @param image
+     *  On exit, contains the frame. This is resized if necessary.
+     * @param truth
+     *  On exit, the ground truth for each meteor and aircraft visible in the frame has been appended.
+     */
+    void renderFrame(const unsigned int &f, Imageuc &image, std::vector<SyntheticTruth> &truth);
+
+    /**
+     * @brief Renders the clip and writes it to a new clip directory, named by the time of the first frame,
+     * within the given video directory. The frames are written to the raw/ subdirectory, and the ground
+     * truth to the file truth.txt.
+     * @param videoDirPath
+     *  Path to the top level video directory.
+     * @return
+     *  The path to the clip directory, or an empty string if it couldn't be created.
+     */
+    std::string generate(const std::string &videoDirPath);
+
+    /**
+     * @brief Gets the position of a meteor at a given time.
+     * @param meteor
+     *  The meteor.
+     * @param t
+     *  The time measured from the start of the clip [seconds]
+     * @param i
+     *  On exit, contains the image i coordinate of the meteor [pixels]
+     * @param j
+     *  On exit, contains the image j coordinate of the meteor [pixels]
+     * @return
+     *  True if the meteor projects into the image; false if it's off the edge of the image.
+     */
+    bool getMeteorPosition(const SyntheticMeteor &meteor, const double &t, double &i, double &j) const;
+
+private:
+
+    /**
+     * @brief The camera model.
+     */
+    const CameraModelBase * cam;
+
+    /**
+     * @brief The rotation matrix from the SEZ frame to the CAM frame.
+     */
+    Eigen::Matrix3d r_sez_cam;
+
+    /**
+     * @brief The rotation matrix from the ECEF frame to the SEZ frame.
+     */
+    Eigen::Matrix3d r_ecef_sez;
+
+    /**
+     * @brief The BCRF unit vectors and magnitudes of the reference stars.
+     */
+    std::vector<Eigen::Vector3d> starDirs;
+    std::vector<double> starMags;
+
+    /**
+     * @brief Table of standard normal deviates, used to add the noise quickly.
+     */
+    std::vector<float> normalDeviates;
+
+    /**
+     * @brief The noise-free signal in the frame being rendered [ADU]
+     */
+    std::vector<float> signal;
+
+    /**
+     * @brief The indices of the hot pixels, chosen when the first frame is rendered.
+     */
+    std::vector<unsigned int> hotPixels;
+
+    /**
+     * @brief Adds a point source to the signal.
+     * @param i
+     *  The image i coordinate of the source [pixels]
+     * @param j
+     *  The image j coordinate of the source [pixels]
+     * @param flux
+     *  The total signal from the source [ADU]
+     */
+    void addPointSource(const double &i, const double &j, const double &flux);
+
+    /**
+     * @brief Adds a source moving in a straight line during the exposure to the signal.
+     * @param i0
+     *  The image i coordinate of the source at the start of the streak [pixels]
+     * @param j0
+     *  The image j coordinate of the source at the start of the streak [pixels]
+     * @param i1
+     *  The image i coordinate of the source at the end of the streak [pixels]
+     * @param j1
+     *  The image j coordinate of the source at the end of the streak [pixels]
+     * @param flux
+     *  The total signal from the source [ADU]
+     */
+    void addStreak(const double &i0, const double &j0, const double &i1, const double &j1, const double &flux);
+
+    /**
+     * @brief Adds the background and noise to a band of rows, and converts the result to 8-bit pixels.
+     * @param f
+     *  The index of the frame, which seeds the noise.
+     * @param band
+     *  The index of the band.
+     * @param image
+     *  The image to write the pixels to.
+     */
+    void addNoise(const unsigned int &f, const unsigned int &band, Imageuc &image);
+};
+
+#endif // SYNTHETICVIDEOGENERATOR_H
@@ -1,12 +1,46 @@
 #include "testutil.h"
 
 #include "math/polynomialfitter.h"
+#include "math/cosinefitter.h"
+#include "math/fixedlevenbergmarquardtsolver.h"
+#include "math/multiepochgeocalfitter.h"
 #include "util/coordinateutil.h"
 #include "util/mathutil.h"
 #include "util/timeutil.h"
+#include "util/framediffutil.h"
+#include "util/jpgutil.h"
+#include "util/jpgdecoder.h"
+#include "util/jpgdecodepool.h"
+#include "util/pixelkernelutil.h"
 #include "infra/imaged.h"
+#include "infra/imageucpool.h"
+#include "infra/spscringbuffer.h"
+#include "infra/workerpool.h"
+#include "infra/replayframesource.h"
+#include "util/syntheticvideogenerator.h"
+#include "infra/calibrationaccumulator.h"
+#include "util/medianfilterutil.h"
+#include "util/sourcedetector.h"
+#include "util/crossmatchutil.h"
+#include "infra/referencestarcatalogue.h"
+#include "infra/visiblestarcache.h"
+#include "infra/pixelraymap.h"
+#include "optics/pinholecamera.h"
+#include "optics/pinholecamerawithradialdistortion.h"
+#include "optics/pinholecamerawithsipdistortion.h"
+#include "util/fileutil.h"
+#include "util/psffitutil.h"
+#include "util/autodiffutil.h"
 
 #include <fstream>
+#include <random>
+#include <set>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
 
 #include <Eigen/Dense>
 
@@ -94,13 +128,16 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
     // 1) Number & value of true parameters, a (model is a0 + a1*x + a2*x*x + ...)
     // 2) Number & value of points at which observations are made, x
     // 3) Number of realizations of the observed data to make
+    //
+    // The data covariance is block diagonal with 2x2 blocks, and each realisation is fitted using both the full
+    // covariance matrix and the block diagonal covariance, which should give identical results.
 
     // True polynomial coefficients
     unsigned int M = 3;
     double a [M] = {2.35, -15.3, 6.367};
 
-    // Points at which to draw observed data
-    unsigned int N = 21;
+    // Points at which to draw observed data; there must be an even number to form 2x2 covariance blocks
+    unsigned int N = 22;
     std::vector<double> xs;
     for(unsigned int n=0; n<N; n++) {
         double x = -1.0 + n*0.1;
@@ -112,7 +149,7 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
 
     // Fixed parts
 
-    // Draw covariance matrix for data points
+    // Draw covariance matrix for data points; consecutive pairs of points are correlated
     double covar[N*N];
     for(unsigned int n1=0; n1<N; n1++) {
         for(unsigned int n2=n1; n2<N; n2++) {
@@ -131,12 +168,24 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
                 unsigned int idxN1 = n1 * N + n2;
                 unsigned int idxN2 = n2 * N + n1;
 
-                covar[idxN1] = 0.0;
-                covar[idxN2] = 0.0;
+                // Points in the same block are correlated
+                double c = (n1/2 == n2/2) ? 0.5 : 0.0;
+
+                covar[idxN1] = c;
+                covar[idxN2] = c;
             }
         }
     }
 
+    // The same covariance matrix as 2x2 blocks
+    double blocks[2*N];
+    for(unsigned int b=0; b<N/2; b++) {
+        blocks[4*b + 0] = covar[(2*b)*N + 2*b];
+        blocks[4*b + 1] = covar[(2*b)*N + 2*b + 1];
+        blocks[4*b + 2] = covar[(2*b + 1)*N + 2*b];
+        blocks[4*b + 3] = covar[(2*b + 1)*N + 2*b + 1];
+    }
+
     // Compute true noise-free observations
     double y_true[N] = {0.0};
     for(unsigned int n=0; n<N; n++) {
@@ -152,6 +201,11 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
     // Sum up the sample covariance matrix for the parameters solution
     double param_cov [M*M] = {0.0};
 
+    // Largest differences between the fits using the full and block diagonal covariance
+    double maxParamDiff = 0.0;
+    double maxChi2Diff = 0.0;
+    double maxParamCovDiff = 0.0;
+
     for(unsigned int trial = 0; trial < trials; trial++) {
 
         fprintf(stderr,  "trial %d:\n", trial);
@@ -175,6 +229,21 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
         double solution[M];
         polyFit.getParameters(solution);
 
+        // 3b) Repeat the fit using the block diagonal covariance
+        PolynomialFitter blockFit(xs, ys, M);
+        blockFit.setParameters(initialGuessParams);
+        blockFit.setBlockDiagonalCovariance(blocks);
+        blockFit.fit(500, false);
+        double blockSolution[M];
+        blockFit.getParameters(blockSolution);
+
+        for(unsigned int m=0; m<M; m++) {
+            maxParamDiff = std::max(maxParamDiff, std::fabs(solution[m] - blockSolution[m]));
+        }
+        maxChi2Diff = std::max(maxChi2Diff, std::fabs(polyFit.getChi2() - blockFit.getChi2()));
+        MatrixXd paramCovDiff = polyFit.getParameterCovariance() - blockFit.getParameterCovariance();
+        maxParamCovDiff = std::max(maxParamCovDiff, paramCovDiff.cwiseAbs().maxCoeff());
+
         // 4) Add the parameters solution to the sample covariance matrix
         for(unsigned int m1=0; m1<M; m1++) {
             for(unsigned int m2=0; m2<M; m2++) {
@@ -213,9 +282,69 @@ void TestUtil::testLevenbergMarquardtFitterCovariance() {
         fprintf(stderr, "\n");
     }
 
+    // The fits stop when the chi2 no longer improves, so the parameters agree to a tiny fraction of their standard errors
+    // rather than to rounding error
+    bool pass = (maxParamDiff < 1e-6) && (maxChi2Diff < 1e-9) && (maxParamCovDiff < 1e-9);
+    fprintf(stderr, "Full vs block diagonal covariance: max difference in parameters = %g, chi2 = %g, parameter covariance = %g\n",
+            maxParamDiff, maxChi2Diff, maxParamCovDiff);
+
+    // Time the fits with a number of data points typical of the geometric calibration
+    unsigned int nLarge = 1000;
+    std::vector<double> xsLarge;
+    std::vector<double> ysLarge;
+    std::vector<double> covarLarge(nLarge*nLarge, 0.0);
+    std::vector<double> blocksLarge(2*nLarge);
+    std::mt19937 gen(41);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for(unsigned int n=0; n<nLarge; n++) {
+        double x = -1.0 + 2.0 * n / (nLarge - 1);
+        double tmp = 1.0;
+        double y = 0.0;
+        for(unsigned int m=0; m<M; m++) {
+            y += tmp * a[m];
+            tmp *= x;
+        }
+        xsLarge.push_back(x);
+        ysLarge.push_back(y + normal(gen));
+        covarLarge[n*nLarge + n] = 1.0;
+        covarLarge[n*nLarge + (n ^ 1u)] = 0.5;
+    }
+    for(unsigned int b=0; b<nLarge/2; b++) {
+        blocksLarge[4*b + 0] = 1.0;
+        blocksLarge[4*b + 1] = 0.5;
+        blocksLarge[4*b + 2] = 0.5;
+        blocksLarge[4*b + 3] = 1.0;
+    }
 
+    double initialGuessParams[M] = {1.0, 1.0, 1.0};
+    double denseSolution[M];
+    double blockSolution[M];
+
+    long long t0 = TimeUtil::getUpTime();
+    PolynomialFitter denseFit(xsLarge, ysLarge, M);
+    denseFit.setParameters(initialGuessParams);
+    denseFit.setCovariance(covarLarge.data());
+    denseFit.fit(500, false);
+    denseFit.getParameters(denseSolution);
+    double tDense = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    t0 = TimeUtil::getUpTime();
+    PolynomialFitter blockFit(xsLarge, ysLarge, M);
+    blockFit.setParameters(initialGuessParams);
+    blockFit.setBlockDiagonalCovariance(blocksLarge.data());
+    blockFit.fit(500, false);
+    blockFit.getParameters(blockSolution);
+    double tBlock = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    double maxLargeDiff = 0.0;
+    for(unsigned int m=0; m<M; m++) {
+        maxLargeDiff = std::max(maxLargeDiff, std::fabs(denseSolution[m] - blockSolution[m]));
+    }
+    pass &= (maxLargeDiff < 1e-6);
 
-
+    fprintf(stderr, "Fit of %d points: %f [s] with full covariance vs %f [s] block diagonal; max difference in parameters = %g\n",
+            nLarge, tDense, tBlock, maxLargeDiff);
+    fprintf(stderr, "Block diagonal covariance test %s\n", pass ? "PASSED" : "FAILED");
 }
 
 void TestUtil::testLevenbergMarquardtFitter() {
@@ -420,3 +549,2735 @@ void TestUtil::testImagedReadWrite() {
     }
 }
 
+
+/**
+ * @brief Tests the fused frame differencing kernel against a straightforward per-pixel loop, and
+ * compares the speed of the vectorised and scalar kernels.
+ */
+void TestUtil::testFrameDifference() {
+
+    // Odd width so that the rows don't fill a whole number of bitmap words
+    unsigned int width = 1923u;
+    unsigned int height = 1080u;
+    unsigned int nPix = width * height;
+    unsigned int threshold = 20u;
+
+    // Two frames of noise, plus a bright streak and a fading streak in the second frame
+    std::mt19937 gen(12345);
+    std::normal_distribution<double> noise(0.0, 6.0);
+    ImageData<unsigned char>::type previous(nPix);
+    ImageData<unsigned char>::type current(nPix);
+    for(unsigned int p = 0; p < nPix; p++) {
+        previous[p] = (unsigned char)std::max(0.0, std::min(255.0, 60.0 + noise(gen)));
+        current[p] = (unsigned char)std::max(0.0, std::min(255.0, 60.0 + noise(gen)));
+    }
+    for(unsigned int x = 100; x < 900; x++) {
+        unsigned int y = 200 + x / 3;
+        current[y * width + x] = 250;
+        previous[(y + 10) * width + x + 1] = 250;
+    }
+    // Saturated pixels at the image edges, including the final partial word of each row
+    current[0] = 255;
+    current[width - 1] = 255;
+    previous[nPix - 1] = 255;
+
+    // Reference solution using the naive loop
+    std::vector<unsigned int> refPos;
+    std::vector<unsigned int> refNeg;
+    double refSumX = 0.0;
+    double refSumY = 0.0;
+    for(unsigned int p = 0; p < nPix; p++) {
+        int d = (int)current[p] - (int)previous[p];
+        if((unsigned int)std::abs(d) > threshold) {
+            if(d > 0) {
+                refPos.push_back(p);
+            }
+            else {
+                refNeg.push_back(p);
+            }
+            refSumX += p % width;
+            refSumY += p / width;
+        }
+    }
+
+    FrameDifference fast;
+    FrameDifference scalar;
+    FrameDiffUtil::computeDifference(current, previous, width, height, threshold, fast);
+    FrameDiffUtil::computeDifferenceScalar(current, previous, width, height, threshold, scalar);
+
+    std::vector<unsigned int> fastPos, fastNeg, scalarPos, scalarNeg;
+    fast.getChangedPixels(fastPos, fastNeg);
+    scalar.getChangedPixels(scalarPos, scalarNeg);
+
+    bool pass = (fastPos == refPos) && (fastNeg == refNeg) && (scalarPos == refPos) && (scalarNeg == refNeg);
+    pass &= (fast.nChangedPixels == refPos.size() + refNeg.size());
+    pass &= (fast.sum_x == (unsigned long long)refSumX) && (fast.sum_y == (unsigned long long)refSumY);
+    pass &= (fast.positiveMask == scalar.positiveMask) && (fast.negativeMask == scalar.negativeMask);
+    pass &= (fast.bb_xmin == 0u) && (fast.bb_xmax == width - 1) && (fast.bb_ymin == 0u) && (fast.bb_ymax == height - 1);
+
+    fprintf(stderr, "Kernel %s: %u changed pixels (%u positive, %u negative); reference %lu (%lu, %lu)\n", FrameDiffUtil::getKernelName(),
+            fast.nChangedPixels, fast.nPositive, fast.nNegative, refPos.size() + refNeg.size(), refPos.size(), refNeg.size());
+    fprintf(stderr, "Frame difference test %s\n", pass ? "PASSED" : "FAILED");
+
+    // Benchmark
+    unsigned int trials = 100;
+    long long t0 = TimeUtil::getUpTime();
+    for(unsigned int t = 0; t < trials; t++) {
+        FrameDiffUtil::computeDifference(current, previous, width, height, threshold, fast);
+    }
+    long long t1 = TimeUtil::getUpTime();
+    for(unsigned int t = 0; t < trials; t++) {
+        FrameDiffUtil::computeDifferenceScalar(current, previous, width, height, threshold, scalar);
+    }
+    long long t2 = TimeUtil::getUpTime();
+
+    fprintf(stderr, "%s kernel: %f [ms/frame]\n", FrameDiffUtil::getKernelName(), (t1 - t0) / (1000.0 * trials));
+    fprintf(stderr, "Scalar kernel: %f [ms/frame]\n", (t2 - t1) / (1000.0 * trials));
+}
+
+/**
+ * @brief Tests the recycling of images by the ImageucPool, emulating the pattern of use in the capture
+ * loop where each frame is held by a ring buffer for a fixed number of frames.
+ */
+void TestUtil::testImageucPool() {
+
+    unsigned int width = 640u;
+    unsigned int height = 480u;
+    unsigned int capacity = 20u;
+    unsigned int head = 16u;
+
+    std::set<Imageuc *> distinctImages;
+    std::vector<std::shared_ptr<Imageuc>> ring(head);
+
+    {
+        ImageucPool pool(width, height, capacity, 4u);
+
+        // Steady state: each frame is released after head more frames have been acquired
+        for(unsigned int f = 0; f < 1000u; f++) {
+            std::shared_ptr<Imageuc> image = pool.acquire();
+            image->epochTimeUs = f;
+            distinctImages.insert(image.get());
+            ring[f % head] = image;
+        }
+
+        ImageucPoolStats stats = pool.getStats();
+        fprintf(stderr, "Steady state: allocated %d, in use %d, peak %d, acquired %lu, overflows %lu, distinct images %lu\n",
+                stats.allocated, stats.inUse, stats.peakInUse, stats.acquired, stats.overflows, distinctImages.size());
+
+        bool pass = (stats.overflows == 0ul) && (distinctImages.size() <= head + 1) && (stats.inUse == head);
+
+        // Exhaust the pool: the extra images should be overflows
+        std::vector<std::shared_ptr<Imageuc>> clip;
+        for(unsigned int f = 0; f < capacity; f++) {
+            clip.push_back(pool.acquire());
+        }
+        stats = pool.getStats();
+        fprintf(stderr, "Exhausted: allocated %d, in use %d, overflow in use %d, overflows %lu\n",
+                stats.allocated, stats.inUse, stats.overflowInUse, stats.overflows);
+        pass &= (stats.allocated == capacity) && (stats.overflows == head) && (stats.overflowInUse == head);
+
+        clip.clear();
+        stats = pool.getStats();
+        pass &= (stats.inUse == head) && (stats.overflowInUse == 0u);
+
+        fprintf(stderr, "Image pool test %s\n", pass ? "PASSED" : "FAILED");
+    }
+
+    // The pool has been deleted; the images in the ring buffer must still be valid
+    fprintf(stderr, "Image outliving the pool: %d x %d, epochTimeUs = %lld\n", ring[0]->width, ring[0]->height, ring[0]->epochTimeUs);
+    ring.clear();
+}
+
+/**
+ * @brief Encodes a synthetic night sky frame as a colour JPEG with 4:2:2 chroma subsampling, like the
+ * frames produced by MJPEG webcams.
+ */
+static void encodeTestJpeg(unsigned int width, unsigned int height, unsigned int seed, std::vector<unsigned char> &jpeg) {
+
+    std::mt19937 gen(seed);
+    std::normal_distribution<double> noise(0.0, 4.0);
+    std::uniform_int_distribution<unsigned int> pos(0, width * height - 1);
+
+    // Neutral grey sky with noise plus some bright 'stars'
+    std::vector<unsigned char> rgb(width * height * 3);
+    for(unsigned int p = 0; p < width * height; p++) {
+        unsigned char level = (unsigned char)std::max(0.0, std::min(255.0, 40.0 + noise(gen)));
+        rgb[3*p] = rgb[3*p+1] = rgb[3*p+2] = level;
+    }
+    for(unsigned int s = 0; s < 200; s++) {
+        unsigned int p = pos(gen);
+        rgb[3*p] = rgb[3*p+1] = rgb[3*p+2] = 250;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char * outbuffer = NULL;
+    unsigned long outsize = 0;
+    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    // 4:2:2 subsampling
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &rgb[cinfo.next_scanline * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    jpeg.assign(outbuffer, outbuffer + outsize);
+    free(outbuffer);
+}
+
+/**
+ * @brief Tests the greyscale JpgDecoder and the JpgDecodePool against JpgUtil::readJpeg, and benchmarks
+ * the three decode paths on a sequence of MJPEG-like frames.
+ */
+void TestUtil::testJpgDecode() {
+
+    unsigned int width = 1280u;
+    unsigned int height = 720u;
+    unsigned int nFrames = 100u;
+    unsigned int nDistinct = 10u;
+
+    std::vector<std::vector<unsigned char>> jpegs(nDistinct);
+    for(unsigned int f = 0; f < nDistinct; f++) {
+        encodeTestJpeg(width, height, f, jpegs[f]);
+    }
+    fprintf(stderr, "Encoded %d test frames of %d x %d; %lu bytes per frame\n", nDistinct, width, height, jpegs[0].size());
+
+    // Correctness: the luminance should match the RGB average closely for a neutral image
+    std::vector<unsigned char> reference(width * height);
+    ImageData<unsigned char>::type grey(width * height);
+    JpgDecoder decoder;
+    JpgUtil::readJpeg(jpegs[0].data(), jpegs[0].size(), reference);
+    bool pass = decoder.decode(jpegs[0].data(), jpegs[0].size(), width, height, grey);
+    int maxDiff = 0;
+    for(unsigned int p = 0; p < width * height; p++) {
+        maxDiff = std::max(maxDiff, std::abs((int)grey[p] - (int)reference[p]));
+    }
+    fprintf(stderr, "Maximum difference between luminance and RGB average = %d\n", maxDiff);
+    pass &= (maxDiff <= 3);
+
+    // Decoding a corrupt or truncated frame, or one of the wrong size, must fail cleanly and leave the
+    // decoder usable
+    std::vector<unsigned char> corrupt(jpegs[1].begin(), jpegs[1].begin() + 100);
+    std::vector<unsigned char> truncated(jpegs[1].begin(), jpegs[1].begin() + jpegs[1].size() / 2);
+    pass &= !decoder.decode(corrupt.data(), corrupt.size(), width, height, grey);
+    pass &= !decoder.decode(truncated.data(), truncated.size(), width, height, grey);
+    pass &= !decoder.decode(jpegs[0].data(), jpegs[0].size(), width / 2, height, grey);
+    pass &= decoder.decode(jpegs[0].data(), jpegs[0].size(), width, height, grey);
+
+    // Benchmark the existing decoder
+    long long t0 = TimeUtil::getUpTime();
+    for(unsigned int f = 0; f < nFrames; f++) {
+        JpgUtil::readJpeg(jpegs[f % nDistinct].data(), jpegs[f % nDistinct].size(), reference);
+    }
+    long long t1 = TimeUtil::getUpTime();
+
+    // Benchmark the greyscale decoder
+    for(unsigned int f = 0; f < nFrames; f++) {
+        decoder.decode(jpegs[f % nDistinct].data(), jpegs[f % nDistinct].size(), width, height, grey);
+    }
+    long long t2 = TimeUtil::getUpTime();
+
+    fprintf(stderr, "JpgUtil::readJpeg: %f [ms/frame]\n", (t1 - t0) / (1000.0 * nFrames));
+    fprintf(stderr, "JpgDecoder:        %f [ms/frame]\n", (t2 - t1) / (1000.0 * nFrames));
+
+    // Benchmark the decode pool with increasing numbers of threads, checking the frame order is preserved
+    for(unsigned int nThreads = 1; nThreads <= 4; nThreads *= 2) {
+
+        JpgDecodePool pool(nThreads);
+        unsigned int maxPending = 2 * nThreads;
+
+        long long t3 = TimeUtil::getUpTime();
+        unsigned int nOut = 0;
+        for(unsigned int f = 0; f < nFrames; f++) {
+            std::shared_ptr<Imageuc> image = std::make_shared<Imageuc>(width, height);
+            image->epochTimeUs = f;
+            pool.submit(jpegs[f % nDistinct].data(), jpegs[f % nDistinct].size(), image);
+            while(pool.next(image, pool.pending() >= maxPending)) {
+                pass &= (image->epochTimeUs == (long long)nOut++);
+            }
+        }
+        std::shared_ptr<Imageuc> image;
+        while(pool.next(image, true)) {
+            pass &= (image->epochTimeUs == (long long)nOut++);
+        }
+        long long t4 = TimeUtil::getUpTime();
+
+        pass &= (nOut == nFrames);
+        fprintf(stderr, "JpgDecodePool (%d threads): %f [ms/frame]\n", nThreads, (t4 - t3) / (1000.0 * nFrames));
+
+        // Frames that fail to decode are retrieved in order as null images; the sequence flag and stats of
+        // each frame are retrieved with it
+        bool newSequence;
+        AcquisitionVideoStats stats;
+        pool.submit(truncated.data(), truncated.size(), std::make_shared<Imageuc>(width, height), true, AcquisitionVideoStats(25.0, 0, 0, 1, "first"));
+        pool.submit(jpegs[0].data(), jpegs[0].size(), std::make_shared<Imageuc>(width, height), false, AcquisitionVideoStats(25.0, 0, 0, 2, "second"));
+        pass &= pool.next(image, newSequence, stats, true) && !image && newSequence && (stats.totalFrames == 1) && (stats.utc == "first");
+        pass &= pool.next(image, newSequence, stats, true) && image && !newSequence && (stats.totalFrames == 2) && (stats.utc == "second");
+    }
+
+    fprintf(stderr, "JPEG decode test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testPixelKernels() {
+
+    // Odd number of pixels so that every kernel has to handle a partial vector at the end, and an offset
+    // into the arrays so that the vector loads are unaligned
+    unsigned int width = 1923u;
+    unsigned int height = 1080u;
+    unsigned int nPix = width * height;
+    unsigned int offset = 3u;
+
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::normal_distribution<double> value(100.0, 50.0);
+
+    std::vector<unsigned char> yuyv(2 * nPix + offset);
+    std::vector<unsigned char> a(nPix + offset);
+    std::vector<unsigned char> b(nPix + offset);
+    std::vector<double> d(nPix + offset);
+    for(unsigned int p = 0; p < yuyv.size(); p++) {
+        yuyv[p] = (unsigned char)byte(gen);
+    }
+    for(unsigned int p = 0; p < nPix + offset; p++) {
+        a[p] = (unsigned char)byte(gen);
+        b[p] = (unsigned char)byte(gen);
+        d[p] = value(gen);
+    }
+    // Put the extreme values in the final partial vector
+    d[offset + nPix - 1] = 1000.0;
+    d[offset + nPix - 2] = -1000.0;
+
+    // Scalar reference solutions
+    std::vector<unsigned char> refLuma(nPix);
+    PixelKernelUtil::extractLumaScalar(&yuyv[offset], refLuma.data(), nPix);
+
+    std::vector<unsigned char> refMax(&b[offset], &b[offset] + nPix);
+    PixelKernelUtil::maxScalar(&a[offset], refMax.data(), nPix);
+
+    double refMin, refMaxVal;
+    PixelKernelUtil::minMaxScalar(&d[offset], nPix, refMin, refMaxVal);
+
+    // Rescale to a narrower range than the data so that the clamping is tested too
+    std::vector<unsigned char> refRescaled(nPix);
+    PixelKernelUtil::rescaleScalar(&d[offset], refRescaled.data(), nPix, 0.0, 200.0);
+
+    std::vector<unsigned int> refSum(nPix, 7u);
+    std::vector<unsigned int> refSumSq(nPix, 11u);
+    PixelKernelUtil::accumulateScalar(&a[offset], refSum.data(), refSumSq.data(), nPix);
+    PixelKernelUtil::accumulateScalar(&b[offset], refSum.data(), refSumSq.data(), nPix);
+
+    bool pass = (refMin == -1000.0) && (refMaxVal == 1000.0);
+
+    PixelKernelUtil::InstructionSet supported = PixelKernelUtil::getSupportedInstructionSet();
+
+    for(int isa = PixelKernelUtil::SCALAR; isa <= supported; isa++) {
+
+        PixelKernelUtil::setInstructionSet((PixelKernelUtil::InstructionSet)isa);
+
+        std::vector<unsigned char> luma(nPix);
+        PixelKernelUtil::extractLuma(&yuyv[offset], luma.data(), nPix);
+        bool lumaPass = (luma == refLuma);
+
+        std::vector<unsigned char> max(&b[offset], &b[offset] + nPix);
+        PixelKernelUtil::max(&a[offset], max.data(), nPix);
+        bool maxPass = (max == refMax);
+
+        double min, maxVal;
+        PixelKernelUtil::minMax(&d[offset], nPix, min, maxVal);
+        bool minMaxPass = (min == refMin) && (maxVal == refMaxVal);
+
+        std::vector<unsigned char> rescaled(nPix);
+        PixelKernelUtil::rescale(&d[offset], rescaled.data(), nPix, 0.0, 200.0);
+        bool rescalePass = (rescaled == refRescaled);
+
+        std::vector<unsigned int> sum(nPix, 7u);
+        std::vector<unsigned int> sumSq(nPix, 11u);
+        PixelKernelUtil::accumulate(&a[offset], sum.data(), sumSq.data(), nPix);
+        PixelKernelUtil::accumulate(&b[offset], sum.data(), sumSq.data(), nPix);
+        bool accumulatePass = (sum == refSum) && (sumSq == refSumSq);
+
+        // Benchmark
+        unsigned int trials = 20;
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int t = 0; t < trials; t++) {
+            PixelKernelUtil::extractLuma(&yuyv[offset], luma.data(), nPix);
+        }
+        long long t1 = TimeUtil::getUpTime();
+        for(unsigned int t = 0; t < trials; t++) {
+            PixelKernelUtil::max(&a[offset], max.data(), nPix);
+        }
+        long long t2 = TimeUtil::getUpTime();
+        for(unsigned int t = 0; t < trials; t++) {
+            PixelKernelUtil::minMax(&d[offset], nPix, min, maxVal);
+        }
+        long long t3 = TimeUtil::getUpTime();
+        for(unsigned int t = 0; t < trials; t++) {
+            PixelKernelUtil::rescale(&d[offset], rescaled.data(), nPix, min, maxVal);
+        }
+        long long t4 = TimeUtil::getUpTime();
+        for(unsigned int t = 0; t < trials; t++) {
+            PixelKernelUtil::accumulate(&a[offset], sum.data(), sumSq.data(), nPix);
+        }
+        long long t5 = TimeUtil::getUpTime();
+
+        fprintf(stderr, "%-8s extractLuma %s (%.3f ms), max %s (%.3f ms), minMax %s (%.3f ms), rescale %s (%.3f ms), accumulate %s (%.3f ms)\n",
+                PixelKernelUtil::getKernelName(),
+                lumaPass ? "OK" : "BAD", (t1 - t0) / (1000.0 * trials),
+                maxPass ? "OK" : "BAD", (t2 - t1) / (1000.0 * trials),
+                minMaxPass ? "OK" : "BAD", (t3 - t2) / (1000.0 * trials),
+                rescalePass ? "OK" : "BAD", (t4 - t3) / (1000.0 * trials),
+                accumulatePass ? "OK" : "BAD", (t5 - t4) / (1000.0 * trials));
+
+        pass &= lumaPass && maxPass && minMaxPass && rescalePass && accumulatePass;
+    }
+
+    // Restore the default dispatch
+    PixelKernelUtil::setInstructionSet(supported);
+
+    fprintf(stderr, "Pixel kernel test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testSpscRingBuffer() {
+
+    unsigned long nItems = 2000000ul;
+
+    // Producer and consumer running flat out: every item accepted by the queue must arrive once, in order,
+    // and every item rejected must be counted as an overflow
+    SpscRingBuffer<unsigned long> queue(64);
+    std::vector<bool> accepted(nItems, false);
+
+    std::atomic<bool> produced(false);
+    long long t0 = TimeUtil::getUpTime();
+    std::thread producer([&]() {
+        for(unsigned long n = 0; n < nItems; n++) {
+            accepted[n] = queue.push(n);
+        }
+        produced = true;
+    });
+
+    bool pass = true;
+    unsigned long nReceived = 0;
+    long long last = -1;
+    unsigned long item;
+    while(true) {
+        // Read the flag first, so that nothing pushed before it was set can be missed
+        bool finished = produced;
+        if(queue.pop(item)) {
+            pass &= ((long long)item > last);
+            last = item;
+            nReceived++;
+        }
+        else if(finished) {
+            break;
+        }
+    }
+    producer.join();
+    long long t1 = TimeUtil::getUpTime();
+
+    unsigned long nAccepted = std::count(accepted.begin(), accepted.end(), true);
+    pass &= (nReceived == nAccepted) && (nAccepted + queue.getOverflows() == nItems);
+
+    fprintf(stderr, "Unthrottled: %lu items, %lu received, %lu overflows; %f [ns/item]\n", nItems, nReceived, queue.getOverflows(),
+            (t1 - t0) * 1000.0 / nItems);
+
+    // Slow consumer that reads items in place: the producer must never block, and the overflows must account
+    // for exactly the items that were rejected
+    SpscRingBuffer<std::vector<unsigned char>> frames(8);
+    unsigned int nFrames = 200;
+    std::atomic<bool> done(false);
+    unsigned int nSent = 0;
+    std::thread sender([&]() {
+        for(unsigned int f = 0; f < nFrames; f++) {
+            std::vector<unsigned char> * slot = frames.claim();
+            if(slot) {
+                slot->assign(1000, (unsigned char)f);
+                frames.publish();
+                nSent++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        done = true;
+    });
+
+    unsigned int nFramesReceived = 0;
+    int lastFrame = -1;
+    while(true) {
+        bool finished = done;
+        std::vector<unsigned char> * slot = frames.peek();
+        if(slot) {
+            pass &= (slot->size() == 1000u) && ((int)(*slot)[0] > lastFrame);
+            lastFrame = (*slot)[0];
+            frames.consume();
+            nFramesReceived++;
+            std::this_thread::sleep_for(std::chrono::microseconds(300));
+        }
+        else if(finished) {
+            break;
+        }
+    }
+    sender.join();
+
+    pass &= (nFramesReceived == nSent) && (nSent + frames.getOverflows() == nFrames) && (frames.getOverflows() > 0);
+
+    fprintf(stderr, "Slow consumer: %u frames, %u received, %lu overflows\n", nFrames, nFramesReceived, frames.getOverflows());
+
+    fprintf(stderr, "SPSC ring buffer test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testWorkerPool() {
+
+    bool pass = true;
+
+    // Records the order in which the jobs are run
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto job = [&](std::string name) {
+        return [&mutex, &order, name]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(name);
+        };
+    };
+
+    // Job that occupies a worker until it is released
+    std::atomic<bool> release(false);
+    auto gate = [&]() {
+        while(!release) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    // Waits until the given number of jobs have completed
+    auto waitForJobs = [](WorkerPool &pool, unsigned long nJobs) {
+        for(unsigned int t = 0; t < 5000; t++) {
+            WorkerPoolStats stats = pool.getStats();
+            if(stats.completed[WorkerPool::CLIP_ANALYSIS] + stats.completed[WorkerPool::CALIBRATION] >= nJobs) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    };
+
+    // 1) Priority ordering: clips are run before calibrations, each in order of submission
+    {
+        WorkerPool pool(1, 10, std::vector<unsigned int>());
+        pool.submit(WorkerPool::CLIP_ANALYSIS, gate);
+        // Wait for the gate to start, so it's not counted in the queue
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.submit(WorkerPool::CALIBRATION, job("cal1"));
+        pool.submit(WorkerPool::CLIP_ANALYSIS, job("clip1"));
+        pool.submit(WorkerPool::CALIBRATION, job("cal2"));
+        pool.submit(WorkerPool::CLIP_ANALYSIS, job("clip2"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        release = true;
+        pass &= waitForJobs(pool, 5);
+
+        std::vector<std::string> expected = {"clip1", "clip2", "cal1", "cal2"};
+        pass &= (order == expected);
+
+        WorkerPoolStats stats = pool.getStats();
+        pass &= (stats.peakQueueLength == 4u) && (stats.queueLength == 0u) && (stats.running == 0u);
+        // The jobs waited for the gate to be released
+        pass &= (stats.maxWaitUs[WorkerPool::CALIBRATION] >= 10000ll) && (stats.totalWaitUs[WorkerPool::CLIP_ANALYSIS] >= 20000ll);
+
+        fprintf(stderr, "Priority ordering: %s\n", (order == expected) ? "PASSED" : "FAILED");
+    }
+
+    // 2) Overflow policy: calibrations are evicted in favour of clips, and clips are spilled then run once
+    // the queue has emptied
+    {
+        order.clear();
+        release = false;
+        std::atomic<unsigned int> nSpills(0);
+        auto spill = [&nSpills]() {
+            nSpills++;
+            return true;
+        };
+
+        WorkerPool pool(1, 2, std::vector<unsigned int>());
+        pool.submit(WorkerPool::CLIP_ANALYSIS, gate);
+        // Wait for the gate to start, so it's not counted in the queue
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.submit(WorkerPool::CALIBRATION, job("cal1"));
+        pool.submit(WorkerPool::CALIBRATION, job("cal2"));
+        // Queue full: evicts (discards) cal2, then cal1
+        pool.submit(WorkerPool::CLIP_ANALYSIS, job("clip1"), spill);
+        pool.submit(WorkerPool::CLIP_ANALYSIS, job("clip2"), spill);
+        // Queue full of clips: the new clip is spilled, and the new calibration is discarded
+        pool.submit(WorkerPool::CLIP_ANALYSIS, job("clip3"), spill);
+        pool.submit(WorkerPool::CALIBRATION, job("cal3"));
+        release = true;
+        pass &= waitForJobs(pool, 4);
+
+        std::vector<std::string> expected = {"clip1", "clip2", "clip3"};
+        pass &= (order == expected);
+
+        WorkerPoolStats stats = pool.getStats();
+        pass &= (nSpills == 1u) && (stats.spilled[WorkerPool::CLIP_ANALYSIS] == 1ul) && (stats.spilledQueueLength == 0u);
+        pass &= (stats.discarded[WorkerPool::CALIBRATION] == 3ul) && (stats.discarded[WorkerPool::CLIP_ANALYSIS] == 0ul);
+        pass &= (stats.submitted[WorkerPool::CLIP_ANALYSIS] == 4ul) && (stats.completed[WorkerPool::CLIP_ANALYSIS] == 4ul);
+        pass &= (stats.submitted[WorkerPool::CALIBRATION] == 3ul) && (stats.completed[WorkerPool::CALIBRATION] == 0ul);
+
+        fprintf(stderr, "Overflow policy: %s\n", (order == expected) ? "PASSED" : "FAILED");
+    }
+
+    // 3) Shutdown: jobs still waiting are spilled rather than lost
+    {
+        order.clear();
+        release = false;
+        std::atomic<unsigned int> nSpills(0);
+        auto spill = [&nSpills]() {
+            nSpills++;
+            return true;
+        };
+
+        WorkerPool * pool = new WorkerPool(1, 10, std::vector<unsigned int>());
+        pool->submit(WorkerPool::CLIP_ANALYSIS, gate);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool->submit(WorkerPool::CLIP_ANALYSIS, job("clip1"), spill);
+        pool->submit(WorkerPool::CLIP_ANALYSIS, job("clip2"), spill);
+        pool->submit(WorkerPool::CALIBRATION, job("cal1"));
+
+        // Release the gate while the pool is shutting down
+        std::thread releaser([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            release = true;
+        });
+        delete pool;
+        releaser.join();
+
+        pass &= order.empty() && (nSpills == 2u);
+
+        fprintf(stderr, "Shutdown: %u clips spilled, %lu jobs run\n", nSpills.load(), order.size());
+    }
+
+    fprintf(stderr, "Worker pool test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testReplayFrameSource() {
+
+    bool pass = true;
+
+    // Write two short clips to a temporary video directory, in the layout used by AnalysisInventory::saveToDir
+    char dirTemplate[] = "/tmp/asteria_replay_XXXXXX";
+    std::string videoDir = mkdtemp(dirTemplate);
+
+    unsigned int width = 64;
+    unsigned int height = 48;
+    unsigned int nFramesPerClip = 20;
+    long long framePeriodUs = 40000ll;
+    // Two clips, an hour apart
+    long long clipStartUs[] = {1500000000000000ll, 1500003600000000ll};
+
+    std::vector<long long> epochTimes;
+    for(unsigned int c = 0; c < 2; c++) {
+        std::string utc = TimeUtil::epochToUtcString(clipStartUs[c]);
+        std::vector<std::string> subLevels = {TimeUtil::extractYearFromUtcString(utc), TimeUtil::extractMonthFromUtcString(utc),
+                                              TimeUtil::extractDayFromUtcString(utc), utc, "raw"};
+        FileUtil::createDirs(videoDir, subLevels);
+        std::string rawDir = videoDir + "/" + subLevels[0] + "/" + subLevels[1] + "/" + subLevels[2] + "/" + utc + "/raw";
+
+        for(unsigned int f = 0; f < nFramesPerClip; f++) {
+            Imageuc image(width, height, (unsigned char)(c * 100 + f));
+            image.epochTimeUs = clipStartUs[c] + f * framePeriodUs;
+            epochTimes.push_back(image.epochTimeUs);
+            std::ofstream out(rawDir + "/" + TimeUtil::epochToUtcString(image.epochTimeUs) + ".pgm");
+            out << image;
+            out.close();
+        }
+    }
+
+    // Replay as fast as possible: all the frames must be delivered in order with their original capture times,
+    // with the start of each clip flagged as a new sequence
+    {
+        AsteriaState state;
+        state.width = 0;
+        state.height = 0;
+        ReplayFrameSource source(&state, videoDir, false);
+        pass &= (state.width == width) && (state.height == height) && (state.nominalFramePeriodUs == framePeriodUs);
+        pass &= (source.getFrameCount() == 2 * nFramesPerClip) && !source.isLive();
+
+        ImageucPool pool(width, height, 8, 0);
+        source.start(&pool);
+
+        unsigned int n = 0;
+        long long t0 = TimeUtil::getUpTime();
+        while(source.waitForFrame(100)) {
+            CapturedFrame frame;
+            long long epochTimeUs;
+            bool continuous = source.readFrame(&frame, epochTimeUs);
+            pass &= (n < epochTimes.size()) && (epochTimeUs == epochTimes[n]) && (frame.image->epochTimeUs == epochTimeUs);
+            pass &= (continuous == (n % nFramesPerClip != 0));
+            pass &= (frame.image->rawImage[0] == (unsigned char)((n / nFramesPerClip) * 100 + n % nFramesPerClip));
+            n++;
+        }
+        long long t1 = TimeUtil::getUpTime();
+        source.stop();
+
+        pass &= (n == epochTimes.size()) && source.isFinished();
+
+        fprintf(stderr, "As fast as possible: replayed %u frames in %f [s]\n", n, (t1 - t0) / 1000000.0);
+    }
+
+    // Stopping releases the frame already loaded, and replay resumes from it as a new sequence
+    {
+        AsteriaState state;
+        state.width = width;
+        state.height = height;
+        ReplayFrameSource source(&state, videoDir, false);
+
+        ImageucPool pool(width, height, 8, 0);
+        source.start(&pool);
+        CapturedFrame frame;
+        long long epochTimeUs;
+        for(unsigned int n = 0; n < 2; n++) {
+            source.waitForFrame(100);
+            source.readFrame(&frame, epochTimeUs);
+        }
+        frame.image.reset();
+        source.waitForFrame(100);
+        pass &= (pool.getStats().inUse == 1);
+        source.stop();
+        pass &= (pool.getStats().inUse == 0);
+
+        source.start(&pool);
+        pass &= source.waitForFrame(100);
+        bool continuous = source.readFrame(&frame, epochTimeUs);
+        pass &= !continuous && (epochTimeUs == epochTimes[2]);
+        source.stop();
+    }
+
+    // Replay at the recorded frame rate: the frames within each clip must be delivered at the original
+    // intervals, and the hour-long gap between the clips must be skipped
+    {
+        AsteriaState state;
+        state.width = width;
+        state.height = height;
+        ReplayFrameSource source(&state, videoDir, true);
+        pass &= source.isLive();
+
+        ImageucPool pool(width, height, 8, 0);
+        source.start(&pool);
+
+        unsigned int n = 0;
+        long long t0 = TimeUtil::getUpTime();
+        while(!source.isFinished()) {
+            if(!source.waitForFrame(100)) {
+                continue;
+            }
+            long long epochTimeUs;
+            // Discard the frames, as a live source does when the pipeline is full
+            source.readFrame(NULL, epochTimeUs);
+            n++;
+        }
+        long long t1 = TimeUtil::getUpTime();
+        source.stop();
+
+        // Each clip lasts (nFramesPerClip - 1) frame periods, and one frame period separates the clips
+        double expected = (2 * nFramesPerClip - 1) * framePeriodUs / 1000000.0;
+        double elapsed = (t1 - t0) / 1000000.0;
+        pass &= (n == epochTimes.size()) && (elapsed > 0.9 * expected) && (elapsed < expected + 0.5);
+
+        fprintf(stderr, "Paced: replayed %u frames in %f [s] (expected %f [s])\n", n, elapsed, expected);
+    }
+
+    FileUtil::deleteFilePath(videoDir);
+
+    fprintf(stderr, "Replay frame source test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testSyntheticVideoGenerator() {
+
+    bool pass = true;
+
+    // Random star field down to 6th magnitude
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<ReferenceStar> catalogue;
+    for(unsigned int s = 0; s < 5000; s++) {
+        double ra = 2.0 * M_PI * uniform(gen);
+        double dec = asin(2.0 * uniform(gen) - 1.0);
+        catalogue.push_back(ReferenceStar(ra, dec, 6.0 * uniform(gen)));
+    }
+
+    // Camera pointing at the zenith
+    Quaterniond q_sez_cam(CoordinateUtil::getSezToCamRot(0.0, M_PI / 2.0, 0.0));
+    double lon = MathUtil::toRadians(-3.0);
+    double lat = MathUtil::toRadians(55.0);
+
+    unsigned int width = 320;
+    unsigned int height = 240;
+    PinholeCamera cam(width, height, 300.0, 300.0, width / 2.0, height / 2.0);
+
+    SyntheticVideoGenerator generator(&cam, q_sez_cam, lon, lat, catalogue);
+    generator.nFrames = 50;
+    SyntheticMeteor meteor = {0.4, 0.6, 80.0, 60.0, 0.5, 0.6, -3.0};
+    generator.meteors.push_back(meteor);
+
+    // Frames must not depend on the number of threads used to render them
+    {
+        std::vector<SyntheticTruth> truth;
+        Imageuc a, b;
+        generator.nThreads = 1;
+        generator.renderFrame(15, a, truth);
+        generator.nThreads = 4;
+        generator.renderFrame(15, b, truth);
+        pass &= (a.rawImage == b.rawImage);
+    }
+
+    // Meteor is present from frame 10 to 24 inclusive, and is bright enough to be detected even at the faint ends
+    // of its light curve; frame differences must trigger on every one of those frames and not on the noise,
+    // twinkling or hot pixels
+    std::vector<SyntheticTruth> truth;
+    std::set<unsigned int> meteorFrames;
+    std::set<unsigned int> triggeredFrames;
+    Imageuc prev, current;
+    FrameDifference diff;
+    for(unsigned int f = 0; f < generator.nFrames; f++) {
+        unsigned int nTruth = truth.size();
+        generator.renderFrame(f, current, truth);
+        for(unsigned int t = nTruth; t < truth.size(); t++) {
+            meteorFrames.insert(truth[t].frame);
+        }
+        if(f > 0) {
+            FrameDiffUtil::computeDifference(current.rawImage, prev.rawImage, width, height, 50, diff);
+            if(diff.nChangedPixels > 20) {
+                triggeredFrames.insert(f);
+            }
+        }
+        std::swap(prev, current);
+    }
+
+    pass &= (meteorFrames.size() == 15) && (*meteorFrames.begin() == 10) && (*meteorFrames.rbegin() == 24);
+
+    unsigned int nFalse = 0;
+    for(std::set<unsigned int>::iterator it = triggeredFrames.begin(); it != triggeredFrames.end(); ++it) {
+        if(!meteorFrames.count(*it) && !meteorFrames.count(*it - 1)) {
+            nFalse++;
+        }
+    }
+    unsigned int nMissed = 0;
+    for(std::set<unsigned int>::iterator it = meteorFrames.begin(); it != meteorFrames.end(); ++it) {
+        if(!triggeredFrames.count(*it)) {
+            nMissed++;
+        }
+    }
+    pass &= (nFalse == 0) && (nMissed == 0);
+    fprintf(stderr, "Meteor in %lu frames: %u missed; %u false triggers\n", meteorFrames.size(), nMissed, nFalse);
+
+    // The meteor path starts at the requested point through a distorted camera too
+    {
+        PinholeCameraWithRadialDistortion radial(width, height, 300.0, 300.0, width / 2.0, height / 2.0, 1e-4, 1e-7);
+        SyntheticVideoGenerator distorted(&radial, q_sez_cam, lon, lat, catalogue);
+        double i, j;
+        pass &= distorted.getMeteorPosition(meteor, meteor.startTimeS, i, j);
+        pass &= (fabs(i - meteor.i) < 1e-3) && (fabs(j - meteor.j) < 1e-3);
+    }
+
+    // Write a clip to disk, which must be readable by the replay source
+    {
+        char dirTemplate[] = "/tmp/asteria_synthetic_XXXXXX";
+        std::string videoDir = mkdtemp(dirTemplate);
+        SyntheticAircraft plane = {20.0, 200.0, 20.0, -5.0, 1.0, 1.0, 0.2};
+        generator.aircraft.push_back(plane);
+        std::string clipPath = generator.generate(videoDir);
+        pass &= !clipPath.empty() && FileUtil::fileExists(clipPath + "/truth.txt");
+
+        AsteriaState state;
+        ReplayFrameSource source(&state, clipPath, false);
+        pass &= (source.getFrameCount() == generator.nFrames) && (state.width == width) && (state.height == height);
+        pass &= (state.nominalFramePeriodUs == generator.framePeriodUs);
+
+        FileUtil::deleteFilePath(videoDir);
+    }
+
+    // Benchmark the rendering at 4K and 60 frames per second
+    {
+        PinholeCamera cam4k(3840, 2160, 3000.0, 3000.0, 1920.0, 1080.0);
+        SyntheticVideoGenerator generator4k(&cam4k, q_sez_cam, lon, lat, catalogue);
+        generator4k.framePeriodUs = 16667ll;
+        SyntheticMeteor meteor4k = {0.0, 1.0, 1000.0, 800.0, 0.3, 0.3, -2.0};
+        generator4k.meteors.push_back(meteor4k);
+
+        unsigned int nFrames = 20;
+        std::vector<SyntheticTruth> truth4k;
+        Imageuc image;
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int f = 0; f < nFrames; f++) {
+            generator4k.renderFrame(f, image, truth4k);
+        }
+        double elapsed = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        pass &= (truth4k.size() == nFrames);
+        fprintf(stderr, "Rendered %u frames at 3840x2160 using %u threads: %f frames per second\n", nFrames, generator4k.nThreads, nFrames / elapsed);
+    }
+
+    fprintf(stderr, "Synthetic video generator test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testCalibrationAccumulator() {
+
+    bool pass = true;
+
+    unsigned int width = 64;
+    unsigned int height = 48;
+    unsigned int nPixels = width * height;
+    unsigned int nFrames = 100;
+
+    // Noisy frames with occasional large outliers, and pixel values clamped to the 8-bit range
+    std::mt19937 gen(7);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<std::shared_ptr<Imageuc>> frames;
+    for(unsigned int f = 0; f < nFrames; f++) {
+        std::shared_ptr<Imageuc> frame = std::make_shared<Imageuc>(width, height);
+        frame->epochTimeUs = 1500000000000000ll + f * 40000ll;
+        for(unsigned int p = 0; p < nPixels; p++) {
+            double value = (p % 250) + 5.0 * normal(gen);
+            if(uniform(gen) < 0.02) {
+                value += 200.0;
+            }
+            frame->rawImage[p] = (unsigned char)std::min(255.0, std::max(0.0, std::round(value)));
+        }
+        frames.push_back(frame);
+    }
+
+    // Accumulate the frames, skipping a run of frames part way through
+    CalibrationAccumulator accumulator(width, height, nFrames);
+    unsigned int nSkipped = 10;
+    for(unsigned int f = 0; f < nFrames; f++) {
+        if(f == 50) {
+            for(unsigned int s = 0; s < nSkipped; s++) {
+                accumulator.skipFrame();
+            }
+        }
+        pass &= !accumulator.isComplete();
+        accumulator.addFrame(*frames[f]);
+    }
+    pass &= accumulator.isComplete() && (accumulator.getFrameCount() == nFrames) && (accumulator.getSkippedFrameCount() == nSkipped);
+    pass &= (accumulator.getMidEpochTimeUs() == (frames.front()->epochTimeUs + frames.back()->epochTimeUs) / 2);
+    pass &= (accumulator.getSampleFrames().size() == 1) && (accumulator.getSampleFrames()[0]->rawImage == frames[0]->rawImage);
+
+    std::vector<double> mean, std;
+    accumulator.getTrimmedMeanStd(mean, std);
+
+    // Compare to the trimmed statistics computed from the full stack
+    double maxErr = 0.0;
+    for(unsigned int p = 0; p < nPixels; p++) {
+        std::vector<double> values;
+        for(unsigned int f = 0; f < nFrames; f++) {
+            values.push_back(frames[f]->rawImage[p]);
+        }
+        double refMean, refStd;
+        MathUtil::getTrimmedMeanStd(values, refMean, refStd, 0.05);
+        maxErr = std::max(maxErr, std::max(fabs(mean[p] - refMean), fabs(std[p] - refStd)));
+    }
+    pass &= (maxErr < 1e-9);
+
+    fprintf(stderr, "Maximum difference from full stack trimmed statistics = %g\n", maxErr);
+    fprintf(stderr, "Calibration accumulator test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testMedianFilter() {
+
+    bool pass = true;
+
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<int> uniform(0, 255);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    // Results must be identical to the direct filter, including windows that are clipped by the image
+    // boundaries or larger than the image, and images split into several bands
+    unsigned int sizes[][2] = {{1, 1}, {7, 5}, {64, 48}, {101, 37}};
+    unsigned int hws[] = {0, 1, 2, 5, 30};
+    for(unsigned int s = 0; s < 4; s++) {
+        unsigned int width = sizes[s][0];
+        unsigned int height = sizes[s][1];
+        std::vector<unsigned char> image(width * height);
+        for(unsigned int p = 0; p < width * height; p++) {
+            image[p] = (unsigned char)uniform(gen);
+        }
+        for(unsigned int h = 0; h < 5; h++) {
+            std::vector<double> direct, fast1, fast4;
+            MedianFilterUtil::medianFilterDirect(image, width, height, hws[h], direct);
+            MedianFilterUtil::medianFilter(image, width, height, hws[h], fast1, 1);
+            MedianFilterUtil::medianFilter(image, width, height, hws[h], fast4, 4);
+            bool match = (direct == fast1) && (direct == fast4);
+            if(!match) {
+                fprintf(stderr, "Mismatch for %dx%d image, half-width %d\n", width, height, hws[h]);
+            }
+            pass &= match;
+        }
+    }
+
+    // Benchmark on a smooth background with stars, as in the calibration signal image
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    std::vector<unsigned char> image(width * height);
+    for(unsigned int p = 0; p < width * height; p++) {
+        double value = 30.0 + 20.0 * (p % width) / width + 2.0 * normal(gen);
+        if(uniform(gen) == 0) {
+            value += 150.0;
+        }
+        image[p] = (unsigned char)std::min(255.0, std::max(0.0, std::round(value)));
+    }
+
+    unsigned int benchHws[] = {2, 5, 10, 20, 30};
+    for(unsigned int h = 0; h < 5; h++) {
+        std::vector<double> fast;
+        long long t0 = TimeUtil::getUpTime();
+        MedianFilterUtil::medianFilter(image, width, height, benchHws[h], fast);
+        double tFast = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // The direct filter is far too slow to run on the whole image, so is timed on a strip and scaled up
+        unsigned int stripHeight = 4 * benchHws[h];
+        std::vector<unsigned char> strip(image.begin(), image.begin() + width * stripHeight);
+        std::vector<double> direct;
+        t0 = TimeUtil::getUpTime();
+        MedianFilterUtil::medianFilterDirect(strip, width, stripHeight, benchHws[h], direct);
+        double tDirect = (TimeUtil::getUpTime() - t0) / 1000000.0 * height / stripHeight;
+
+        fprintf(stderr, "%dx%d image, half-width %2d: %f [s]; direct filter (estimated) %f [s]\n", width, height, benchHws[h], tFast, tDirect);
+    }
+
+    fprintf(stderr, "Median filter test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+/**
+ * @brief Builds the calibration signal, background and noise images of a synthetic star field, as computed
+ * by the CalibrationWorker.
+ */
+static void getSyntheticStarField(const unsigned int &width, const unsigned int &height, const unsigned int &nFrames,
+                                  std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise) {
+
+    // Random star field down to 7th magnitude
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<ReferenceStar> catalogue;
+    for(unsigned int s = 0; s < 20000; s++) {
+        double ra = 2.0 * M_PI * uniform(gen);
+        double dec = asin(2.0 * uniform(gen) - 1.0);
+        catalogue.push_back(ReferenceStar(ra, dec, 7.0 * uniform(gen)));
+    }
+
+    // Camera pointing at the zenith
+    Quaterniond q_sez_cam(CoordinateUtil::getSezToCamRot(0.0, M_PI / 2.0, 0.0));
+    double lon = MathUtil::toRadians(-3.0);
+    double lat = MathUtil::toRadians(55.0);
+    PinholeCamera cam(width, height, width / 2.0, width / 2.0, width / 2.0, height / 2.0);
+
+    SyntheticVideoGenerator generator(&cam, q_sez_cam, lon, lat, catalogue);
+    generator.nFrames = nFrames;
+    generator.faintMagLimit = 7.0;
+
+    CalibrationAccumulator accumulator(width, height, nFrames);
+    std::vector<SyntheticTruth> truth;
+    Imageuc frame;
+    for(unsigned int f = 0; f < nFrames; f++) {
+        generator.renderFrame(f, frame, truth);
+        accumulator.addFrame(frame);
+    }
+    accumulator.getTrimmedMeanStd(signal, noise);
+
+    std::vector<unsigned char> quantized(signal.size());
+    for(unsigned int p = 0; p < signal.size(); p++) {
+        quantized[p] = (unsigned char)std::round(signal[p]);
+    }
+    MedianFilterUtil::medianFilter(quantized, width, height, 10u, background);
+}
+
+void TestUtil::testSourceDetector() {
+
+    bool pass = true;
+
+    double threshold = 5.0;
+    double noFloor = -std::numeric_limits<double>::infinity();
+
+    // Results must be identical to the reference algorithm when no floor is applied, for any number of tiles
+    unsigned int sizes[][2] = {{37, 33}, {320, 240}, {960, 540}};
+    for(unsigned int s = 0; s < 3; s++) {
+        unsigned int width = sizes[s][0];
+        unsigned int height = sizes[s][1];
+        std::vector<double> signal, background, noise;
+        getSyntheticStarField(width, height, 20, signal, background, noise);
+
+        std::vector<Source> reference = SourceDetector::getSourcesReference(signal, background, noise, width, height, threshold);
+
+        unsigned int threads[] = {1, 2, 7};
+        for(unsigned int t = 0; t < 3; t++) {
+            std::vector<Source> sources = SourceDetector::getSources(signal, background, noise, width, height, threshold, noFloor, threads[t]);
+            bool match = (sources.size() == reference.size());
+            for(unsigned int i = 0; match && i < sources.size(); i++) {
+                match &= (sources[i].pixels == reference[i].pixels) && (sources[i].adu == reference[i].adu);
+                match &= (sources[i].i == reference[i].i) && (sources[i].j == reference[i].j);
+            }
+            if(!match) {
+                fprintf(stderr, "Mismatch for %dx%d image using %d threads\n", width, height, threads[t]);
+            }
+            pass &= match;
+        }
+    }
+
+    // Applying a floor excludes the noise pixels around each source, but the bright sources must still be
+    // found at the same positions
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    std::vector<double> signal, background, noise;
+    getSyntheticStarField(width, height, 20, signal, background, noise);
+
+    long long t0 = TimeUtil::getUpTime();
+    std::vector<Source> reference = SourceDetector::getSourcesReference(signal, background, noise, width, height, threshold);
+    double tReference = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    t0 = TimeUtil::getUpTime();
+    std::vector<Source> all = SourceDetector::getSources(signal, background, noise, width, height, threshold);
+    double tAll = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    double floor = 1.0;
+    t0 = TimeUtil::getUpTime();
+    std::vector<Source> floored = SourceDetector::getSources(signal, background, noise, width, height, threshold, floor);
+    double tFloor = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    unsigned int nBright = 0;
+    unsigned int nMatched = 0;
+    for(const Source &ref : reference) {
+        if(ref.adu / ref.sigma_adu < 15.0) {
+            continue;
+        }
+        nBright++;
+        for(const Source &source : floored) {
+            if(fabs(source.i - ref.i) < 0.5 && fabs(source.j - ref.j) < 0.5) {
+                nMatched++;
+                break;
+            }
+        }
+    }
+    pass &= (nBright > 0) && (nMatched == nBright);
+
+    fprintf(stderr, "%dx%d image: %u of %u bright sources found with a floor of %g sigmas\n", width, height, nMatched, nBright, floor);
+    fprintf(stderr, "Reference algorithm %f [s]; no floor %f [s]; floor %f [s]\n", tReference, tAll, tFloor);
+    fprintf(stderr, "Source detector test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testCrossMatch() {
+
+    bool pass = true;
+
+    std::mt19937 gen(17);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    double threshold = 20.0;
+
+    // Reference stars scattered over the image, with sources detected near some of them and some spurious
+    // sources; the dispersion matrices are random and elongated
+    auto getField = [&](const unsigned int &nStars, std::vector<Source> &sources, std::vector<ReferenceStar> &stars) {
+        sources.clear();
+        stars.clear();
+        for(unsigned int s = 0; s < nStars; s++) {
+            ReferenceStar star;
+            star.i = width * uniform(gen);
+            star.j = height * uniform(gen);
+            stars.push_back(star);
+        }
+        for(unsigned int s = 0; s < nStars; s++) {
+            Source source;
+            if(uniform(gen) < 0.8) {
+                source.i = stars[s].i + 3.0 * normal(gen);
+                source.j = stars[s].j + 3.0 * normal(gen);
+            }
+            else {
+                source.i = width * uniform(gen);
+                source.j = height * uniform(gen);
+            }
+            double l1 = 0.3 + 4.0 * uniform(gen);
+            double l2 = 0.3 + 1.0 * uniform(gen);
+            double theta = M_PI * uniform(gen);
+            double ct = cos(theta);
+            double st = sin(theta);
+            source.c_ii = l1 * ct * ct + l2 * st * st;
+            source.c_ij = (l1 - l2) * ct * st;
+            source.c_jj = l1 * st * st + l2 * ct * ct;
+            sources.push_back(source);
+        }
+        std::shuffle(sources.begin(), sources.end(), gen);
+    };
+
+    // Matches must be identical to those found by comparing all pairs
+    unsigned int nStars[] = {1, 10, 200, 1000};
+    for(unsigned int n = 0; n < 4; n++) {
+        std::vector<Source> sources;
+        std::vector<ReferenceStar> stars;
+        getField(nStars[n], sources, stars);
+
+        std::vector<std::pair<unsigned int, unsigned int>> direct, grid;
+        CrossMatchUtil::crossMatchDirect(sources, stars, threshold, direct);
+        CrossMatchUtil::crossMatch(sources, stars, threshold, grid);
+
+        if(direct != grid) {
+            fprintf(stderr, "Mismatch for %d stars: %lu matches vs %lu\n", nStars[n], grid.size(), direct.size());
+            pass = false;
+        }
+        if(n == 3) {
+            pass &= (grid.size() > nStars[n] / 2);
+            fprintf(stderr, "%lu matches among %d sources and stars\n", grid.size(), nStars[n]);
+        }
+    }
+
+    // Benchmark
+    unsigned int benchStars[] = {1000, 5000, 20000};
+    for(unsigned int n = 0; n < 3; n++) {
+        std::vector<Source> sources;
+        std::vector<ReferenceStar> stars;
+        getField(benchStars[n], sources, stars);
+
+        std::vector<std::pair<unsigned int, unsigned int>> matches;
+        long long t0 = TimeUtil::getUpTime();
+        CrossMatchUtil::crossMatch(sources, stars, threshold, matches);
+        double tGrid = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        fprintf(stderr, "%d sources and stars: %f [s]", benchStars[n], tGrid);
+
+        if(n == 0) {
+            t0 = TimeUtil::getUpTime();
+            CrossMatchUtil::crossMatchDirect(sources, stars, threshold, matches);
+            double tDirect = (TimeUtil::getUpTime() - t0) / 1000000.0;
+            fprintf(stderr, "; all pairs %f [s]", tDirect);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "Cross match test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testReferenceStarCatalogue() {
+
+    bool pass = true;
+
+    std::mt19937 gen(19);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    // Write a random text catalogue, in the same format as RefStarCat.dat
+    char dirTemplate[] = "/tmp/asteria_catalogue_XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    std::string textPath = dir + "/RefStarCat.dat";
+    std::string binaryPath = dir + "/RefStarCat.bin";
+    {
+        std::ofstream out(textPath);
+        out << "# Random reference stars\n";
+        char line[128];
+        for(unsigned int s = 0; s < 100000; s++) {
+            double ra = 360.0 * uniform(gen);
+            double dec = MathUtil::toDegrees(asin(2.0 * uniform(gen) - 1.0));
+            double mag = 9.0 * uniform(gen) - 1.0;
+            sprintf(line, "%.8f\t%.8f\t%.3f\n", ra, dec, mag);
+            out << line;
+        }
+    }
+
+    long long t0 = TimeUtil::getUpTime();
+    std::vector<ReferenceStar> all = ReferenceStar::loadCatalogue(textPath);
+    double tText = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    pass &= ReferenceStarCatalogue::convert(textPath, binaryPath);
+
+    ReferenceStarCatalogue binary;
+    t0 = TimeUtil::getUpTime();
+    pass &= binary.load(binaryPath);
+    double tBinary = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    ReferenceStarCatalogue text;
+    pass &= text.load(textPath);
+
+    pass &= (binary.size() == all.size()) && (text.size() == all.size());
+
+    // Queries must return exactly the stars within the region and magnitude limit, including regions that
+    // contain a pole or straddle zero right ascension
+    Vector3d axes[] = {Vector3d(1.0, 0.0, 0.0), Vector3d(0.0, 0.0, 1.0), Vector3d(0.1, 0.0, -1.0).normalized(), Vector3d(1.0, -0.01, 0.5).normalized()};
+    double radii[] = {0.01, 0.3, 1.0, 2.0};
+    for(unsigned int a = 0; a < 4; a++) {
+        for(unsigned int r = 0; r < 4; r++) {
+            std::set<std::pair<double, double>> expected;
+            for(ReferenceStar &star : all) {
+                Vector3d r_bcrf;
+                CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, star.ra, star.dec);
+                if(star.mag <= 6.0 && r_bcrf.dot(axes[a]) >= cos(radii[r])) {
+                    expected.insert(std::make_pair(star.ra, star.dec));
+                }
+            }
+            std::vector<ReferenceStar> found, foundText;
+            binary.getStars(axes[a], radii[r], 6.0, found);
+            text.getStars(axes[a], radii[r], 6.0, foundText);
+
+            std::set<std::pair<double, double>> actual;
+            for(ReferenceStar &star : found) {
+                actual.insert(std::make_pair(star.ra, star.dec));
+            }
+            bool match = (actual == expected) && (found.size() == expected.size()) && (foundText.size() == found.size());
+            if(!match) {
+                fprintf(stderr, "Mismatch for region %d radius %f: %lu stars vs %lu\n", a, radii[r], found.size(), expected.size());
+            }
+            pass &= match;
+        }
+    }
+
+    // The camera footprint must contain every star visible to the camera
+    PinholeCamera cam(1920, 1080, 800.0, 800.0, 960.0, 540.0);
+    Matrix3d r_bcrf_cam = CoordinateUtil::getSezToCamRot(0.3, 0.7, 0.1) * CoordinateUtil::getEcefToSezRot(0.1, 0.9) * CoordinateUtil::getBcrfToEcefRot(5.0);
+
+    t0 = TimeUtil::getUpTime();
+    unsigned int nVisible = 0;
+    for(ReferenceStar &star : all) {
+        if(star.mag > 6.0) {
+            continue;
+        }
+        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, cam);
+        if(star.visible) {
+            nVisible++;
+        }
+    }
+    double tAll = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    t0 = TimeUtil::getUpTime();
+    std::vector<ReferenceStar> footprint;
+    binary.getStars(cam, r_bcrf_cam, 6.0, footprint);
+    unsigned int nFootprintVisible = 0;
+    for(ReferenceStar &star : footprint) {
+        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, cam);
+        if(star.visible) {
+            nFootprintVisible++;
+        }
+    }
+    double tFootprint = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+    pass &= (nVisible > 0) && (nFootprintVisible == nVisible);
+
+    fprintf(stderr, "Loaded %lu stars: text %f [s]; binary %f [s]\n", all.size(), tText, tBinary);
+    fprintf(stderr, "%u visible stars: projecting whole catalogue %f [s]; footprint of %lu stars %f [s]\n", nVisible, tAll, footprint.size(), tFootprint);
+
+    FileUtil::deleteFilePath(dir);
+
+    fprintf(stderr, "Reference star catalogue test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testVisibleStarCache() {
+
+    bool pass = true;
+
+    std::mt19937 gen(23);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    // Random text catalogue
+    char dirTemplate[] = "/tmp/asteria_catalogue_XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    std::string textPath = dir + "/RefStarCat.dat";
+    {
+        std::ofstream out(textPath);
+        char line[128];
+        for(unsigned int s = 0; s < 50000; s++) {
+            double ra = 360.0 * uniform(gen);
+            double dec = MathUtil::toDegrees(asin(2.0 * uniform(gen) - 1.0));
+            double mag = 8.0 * uniform(gen) - 1.0;
+            sprintf(line, "%.8f\t%.8f\t%.3f\n", ra, dec, mag);
+            out << line;
+        }
+    }
+    std::vector<ReferenceStar> all = ReferenceStar::loadCatalogue(textPath);
+    ReferenceStarCatalogue catalogue;
+    pass &= catalogue.load(textPath);
+
+    PinholeCamera cam(1920, 1080, 1500.0, 1500.0, 960.0, 540.0);
+    double lon = MathUtil::toRadians(-3.0);
+    double lat = MathUtil::toRadians(55.0);
+    long long epochTimeUs = 1500000000000000ll;
+    double magLimit = 6.0;
+
+    // Successive calibrations a minute apart over two hours, followed by small interactive adjustments of
+    // the orientation
+    VisibleStarCache cache;
+    double tCache = 0.0;
+    double tAll = 0.0;
+    unsigned int nQueries = 0;
+    double az = 0.5, el = 1.0, roll = 0.0;
+    for(unsigned int q = 0; q < 220; q++) {
+
+        if(q < 120) {
+            epochTimeUs += 60000000ll;
+        }
+        else {
+            az += 0.002;
+            el -= 0.001;
+            roll += 0.003;
+        }
+        double gmst = TimeUtil::epochToGmst(epochTimeUs);
+        Matrix3d r_bcrf_cam = CoordinateUtil::getSezToCamRot(az, el, roll) * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+        long long t0 = TimeUtil::getUpTime();
+        std::vector<ReferenceStar> visible;
+        cache.getVisibleStars(catalogue, cam, r_bcrf_cam, magLimit, visible);
+        tCache += (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        t0 = TimeUtil::getUpTime();
+        std::vector<ReferenceStar> expected;
+        for(ReferenceStar &star : all) {
+            if(star.mag > magLimit) {
+                continue;
+            }
+            CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, cam);
+            if(star.visible) {
+                expected.push_back(star);
+            }
+        }
+        tAll += (TimeUtil::getUpTime() - t0) / 1000000.0;
+        nQueries++;
+
+        // Same stars at the same image coordinates
+        std::map<std::pair<double, double>, std::pair<double, double>> expectedPositions;
+        for(ReferenceStar &star : expected) {
+            expectedPositions[std::make_pair(star.ra, star.dec)] = std::make_pair(star.i, star.j);
+        }
+        bool match = (visible.size() == expected.size());
+        for(ReferenceStar &star : visible) {
+            auto it = expectedPositions.find(std::make_pair(star.ra, star.dec));
+            match &= (it != expectedPositions.end()) && (fabs(it->second.first - star.i) < 1e-9) && (fabs(it->second.second - star.j) < 1e-9);
+        }
+        if(!match) {
+            fprintf(stderr, "Mismatch for query %d: %lu stars vs %lu\n", q, visible.size(), expected.size());
+        }
+        pass &= match;
+    }
+
+    // A fainter magnitude limit requires the stars to be retrieved again
+    unsigned int nRefreshes = cache.getRefreshCount();
+    {
+        double gmst = TimeUtil::epochToGmst(epochTimeUs);
+        Matrix3d r_bcrf_cam = CoordinateUtil::getSezToCamRot(az, el, roll) * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+        std::vector<ReferenceStar> visible;
+        cache.getVisibleStars(catalogue, cam, r_bcrf_cam, magLimit + 1.0, visible);
+        pass &= (cache.getRefreshCount() == nRefreshes + 1);
+    }
+
+    pass &= (nRefreshes < 20);
+
+    fprintf(stderr, "%u queries with %u refreshes of %u cached stars: cache %f [s]; whole catalogue %f [s]\n",
+            nQueries, nRefreshes, cache.getCandidateCount(), tCache, tAll);
+
+    FileUtil::deleteFilePath(dir);
+
+    fprintf(stderr, "Visible star cache test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testBatchProjection() {
+
+    bool pass = true;
+
+    std::mt19937 gen(29);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    PinholeCamera pinhole(1920, 1080, 1500.0, 1500.0, 960.0, 540.0);
+    PinholeCameraWithRadialDistortion radial(1920, 1080, 1500.0, 1500.0, 960.0, 540.0, 0.02, -0.01);
+    PinholeCameraWithSipDistortion sip(1920, 1080, 1500.0, 1500.0, 960.0, 540.0,
+                                       2e-7, -1e-7, 5e-8, 1e-10, -2e-10, 3e-10, -1e-10,
+                                       -1e-7, 2e-7, -5e-8, -2e-10, 1e-10, -1e-10, 3e-10);
+    std::vector<CameraModelBase *> cams = {&pinhole, &radial, &sip};
+
+    // Random directions within 60 degrees of the boresight, some of them behind the camera
+    unsigned int nVectors = 1000000;
+    std::vector<double> x(nVectors), y(nVectors), z(nVectors);
+    for(unsigned int p = 0; p < nVectors; p++) {
+        double theta = (M_PI / 3.0) * std::sqrt(uniform(gen));
+        double phi = 2.0 * M_PI * uniform(gen);
+        double sign = (p % 20 == 0) ? -1.0 : 1.0;
+        x[p] = std::sin(theta) * std::cos(phi);
+        y[p] = std::sin(theta) * std::sin(phi);
+        z[p] = sign * std::cos(theta);
+    }
+
+    // Random pixels within the image
+    unsigned int nPixels = 100000;
+    std::vector<double> i(nPixels), j(nPixels);
+    for(unsigned int p = 0; p < nPixels; p++) {
+        i[p] = 1920.0 * uniform(gen);
+        j[p] = 1080.0 * uniform(gen);
+    }
+
+    for(CameraModelBase * cam : cams) {
+
+        // Projection
+        std::vector<double> iBatch(nVectors), jBatch(nVectors), iScalar(nVectors), jScalar(nVectors);
+        std::vector<unsigned char> visBatch(nVectors), visScalar(nVectors);
+
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nVectors; p++) {
+            visScalar[p] = cam->projectVector(Vector3d(x[p], y[p], z[p]), iScalar[p], jScalar[p]);
+        }
+        double tScalarProj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        t0 = TimeUtil::getUpTime();
+        cam->projectVectors(x.data(), y.data(), z.data(), nVectors, iBatch.data(), jBatch.data(), visBatch.data());
+        double tBatchProj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        unsigned int nVisible = 0;
+        unsigned int nProjMismatches = 0;
+        for(unsigned int p = 0; p < nVectors; p++) {
+            nVisible += visScalar[p];
+            if(visBatch[p] != visScalar[p] || fabs(iBatch[p] - iScalar[p]) > 1e-9 || fabs(jBatch[p] - jScalar[p]) > 1e-9) {
+                nProjMismatches++;
+            }
+        }
+
+        // Deprojection
+        std::vector<double> xBatch(nPixels), yBatch(nPixels), zBatch(nPixels);
+        std::vector<Vector3d> rScalar(nPixels);
+
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nPixels; p++) {
+            rScalar[p] = cam->deprojectPixel(i[p], j[p]);
+        }
+        double tScalarDeproj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        t0 = TimeUtil::getUpTime();
+        cam->deprojectPixels(i.data(), j.data(), nPixels, xBatch.data(), yBatch.data(), zBatch.data());
+        double tBatchDeproj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        unsigned int nDeprojMismatches = 0;
+        for(unsigned int p = 0; p < nPixels; p++) {
+            if((Vector3d(xBatch[p], yBatch[p], zBatch[p]) - rScalar[p]).norm() > 1e-12) {
+                nDeprojMismatches++;
+            }
+        }
+
+        fprintf(stderr, "%s:\n", cam->getModelName().c_str());
+        fprintf(stderr, "  project   %u vectors (%u visible): scalar %6.2f [M/s]; batch %6.2f [M/s]; %u mismatches\n",
+                nVectors, nVisible, nVectors / tScalarProj / 1e6, nVectors / tBatchProj / 1e6, nProjMismatches);
+        fprintf(stderr, "  deproject %u pixels: scalar %6.2f [M/s]; batch %6.2f [M/s]; %u mismatches\n",
+                nPixels, nPixels / tScalarDeproj / 1e6, nPixels / tBatchDeproj / 1e6, nDeprojMismatches);
+
+        pass &= (nProjMismatches == 0) && (nDeprojMismatches == 0);
+    }
+
+    fprintf(stderr, "Batch projection test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testInverseDistortion() {
+
+    bool pass = true;
+
+    std::mt19937 gen(31);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    PinholeCameraWithRadialDistortion radial(1920, 1080, 1500.0, 1500.0, 960.0, 540.0, 0.05, -0.03);
+    PinholeCameraWithSipDistortion sip(1920, 1080, 1500.0, 1500.0, 960.0, 540.0,
+                                       4e-7, -2e-7, 1e-7, 2e-10, -4e-10, 6e-10, -2e-10,
+                                       -2e-7, 4e-7, -1e-7, -4e-10, 2e-10, -2e-10, 6e-10);
+    std::vector<PinholeCamera *> cams = {&radial, &sip};
+
+    for(PinholeCamera * cam : cams) {
+
+        // Iterative inverse of either model
+        auto getIterativeOffset = [&](const double &ip, const double &jp, double &dip, double &djp, const double &tol) {
+            if(cam == &radial) {
+                radial.getInverseDistortionOffset(ip, jp, dip, djp, tol);
+            }
+            else {
+                sip.getInverseDistortionOffset(ip, jp, dip, djp, tol);
+            }
+        };
+        double &r_max = (cam == &radial) ? radial.r_max : sip.r_max;
+
+        // Previous calculation of the radial distance threshold, done on every parameter update
+        long long t0 = TimeUtil::getUpTime();
+        double r_max_iterative = 0.0;
+        auto updateRMax = [&](const double &ip, const double &jp) {
+            double dip, djp;
+            getIterativeOffset(ip, jp, dip, djp, 0.0001);
+            double i = ip + dip - cam->pi;
+            double j = jp + djp - cam->pj;
+            r_max_iterative = std::max(r_max_iterative, std::sqrt(i * i + j * j));
+        };
+        for(double ip = 0; ip <= (double)cam->width; ip += 1.0) {
+            updateRMax(ip, 0.0);
+            updateRMax(ip, cam->height);
+        }
+        for(double jp = 0; jp <= (double)cam->height; jp += 1.0) {
+            updateRMax(0.0, jp);
+            updateRMax(cam->width, jp);
+        }
+        double tIterativeUpdate = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        pass &= std::fabs(r_max - r_max_iterative) < 0.01;
+
+        // Parameter updates as made by the calibration fit: each new set of parameters is set twice
+        std::vector<double> params(cam->getNumParameters());
+        cam->getParameters(params.data());
+        unsigned int nUpdates = 1000;
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int u = 0; u < nUpdates; u++) {
+            params[0] += (u % 2 == 0) ? 1e-3 : -1e-3;
+            cam->setParameters(params.data());
+            cam->setParameters(params.data());
+        }
+        double tUpdate = (TimeUtil::getUpTime() - t0) / 1000000.0 / nUpdates;
+
+        // Deprojection against the iterative inverse, converged to high precision, at random points within the image
+        unsigned int nPixels = 100000;
+        std::vector<double> i(nPixels), j(nPixels);
+        for(unsigned int p = 0; p < nPixels; p++) {
+            i[p] = cam->width * uniform(gen);
+            j[p] = cam->height * uniform(gen);
+        }
+
+        // Deprojection by the camera model; the first call fits the inverse
+        std::vector<Vector3d> r(nPixels);
+        t0 = TimeUtil::getUpTime();
+        r[0] = cam->deprojectPixel(i[0], j[0]);
+        double tFit = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nPixels; p++) {
+            r[p] = cam->deprojectPixel(i[p], j[p]);
+        }
+        double tDeproj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Previous deprojection using the iterative inverse
+        std::vector<Vector3d> rIterative(nPixels);
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nPixels; p++) {
+            double dip, djp;
+            getIterativeOffset(i[p], j[p], dip, djp, 0.0001);
+            rIterative[p] = cam->PinholeCamera::deprojectPixel(i[p] + dip, j[p] + djp);
+        }
+        double tIterativeDeproj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Error in pixels, from the angle between the vectors
+        double maxError = 0.0;
+        for(unsigned int p = 0; p < nPixels; p++) {
+            double dip, djp;
+            getIterativeOffset(i[p], j[p], dip, djp, 1e-9);
+            Vector3d rExact = cam->PinholeCamera::deprojectPixel(i[p] + dip, j[p] + djp);
+            maxError = std::max(maxError, (r[p] - rExact).norm() * cam->fi);
+        }
+        pass &= (maxError < InverseDistortionPolynomial::tolerance);
+
+        fprintf(stderr, "%s:\n", cam->getModelName().c_str());
+        if(cam == &sip) {
+            std::shared_ptr<const InverseDistortionPolynomial> polynomial = sip.getInverseDistortionPolynomial();
+            fprintf(stderr, "  fitted inverse %s with max error %g [pixels] at the check points; fitted in %f [ms]\n",
+                    polynomial->valid ? "valid" : "invalid", polynomial->maxError, tFit * 1000.0);
+            pass &= polynomial->valid;
+        }
+        fprintf(stderr, "  r_max %f vs %f (iterative)\n", r_max, r_max_iterative);
+        fprintf(stderr, "  parameter update: %f [ms] vs %f [ms] (iterative)\n", tUpdate * 1000.0, tIterativeUpdate * 1000.0);
+        fprintf(stderr, "  deprojection of %u pixels: %f [s] vs %f [s] (iterative); max error %g [pixels]\n",
+                nPixels, tDeproj, tIterativeDeproj, maxError);
+    }
+
+    fprintf(stderr, "Inverse distortion test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testPixelRayMap() {
+
+    bool pass = true;
+
+    std::mt19937 gen(37);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    PinholeCameraWithRadialDistortion radial(1920, 1080, 1500.0, 1500.0, 960.0, 540.0, 0.05, -0.03);
+    PinholeCameraWithSipDistortion sip(1920, 1080, 1500.0, 1500.0, 960.0, 540.0,
+                                       4e-7, -2e-7, 1e-7, 2e-10, -4e-10, 6e-10, -2e-10,
+                                       -2e-7, 4e-7, -1e-7, -4e-10, 2e-10, -2e-10, 6e-10);
+    std::vector<PinholeCamera *> cams = {&radial, &sip};
+
+    Quaterniond q_sez_cam(CoordinateUtil::getSezToCamRot(MathUtil::toRadians(350.0), MathUtil::toRadians(40.0), MathUtil::toRadians(5.0)));
+    Matrix3d r_cam_sez = q_sez_cam.toRotationMatrix().transpose();
+
+    // Points along straight tracks across the image, like the centroids of meteors in successive frames
+    unsigned int nTracks = 1000;
+    unsigned int nPointsPerTrack = 100;
+    unsigned int nPixels = nTracks * nPointsPerTrack;
+    std::vector<double> i(nPixels), j(nPixels);
+    for(unsigned int t = 0; t < nTracks; t++) {
+        double i0 = radial.width * uniform(gen);
+        double j0 = radial.height * uniform(gen);
+        double i1 = radial.width * uniform(gen);
+        double j1 = radial.height * uniform(gen);
+        for(unsigned int p = 0; p < nPointsPerTrack; p++) {
+            double f = (double)p / (nPointsPerTrack - 1);
+            i[t * nPointsPerTrack + p] = i0 + (i1 - i0) * f;
+            j[t * nPointsPerTrack + p] = j0 + (j1 - j0) * f;
+        }
+    }
+
+    for(PinholeCamera * cam : cams) {
+
+        // Build the map in memory
+        PixelRayMap map;
+        long long t0 = TimeUtil::getUpTime();
+        pass &= map.build(*cam, q_sez_cam);
+        double tBuild = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Round trip through the file, which is then memory mapped
+        std::string path = std::tmpnam(nullptr);
+        pass &= map.save(path);
+        PixelRayMap loaded;
+        t0 = TimeUtil::getUpTime();
+        pass &= loaded.load(path, *cam, q_sez_cam);
+        double tLoad = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        pass &= loaded.matches(*cam, q_sez_cam);
+
+        // Conversion by deprojection through the camera model
+        std::vector<Vector3d> r(nPixels);
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nPixels; p++) {
+            r[p] = cam->deprojectPixel(i[p], j[p]);
+            double rr, azDeproj, elDeproj;
+            CoordinateUtil::cartesianToSpherical(r_cam_sez * r[p], rr, azDeproj, elDeproj);
+            CoordinateUtil::eastOfSouthToEastOfNorth(azDeproj);
+        }
+        double tDeproj = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Conversion by lookup
+        std::vector<double> az(nPixels), el(nPixels);
+        t0 = TimeUtil::getUpTime();
+        for(unsigned int p = 0; p < nPixels; p++) {
+            pass &= loaded.getAzEl(i[p], j[p], az[p], el[p]);
+        }
+        double tLookup = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Error in pixels, from the angle between the directions
+        double maxError = 0.0;
+        for(unsigned int p = 0; p < nPixels; p++) {
+            Vector3d r_sez;
+            CoordinateUtil::sphericalToCartesian(r_sez, 1.0, az[p], el[p]);
+            // Convert east-of-north azimuth back to east-of-south for the SEZ frame
+            r_sez[0] = -r_sez[0];
+            maxError = std::max(maxError, (r_sez - r_cam_sez * r[p]).norm() * cam->fi);
+        }
+        pass &= (maxError < 0.01);
+
+        // Points outside the image are rejected
+        double azOut, elOut;
+        pass &= !loaded.getAzEl(-0.5, 10.0, azOut, elOut);
+        pass &= !loaded.getAzEl(10.0, cam->height + 0.5, azOut, elOut);
+
+        // Changing the calibration makes the map stale
+        Quaterniond q_changed(CoordinateUtil::getSezToCamRot(MathUtil::toRadians(351.0), MathUtil::toRadians(40.0), MathUtil::toRadians(5.0)));
+        pass &= !loaded.matches(*cam, q_changed);
+        std::vector<double> params(cam->getNumParameters());
+        cam->getParameters(params.data());
+        params[0] += 1.0;
+        cam->setParameters(params.data());
+        pass &= !loaded.matches(*cam, q_sez_cam);
+        PixelRayMap stale;
+        pass &= !stale.load(path, *cam, q_sez_cam);
+
+        std::remove(path.c_str());
+
+        fprintf(stderr, "%s:\n", cam->getModelName().c_str());
+        fprintf(stderr, "  built map of %ux%u nodes in %f [s]; loaded in %f [ms]\n", map.getNodesWidth(), map.getNodesHeight(),
+                tBuild, tLoad * 1000.0);
+        fprintf(stderr, "  az/el of %u points along tracks: %f [s] by lookup vs %f [s] by deprojection; max error %g [pixels]\n",
+                nPixels, tLookup, tDeproj, maxError);
+    }
+
+    fprintf(stderr, "Pixel ray map test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testLevenbergMarquardtSolvers() {
+
+    bool pass = true;
+
+    std::mt19937 gen(43);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    const char * solverNames[3] = {"LDLT", "QR", "SVD"};
+    LevenbergMarquardtSolver::LinearSolverType solvers[3] = {LevenbergMarquardtSolver::NORMALEQUATIONSLDLT,
+                                                             LevenbergMarquardtSolver::JACOBIANQR,
+                                                             LevenbergMarquardtSolver::JACOBIANSVD};
+    const char * covarianceNames[3] = {"diagonal", "block diagonal", "full"};
+
+    // Points with pairwise correlated noise
+    unsigned int N = 40;
+    std::vector<double> xs;
+    std::vector<double> ysPoly;
+    std::vector<double> ysCos;
+    std::vector<double> variance(N, 0.0);
+    std::vector<double> blocks(2*N, 0.0);
+    std::vector<double> covar(N*N, 0.0);
+    for(unsigned int n=0; n<N; n++) {
+        double x = -2.0 + 4.0 * n / (N - 1);
+        xs.push_back(x);
+        ysPoly.push_back(2.35 - 15.3*x + 6.367*x*x + 0.1*normal(gen));
+        ysCos.push_back(1.5 * std::cos(2.1*x + 0.3) + 0.01*normal(gen));
+        double sigma = 0.5 + 0.05 * n;
+        variance[n] = sigma * sigma;
+        covar[n*N + n] = sigma * sigma;
+    }
+    for(unsigned int b=0; b<N/2; b++) {
+        double s0 = std::sqrt(covar[(2*b)*N + 2*b]);
+        double s1 = std::sqrt(covar[(2*b+1)*N + 2*b+1]);
+        covar[(2*b)*N + 2*b+1] = 0.6 * s0 * s1;
+        covar[(2*b+1)*N + 2*b] = 0.6 * s0 * s1;
+        blocks[4*b + 0] = s0 * s0;
+        blocks[4*b + 1] = 0.6 * s0 * s1;
+        blocks[4*b + 2] = 0.6 * s0 * s1;
+        blocks[4*b + 3] = s1 * s1;
+    }
+
+    // Polynomial (linear) and cosine (nonlinear) problems, with each type of covariance and each solver
+    for(unsigned int problem = 0; problem < 2; problem++) {
+        for(unsigned int c = 0; c < 3; c++) {
+
+            double reference[3];
+
+            for(unsigned int s = 0; s < 3; s++) {
+
+                LevenbergMarquardtSolver * fitter;
+                if(problem == 0) {
+                    fitter = new PolynomialFitter(xs, ysPoly, 3);
+                }
+                else {
+                    fitter = new CosineFitter(xs, ysCos);
+                    double initialGuessParams[3] = {1.0, 2.0, 0.0};
+                    fitter->setParameters(initialGuessParams);
+                }
+
+                if(c == 0) {
+                    fitter->setVariance(variance.data());
+                }
+                else if(c == 1) {
+                    fitter->setBlockDiagonalCovariance(blocks.data());
+                }
+                else {
+                    fitter->setCovariance(covar.data());
+                }
+                fitter->setLinearSolver(solvers[s]);
+                fitter->fit(500, false);
+
+                double solution[3];
+                fitter->getParameters(solution);
+                double errors[3];
+                fitter->getAsymptoticStandardError(errors);
+
+                // Each solver must find the same solution, to a small fraction of the standard errors
+                double maxDiff = 0.0;
+                if(s == 0) {
+                    std::copy(solution, solution + 3, reference);
+                }
+                for(unsigned int m=0; m<3; m++) {
+                    maxDiff = std::max(maxDiff, std::fabs(solution[m] - reference[m]) / errors[m]);
+                }
+                pass &= (maxDiff < 1e-4);
+
+                const LevenbergMarquardtSolver::FitStatistics &stats = fitter->getFitStatistics();
+                double meanIterationTime = 0.0;
+                for(double t : stats.iterationTimes) {
+                    meanIterationTime += t / stats.iterationTimes.size();
+                }
+                fprintf(stderr, "%s, %s covariance, %s: %d iterations (%d accepted, %d rejected steps), %d model evaluations, "
+                                "%s; chi2 %.3f -> %.3f; %.1f [us] per iteration, %.1f [us] in linear algebra; "
+                                "condition number %g; max difference %g [sigma]\n",
+                        problem == 0 ? "Polynomial" : "Cosine", covarianceNames[c], solverNames[s], stats.nIterations,
+                        stats.nAcceptedSteps, stats.nRejectedSteps, stats.nModelEvaluations, stats.converged ? "converged" : "not converged",
+                        stats.chi2Initial, stats.chi2Final, meanIterationTime * 1e6, stats.solveTime * 1e6,
+                        stats.maxConditionNumber, maxDiff);
+
+                delete fitter;
+            }
+        }
+    }
+
+    // A problem with more data than would fit in the stack frame if the Jacobian were held there
+    unsigned int nLarge = 500000;
+    std::vector<double> xsLarge(nLarge);
+    std::vector<double> ysLarge(nLarge);
+    for(unsigned int n=0; n<nLarge; n++) {
+        xsLarge[n] = -1.0 + 2.0 * n / (nLarge - 1);
+        ysLarge[n] = 2.35 - 15.3*xsLarge[n] + 6.367*xsLarge[n]*xsLarge[n] + 0.1*normal(gen);
+    }
+    PolynomialFitter largeFit(xsLarge, ysLarge, 3);
+    long long t0 = TimeUtil::getUpTime();
+    largeFit.fit(500, false);
+    double tLarge = (TimeUtil::getUpTime() - t0) / 1000000.0;
+    double largeSolution[3];
+    largeFit.getParameters(largeSolution);
+    pass &= std::fabs(largeSolution[0] - 2.35) < 0.01 && std::fabs(largeSolution[1] + 15.3) < 0.01 && std::fabs(largeSolution[2] - 6.367) < 0.01;
+    fprintf(stderr, "Fit of %d points: %f [s], %d iterations; solution %f %f %f\n", nLarge, tLarge,
+            largeFit.getFitStatistics().nIterations, largeSolution[0], largeSolution[1], largeSolution[2]);
+
+    fprintf(stderr, "Levenberg-Marquardt solvers test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+/**
+ * @brief Fixed size equivalent of the CosineFitter, for 40 data points.
+ */
+class FixedCosineFitter : public FixedLevenbergMarquardtSolver<3, 40> {
+public:
+    FixedCosineFitter(const double * xs) : xs(xs), nModelEvaluations(0) {}
+
+    const double * xs;
+
+    unsigned int nModelEvaluations;
+
+    void getModel(double * model) {
+        nModelEvaluations++;
+        for(unsigned int n=0; n<N; n++) {
+            model[n] = params[0] * std::cos(xs[n] * params[1] + params[2]);
+        }
+    }
+
+    void getJacobian(double * jac) {
+        for(unsigned int n=0; n<N; n++) {
+            double c = std::cos(xs[n] * params[1] + params[2]);
+            double s = std::sin(xs[n] * params[1] + params[2]);
+            jac[3*n + 0] = c;
+            jac[3*n + 1] = -params[0] * xs[n] * s;
+            jac[3*n + 2] = -params[0] * s;
+        }
+    }
+};
+
+/**
+ * @brief Fixed size equivalent of the PolynomialFitter.
+ */
+template<int Params, int Data> class FixedPolynomialFitter : public FixedLevenbergMarquardtSolver<Params, Data> {
+public:
+    FixedPolynomialFitter(const double * xs) : xs(xs) {}
+
+    const double * xs;
+
+    void getModel(double * model) {
+        for(unsigned int n=0; n<this->N; n++) {
+            double tmp = 1.0;
+            model[n] = 0.0;
+            for(unsigned int m=0; m<Params; m++) {
+                model[n] += this->params[m] * tmp;
+                tmp *= xs[n];
+            }
+        }
+    }
+
+    void getJacobian(double * jac) {
+        for(unsigned int n=0; n<this->N; n++) {
+            double tmp = 1.0;
+            for(unsigned int m=0; m<Params; m++) {
+                jac[Params*n + m] = tmp;
+                tmp *= xs[n];
+            }
+        }
+    }
+};
+
+/**
+ * @brief Fits a polynomial with the given number of parameters to many independent data sets using the dynamic and
+ * fixed size solvers, and compares the solutions and the time taken. Each solver is timed several times and the
+ * fastest run is used, so that the comparison isn't upset by other processes.
+ * @param minSpeedup
+ *  The minimum ratio of the time taken by the dynamic size solver to that taken by the fixed size solver.
+ * @return
+ *  True if the solutions agree and the fixed size solver is at least minSpeedup times faster.
+ */
+template<int Params, int Data> static bool compareFixedPolynomialFits(const std::vector<double> &xs, const std::vector<std::vector<double>> &ys,
+                                                                      const std::vector<double> &variance, const double &minSpeedup) {
+
+    unsigned int N = Data;
+    unsigned int nFits = ys.size();
+    const unsigned int nRuns = 3;
+    double initialGuess[Params];
+    std::fill(initialGuess, initialGuess + Params, 1.0);
+
+    std::vector<double> xsCopy(xs);
+    std::vector<double> solutions(Params * nFits);
+    double tDynamic = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int f=0; f<nFits; f++) {
+            std::vector<double> ysCopy(ys[f]);
+            PolynomialFitter fitter(xsCopy, ysCopy, Params);
+            fitter.setVariance(variance.data());
+            fitter.fit(500, false);
+            fitter.getParameters(&solutions[Params*f]);
+        }
+        tDynamic = std::min(tDynamic, (TimeUtil::getUpTime() - t0) / 1000000.0);
+    }
+
+    // One solver reused for every fit
+    double maxDiff = 0.0;
+    FixedPolynomialFitter<Params, Data> fixed(xs.data());
+    fixed.setVariance(variance.data());
+    double tFixed = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        long long t0 = TimeUtil::getUpTime();
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        Eigen::internal::set_is_malloc_allowed(false);
+#endif
+        for(unsigned int f=0; f<nFits; f++) {
+            fixed.setData(ys[f].data());
+            fixed.setParameters(initialGuess);
+            fixed.fit(500);
+            double solution[Params];
+            fixed.getParameters(solution);
+            for(unsigned int m=0; m<Params; m++) {
+                maxDiff = std::max(maxDiff, std::fabs(solution[m] - solutions[Params*f + m]));
+            }
+        }
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        Eigen::internal::set_is_malloc_allowed(true);
+#endif
+        tFixed = std::min(tFixed, (TimeUtil::getUpTime() - t0) / 1000000.0);
+    }
+
+    fprintf(stderr, "Polynomial (M=%d, N=%d): %f [us] per fit with dynamic vs %f [us] with fixed size solver (%.1fx); max difference in parameters = %g\n",
+            Params, N, 1e6 * tDynamic / nFits, 1e6 * tFixed / nFits, tDynamic / tFixed, maxDiff);
+
+    return (maxDiff < 1e-6) && (tDynamic / tFixed >= minSpeedup);
+}
+
+void TestUtil::testFixedLevenbergMarquardtSolver() {
+
+    bool pass = true;
+
+    std::mt19937 gen(44);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    const unsigned int nFits = 20000;
+    const unsigned int N = 40;
+
+    std::vector<double> xs(N);
+    std::vector<double> variance(N);
+    for(unsigned int n=0; n<N; n++) {
+        xs[n] = -2.0 + 4.0 * n / (N - 1);
+        variance[n] = 0.01 * 0.01 * (1.0 + 0.1 * n);
+    }
+
+    // Independent data sets, as if fitting each star in each frame
+    std::vector<std::vector<double>> ysCos(nFits, std::vector<double>(N));
+    for(unsigned int f=0; f<nFits; f++) {
+        double amp = 1.5 + 0.1 * normal(gen);
+        double freq = 2.1 + 0.05 * normal(gen);
+        double phase = 0.3 + 0.1 * normal(gen);
+        for(unsigned int n=0; n<N; n++) {
+            ysCos[f][n] = amp * std::cos(xs[n] * freq + phase) + std::sqrt(variance[n]) * normal(gen);
+        }
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //          Cosine: three parameters, fixed N            //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    double initialGuessCos[3] = {1.4, 2.0, 0.2};
+
+    // Each solver is timed several times and the fastest run is used
+    const unsigned int nRuns = 3;
+
+    std::vector<double> solutionsCos(3 * nFits);
+    unsigned long nModelsDynamicCos = 0;
+    double tDynamicCos = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        nModelsDynamicCos = 0;
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int f=0; f<nFits; f++) {
+            CosineFitter fitter(xs, ysCos[f]);
+            fitter.setVariance(variance.data());
+            fitter.setParameters(initialGuessCos);
+            fitter.fit(500, false);
+            fitter.getParameters(&solutionsCos[3*f]);
+            nModelsDynamicCos += fitter.getFitStatistics().nModelEvaluations;
+        }
+        tDynamicCos = std::min(tDynamicCos, (TimeUtil::getUpTime() - t0) / 1000000.0);
+    }
+
+    double maxDiffCos = 0.0;
+    unsigned int nConvergedCos = 0;
+    unsigned long nModelsFixedCos = 0;
+    double tFixedCos = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        nConvergedCos = 0;
+        nModelsFixedCos = 0;
+        long long t0 = TimeUtil::getUpTime();
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        Eigen::internal::set_is_malloc_allowed(false);
+#endif
+        for(unsigned int f=0; f<nFits; f++) {
+            FixedCosineFitter fitter(xs.data());
+            fitter.setData(ysCos[f].data());
+            fitter.setVariance(variance.data());
+            fitter.setParameters(initialGuessCos);
+            fitter.fit(500);
+            double solution[3];
+            fitter.getParameters(solution);
+            for(unsigned int m=0; m<3; m++) {
+                maxDiffCos = std::max(maxDiffCos, std::fabs(solution[m] - solutionsCos[3*f + m]));
+            }
+            nConvergedCos += fitter.isConverged();
+            nModelsFixedCos += fitter.nModelEvaluations;
+        }
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+        Eigen::internal::set_is_malloc_allowed(true);
+#endif
+        tFixedCos = std::min(tFixedCos, (TimeUtil::getUpTime() - t0) / 1000000.0);
+    }
+
+    // The time for this model is dominated by the trigonometric functions, which both solvers must evaluate, so the
+    // fixed size solver gains mainly by restoring the model after rejected steps rather than evaluating it again
+    pass &= (maxDiffCos < 1e-6) && (nConvergedCos == nFits) && (nModelsFixedCos < nModelsDynamicCos) && (tFixedCos < tDynamicCos);
+
+    fprintf(stderr, "Cosine (M=3, N=%d): %d fits in %f [s] with dynamic vs %f [s] with fixed size solver (%.1fx); %lu vs %lu model evaluations; %d converged; max difference in parameters = %g\n",
+            N, nFits, tDynamicCos, tFixedCos, tDynamicCos / tFixedCos, nModelsDynamicCos, nModelsFixedCos, nConvergedCos, maxDiffCos);
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //        Polynomials: two to eight parameters           //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Fewer points, as in the fit of a star image in a single frame
+    const unsigned int nPoly = 16;
+    std::vector<double> xsPoly(nPoly);
+    std::vector<double> variancePoly(nPoly, 0.01 * 0.01);
+    std::vector<std::vector<double>> ysPoly(nFits, std::vector<double>(nPoly));
+    for(unsigned int n=0; n<nPoly; n++) {
+        xsPoly[n] = -1.0 + 2.0 * n / (nPoly - 1);
+    }
+    for(unsigned int f=0; f<nFits; f++) {
+        for(unsigned int n=0; n<nPoly; n++) {
+            double x = xsPoly[n];
+            ysPoly[f][n] = 2.35 - 15.3*x + 6.367*x*x + 0.5*x*x*x + 0.01 * normal(gen);
+        }
+    }
+
+    // The minimum speedups documented for the FixedLevenbergMarquardtSolver. Only the two-parameter fit approaches 5x:
+    // as M grows the O(NM^2) normal equations, which both solvers must form, dominate the overheads that the fixed
+    // size solver removes.
+    pass &= compareFixedPolynomialFits<2, nPoly>(xsPoly, ysPoly, variancePoly, 3.5);
+    pass &= compareFixedPolynomialFits<3, nPoly>(xsPoly, ysPoly, variancePoly, 2.5);
+    pass &= compareFixedPolynomialFits<5, nPoly>(xsPoly, ysPoly, variancePoly, 1.5);
+    pass &= compareFixedPolynomialFits<8, nPoly>(xsPoly, ysPoly, variancePoly, 1.5);
+
+    fprintf(stderr, "Fixed size Levenberg-Marquardt solver test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testPsfFit() {
+
+    bool pass = true;
+
+    std::mt19937 gen(45);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    // Grid of well separated stars
+    const unsigned int nCols = 100;
+    const unsigned int nRows = 50;
+    const unsigned int spacing = 16;
+    unsigned int width = nCols * spacing;
+    unsigned int height = nRows * spacing;
+    const double bkg = 20.0;
+
+    const char * modelNames[2] = {"Gaussian", "Moffat"};
+    PsfFitUtil::PsfModel models[2] = {PsfFitUtil::GAUSSIAN, PsfFitUtil::MOFFAT};
+
+    for(unsigned int mod = 0; mod < 2; mod++) {
+
+        // Undersampled Gaussian, or Moffat with a similar core width
+        double sigma = 0.7;
+        double alpha = 1.5;
+
+        std::vector<double> model(width * height, 0.0);
+        std::vector<double> trueI;
+        std::vector<double> trueJ;
+        std::vector<double> trueFlux;
+
+        for(unsigned int r = 0; r < nRows; r++) {
+            for(unsigned int c = 0; c < nCols; c++) {
+                double ci = c * spacing + spacing / 2 + uniform(gen) - 0.5;
+                double cj = r * spacing + spacing / 2 + uniform(gen) - 0.5;
+                double flux = 200.0 * std::pow(100.0, uniform(gen));
+                trueI.push_back(ci);
+                trueJ.push_back(cj);
+                trueFlux.push_back(flux);
+
+                for(int j = (int)cj - 6; j <= (int)cj + 6; j++) {
+                    for(int i = (int)ci - 6; i <= (int)ci + 6; i++) {
+                        double value;
+                        if(models[mod] == PsfFitUtil::GAUSSIAN) {
+                            // Integrated over the pixel
+                            double ex = 0.5 * (std::erf((i + 0.5 - ci) / (sigma * std::sqrt(2.0))) - std::erf((i - 0.5 - ci) / (sigma * std::sqrt(2.0))));
+                            double ey = 0.5 * (std::erf((j + 0.5 - cj) / (sigma * std::sqrt(2.0))) - std::erf((j - 0.5 - cj) / (sigma * std::sqrt(2.0))));
+                            value = flux * ex * ey;
+                        }
+                        else {
+                            double beta = PsfFitUtil::moffatBeta;
+                            double r2 = (i - ci) * (i - ci) + (j - cj) * (j - cj);
+                            value = flux * (beta - 1.0) / (M_PI * alpha * alpha) * std::pow(1.0 + r2 / (alpha * alpha), -beta);
+                        }
+                        model[j * width + i] += value;
+                    }
+                }
+            }
+        }
+
+        // Poisson-like noise
+        std::vector<double> signal(width * height);
+        std::vector<double> background(width * height, bkg);
+        std::vector<double> noise(width * height);
+        for(unsigned int p = 0; p < width * height; p++) {
+            noise[p] = std::sqrt(bkg + model[p]);
+            signal[p] = bkg + model[p] + noise[p] * normal(gen);
+        }
+
+        // Sources at the flux-weighted centroid of the 3x3 pixels around the brightest pixel
+        std::vector<Source> sources(trueI.size());
+        for(unsigned int s = 0; s < sources.size(); s++) {
+            int pi = (int)std::lround(trueI[s]);
+            int pj = (int)std::lround(trueJ[s]);
+            double sum = 0.0, si = 0.0, sj = 0.0;
+            for(int j = pj - 1; j <= pj + 1; j++) {
+                for(int i = pi - 1; i <= pi + 1; i++) {
+                    double adu = std::max(0.0, signal[j * width + i] - bkg);
+                    sum += adu;
+                    si += i * adu;
+                    sj += j * adu;
+                }
+            }
+            sources[s].i = si / sum;
+            sources[s].j = sj / sum;
+        }
+
+        PsfFitUtil::StampBatch stamps;
+        std::vector<PsfFitUtil::PsfFit> fits;
+        long long t0 = TimeUtil::getUpTime();
+        PsfFitUtil::extractStamps(signal, background, noise, width, height, sources, stamps);
+        PsfFitUtil::fitStamps(stamps, models[mod], fits);
+        double t = (TimeUtil::getUpTime() - t0) / 1000000.0;
+
+        // Compare the position errors and check the consistency of the covariance
+        unsigned int nValid = 0;
+        double centroidSumSq = 0.0;
+        double fitSumSq = 0.0;
+        double normalisedSumSq = 0.0;
+        double fluxSumSq = 0.0;
+        for(unsigned int s = 0; s < fits.size(); s++) {
+            centroidSumSq += (sources[s].i - trueI[s]) * (sources[s].i - trueI[s]) + (sources[s].j - trueJ[s]) * (sources[s].j - trueJ[s]);
+            if(!fits[s].valid) {
+                continue;
+            }
+            nValid++;
+            double di = fits[s].i - trueI[s];
+            double dj = fits[s].j - trueJ[s];
+            fitSumSq += di * di + dj * dj;
+            normalisedSumSq += (di * di / fits[s].c_ii + dj * dj / fits[s].c_jj) / 2.0;
+            fluxSumSq += (fits[s].flux - trueFlux[s]) * (fits[s].flux - trueFlux[s]) / (fits[s].sigma_flux * fits[s].sigma_flux);
+        }
+        double centroidRms = std::sqrt(centroidSumSq / fits.size());
+        double fitRms = std::sqrt(fitSumSq / nValid);
+        double normalisedRms = std::sqrt(normalisedSumSq / nValid);
+        double fluxNormalisedRms = std::sqrt(fluxSumSq / nValid);
+
+        pass &= (nValid > 0.99 * fits.size()) && (fitRms < 0.5 * centroidRms) && (normalisedRms > 0.8) && (normalisedRms < 1.25) &&
+                (fluxNormalisedRms > 0.8) && (fluxNormalisedRms < 1.25) && (t < 1.0);
+
+        fprintf(stderr, "%s PSF: fitted %d stars in %f [s]; %d valid; position RMS error %f [pixels] vs %f for centroids; "
+                        "normalised position error RMS %f; normalised flux error RMS %f\n",
+                modelNames[mod], (unsigned int)fits.size(), t, nValid, fitRms, centroidRms, normalisedRms, fluxNormalisedRms);
+    }
+
+    fprintf(stderr, "PSF fit test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+void TestUtil::testMultiEpochGeoCalFitter() {
+
+    bool pass = true;
+
+    std::mt19937 gen(47);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+
+    // Site and nominal pointing of the camera
+    double lon = MathUtil::toRadians(-3.2);
+    double lat = MathUtil::toRadians(55.9);
+    Quaterniond q_nominal(AngleAxisd(0.4, Vector3d(1.0, 0.3, 0.2).normalized()));
+
+    // Noise on the source positions [pixels]
+    double sigma = 0.2;
+    unsigned int nStarsPerEpoch = 40;
+    long long epoch0 = 1500000000000000ll;
+
+    // Synthetic cross-matches for one calibration: the camera orientation drifts slightly from night to night, and
+    // the initial guess is the orientation with a small error as from a single-epoch calibration. Also gets the
+    // noise-free positions of the sources.
+    auto makeEpoch = [&](const CameraModelBase &truth, unsigned int e, std::vector<std::pair<Source, ReferenceStar>> &xms,
+            std::vector<Vector2d> &truePositions, Quaterniond &q_guess, double &gmst) {
+
+        long long epochTimeUs = epoch0 + e * 86400000000ll + (long long)(uniform(gen) * 3600e6);
+        gmst = TimeUtil::epochToGmst(epochTimeUs);
+        Matrix3d r_bcrf_sez = CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+        Vector3d drift(normal(gen), normal(gen), normal(gen));
+        Quaterniond q_true = Quaterniond(AngleAxisd(MathUtil::toRadians(0.5) * drift.norm(), drift.normalized())) * q_nominal;
+        Vector3d error(normal(gen), normal(gen), normal(gen));
+        q_guess = Quaterniond(AngleAxisd(MathUtil::toRadians(0.05) * error.norm(), error.normalized())) * q_true;
+
+        // Stars at random positions in the image
+        xms.clear();
+        truePositions.clear();
+        for(unsigned int s = 0; s < nStarsPerEpoch; s++) {
+            Vector3d r_cam = truth.deprojectPixel(width * uniform(gen), height * uniform(gen));
+            Vector3d r_bcrf = r_bcrf_sez.transpose() * (q_true.toRotationMatrix().transpose() * r_cam);
+            double r, ra, dec;
+            CoordinateUtil::cartesianToSpherical(r_bcrf, r, ra, dec);
+
+            Vector2d position;
+            truth.projectVector(r_cam, position[0], position[1]);
+            truePositions.push_back(position);
+
+            // Positions refined by PSF fitting; the dispersion matrix is the size of the star image, which is much
+            // larger than the uncertainty on the position
+            Source source;
+            source.i = position[0] + sigma * normal(gen);
+            source.j = position[1] + sigma * normal(gen);
+            source.c_ii = 2.0;
+            source.c_ij = 0.0;
+            source.c_jj = 2.0;
+            source.psf = true;
+            source.psf_c_ii = sigma * sigma;
+            source.psf_c_ij = 0.0;
+            source.psf_c_jj = sigma * sigma;
+
+            xms.push_back(std::pair<Source, ReferenceStar>(source, ReferenceStar(ra, dec, 3.0)));
+        }
+        return epochTimeUs;
+    };
+
+    // Adds synthetic epochs to a fitter, and gets the noise-free positions of the sources in each one
+    auto addEpochs = [&](const CameraModelBase &truth, unsigned int nEpochs, MultiEpochGeoCalFitter &fitter, std::vector<std::vector<Vector2d>> &truePositions) {
+        truePositions.resize(nEpochs);
+        for(unsigned int e = 0; e < nEpochs; e++) {
+            std::vector<std::pair<Source, ReferenceStar>> xms;
+            Quaterniond q_guess;
+            double gmst;
+            long long epochTimeUs = makeEpoch(truth, e, xms, truePositions[e], q_guess, gmst);
+            fitter.addEpoch(epochTimeUs, xms, q_guess, gmst, lon, lat);
+        }
+        fitter.setExitTolerance(1e-9);
+    };
+
+    // RMS distance between the fitted projections of the reference stars and the noise-free positions of the sources;
+    // this is independent of any degeneracy between the orientation and the intrinsic parameters
+    auto getProjectionError = [&](const MultiEpochGeoCalFitter &fitter, const std::vector<std::vector<Vector2d>> &truePositions) {
+        double sumSq = 0.0;
+        unsigned int n = 0;
+        for(unsigned int e = 0; e < fitter.getEpochs().size(); e++) {
+            const std::vector<std::pair<Source, ReferenceStar>> &xms = fitter.getEpochs()[e].xms;
+            for(unsigned int s = 0; s < xms.size(); s++) {
+                sumSq += (Vector2d(xms[s].second.i, xms[s].second.j) - truePositions[e][s]).squaredNorm();
+                n++;
+            }
+        }
+        return std::sqrt(sumSq / n);
+    };
+
+    unsigned int nEpochs = 200;
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //     Radial distortion: recovery of the parameters     //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    {
+        PinholeCameraWithRadialDistortion truth(width, height, 1500.0, 1500.0, 960.0, 540.0, 0.02, -0.01);
+        unsigned int nParams = truth.getNumParameters();
+        std::vector<double> trueParams(nParams);
+        truth.getParameters(trueParams.data());
+
+        // Initial guess: no distortion, and the focal length and principal point a little off
+        PinholeCameraWithRadialDistortion joint(width, height, 1485.0, 1515.0, 955.0, 546.0, 0.0, 0.0);
+        PinholeCameraWithRadialDistortion single(joint);
+
+        MultiEpochGeoCalFitter jointFitter(&joint);
+        std::vector<std::vector<Vector2d>> truePositions;
+        addEpochs(truth, nEpochs, jointFitter, truePositions);
+
+        // The first epoch on its own
+        MultiEpochGeoCalFitter singleFitter(&single);
+        const MultiEpochGeoCalFitter::Epoch &first = jointFitter.getEpochs()[0];
+        singleFitter.addEpoch(first.epochTimeUs, first.xms, first.q_sez_cam, first.gmst, first.lon, first.lat);
+        singleFitter.setExitTolerance(1e-9);
+
+        // An epoch in which one of the sources hasn't been refined by PSF fitting would be weighted differently
+        std::vector<std::pair<Source, ReferenceStar>> unrefinedXms(first.xms);
+        unrefinedXms[0].first.psf = false;
+        bool unrefinedAdded = singleFitter.addEpoch(first.epochTimeUs, unrefinedXms, first.q_sez_cam, first.gmst, first.lon, first.lat);
+        pass &= !unrefinedAdded && (singleFitter.getEpochs().size() == 1);
+
+        long long t0 = TimeUtil::getUpTime();
+        jointFitter.fit(100, false);
+        double tJoint = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        singleFitter.fit(100, false);
+
+        MatrixXd jointCovariance = jointFitter.getIntrinsicCovariance();
+        MatrixXd singleCovariance = singleFitter.getIntrinsicCovariance();
+
+        // Errors in the intrinsic parameters normalised by their standard deviations
+        std::vector<double> jointParams(nParams);
+        joint.getParameters(jointParams.data());
+        double maxNormalisedError = 0.0;
+        for(unsigned int p = 0; p < nParams; p++) {
+            double normalisedError = (jointParams[p] - trueParams[p]) / std::sqrt(jointCovariance(p, p));
+            maxNormalisedError = std::max(maxNormalisedError, std::fabs(normalisedError));
+            fprintf(stderr, "Parameter %d: true = %+e; fitted = %+e; sigma = %e (%e from one epoch)\n", p, trueParams[p], jointParams[p],
+                    std::sqrt(jointCovariance(p, p)), std::sqrt(singleCovariance(p, p)));
+            // Each intrinsic parameter is constrained far better by the joint fit
+            pass &= (jointCovariance(p, p) < singleCovariance(p, p) / 25.0);
+        }
+
+        // Residuals of each epoch
+        double meanRmsResidual = 0.0;
+        double maxRmsResidual = 0.0;
+        for(const MultiEpochGeoCalFitter::Epoch &epoch : jointFitter.getEpochs()) {
+            meanRmsResidual += epoch.rmsResidual / nEpochs;
+            maxRmsResidual = std::max(maxRmsResidual, epoch.rmsResidual);
+        }
+
+        // The orientation of each epoch is still fitted to its own stars, which limits the improvement in the projections
+        double jointProjectionError = getProjectionError(jointFitter, truePositions);
+        double singleProjectionError = getProjectionError(singleFitter, truePositions);
+
+        fprintf(stderr, "%s: joint fit of %d epochs: %d iterations in %f [s]; reduced chi2 = %f; max normalised intrinsic error = %f; "
+                        "RMS residual per epoch mean %f max %f [pixels]; projection error %f [pixels] (%f from one epoch)\n",
+                truth.getModelName().c_str(), nEpochs, jointFitter.getNumIterations(), tJoint, jointFitter.getReducedChi2(), maxNormalisedError,
+                meanRmsResidual, maxRmsResidual, jointProjectionError, singleProjectionError);
+
+        pass &= jointFitter.isConverged() && (jointFitter.getReducedChi2() > 0.9) && (jointFitter.getReducedChi2() < 1.1) &&
+                (maxNormalisedError < 5.0) && (meanRmsResidual < 1.1 * sigma * std::sqrt(2.0)) && (jointProjectionError < 0.6 * singleProjectionError);
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //       SIP distortion: accuracy of the projection      //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // To first order, a rotation common to every epoch is equivalent to a shift of the principal point together with a
+    // change to the quadratic SIP coefficients, so those parameters are poorly determined even by the joint fit. The
+    // projections are unaffected, so these are what is checked.
+    {
+        PinholeCameraWithSipDistortion truth(width, height, 1500.0, 1500.0, 960.0, 540.0,
+                                             2e-7, -1e-7, 5e-8, 1e-10, -2e-10, 3e-10, -1e-10,
+                                             -1e-7, 2e-7, -5e-8, -2e-10, 1e-10, -1e-10, 3e-10);
+        PinholeCameraWithSipDistortion joint(width, height, 1485.0, 1515.0, 955.0, 546.0,
+                                             0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+        PinholeCameraWithSipDistortion single(joint);
+
+        MultiEpochGeoCalFitter jointFitter(&joint);
+        std::vector<std::vector<Vector2d>> truePositions;
+        addEpochs(truth, nEpochs, jointFitter, truePositions);
+
+        MultiEpochGeoCalFitter singleFitter(&single);
+        const MultiEpochGeoCalFitter::Epoch &first = jointFitter.getEpochs()[0];
+        singleFitter.addEpoch(first.epochTimeUs, first.xms, first.q_sez_cam, first.gmst, first.lon, first.lat);
+        singleFitter.setExitTolerance(1e-9);
+
+        long long t0 = TimeUtil::getUpTime();
+        jointFitter.fit(20, false);
+        double tJoint = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        singleFitter.fit(20, false);
+
+        double jointProjectionError = getProjectionError(jointFitter, truePositions);
+        double singleProjectionError = getProjectionError(singleFitter, truePositions);
+
+        fprintf(stderr, "%s: joint fit of %d epochs: %d iterations in %f [s]; reduced chi2 = %f; projection error %f [pixels] (%f from one epoch)\n",
+                truth.getModelName().c_str(), nEpochs, jointFitter.getNumIterations(), tJoint, jointFitter.getReducedChi2(),
+                jointProjectionError, singleProjectionError);
+
+        pass &= (jointFitter.getReducedChi2() > 0.9) && (jointFitter.getReducedChi2() < 1.1) && (jointProjectionError < 0.6 * singleProjectionError);
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //           Too few data to fit the intrinsics          //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Each epoch has enough cross-matches to constrain its orientation, but the SIP model has more intrinsic
+    // parameters than there are data left over, so the fit must not be attempted
+    {
+        PinholeCameraWithSipDistortion truth(width, height, 1500.0, 1500.0, 960.0, 540.0,
+                                             0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+        PinholeCameraWithSipDistortion cam(truth);
+        MultiEpochGeoCalFitter fitter(&cam);
+        for(unsigned int e = 0; e < 3; e++) {
+            std::vector<std::pair<Source, ReferenceStar>> xms;
+            std::vector<Vector2d> truePositions;
+            Quaterniond q_guess;
+            double gmst;
+            long long epochTimeUs = makeEpoch(truth, e, xms, truePositions, q_guess, gmst);
+            xms.resize(4);
+            pass &= fitter.addEpoch(epochTimeUs, xms, q_guess, gmst, lon, lat);
+        }
+        fitter.fit(10, false);
+        fprintf(stderr, "%d epochs with %d data: %d degrees of freedom; %d iterations\n",
+                (unsigned int)fitter.getEpochs().size(), 2 * 4 * 3, fitter.getDOF(), fitter.getNumIterations());
+        pass &= (fitter.getDOF() < 0) && (fitter.getNumIterations() == 0) && !fitter.isConverged();
+    }
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //          Scaling with the number of epochs            //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The time per iteration should grow linearly with the number of epochs
+    PinholeCameraWithSipDistortion truth(width, height, 1500.0, 1500.0, 960.0, 540.0,
+                                         2e-7, -1e-7, 5e-8, 1e-10, -2e-10, 3e-10, -1e-10,
+                                         -1e-7, 2e-7, -5e-8, -2e-10, 1e-10, -1e-10, 3e-10);
+    std::vector<unsigned int> nEpochsList = {100, 400};
+    std::vector<double> timePerIteration;
+    for(unsigned int n : nEpochsList) {
+        PinholeCameraWithSipDistortion cam(width, height, 1485.0, 1515.0, 955.0, 546.0,
+                                           0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+        MultiEpochGeoCalFitter fitter(&cam);
+        std::vector<std::vector<Vector2d>> truePositions;
+        addEpochs(truth, n, fitter, truePositions);
+        long long t0 = TimeUtil::getUpTime();
+        fitter.fit(10, false);
+        double t = (TimeUtil::getUpTime() - t0) / 1000000.0;
+        timePerIteration.push_back(t / fitter.getNumIterations());
+        fprintf(stderr, "%d epochs (%d parameters): %d iterations in %f [s]; %f [s] per iteration\n",
+                n, cam.getNumParameters() + 3 * n, fitter.getNumIterations(), t, t / fitter.getNumIterations());
+    }
+
+    pass &= (timePerIteration[1] < 8.0 * timePerIteration[0]);
+
+    fprintf(stderr, "Multi-epoch geometric calibration test %s\n", pass ? "PASSED" : "FAILED");
+}
+
+/**
+ * @brief Compares the partial derivatives of the (i,j) coordinates with respect to the intrinsic and extrinsic
+ * parameters of a camera model computed by automatic differentiation against the analytic partial derivatives and
+ * central finite differences, at random points in the image, and times each method.
+ * @return
+ *  True if the partial derivatives agree and automatic differentiation is faster than finite differences.
+ */
+template<typename Camera> static bool checkAutoDiffPartials(const Camera &cam, std::mt19937 &gen) {
+
+    bool pass = true;
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    const unsigned int N = Camera::nParams;
+    const unsigned int nPoints = 10000;
+
+    // Random orientation of the camera, and random points in the image
+    Quaterniond q_sez_cam(normal(gen), normal(gen), normal(gen), normal(gen));
+    q_sez_cam.normalize();
+    Matrix3d r_sez_cam = q_sez_cam.toRotationMatrix();
+    std::vector<Vector3d> r_sez(nPoints);
+    std::vector<Vector3d> r_cam(nPoints);
+    for(unsigned int p = 0; p < nPoints; p++) {
+        r_cam[p] = cam.deprojectPixel(cam.width * uniform(gen), cam.height * uniform(gen));
+        r_sez[p] = r_sez_cam.transpose() * r_cam[p];
+    }
+
+    double params[N];
+    cam.getParameters(params);
+    double q[4] = {q_sez_cam.w(), q_sez_cam.x(), q_sez_cam.y(), q_sez_cam.z()};
+
+    // Central finite differences of the templated projection with respect to the intrinsic and extrinsic parameters
+    auto getFiniteDifferences = [&](const Vector3d &r_sez, double * intrinsic, double * extrinsic) {
+        double h = 1e-6;
+        double pp[N], qq[4], r[3], ip, jp, im, jm;
+        std::copy(params, params + N, pp);
+        std::copy(q, q + 4, qq);
+        AutoDiffUtil::rotateSezToCam(qq, r_sez, r);
+        for(unsigned int k = 0; k < N; k++) {
+            double step = h * std::max(1.0, std::fabs(params[k]));
+            pp[k] = params[k] + step;
+            Camera::project(pp, r, ip, jp);
+            pp[k] = params[k] - step;
+            Camera::project(pp, r, im, jm);
+            pp[k] = params[k];
+            intrinsic[2*k + 0] = (ip - im) / (2.0 * step);
+            intrinsic[2*k + 1] = (jp - jm) / (2.0 * step);
+        }
+        for(unsigned int k = 0; k < 4; k++) {
+            qq[k] = q[k] + h;
+            AutoDiffUtil::rotateSezToCam(qq, r_sez, r);
+            Camera::project(pp, r, ip, jp);
+            qq[k] = q[k] - h;
+            AutoDiffUtil::rotateSezToCam(qq, r_sez, r);
+            Camera::project(pp, r, im, jm);
+            qq[k] = q[k];
+            extrinsic[2*k + 0] = (ip - im) / (2.0 * h);
+            extrinsic[2*k + 1] = (jp - jm) / (2.0 * h);
+        }
+    };
+
+    // Difference between two partial derivatives, relative to their size for those larger than one
+    auto getError = [](const double &a, const double &b) {
+        return std::fabs(a - b) / std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+    };
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //               Accuracy of the derivatives             //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The combined partial derivatives provided by the camera model are analytic
+    const CameraModelBase &base = cam;
+
+    double maxAnalyticError = 0.0;
+    double maxFiniteDifferenceError = 0.0;
+    double maxSplitError = 0.0;
+    for(unsigned int p = 0; p < nPoints; p++) {
+        double intrinsic[2*N], extrinsic[8];
+        AutoDiffUtil::getPartialDerivatives(cam, intrinsic, extrinsic, r_sez[p], q_sez_cam);
+
+        double analyticIntrinsic[2*N], analyticExtrinsic[8];
+        base.getPartialDerivatives(analyticIntrinsic, analyticExtrinsic, r_sez[p], q_sez_cam);
+
+        double fdIntrinsic[2*N], fdExtrinsic[8];
+        getFiniteDifferences(r_sez[p], fdIntrinsic, fdExtrinsic);
+
+        // The separate intrinsic and extrinsic passes
+        double splitIntrinsic[2*N], splitExtrinsic[8];
+        AutoDiffUtil::getIntrinsicPartialDerivatives(cam, splitIntrinsic, r_cam[p]);
+        AutoDiffUtil::getExtrinsicPartialDerivatives(cam, splitExtrinsic, r_sez[p], q_sez_cam);
+
+        for(unsigned int k = 0; k < 2*N; k++) {
+            maxAnalyticError = std::max(maxAnalyticError, getError(intrinsic[k], analyticIntrinsic[k]));
+            maxFiniteDifferenceError = std::max(maxFiniteDifferenceError, getError(intrinsic[k], fdIntrinsic[k]));
+            maxSplitError = std::max(maxSplitError, getError(intrinsic[k], splitIntrinsic[k]));
+        }
+        for(unsigned int k = 0; k < 8; k++) {
+            maxAnalyticError = std::max(maxAnalyticError, getError(extrinsic[k], analyticExtrinsic[k]));
+            maxFiniteDifferenceError = std::max(maxFiniteDifferenceError, getError(extrinsic[k], fdExtrinsic[k]));
+            maxSplitError = std::max(maxSplitError, getError(extrinsic[k], splitExtrinsic[k]));
+        }
+    }
+
+    pass &= (maxAnalyticError < 1e-9) && (maxFiniteDifferenceError < 1e-5) && (maxSplitError < 1e-9);
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //                 Speed of each method                  //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // Each method is timed over several runs and the fastest taken, to reduce the effect of other processes
+    const unsigned int nRuns = 3;
+    const unsigned int nReps = 10;
+    double sum = 0.0;
+    double intrinsic[2*N], extrinsic[8];
+
+    // Analytic partial derivatives, as used in production [nanoseconds per point]
+    double tAnalytic = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int rep = 0; rep < nReps; rep++) {
+            for(unsigned int p = 0; p < nPoints; p++) {
+                base.getPartialDerivatives(intrinsic, extrinsic, r_sez[p], q_sez_cam);
+                sum += intrinsic[0] + extrinsic[0];
+            }
+        }
+        tAnalytic = std::min(tAnalytic, (TimeUtil::getUpTime() - t0) * 1000.0 / (nReps * nPoints));
+    }
+
+    // Automatic differentiation of both blocks of parameters
+    double tAutoDiff = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int rep = 0; rep < nReps; rep++) {
+            for(unsigned int p = 0; p < nPoints; p++) {
+                AutoDiffUtil::getPartialDerivatives(cam, intrinsic, extrinsic, r_sez[p], q_sez_cam);
+                sum += intrinsic[0] + extrinsic[0];
+            }
+        }
+        tAutoDiff = std::min(tAutoDiff, (TimeUtil::getUpTime() - t0) * 1000.0 / (nReps * nPoints));
+    }
+
+    // Central finite differences as computed by the LevenbergMarquardtSolver: the model is evaluated for all the
+    // points twice for each parameter, as in GeoCalFitter::getModel
+    Camera fdCam(cam);
+    std::vector<double> x(nPoints), y(nPoints), z(nPoints), i(nPoints), j(nPoints);
+    std::vector<unsigned char> visible(nPoints);
+    double tFiniteDifference = std::numeric_limits<double>::max();
+    for(unsigned int r=0; r<nRuns; r++) {
+        long long t0 = TimeUtil::getUpTime();
+        for(unsigned int rep = 0; rep < nReps; rep++) {
+            for(unsigned int k = 0; k < 2 * (N + 4); k++) {
+                double pp[N + 4];
+                std::copy(q, q + 4, pp);
+                std::copy(params, params + N, pp + 4);
+                pp[k / 2] *= (k % 2 == 0) ? (1.0 + 1e-6) : (1.0 - 1e-6);
+                fdCam.setParameters(pp + 4);
+                Matrix3d r_sez_cam = Quaterniond(pp[0], pp[1], pp[2], pp[3]).toRotationMatrix();
+                for(unsigned int p = 0; p < nPoints; p++) {
+                    Vector3d r = r_sez_cam * r_sez[p];
+                    x[p] = r[0];
+                    y[p] = r[1];
+                    z[p] = r[2];
+                }
+                fdCam.projectVectors(x.data(), y.data(), z.data(), nPoints, i.data(), j.data(), visible.data());
+                sum += i[0] + j[0];
+            }
+        }
+        tFiniteDifference = std::min(tFiniteDifference, (TimeUtil::getUpTime() - t0) * 1000.0 / (nReps * nPoints));
+    }
+
+    fprintf(stderr, "%s: max difference from analytic = %e, from finite differences = %e, between single and separate passes = %e; "
+                    "time per point: analytic %f, automatic %f (%.2fx), finite differences %f (%.2fx) [ns] (%f)\n",
+            cam.getModelName().c_str(), maxAnalyticError, maxFiniteDifferenceError, maxSplitError,
+            tAnalytic, tAutoDiff, tAutoDiff / tAnalytic, tFiniteDifference, tAutoDiff / tFiniteDifference, sum);
+
+    // Automatic differentiation must be at least as fast as the finite difference Jacobian that it replaces. It's
+    // not expected to match the analytic partial derivatives, which exploit the structure of each camera model.
+    pass &= (tAutoDiff < tFiniteDifference);
+
+    return pass;
+}
+
+void TestUtil::testAutoDiffPartials() {
+
+    bool pass = true;
+
+    std::mt19937 gen(53);
+
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+
+    PinholeCamera pinhole(width, height, 1500.0, 1480.0, 962.0, 538.0);
+    pass &= checkAutoDiffPartials(pinhole, gen);
+
+    PinholeCameraWithRadialDistortion radial(width, height, 1500.0, 1480.0, 962.0, 538.0, 0.02, -0.01);
+    pass &= checkAutoDiffPartials(radial, gen);
+
+    PinholeCameraWithSipDistortion sip(width, height, 1500.0, 1480.0, 962.0, 538.0,
+                                       2e-7, -1e-7, 5e-8, 1e-10, -2e-10, 3e-10, -1e-10,
+                                       -1e-7, 2e-7, -5e-8, -2e-10, 1e-10, -1e-10, 3e-10);
+    pass &= checkAutoDiffPartials(sip, gen);
+
+    fprintf(stderr, "Automatic differentiation partial derivatives test %s\n", pass ? "PASSED" : "FAILED");
+}
@@ -16,6 +16,50 @@ public:
 
     static void testImagedReadWrite();
 
+    static void testFrameDifference();
+
+    static void testImageucPool();
+
+    static void testJpgDecode();
+
+    static void testPixelKernels();
+
+    static void testSpscRingBuffer();
+
+    static void testWorkerPool();
+
+    static void testReplayFrameSource();
+
+    static void testSyntheticVideoGenerator();
+
+    static void testCalibrationAccumulator();
+
+    static void testMedianFilter();
+
+    static void testSourceDetector();
+
+    static void testCrossMatch();
+
+    static void testReferenceStarCatalogue();
+
+    static void testVisibleStarCache();
+
+    static void testBatchProjection();
+
+    static void testInverseDistortion();
+
+    static void testPixelRayMap();
+
+    static void testLevenbergMarquardtSolvers();
+
+    static void testFixedLevenbergMarquardtSolver();
+
+    static void testPsfFit();
+
+    static void testMultiEpochGeoCalFitter();
+
+    static void testAutoDiffPartials();
+
 };
 
 #endif // TESTUTIL_H
@@ -0,0 +1,46 @@
+#include "threadutil.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+
+ThreadUtil::ThreadUtil() {
+
+}
+
+bool ThreadUtil::setAffinity(std::thread &thread, const std::vector<unsigned int> &cpus) {
+
+    if(cpus.empty()) {
+        return true;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for(unsigned int c = 0; c < cpus.size(); c++) {
+        CPU_SET(cpus[c], &cpuset);
+    }
+
+    int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+    if(err != 0) {
+        fprintf(stderr, "Couldn't set thread affinity: %s\n", strerror(err));
+        return false;
+    }
+    return true;
+}
+
+void ThreadUtil::partitionCpus(std::vector<unsigned int> &captureCpus, std::vector<unsigned int> &processingCpus) {
+
+    captureCpus.clear();
+    processingCpus.clear();
+
+    unsigned int nCpus = std::thread::hardware_concurrency();
+    if(nCpus < 2) {
+        return;
+    }
+
+    captureCpus.push_back(0u);
+    for(unsigned int c = 1; c < nCpus; c++) {
+        processingCpus.push_back(c);
+    }
+}
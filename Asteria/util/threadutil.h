@@ -0,0 +1,36 @@
+#ifndef THREADUTIL_H
+#define THREADUTIL_H
+
+#include <vector>
+#include <thread>
+
+class ThreadUtil
+{
+public:
+    ThreadUtil();
+
+    /**
+     * @brief Restricts the thread to run only on the given CPUs, e.g. to keep background processing off the
+     * core used for frame capture.
+     * @param thread
+     *  The thread.
+     * @param cpus
+     *  The indices of the CPUs that the thread may run on. If this is empty the affinity is not changed.
+     * @return
+     *  True if the affinity was set (or left unchanged), false if it couldn't be set.
+     */
+    static bool setAffinity(std::thread &thread, const std::vector<unsigned int> &cpus);
+
+    /**
+     * @brief Gets the indices of the CPUs to use for capture and for background processing. When there
+     * is more than one CPU, capture gets the first CPU to itself and the processing uses the rest; otherwise
+     * both lists are empty, meaning no affinity is set.
+     * @param captureCpus
+     *  On exit, contains the CPUs to use for the capture thread.
+     * @param processingCpus
+     *  On exit, contains the CPUs to use for the processing threads.
+     */
+    static void partitionCpus(std::vector<unsigned int> &captureCpus, std::vector<unsigned int> &processingCpus);
+};
+
+#endif // THREADUTIL_H